@@ -0,0 +1,348 @@
+// Checks and timings that need the real engine but no window: a console program built
+// from main.cpp by the "Bench" target of FamilyTreeDestio.cbp.
+//
+//   bench edits <file> [steps]   Random edits (add child, link spouse, ex), undo and redo.
+//                                After each one the patched indices and the incremental
+//                                relayout must match a model and layout built from scratch.
+//   bench dates                  Filters on a Date column with year, month and day literals
+//                                (=, <=, >) against the text order of ISO dates, and the
+//                                cells printed back as they were written.
+//   bench memory <file>          Bytes per person of each part of the loaded model
+//                                (DataModel::MemoryFootprint, as in the statistics export).
+//   bench scheduler [workers] [tasks]
+//                                TaskScheduler against a pool with one locked queue (the
+//                                usual std::thread pool), same thread count: many small
+//                                tasks forked from outside, then a recursive fork-join.
+
+#define WinMain BenchUnusedWinMain
+#include "../main.cpp"
+#undef WinMain
+
+#include <cstdio>
+#include <deque>
+#include <random>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::wstring Widen(const char* s) { return ToWString(s); }
+
+// Parent indices, child and spouse lists and the ID map of `m` against a copy whose
+// indices were built in one go
+bool SameIndices(const DataModel& m) {
+    DataModel fresh = m.Subset(RowBitmap(m.people.size(), true));
+    if (fresh.people.size() != m.people.size() || m.idMap.size() != m.people.size()) return false;
+    auto same = [](PackedLists::Span a, PackedLists::Span b) {
+        std::vector<int> x, y;
+        for (int k : a) x.push_back(k);
+        for (int k : b) y.push_back(k);
+        return x == y;
+    };
+    for (size_t i = 0; i < m.people.size(); ++i) {
+        if (m.IndexOf(m.people[i].id) != (int)i) return false;
+        if (m.people[i].fatherIdx != fresh.people[i].fatherIdx || m.people[i].motherIdx != fresh.people[i].motherIdx) return false;
+        if (!same(m.Children((int)i), fresh.Children((int)i)) || !same(m.Spouses((int)i), fresh.Spouses((int)i))) return false;
+    }
+    return true;
+}
+
+bool SameLayout(const DataModel& m, const LayoutEngine& a, const LayoutEngine& b) {
+    if (a.totalWidth != b.totalWidth || a.totalHeight != b.totalHeight) return false;
+    for (size_t i = 0; i < m.people.size(); ++i) {
+        int id = m.people[i].id;
+        if (a.gens[i] != b.gens[i] || a.OwnerRoot(id) != b.OwnerRoot(id) || a.Placed((int)i) != b.Placed((int)i)) return false;
+        if (a.Placed((int)i) && (a.boxX[i] != b.boxX[i] || a.boxY[i] != b.boxY[i])) return false;
+    }
+    return true;
+}
+
+int Edits(const char* file, int steps) {
+    DataModel data;
+    data.LoadFromFile(Widen(file).c_str());
+    if (data.people.empty()) { printf("%s: nothing loaded\n", file); return 1; }
+    EditHistory history;
+    history.Reset(data);
+    LayoutEngine layout(&data);
+    layout.Recalculate();
+
+    std::mt19937 rng(1);
+    int edits = 0, failures = 0;
+    double editMs = 0, relayoutMs = 0, fullMs = 0;
+    for (int step = 0; step < steps; ++step) {
+        ModelDiff diff;
+        bool done = false;
+        int n = (int)data.people.size();
+        int a = data.people[rng() % n].id, b = data.people[rng() % n].id;
+        auto start = Clock::now();
+        switch (rng() % 5) {
+        case 0:
+        case 1: {
+            int other = 0;
+            for (int sid : data.Get(a)->spouses) if (data.Get(sid)) { other = sid; break; }
+            done = history.AddChild(data, a, other, L"Child", L"Male", L"Child", diff) != 0;
+            break;
+        }
+        case 2: done = history.SetSpouse(data, a, b, rng() % 2 != 0, diff); break;
+        case 3: done = history.Undo(data, diff); break;
+        default: done = history.Redo(data, diff); break;
+        }
+        editMs += MsSince(start);
+        if (!done) continue;
+        ++edits;
+
+        start = Clock::now();
+        layout.Recalculate(diff);
+        relayoutMs += MsSince(start);
+
+        start = Clock::now();
+        LayoutEngine full(&data);
+        full.Recalculate();
+        fullMs += MsSince(start);
+
+        if (!SameIndices(data) || !SameLayout(data, layout, full)) {
+            printf("step %d: differs from a full rebuild\n", step);
+            ++failures;
+            layout.Recalculate();
+        }
+    }
+    int k = std::max(edits, 1);
+    printf("%s: %zu people, %d edits, %d differing\n", file, data.people.size(), edits, failures);
+    printf("per edit: apply %.3f ms, relayout %.2f ms (full layout %.2f ms)\n", editMs / k, relayoutMs / k, fullMs / k);
+    return failures != 0;
+}
+
+int Dates() {
+    const char* cells[] = { "1949-12-31", "1950", "1950-02-28", "1950-03", "1950-03-01", "1950-03-12",
+                            "1950-03-31", "1950-04-01", "1951", "1951-01-01" };
+    const size_t n = sizeof(cells) / sizeof(cells[0]);
+    AttributeTable attrs;
+    attrs.Clear();
+    attrs.SetColumns({ "birth" });
+    for (const char* c : cells) attrs.AddRow(c);
+    int failures = 0;
+    if (attrs.Get(0).type != AttributeTable::Type::Date) { printf("birth: not read as dates\n"); return 1; }
+    for (size_t r = 0; r < n; ++r) {
+        if (attrs.Get(0).Text(r) != Widen(cells[r])) {
+            printf("%s printed as %s\n", cells[r], ToUtf8(attrs.Get(0).Text(r)).c_str());
+            ++failures;
+        }
+    }
+    // A literal covers every date it is a prefix of, so zero-padded ISO text orders the
+    // cells the way the filter must
+    for (const char* lit : { "1950", "1950-03", "1950-03-12", "1951" }) {
+        for (CmpOp op : { CmpOp::Eq, CmpOp::Le, CmpOp::Gt }) {
+            RowBitmap got;
+            if (!attrs.Select(0, op, Widen(lit), got)) { printf("%s: literal refused\n", lit); ++failures; continue; }
+            for (size_t r = 0; r < n; ++r) {
+                std::string cell = cells[r];
+                bool within = cell.compare(0, strlen(lit), lit) == 0;
+                bool le = within || cell < lit;
+                bool want = (op == CmpOp::Eq) ? within : (op == CmpOp::Le) ? le : !le;
+                if (got.Test(r) != want) {
+                    printf("birth %s %s: %s %s\n", op == CmpOp::Eq ? "=" : op == CmpOp::Le ? "<=" : ">", lit, cell.c_str(),
+                           want ? "missed" : "matched");
+                    ++failures;
+                }
+            }
+        }
+    }
+    printf("dates: %d failures\n", failures);
+    return failures != 0;
+}
+
+int Memory(const char* file) {
+    DataModel data;
+    auto start = Clock::now();
+    data.LoadFromFile(Widen(file).c_str());
+    double loadMs = MsSince(start);
+    if (data.people.empty()) { printf("%s: nothing loaded\n", file); return 1; }
+    DataModel::Footprint f = data.MemoryFootprint();
+    const struct { const char* name; size_t bytes; } parts[] = {
+        { "records", f.records }, { "text", f.text }, { "spouse lists", f.spouseLists },
+        { "adjacency", f.adjacency }, { "ID index", f.idIndex },
+    };
+    size_t total = 0;
+    for (const auto& part : parts) total += part.bytes;
+    double n = (double)data.people.size();
+    printf("%s: %zu people, loaded in %.0f ms\n", file, data.people.size(), loadMs);
+    for (const auto& part : parts)
+        printf("%-13s %8.1f bytes/person %10.1f MB\n", part.name, part.bytes / n, part.bytes / 1048576.0);
+    printf("%-13s %8.1f bytes/person %10.1f MB\n", "total", total / n, total / 1048576.0);
+    return 0;
+}
+
+// The baseline: workers take tasks from one deque under one mutex, and a thread waiting
+// for a group runs queued tasks meanwhile (or nested waits would run out of threads)
+class MutexPool {
+public:
+    struct Group { std::atomic<size_t> pending{0}; };
+
+    explicit MutexPool(size_t count) {
+        for (size_t w = 0; w < count; ++w) threads.emplace_back([this] { Loop(); });
+    }
+
+    ~MutexPool() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void Run(Group& g, std::function<void()> fn) {
+        g.pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            queue.push_back({ std::move(fn), &g });
+        }
+        wake.notify_one();
+    }
+
+    void Wait(Group& g) {
+        while (g.pending.load() != 0)
+            if (!RunOne()) std::this_thread::yield();
+    }
+
+private:
+    struct Task { std::function<void()> fn; Group* group; };
+    std::vector<std::thread> threads;
+    std::mutex mu;
+    std::condition_variable wake;
+    std::deque<Task> queue;
+    bool stopping = false;
+
+    bool RunOne() {
+        Task t;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (queue.empty()) return false;
+            t = std::move(queue.front());
+            queue.pop_front();
+        }
+        t.fn();
+        t.group->pending.fetch_sub(1);
+        return true;
+    }
+
+    void Loop() {
+        for (;;) {
+            Task t;
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                t = std::move(queue.front());
+                queue.pop_front();
+            }
+            t.fn();
+            t.group->pending.fetch_sub(1);
+        }
+    }
+};
+
+// A few hundred nanoseconds of arithmetic per item, summed so the pools can be compared
+uint64_t Work(size_t begin, size_t end) {
+    uint64_t sum = 0;
+    for (size_t i = begin; i < end; ++i) {
+        uint64_t x = i * 2654435761u + 1;
+        for (int r = 0; r < 64; ++r) x ^= (x << 7) ^ (x >> 9);
+        sum += x;
+    }
+    return sum;
+}
+
+const size_t LEAF = 64; // Items per task in the fork-join runs
+
+// Halves [begin, end) down to LEAF items, forking one half and doing the other
+void SplitScheduler(TaskScheduler& pool, size_t begin, size_t end, std::atomic<uint64_t>& sum) {
+    if (end - begin <= LEAF) { sum.fetch_add(Work(begin, end)); return; }
+    size_t mid = begin + (end - begin) / 2;
+    TaskScheduler::Group group(nullptr, pool);
+    group.Run([&pool, begin, mid, &sum] { SplitScheduler(pool, begin, mid, sum); });
+    SplitScheduler(pool, mid, end, sum);
+    group.Wait();
+}
+
+void SplitMutex(MutexPool& pool, size_t begin, size_t end, std::atomic<uint64_t>& sum) {
+    if (end - begin <= LEAF) { sum.fetch_add(Work(begin, end)); return; }
+    size_t mid = begin + (end - begin) / 2;
+    MutexPool::Group group;
+    pool.Run(group, [&pool, begin, mid, &sum] { SplitMutex(pool, begin, mid, sum); });
+    SplitMutex(pool, mid, end, sum);
+    pool.Wait(group);
+}
+
+int Scheduler(size_t workers, size_t tasks) {
+    const int ROUNDS = 5; // Best of
+    double flat[2] = { 1e300, 1e300 }, nested[2] = { 1e300, 1e300 };
+    uint64_t sums[2][2] = {};
+    TaskScheduler::Counters counts;
+    {
+        TaskScheduler pool(workers);
+        for (int r = 0; r < ROUNDS; ++r) {
+            std::atomic<uint64_t> sum{0};
+            auto start = Clock::now();
+            {
+                TaskScheduler::Group group(nullptr, pool);
+                for (size_t k = 0; k < tasks; ++k) group.Run([k, &sum] { sum.fetch_add(Work(k * 4, k * 4 + 4)); });
+                group.Wait();
+            }
+            flat[0] = std::min(flat[0], MsSince(start));
+            sums[0][0] = sum;
+
+            sum = 0;
+            start = Clock::now();
+            SplitScheduler(pool, 0, tasks * LEAF, sum);
+            nested[0] = std::min(nested[0], MsSince(start));
+            sums[0][1] = sum;
+        }
+        counts = pool.Snapshot();
+    }
+    {
+        MutexPool pool(workers);
+        for (int r = 0; r < ROUNDS; ++r) {
+            std::atomic<uint64_t> sum{0};
+            auto start = Clock::now();
+            {
+                MutexPool::Group group;
+                for (size_t k = 0; k < tasks; ++k) pool.Run(group, [k, &sum] { sum.fetch_add(Work(k * 4, k * 4 + 4)); });
+                pool.Wait(group);
+            }
+            flat[1] = std::min(flat[1], MsSince(start));
+            sums[1][0] = sum;
+
+            sum = 0;
+            start = Clock::now();
+            SplitMutex(pool, 0, tasks * LEAF, sum);
+            nested[1] = std::min(nested[1], MsSince(start));
+            sums[1][1] = sum;
+        }
+    }
+    bool same = sums[0][0] == sums[1][0] && sums[0][1] == sums[1][1];
+    printf("%zu workers + caller, %zu tasks, best of %d%s\n", workers, tasks, ROUNDS, same ? "" : ", RESULTS DIFFER");
+    printf("flat:       scheduler %8.2f ms, mutex queue %8.2f ms (%.2fx)\n", flat[0], flat[1], flat[1] / flat[0]);
+    printf("fork-join:  scheduler %8.2f ms, mutex queue %8.2f ms (%.2fx)\n", nested[0], nested[1], nested[1] / nested[0]);
+    printf("scheduler totals: %llu tasks, %llu steals, %.1f ms idle\n", (unsigned long long)counts.tasks,
+           (unsigned long long)counts.steals, counts.idleMs);
+    return same ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "edits") == 0) return Edits(argv[2], argc > 3 ? atoi(argv[3]) : 500);
+    if (argc >= 2 && strcmp(argv[1], "dates") == 0) return Dates();
+    if (argc >= 3 && strcmp(argv[1], "memory") == 0) return Memory(argv[2]);
+    if (argc >= 2 && strcmp(argv[1], "scheduler") == 0) {
+        size_t workers = argc > 2 ? (size_t)atoi(argv[2]) : std::max(2u, std::thread::hardware_concurrency()) - 1;
+        return Scheduler(workers, argc > 3 ? (size_t)atoi(argv[3]) : 100000);
+    }
+    printf("usage: bench edits <file> [steps]\n       bench dates\n       bench memory <file>\n       bench scheduler [workers] [tasks]\n");
+    return 2;
+}
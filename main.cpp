@@ -13,7 +13,9 @@
 
 #define NOMINMAX
 #include <windows.h>
+#include <windowsx.h>
 #include <tchar.h>
+#include <gdiplus.h> // Photo decoding (link gdiplus, msimg32 for AlphaBlend)
 #include <string>
 #include <vector>
 #include <map>
@@ -24,6 +26,23 @@
 #include <cmath>
 #include <ctime>
 #include <cstdio>
+#include <climits>
+#include <queue>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cwctype>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <iterator>
+#include <cstdarg>
 
 // -----------------------------------------------------------------------------
 // 1. CONFIGURATION
@@ -36,15 +55,78 @@ namespace Config {
     const int H_GAP         = 50;   // Horizontal gap between siblings
     const int SPOUSE_GAP    = 25;   // Gap between spouses
     const int TREE_GAP      = 0;   // Gap between separate family trees
+    const int BOX_SHADOW    = 4;   // Drop shadow offset (right and down)
+    const int CANVAS_MARGIN = 40;  // Blank border right of and below the drawing
+    const size_t BOUNDS_BLOCK = 16384; // Rows per parallel chunk of the bounds reduction (a multiple of 64)
+
+    // Legend overlay, anchored bottom-left (window and screenshot)
+    const int LEGEND_W     = 360;
+    const int LEGEND_H     = 135;
+    const int LEGEND_INSET = 20;  // From the left and bottom edges
+
+    // Timeline
+    const int TL_PX_PER_YEAR      = 12;
+    const int TL_BAR_HEIGHT       = 28;
+    const int TL_LANE_GAP         = 8;   // Vertical gap between lanes of one branch
+    const int TL_BRANCH_GAP       = 40;  // Vertical gap between branches
+    const int TL_MIN_BAR          = 170; // Packing width floor so the label always fits
+    const int TL_GENERATION_YEARS = 28;  // Used to estimate missing birth years
+    const int TL_DEFAULT_LIFESPAN = 75;  // Assumed life length when the birth or death year is missing
+    const int TL_TOP              = 120; // First lane (below the header and year labels)
+
+    // Fan chart
+    const int FAN_CENTER_R  = 90;   // Radius of the focus disc
+    const int FAN_RING_W    = 100;  // Width of each generation ring
+    const int FAN_SWEEP_DEG = 240;  // Total angle covered by the fan
+    const int FAN_MIN_LABEL = 36;   // Wedges with a shorter mid-arc skip their label
+
+    // Photo thumbnails (optional Photo column)
+    const int THUMB_SIZE        = 59;  // Square, inset 8px in the box
+    const size_t THUMB_CACHE_MB = 48;  // Decoded thumbnails kept in memory (LRU)
+    const int THUMB_WORKERS     = 2;   // Decode threads
+    const size_t THUMB_QUEUE_MAX = 256; // Older pending decodes are dropped while scrolling
+    const COLORREF COL_THUMB_PLACEHOLDER = RGB(228, 230, 235);
+    const COLORREF COL_THUMB_SILHOUETTE  = RGB(200, 203, 210);
+    const UINT WM_THUMBS_READY = WM_APP + 1;
+
+    // Crossing minimization (optional ordering pass)
+    const int CROSSING_MAX_SWEEPS    = 8;
+    const int CROSSING_BUDGET_MS     = 100; // Stop sweeping once this much time is spent
 
     const wchar_t* DATA_FILE = L"Family.csv";
+    const size_t RENUMBER_AT = 20000; // Larger archives are reordered family by family after loading (SIZE_MAX = never)
+    const UINT WM_RELOAD_READY = WM_APP + 3; // A changed DATA_FILE was loaded and laid out in the background
+    const UINT WM_LINEAGE_READY = WM_APP + 4; // Lineage labels of edited data were built in the background
+
+    // In-app edits are logged to "<DATA_FILE>.journal" and folded into the CSV in the background
+    const size_t JOURNAL_COMPACT_AT = 500; // Logged records before the CSV is rewritten
+    const UINT WM_JOURNAL_COMPACTED = WM_APP + 2;
+
+    // A SQLite DATA_FILE is read and written in place (no journal); reloads fetch changed rows only
+    const size_t SQLITE_BATCH = 50000; // Rows per query when loading
+
+    // PDF print export: the canvas is tiled over landscape pages at 96 dpi
+    const int PDF_MARGIN_PT      = 28;  // Unprinted border; the page label sits in the bottom one
+    const int PDF_OVERLAP_PX     = 40;  // Canvas repeated on both sides of every page join
+    const size_t PDF_BATCH_PAGES = 256; // Pages rendered in parallel before being written out
+
+    // Shared pool behind every parallel stage (see TaskScheduler)
+    const size_t WORKER_THREADS    = 0; // Besides the waiting thread; 0 = one per core minus one
+    const size_t CHUNKS_PER_THREAD = 4; // ParallelFor ranges per thread, so idle threads have something to steal
+
+    // Layout coordinates are 96-dpi canvas units, scaled to the target when drawn
+    const int EXPORT_DPI = 0; // Screenshot resolution; 0 = that of the window's monitor
+    const int PAINT_CELL = 512; // Grid cell (canvas units) a paint looks its commands up by; grown on huge canvases
 
     // Colors
+    const COLORREF COL_NONE          = 0xFFFFFFFF;         // "No fill/stroke" in display lists
     const COLORREF COL_BG_CANVAS     = RGB(250, 250, 252); // Very light gray/white
     const COLORREF COL_BOX_DEFAULT   = RGB(255, 255, 255);
     const COLORREF COL_BOX_FEMALE    = RGB(255, 245, 248);
     const COLORREF COL_BOX_FOCUS     = RGB(255, 252, 220); // Highlight
     const COLORREF COL_BOX_BORDER    = RGB(180, 180, 180);
+    const COLORREF COL_BOX_PROXY     = RGB(244, 244, 246); // Linked stand-in (DAG mode)
+    const COLORREF COL_PROXY_BORDER  = RGB(150, 150, 150);
 
     const COLORREF COL_TEXT_NAME     = RGB(30, 30, 30);
     const COLORREF COL_TEXT_ROLE     = RGB(100, 100, 100);
@@ -53,9 +135,30 @@ namespace Config {
     const COLORREF LINE_CHILD_NORMAL = RGB(180, 180, 180);
     const COLORREF LINE_SPOUSE_CURR  = RGB(220, 80, 80);   // Red/Pink for current
     const COLORREF LINE_SPOUSE_EX    = RGB(220, 80, 80); // Gray for ex
+    const COLORREF COL_RELATION      = RGB(40, 120, 220); // Highlighted relationship chain
 
     // UI IDs
     const int ID_BTN_SCREENSHOT = 101;
+    const int ID_BTN_SVG        = 102;
+    const int ID_EDIT_FILTER    = 103;
+    const int ID_BTN_PDF        = 104;
+
+    // Keyboard shortcuts
+    const int KEY_TOGGLE_CROSSING = 'C';
+    const int KEY_CYCLE_MODE      = 'M';
+    const int KEY_FILTER_DISPLAY  = 'F'; // Dim -> Hide -> Collapse
+    const int KEY_ADD_CHILD       = 'A'; // Child of the focus person and their spouse
+    const int KEY_LINK_SPOUSE     = 'S'; // Then click the spouse
+    const int KEY_TOGGLE_EX       = 'X'; // Then click the (ex-)spouse
+    const int KEY_UNDO            = 'Z'; // With Ctrl
+    const int KEY_REDO            = 'Y'; // With Ctrl
+    const int KEY_NEW_VIEW        = 'N'; // Another window on the same data
+    const int KEY_PAPER           = 'P'; // PDF paper size: A4 -> A3 -> A1
+    const int KEY_STATS           = 'I'; // Archive statistics to JSON
+    const int KEY_RELATION        = 'R'; // Then click someone: how they are related to the focus
+    const int KEY_ARCHIVE         = 'K'; // Columnar archive with this window's layout
+    const int KEY_ARROW           = 'W'; // Arrow/Feather person table with this window's layout
+    const int KEY_SQLITE          = 'L'; // This window's layout into the SQLite source (or a new database)
 }
 
 // -----------------------------------------------------------------------------
@@ -81,6 +184,327 @@ public:
     ~AutoSelect() { SelectObject(hdc, oldObj); }
 };
 
+// Set once with Cancel() and polled by long-running work, which then stops early and
+// leaves its results unspecified. Tasks of a TaskScheduler::Group holding a cancelled
+// token are dropped without running.
+class CancelToken {
+public:
+    void Cancel() { cancelled.store(true, std::memory_order_release); }
+    bool Cancelled() const { return cancelled.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+// The thread pool every parallel stage runs on (ParallelFor, and Group for fork-join),
+// so nested or concurrent stages share Config::WORKER_THREADS threads instead of each
+// starting its own. Each worker owns a Chase-Lev deque: it pushes and pops its own
+// tasks at the bottom without locking (newest first, still warm in cache), and a worker
+// out of tasks steals the oldest one from the top of another's. Threads outside the
+// pool (the UI thread) hand their tasks in through a small locked queue. While they wait
+// for a group they run that group's tasks from the queue, but never another group's: a
+// long task someone else forked (a reload, lineage labels) would hold up the wait.
+class TaskScheduler {
+public:
+    // Totals since the pool started
+    struct Counters {
+        size_t workers = 0;
+        uint64_t tasks = 0;        // Tasks run, by workers and waiting threads
+        uint64_t steals = 0;       // Tasks taken from another worker's deque
+        double idleMs = 0;         // Time workers spent asleep for lack of tasks
+    };
+
+    // Tasks forked together and waited for together
+    class Group {
+    public:
+        explicit Group(const CancelToken* token = nullptr, TaskScheduler& on = TaskScheduler::Get())
+            : pool(on), cancel(token) {}
+        ~Group() { Wait(); }
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+        void Run(std::function<void()> fn) {
+            pending.fetch_add(1, std::memory_order_relaxed);
+            pool.Push(new Task{ std::move(fn), this });
+        }
+
+        // Returns once every task run through this group has finished or been dropped
+        void Wait() { pool.WaitFor(*this); }
+
+        bool Cancelled() const { return cancel && cancel->Cancelled(); }
+
+    private:
+        friend class TaskScheduler;
+        TaskScheduler& pool;
+        const CancelToken* cancel;
+        std::atomic<size_t> pending{0};
+    };
+
+    // `count` worker threads besides the callers of Wait
+    explicit TaskScheduler(size_t count) {
+        for (size_t w = 0; w < count; ++w) workers.emplace_back(new Worker());
+        for (size_t w = 0; w < count; ++w) threads.emplace_back(&TaskScheduler::WorkerLoop, this, w);
+    }
+
+    ~TaskScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    // The shared pool, started on first use
+    static TaskScheduler& Get() {
+        static TaskScheduler pool(Config::WORKER_THREADS ? Config::WORKER_THREADS
+                                                         : std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+    // Threads that run tasks while a caller waits (the workers plus the caller)
+    size_t Threads() const { return threads.size() + 1; }
+
+    Counters Snapshot() const {
+        Counters c;
+        c.workers = threads.size();
+        uint64_t idleNs = 0;
+        for (size_t w = 0; w <= workers.size(); ++w) {
+            const Counts& k = w < workers.size() ? workers[w]->counts : outside;
+            c.tasks += k.tasks.load(std::memory_order_relaxed);
+            c.steals += k.steals.load(std::memory_order_relaxed);
+            idleNs += k.idleNs.load(std::memory_order_relaxed);
+        }
+        c.idleMs = idleNs / 1e6;
+        return c;
+    }
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        Group* group;
+    };
+
+    // Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013). Outgrown arrays are
+    // kept until the deque goes away: a thief may still be reading one.
+    class WorkDeque {
+    public:
+        WorkDeque() { arrays.emplace_back(new Ring(256)); ring.store(arrays.back().get(), std::memory_order_relaxed); }
+
+        // Owner only
+        void Push(Task* t) {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t tp = top.load(std::memory_order_acquire);
+            Ring* r = ring.load(std::memory_order_relaxed);
+            if (b - tp >= (int64_t)r->size) {
+                arrays.emplace_back(new Ring(r->size * 2));
+                Ring* bigger = arrays.back().get();
+                for (int64_t i = tp; i < b; ++i) bigger->Put(i, r->Get(i));
+                ring.store(bigger, std::memory_order_release);
+                r = bigger;
+            }
+            r->Put(b, t);
+            bottom.store(b + 1, std::memory_order_release); // Publishes the slot and the task to thieves
+        }
+
+        // Owner only: the newest task, or null
+        Task* Pop() {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Ring* r = ring.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t tp = top.load(std::memory_order_relaxed);
+            Task* t = nullptr;
+            if (tp <= b) {
+                t = r->Get(b);
+                if (tp == b) { // Last one: race the thieves for it
+                    if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        t = nullptr;
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+            } else {
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return t;
+        }
+
+        // Any thread: the oldest task, or null if empty or another thief won
+        Task* Steal() {
+            int64_t tp = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (tp >= b) return nullptr;
+            Task* t = ring.load(std::memory_order_acquire)->Get(tp);
+            if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+            return t;
+        }
+
+    private:
+        struct Ring {
+            size_t size;
+            std::unique_ptr<std::atomic<Task*>[]> slots;
+            explicit Ring(size_t n) : size(n), slots(new std::atomic<Task*>[n]) {}
+            Task* Get(int64_t i) const { return slots[(size_t)i & (size - 1)].load(std::memory_order_relaxed); }
+            void Put(int64_t i, Task* t) { slots[(size_t)i & (size - 1)].store(t, std::memory_order_relaxed); }
+        };
+        alignas(64) std::atomic<int64_t> top{0};
+        alignas(64) std::atomic<int64_t> bottom{0};
+        std::atomic<Ring*> ring;
+        std::vector<std::unique_ptr<Ring>> arrays;
+    };
+
+    // Per thread, each on its own cache line; threads outside the pool share `outside`
+    struct alignas(64) Counts {
+        std::atomic<uint64_t> tasks{0}, steals{0}, idleNs{0};
+    };
+    struct Worker {
+        WorkDeque queue;
+        Counts counts;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    Counts outside;
+    std::mutex injectMu;
+    std::deque<Task*> injected; // From threads outside the pool
+    std::atomic<size_t> injectedCount{0};
+
+    // Sleeping: a thread reads `epoch`, searches every queue, and sleeps only if `epoch`
+    // is unchanged; every push bumps it, so no wakeup is lost. Idle workers wait on
+    // `wake` (one is woken per push), threads waiting for a group on `done` (woken by
+    // pushes too, to help, and when a group's last task finishes).
+    std::mutex mu;
+    std::condition_variable wake, done;
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<int> sleepers{0}, waiters{0};
+    bool stopping = false;
+
+    // The worker index of the calling thread in this pool, -1 outside it
+    int Self() const {
+        return current.pool == this ? current.index : -1;
+    }
+    struct Current { const TaskScheduler* pool = nullptr; int index = -1; };
+    static thread_local Current current;
+
+    void Push(Task* t) {
+        int self = Self();
+        if (self >= 0) {
+            workers[self]->queue.Push(t);
+        } else {
+            std::lock_guard<std::mutex> lock(injectMu);
+            injected.push_back(t);
+            injectedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        bool sleeping = sleepers.load(std::memory_order_seq_cst) > 0, waiting = waiters.load(std::memory_order_seq_cst) > 0;
+        if (sleeping || waiting) {
+            std::lock_guard<std::mutex> lock(mu);
+            if (sleeping) wake.notify_one();
+            if (waiting) done.notify_all();
+        }
+    }
+
+    Counts& CountsOf(int self) { return self >= 0 ? workers[self]->counts : outside; }
+
+    // Own deque first, then handed-in tasks, then a steal starting at a random victim.
+    // A thread outside the pool only takes handed-in tasks of the group it waits for
+    // (`only`); it cannot steal selectively, as a thief learns the task only by taking it.
+    Task* Find(int self, uint32_t& seed, const Group* only = nullptr) {
+        if (self >= 0)
+            if (Task* t = workers[self]->queue.Pop()) return t;
+        if (injectedCount.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(injectMu);
+            auto it = injected.begin();
+            if (only) it = std::find_if(it, injected.end(), [only](const Task* t) { return t->group == only; });
+            if (it != injected.end()) {
+                Task* t = *it;
+                injected.erase(it);
+                injectedCount.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        if (self < 0) return nullptr;
+        size_t n = workers.size();
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        for (size_t k = 0, v = seed % std::max<size_t>(n, 1); k < n; ++k, v = (v + 1) % n) {
+            if ((int)v == self) continue;
+            if (Task* t = workers[v]->queue.Steal()) {
+                CountsOf(self).steals.fetch_add(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    void Execute(int self, Task* t) {
+        Group* g = t->group;
+        if (!g->Cancelled()) t->fn();
+        delete t;
+        CountsOf(self).tasks.fetch_add(1, std::memory_order_relaxed);
+        // `g` may be gone once pending reaches 0
+        if (g->pending.fetch_sub(1, std::memory_order_seq_cst) == 1 && waiters.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(mu);
+            done.notify_all();
+        }
+    }
+
+    // Runs tasks until every one of `g` is done, sleeping while there are none to run.
+    // A worker runs any task; another thread only `g`'s (see Find).
+    void WaitFor(const Group& g) {
+        const std::atomic<size_t>& pending = g.pending;
+        uint32_t seed = (uint32_t)(uintptr_t)&pending | 1;
+        int self = Self();
+        while (pending.load(std::memory_order_acquire) != 0) {
+            uint64_t seen = epoch.load(std::memory_order_seq_cst);
+            if (Task* t = Find(self, seed, self < 0 ? &g : nullptr)) { Execute(self, t); continue; }
+            std::unique_lock<std::mutex> lock(mu);
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            while (pending.load(std::memory_order_seq_cst) != 0 && epoch.load(std::memory_order_seq_cst) == seen) done.wait(lock);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    void WorkerLoop(size_t index) {
+        current.pool = this;
+        current.index = (int)index;
+        uint32_t seed = (uint32_t)index * 2654435761u + 1;
+        for (;;) {
+            uint64_t seen = epoch.load(std::memory_order_seq_cst);
+            if (Task* t = Find((int)index, seed)) { Execute((int)index, t); continue; }
+            auto start = std::chrono::steady_clock::now();
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                if (stopping) return;
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                while (!stopping && epoch.load(std::memory_order_seq_cst) == seen) wake.wait(lock);
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+            }
+            workers[index]->counts.idleNs.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        }
+    }
+};
+
+thread_local TaskScheduler::Current TaskScheduler::current;
+
+// Splits [0, count) into contiguous chunks and runs them on the shared TaskScheduler,
+// the calling thread included. fn(begin, end) must only write to data owned by its own
+// range. Chunks not yet started are skipped once `cancel` is set.
+void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& fn, const CancelToken* cancel = nullptr) {
+    TaskScheduler& pool = TaskScheduler::Get();
+    size_t chunks = std::min(count, pool.Threads() * Config::CHUNKS_PER_THREAD);
+    if (pool.Threads() <= 1 || chunks <= 1) { if (count && !(cancel && cancel->Cancelled())) fn(0, count); return; }
+
+    size_t chunk = (count + chunks - 1) / chunks;
+    TaskScheduler::Group group(cancel, pool);
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        size_t end = std::min(count, begin + chunk);
+        group.Run([&fn, begin, end] { fn(begin, end); });
+    }
+    if (!group.Cancelled()) fn(0, std::min(count, chunk)); // Calling thread takes the first chunk
+    group.Wait();
+}
+
 std::wstring ToWString(const std::string& str) {
     if (str.empty()) return L"";
     int size = MultiByteToWideChar(CP_UTF8, 0, &str[0], (int)str.size(), NULL, 0);
@@ -89,6 +513,50 @@ std::wstring ToWString(const std::string& str) {
     return wstr;
 }
 
+std::string ToUtf8(const std::wstring& wstr) {
+    if (wstr.empty()) return "";
+    int size = WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), NULL, 0, NULL, NULL);
+    std::string str(size, 0);
+    WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &str[0], size, NULL, NULL);
+    return str;
+}
+
+std::string Base64(const std::string& bytes) {
+    static const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((bytes.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t v = (uint8_t)bytes[i] << 16;
+        if (i + 1 < bytes.size()) v |= (uint8_t)bytes[i + 1] << 8;
+        if (i + 2 < bytes.size()) v |= (uint8_t)bytes[i + 2];
+        out += digits[(v >> 18) & 63];
+        out += digits[(v >> 12) & 63];
+        out += (i + 1 < bytes.size()) ? digits[(v >> 6) & 63] : '=';
+        out += (i + 2 < bytes.size()) ? digits[v & 63] : '=';
+    }
+    return out;
+}
+
+// DPI of the monitor a window is on. GetDpiForWindow needs Windows 10, so it is
+// looked up at runtime; older systems report the (single) system DPI.
+UINT WindowDpi(HWND hwnd) {
+    typedef UINT (WINAPI *GetDpiForWindowFn)(HWND);
+    GetDpiForWindowFn fn = (GetDpiForWindowFn)GetProcAddress(GetModuleHandleW(L"user32.dll"), "GetDpiForWindow");
+    if (fn) return fn(hwnd);
+    HDC hdc = GetDC(NULL);
+    UINT dpi = GetDeviceCaps(hdc, LOGPIXELSX);
+    ReleaseDC(NULL, hdc);
+    return dpi ? dpi : 96;
+}
+
+// Opt out of bitmap stretching: per-monitor v2 where available, else system DPI aware
+void EnableDpiAwareness() {
+    typedef BOOL (WINAPI *SetContextFn)(HANDLE);
+    SetContextFn fn = (SetContextFn)GetProcAddress(GetModuleHandleW(L"user32.dll"), "SetProcessDpiAwarenessContext");
+    if (fn && fn((HANDLE)-4)) return; // DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2
+    SetProcessDPIAware();
+}
+
 // Helper to save HBITMAP to file
 bool SaveBitmapToFile(HBITMAP hBitmap, const std::wstring& filePath) {
     HDC hDC = GetDC(NULL);
@@ -144,6 +612,101 @@ bool SaveBitmapToFile(HBITMAP hBitmap, const std::wstring& filePath) {
 // -----------------------------------------------------------------------------
 // 3. DATA MODEL
 // -----------------------------------------------------------------------------
+// A person's spouse IDs and which of them are exes. Nearly everyone has two or fewer,
+// kept inline; a longer list moves to one heap block holding the IDs followed by the
+// ex flag words. 16 bytes per person, where a vector plus a set cost about 100 even
+// when both are empty.
+class SpouseList {
+public:
+    SpouseList() {}
+    SpouseList(const SpouseList& o) { *this = o; }
+    SpouseList(SpouseList&& o) noexcept { *this = std::move(o); }
+    ~SpouseList() { if (count > INLINE) delete[] heap; }
+
+    SpouseList& operator=(const SpouseList& o) {
+        if (this == &o) return *this;
+        if (count > INLINE) delete[] heap;
+        count = o.count;
+        flags = o.flags;
+        if (count > INLINE) {
+            heap = new uint32_t[Words(count)];
+            memcpy(heap, o.heap, Words(count) * sizeof(uint32_t));
+        } else {
+            inl[0] = o.inl[0];
+            inl[1] = o.inl[1];
+        }
+        return *this;
+    }
+
+    SpouseList& operator=(SpouseList&& o) noexcept {
+        if (this == &o) return *this;
+        if (count > INLINE) delete[] heap;
+        count = o.count;
+        flags = o.flags;
+        if (count > INLINE) heap = o.heap;
+        else { inl[0] = o.inl[0]; inl[1] = o.inl[1]; }
+        o.count = 0;
+        o.flags = 0;
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const int* begin() const { return count > INLINE ? (const int*)heap : inl; }
+    const int* end() const { return begin() + count; }
+    int operator[](size_t i) const { return begin()[i]; }
+
+    void push_back(int id) {
+        if (count < INLINE) { inl[count++] = id; return; }
+        uint32_t* grown = new uint32_t[Words(count + 1)];
+        memcpy(grown, begin(), count * sizeof(int));
+        grown[count] = (uint32_t)id;
+        uint32_t* flagWords = grown + count + 1;
+        memset(flagWords, 0, FlagWords(count + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < count; ++i) if (Flag(i)) flagWords[i / 32] |= 1u << (i % 32);
+        if (count > INLINE) delete[] heap;
+        heap = grown;
+        flags = 0;
+        ++count;
+    }
+
+    // Whether the marriage to `id` is marked as ended
+    bool IsEx(int id) const {
+        for (uint32_t i = 0; i < count; ++i) if (begin()[i] == id) return Flag(i);
+        return false;
+    }
+
+    // Marks or unmarks an ex; `id` has to be in the list already
+    void SetEx(int id, bool ex) {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (begin()[i] != id) continue;
+            uint32_t& word = (count > INLINE) ? heap[count + i / 32] : flags;
+            if (ex) word |= 1u << (i % 32);
+            else word &= ~(1u << (i % 32));
+        }
+    }
+
+    bool AnyEx() const {
+        for (uint32_t i = 0; i < count; ++i) if (Flag(i)) return true;
+        return false;
+    }
+
+    size_t HeapBytes() const { return count > INLINE ? Words(count) * sizeof(uint32_t) : 0; }
+
+private:
+    static const uint32_t INLINE = 2;
+    uint32_t count = 0;
+    uint32_t flags = 0; // Ex flags while inline
+    union {
+        int inl[INLINE] = { 0, 0 };
+        uint32_t* heap; // `count` IDs, then FlagWords(count) words of ex flags
+    };
+
+    static size_t FlagWords(uint32_t n) { return (n + 31) / 32; }
+    static size_t Words(uint32_t n) { return n + FlagWords(n); }
+    bool Flag(uint32_t i) const { return ((count > INLINE ? heap[count + i / 32] : flags) >> (i % 32)) & 1; }
+};
+
 struct Person {
     int id = 0;
     std::wstring name;
@@ -151,266 +714,5690 @@ struct Person {
     std::wstring gender;
     int fatherId = 0;
     int motherId = 0;
+    int fatherIdx = -1; // Dense indices into DataModel::people, -1 if unknown
+    int motherIdx = -1;
 
     // Relationships
-    std::vector<int> spouses;
-    std::set<int> exSpouses; // IDs marked with 'x' in CSV
-
-    // Visualization state
-    int x = -10000;
-    int y = -10000;
-    int gen = 0;
+    SpouseList spouses; // IDs; exes are marked with 'x' in the CSV
 
     bool IsFemale() const { return gender == L"Female"; }
 };
 
-class DataModel {
+// Sorted lists of dense indices, one per person, packed as varints: the count, the
+// first index as a zigzag delta from the owner, then the gaps between neighbours.
+// Relatives sit close together in the file, so most entries take one byte instead of
+// four; an empty list takes none. Decoding is a forward walk, which is all the
+// traversals need.
+class PackedLists {
 public:
-    std::vector<Person> people;
-    std::map<int, size_t> idMap;
-
-    void LoadFromFile(const wchar_t* filename) {
-        people.clear();
-        idMap.clear();
+    class Iterator {
+    public:
+        Iterator(const uint8_t* p, uint32_t left, int value) : p(p), left(left), value(value) {}
+        int operator*() const { return value; }
+        Iterator& operator++() {
+            if (--left) value += (int)ReadVarint(p);
+            return *this;
+        }
+        bool operator!=(const Iterator& o) const { return left != o.left; }
+    private:
+        const uint8_t* p;
+        uint32_t left;
+        int value;
+    };
+
+    struct Span {
+        const uint8_t* p; // Past the count
+        uint32_t count;
+        int first;
+        Iterator begin() const { return Iterator(p, count, first); }
+        Iterator end() const { return Iterator(nullptr, 0, 0); }
+        size_t size() const { return count; }
+    };
+
+    // Packs a plain CSR (start has n + 1 offsets into list, each row sorted)
+    void Build(const std::vector<int>& start, const std::vector<int>& list) {
+        size_t n = start.size() - 1;
+        offset.resize(n + 1);
+        bytes.clear();
+        for (size_t i = 0; i < n; ++i) {
+            offset[i] = (uint32_t)bytes.size();
+            WriteRow(bytes, (int)i, list.data() + start[i], list.data() + start[i + 1]);
+        }
+        offset[n] = (uint32_t)bytes.size();
+        bytes.shrink_to_fit();
+    }
 
-        char fNameMB[MAX_PATH];
-        WideCharToMultiByte(CP_ACP, 0, filename, -1, fNameMB, MAX_PATH, NULL, NULL);
+    // Replaces the lists of the rows given (sorted by row, each list sorted) and makes
+    // the total `n` rows: new rows start empty, rows past `n` go. The bytes of the rows in
+    // between are copied as they are, so an edit never decodes the rest of the family.
+    void Patch(size_t n, const std::vector<std::pair<int, std::vector<int>>>& rows) {
+        const size_t old = offset.size() - 1;
+        std::vector<uint8_t> out;
+        std::vector<uint32_t> at(n + 1);
+        out.reserve(bytes.size() + rows.size() * 8);
+        size_t next = 0; // First row not written yet
+        auto copyUntil = [&](size_t end) {
+            size_t keep = std::min(end, old);
+            if (next < keep) {
+                uint32_t shift = (uint32_t)out.size() - offset[next];
+                for (size_t i = next; i < keep; ++i) at[i] = offset[i] + shift;
+                out.insert(out.end(), bytes.begin() + offset[next], bytes.begin() + offset[keep]);
+            }
+            for (size_t i = std::max(next, keep); i < end; ++i) at[i] = (uint32_t)out.size();
+            next = end;
+        };
+        for (const auto& row : rows) {
+            if ((size_t)row.first >= n) break;
+            copyUntil(row.first);
+            at[row.first] = (uint32_t)out.size();
+            WriteRow(out, row.first, row.second.data(), row.second.data() + row.second.size());
+            next = row.first + 1;
+        }
+        copyUntil(n);
+        at[n] = (uint32_t)out.size();
+        offset.swap(at);
+        bytes.swap(out);
+    }
 
-        std::ifstream file(fNameMB);
-        if (!file.is_open()) return;
+    void Clear() { offset.assign(1, 0); bytes.clear(); }
 
-        // Skip BOM if present
-        if (file.peek() == 0xEF) { file.get(); file.get(); file.get(); }
+    Span operator[](int idx) const {
+        const uint8_t* p = bytes.data() + offset[idx];
+        if (offset[idx] == offset[idx + 1]) return { p, 0, 0 };
+        uint32_t count = ReadVarint(p);
+        uint32_t zz = ReadVarint(p);
+        return { p, count, idx + (int)((zz >> 1) ^ (0u - (zz & 1))) };
+    }
 
-        std::string line;
-        std::getline(file, line); // Skip Header
+    size_t Bytes() const { return offset.capacity() * sizeof(uint32_t) + bytes.capacity(); }
 
-        while (std::getline(file, line)) {
-            if (line.empty()) continue;
-            if (line.back() == '\r') line.pop_back();
+private:
+    std::vector<uint32_t> offset; // Byte offset of each person's list
+    std::vector<uint8_t> bytes;
 
-            std::stringstream ss(line);
-            std::string segment;
-            std::vector<std::string> parts;
-            while (std::getline(ss, segment, ',')) parts.push_back(segment);
+    static void WriteVarint(std::vector<uint8_t>& out, uint32_t v) {
+        while (v >= 0x80) { out.push_back((uint8_t)(v | 0x80)); v >>= 7; }
+        out.push_back((uint8_t)v);
+    }
 
-            if (parts.size() >= 7) {
-                Person p;
-                try {
-                    p.id = std::stoi(parts[0]);
-                    p.name = ToWString(parts[1]);
-                    p.role = ToWString(parts[2]);
-                    p.gender = ToWString(parts[3]);
-                    p.fatherId = std::stoi(parts[4]);
-                    p.motherId = std::stoi(parts[5]);
-
-                    // Parse Spouses (e.g., "2x|3")
-                    std::stringstream ssSpouse(parts[6]);
-                    std::string sId;
-                    while(std::getline(ssSpouse, sId, '|')) {
-                        bool isEx = false;
-                        if (!sId.empty() && (sId.back() == 'x' || sId.back() == 'X')) {
-                            isEx = true;
-                            sId.pop_back();
-                        }
-                        try {
-                            int id = std::stoi(sId);
-                            if (id != 0) {
-                                p.spouses.push_back(id);
-                                if (isEx) p.exSpouses.insert(id);
-                            }
-                        } catch(...) {}
-                    }
-                } catch(...) { continue; }
-                people.push_back(p);
-            }
+    static void WriteRow(std::vector<uint8_t>& out, int idx, const int* first, const int* last) {
+        if (first == last) return;
+        WriteVarint(out, (uint32_t)(last - first));
+        int prev = *first;
+        int delta = prev - idx;
+        WriteVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        for (const int* k = first + 1; k < last; ++k) {
+            WriteVarint(out, (uint32_t)(*k - prev));
+            prev = *k;
         }
+    }
 
-        for (size_t i = 0; i < people.size(); ++i) idMap[people[i].id] = i;
+    static uint32_t ReadVarint(const uint8_t*& p) {
+        uint32_t v = *p++;
+        if (v < 0x80) return v;
+        v &= 0x7F;
+        for (int shift = 7;; shift += 7) {
+            uint32_t b = *p++;
+            v |= (b & 0x7F) << shift;
+            if (b < 0x80) return v;
+        }
     }
+};
 
-    Person* Get(int id) {
-        auto it = idMap.find(id);
-        if (it != idMap.end()) return &people[it->second];
-        return nullptr;
+// One bit per person (dense index). Null masks and query results use the same layout so
+// they combine a word (64 people) at a time.
+struct RowBitmap {
+    std::vector<uint64_t> words;
+    size_t size = 0;
+
+    RowBitmap() {}
+    explicit RowBitmap(size_t n, bool value = false) { Resize(n, value); }
+
+    void Resize(size_t n, bool value) {
+        size = n;
+        words.assign((n + 63) / 64, value ? ~0ull : 0ull);
+        ClearTail();
     }
+    bool Test(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    void Set(size_t i) { words[i >> 6] |= 1ull << (i & 63); }
+    void Reset(size_t i) { words[i >> 6] &= ~(1ull << (i & 63)); }
+
+    size_t Count() const {
+        size_t c = 0;
+        for (uint64_t w : words) c += (size_t)__builtin_popcountll(w);
+        return c;
+    }
+    RowBitmap& operator&=(const RowBitmap& o) { for (size_t i = 0; i < words.size(); ++i) words[i] &= o.words[i]; return *this; }
+    RowBitmap& operator|=(const RowBitmap& o) { for (size_t i = 0; i < words.size(); ++i) words[i] |= o.words[i]; return *this; }
+    void Flip() { for (auto& w : words) w = ~w; ClearTail(); }
+
+    // Sets every bit from pred(row), packing one 64-row word at a time
+    template <typename Pred>
+    void Fill(Pred pred) {
+        for (size_t w = 0; w < words.size(); ++w) {
+            size_t base = w * 64, count = std::min<size_t>(64, size - base);
+            uint64_t bits = 0;
+            for (size_t b = 0; b < count; ++b) bits |= (uint64_t)(pred(base + b) ? 1 : 0) << b;
+            words[w] = bits;
+        }
+    }
+
+private:
+    void ClearTail() { if ((size & 63) && !words.empty()) words.back() &= (1ull << (size & 63)) - 1; }
 };
 
-// -----------------------------------------------------------------------------
-// 4. LAYOUT ENGINE
-// -----------------------------------------------------------------------------
-class LayoutEngine {
-    DataModel* model;
-    std::map<int, std::pair<int, int>> subtreeMetrics; // <id, {width, centerOffset}>
-    std::map<int, int> nodeOwner; // <person_id, root_id>
+enum class CmpOp : unsigned char { Lt, Le, Gt, Ge, Eq, Ne, Contains };
 
+// Extra CSV columns beyond the 7 core fields (dates, places, notes, photos...). They stay
+// out of Person so the layout's hot struct does not grow. Loading only keeps the raw row
+// text; a column is split, typed and encoded the first time something asks for it.
+class AttributeTable {
 public:
-    int totalWidth = 1000;
-    int totalHeight = 1000;
+    enum class Type : unsigned char { Int, Date, Text };
+
+    struct Column {
+        std::string name;               // Lowercased header
+        Type type = Type::Text;
+        RowBitmap valid;                // Bit set = cell present
+        std::vector<int64_t> values;    // Int: the number, Date: yyyymmdd (mm/dd 0 if unknown)
+        std::vector<uint32_t> codes;    // Text: index into dict
+        std::vector<std::wstring> dict; // Distinct text values in first-seen order
+
+        int Year(size_t row) const {
+            if (!valid.Test(row)) return 0;
+            if (type == Type::Int) return (int)values[row];
+            if (type == Type::Date) return (int)(values[row] / 10000);
+            return ParseYear(ToUtf8(dict[codes[row]]));
+        }
+        std::wstring Text(size_t row) const {
+            if (!valid.Test(row)) return L"";
+            if (type == Type::Text) return dict[codes[row]];
+            if (type == Type::Int) return std::to_wstring(values[row]);
+            wchar_t buf[16];
+            int64_t v = values[row];
+            if (v % 10000 == 0) swprintf(buf, 16, L"%d", (int)(v / 10000));
+            else if (v % 100 == 0) swprintf(buf, 16, L"%04d-%02d", (int)(v / 10000), (int)(v / 100 % 100));
+            else swprintf(buf, 16, L"%04d-%02d-%02d", (int)(v / 10000), (int)(v / 100 % 100), (int)(v % 100));
+            return buf;
+        }
+    };
 
-    LayoutEngine(DataModel* m) : model(m) {}
+    void Clear() {
+        names.clear();
+        columns.clear();
+        raw.clear();
+        rowStart.assign(1, 0);
+    }
 
-    void Recalculate() {
-        if (model->people.empty()) return;
-        ResetState();
-        CalculateGenerations();
-        AssignOwnership();
+    void SetColumns(std::vector<std::string> extraNames) {
+        names = std::move(extraNames);
+        columns.clear();
+        columns.resize(names.size());
+    }
 
-        int currentX = 50;
-        int currentY = 50;
-        std::set<int> placed;
+    // `tail` is the raw text after the core columns of one accepted row
+    void AddRow(const std::string& tail) {
+        raw += tail;
+        rowStart.push_back(raw.size());
+    }
 
-        // Sort roots to ensure consistent order? For now, insertion order (ID order typically)
-        // We iterate standard vector order
-        for (const auto& p : model->people) {
-            // Process Gen 0 Roots
-            if (p.gen == 0 && !placed.count(p.id)) {
+    size_t RowCount() const { return rowStart.size() - 1; }
 
-                // If part of a marriage, only layout the "Canonical" root (smallest ID)
-                int minId = p.id;
-                for(int sid : p.spouses) minId = std::min(minId, sid);
-                if (p.id > minId) continue;
+    // Raw text after the core columns of `row`, as read from the CSV
+    std::string Tail(size_t row) const { return raw.substr(rowStart[row], rowStart[row + 1] - rowStart[row]); }
 
-                // Sanity: Do I own myself?
-                if (nodeOwner[p.id] != p.id) continue;
+    // Same rows and columns, nothing materialized (cheap enough to hand to another thread)
+    AttributeTable Clone() const {
+        AttributeTable out;
+        out.names = names;
+        out.raw = raw;
+        out.rowStart = rowStart;
+        out.columns.resize(names.size());
+        return out;
+    }
 
-                // Smart Gap Logic: Reduce gap if this tree relates to the previous one
-                int gap = 0;
-                if (!placed.empty()) {
-                    gap = IsConnectedToPlaced(p.id, placed) ? Config::H_GAP : Config::TREE_GAP;
-                }
-                currentX += gap;
+    // Keeps the first `rows` rows or pads with empty ones; columns are re-materialized on demand
+    void Resize(size_t rows) {
+        if (rows < RowCount()) {
+            raw.resize(rowStart[rows]);
+            rowStart.resize(rows + 1);
+        }
+        while (RowCount() < rows) rowStart.push_back(raw.size());
+        for (auto& c : columns) c.reset();
+    }
 
-                ComputeSubtreeSize(p.id, p.id);
-                PositionSubtree(p.id, currentX, currentY, placed, p.id);
-                currentX += subtreeMetrics[p.id].first;
-            }
+    // Row r of the result is row order[r] of this table; columns are re-materialized on demand
+    AttributeTable Permute(const std::vector<int>& order) const {
+        AttributeTable out;
+        out.Clear();
+        out.SetColumns(names);
+        out.raw.reserve(raw.size());
+        for (int r : order) out.AddRow(raw.substr(rowStart[r], rowStart[r + 1] - rowStart[r]));
+        return out;
+    }
+
+    // Replaces the text of the rows listed (sorted by row; rows past the end are appended,
+    // gaps left empty) in one pass; columns are re-materialized on demand
+    void SetRows(const std::vector<std::pair<size_t, std::string>>& rows) {
+        if (rows.empty()) return;
+        size_t total = std::max(RowCount(), rows.back().first + 1);
+        std::string out;
+        std::vector<uint64_t> starts(1, 0);
+        out.reserve(raw.size());
+        starts.reserve(total + 1);
+        for (size_t r = 0, k = 0; r < total; ++r) {
+            if (k < rows.size() && rows[k].first == r) out += rows[k++].second;
+            else if (r < RowCount()) out.append(raw, rowStart[r], rowStart[r + 1] - rowStart[r]);
+            starts.push_back(out.size());
         }
+        raw.swap(out);
+        rowStart.swap(starts);
+        for (auto& c : columns) c.reset();
+    }
 
-        FinalizeBounds();
+    // Same columns, only the rows set in `keep`; columns are re-materialized on demand
+    AttributeTable Subset(const RowBitmap& keep) const {
+        AttributeTable out;
+        out.Clear();
+        out.SetColumns(names);
+        for (size_t r = 0; r < RowCount(); ++r)
+            if (keep.Test(r)) out.AddRow(raw.substr(rowStart[r], rowStart[r + 1] - rowStart[r]));
+        return out;
     }
+    size_t ColumnCount() const { return names.size(); }
+    const std::string& Name(int c) const { return names[c]; }
 
-private:
-    void ResetState() {
-        for (auto& p : model->people) { p.x = p.y = -10000; p.gen = -1; }
-        subtreeMetrics.clear();
-        nodeOwner.clear();
+    int Find(const std::string& name) const {
+        std::string key = Lower(name);
+        for (size_t c = 0; c < names.size(); ++c) if (names[c] == key) return (int)c;
+        return -1;
     }
 
-    // Determine generation levels relative to roots
-    void CalculateGenerations() {
-        bool changed = true;
-        int limit = 0;
-        while(changed && limit++ < 20) {
-            changed = false;
-            for(auto& p : model->people) {
-                if (p.gen != -1) continue;
+    // First column whose header is one of `aliases`, -1 if none
+    int FindAny(std::initializer_list<const char*> aliases) const {
+        for (const char* a : aliases) { int c = Find(a); if (c >= 0) return c; }
+        return -1;
+    }
 
-                Person* f = model->Get(p.fatherId);
-                Person* m = model->Get(p.motherId);
+    // Materializes the column on first use (UI thread only)
+    const Column& Get(int c) const {
+        if (!columns[c]) columns[c].reset(Materialize(c));
+        return *columns[c];
+    }
 
-                int pGen = -1;
-                if(f && f->gen != -1) pGen = std::max(pGen, f->gen);
-                if(m && m->gen != -1) pGen = std::max(pGen, m->gen);
+    // Whether `column op literal` can be evaluated: the literal parses as the column's type
+    bool Fits(int c, CmpOp op, const std::wstring& literal) const {
+        const Column& col = Get(c);
+        if (col.type == Type::Text) return true;
+        int64_t v;
+        std::string lit = ToUtf8(literal);
+        return op != CmpOp::Contains && (col.type == Type::Int ? ParseInt(lit, v) : ParseDate(lit, v));
+    }
 
-                if (pGen != -1) {
-                    p.gen = pGen + 1;
-                    changed = true;
-                } else {
-                    // Try to inherit from spouse
-                    for(int sid : p.spouses) {
-                        Person* sp = model->Get(sid);
-                        if (sp && sp->gen != -1) {
-                            p.gen = sp->gen;
-                            changed = true;
-                            break;
-                        }
-                    }
-                    // Roots
-                    if (p.gen == -1 && p.fatherId == 0 && p.motherId == 0 && p.spouses.empty()) {
-                        p.gen = 0; changed = true;
-                    }
-                }
+    // Sets `out` to the rows where `column op literal` holds; nulls never match.
+    // Returns false if the literal does not fit the column type.
+    bool Select(int c, CmpOp op, const std::wstring& literal, RowBitmap& out) const {
+        const Column& col = Get(c);
+        const size_t n = RowCount();
+        out.Resize(n, false);
+
+        if (col.type == Type::Text) {
+            // Decide once per distinct value, then scan the codes
+            std::wstring lit = LowerW(literal);
+            std::vector<char> hit(col.dict.size());
+            for (size_t d = 0; d < col.dict.size(); ++d) {
+                std::wstring v = LowerW(col.dict[d]);
+                int cmp = v.compare(lit);
+                hit[d] = (op == CmpOp::Contains) ? (v.find(lit) != std::wstring::npos) : Holds(op, cmp);
+            }
+            const uint32_t* codes = col.codes.data();
+            out.Fill([&](size_t i) { return hit[codes[i]] != 0; });
+        } else {
+            // A literal is a half-open range: in a Date column a bare year covers the whole
+            // year and "yyyy-mm" the whole month
+            int64_t lo, hi;
+            std::string lit = ToUtf8(literal);
+            if (col.type == Type::Int) {
+                if (!ParseInt(lit, lo)) return false;
+                hi = lo + 1;
+            } else {
+                if (!ParseDate(lit, lo)) return false;
+                hi = lo + ((lo % 10000 == 0) ? 10000 : (lo % 100 == 0) ? 100 : 1);
+            }
+            const int64_t* v = col.values.data();
+            switch (op) {
+                case CmpOp::Lt: out.Fill([&](size_t i) { return v[i] < lo; }); break;
+                case CmpOp::Le: out.Fill([&](size_t i) { return v[i] < hi; }); break;
+                case CmpOp::Gt: out.Fill([&](size_t i) { return v[i] >= hi; }); break;
+                case CmpOp::Ge: out.Fill([&](size_t i) { return v[i] >= lo; }); break;
+                case CmpOp::Eq: out.Fill([&](size_t i) { return v[i] >= lo && v[i] < hi; }); break;
+                case CmpOp::Ne: out.Fill([&](size_t i) { return v[i] < lo || v[i] >= hi; }); break;
+                case CmpOp::Contains: return false;
             }
         }
-        // Fallback
-        for(auto& p : model->people) if (p.gen == -1) p.gen = 0;
+        out &= col.valid;
+        return true;
     }
 
-    // Assign every node to a 'Root Family' to prevent duplicates across trees
-    void AssignOwnership() {
-        std::set<int> visited;
-        for (const auto& p : model->people) {
-            if (p.gen == 0) {
-                // Canonical root check
-                int minId = p.id;
-                for(int sid : p.spouses) minId = std::min(minId, sid);
-                if (p.id > minId || visited.count(p.id)) continue;
+    static std::string Lower(std::string s) {
+        s.erase(0, s.find_first_not_of(" \t"));
+        s.erase(s.find_last_not_of(" \t") + 1);
+        for (char& c : s) c = (char)tolower((unsigned char)c);
+        return s;
+    }
 
-                StartClaiming(p.id, visited);
+    static std::wstring LowerW(std::wstring s) {
+        for (wchar_t& c : s) c = (wchar_t)towlower(c);
+        return s;
+    }
+
+    // First run of 3-4 digits, so "1950", "1950-03-12" and "12/03/1950" all give 1950
+    static int ParseYear(const std::string& s) {
+        for (size_t i = 0; i < s.size(); ) {
+            if (!isdigit((unsigned char)s[i])) { ++i; continue; }
+            size_t j = i;
+            while (j < s.size() && isdigit((unsigned char)s[j])) ++j;
+            if (j - i >= 3 && j - i <= 4) return std::stoi(s.substr(i, j - i));
+            i = j;
+        }
+        return 0;
+    }
+
+    static bool ParseInt(const std::string& s, int64_t& out) {
+        size_t i = (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+        if (i == s.size() || s.size() > 18) return false;
+        for (size_t k = i; k < s.size(); ++k) if (!isdigit((unsigned char)s[k])) return false;
+        out = std::stoll(s);
+        return true;
+    }
+
+    // "yyyy", "yyyy-mm", "yyyy-mm-dd" or "dd/mm/yyyy" (also with '-' or '.') to yyyymmdd
+    static bool ParseDate(const std::string& s, int64_t& out) {
+        int a = 0, b = 0, c = 0, la = 0, lb = 0, lc = 0, field = 0;
+        for (char ch : s) {
+            if (isdigit((unsigned char)ch)) {
+                int& v = (field == 0) ? a : (field == 1) ? b : c;
+                int& l = (field == 0) ? la : (field == 1) ? lb : lc;
+                v = v * 10 + (ch - '0'); ++l;
+                if (l > 4) return false;
+            } else if ((ch == '-' || ch == '/' || ch == '.') && field < 2) {
+                ++field;
+            } else {
+                return false;
             }
         }
+        int y, m = 0, d = 0;
+        if (la == 4) { y = a; m = b; d = c; }
+        else if (lc == 4 && field == 2) { y = c; m = b; d = a; }
+        else return false;
+        if (m > 12 || d > 31 || (field >= 1 && m == 0)) return false;
+        out = (int64_t)y * 10000 + m * 100 + d;
+        return true;
     }
 
-    void StartClaiming(int rootId, std::set<int>& visited) {
-        std::vector<int> q = {rootId};
-        visited.insert(rootId);
-        nodeOwner[rootId] = rootId;
+    // Next CSV field starting at `pos`; returns the position after its delimiter (npos at end).
+    // A line ending in a comma has a last, empty field, so "3,Destio,Myself,Male,2,5,"
+    // reads as seven fields with no spouses (the original stream split dropped that row).
+    static size_t NextField(const std::string& line, size_t pos, std::string& field) {
+        field.clear();
+        bool quoted = (pos < line.size() && line[pos] == '"');
+        if (quoted) ++pos;
+        while (pos < line.size()) {
+            char ch = line[pos++];
+            if (quoted && ch == '"') {
+                if (pos < line.size() && line[pos] == '"') { field += '"'; ++pos; }
+                else quoted = false;
+            } else if (!quoted && ch == ',') {
+                return pos;
+            } else {
+                field += ch;
+            }
+        }
+        return std::string::npos;
+    }
 
-        size_t head = 0;
-        while(head < q.size()) {
-            int currId = q[head++];
-            Person* curr = model->Get(currId);
-            if (!curr) continue;
+    // Next record of a CSV stream into `line` (without its final newline). A line break
+    // inside a quoted field (QuoteField keeps them) continues the record on the next
+    // line. False at the end of the stream; eof() is set after a record the stream ended
+    // in, with no newline after it or inside quotes.
+    static bool ReadRecord(std::istream& in, std::string& line) {
+        if (!std::getline(in, line)) return false;
+        std::string more;
+        while (!in.eof() && EndsInQuotes(line) && std::getline(in, more)) {
+            line += '\n';
+            line += more;
+        }
+        return true;
+    }
 
-            // Claim Spouses
-            for(int sid : curr->spouses) {
-                if (!visited.count(sid)) {
-                    visited.insert(sid);
-                    nodeOwner[sid] = rootId;
-                    q.push_back(sid);
-                }
+    // Whether `line` ends inside a quoted field, by NextField's rules (only a quote that
+    // opens a field starts one)
+    static bool EndsInQuotes(const std::string& line) {
+        bool quoted = false, fieldStart = true;
+        for (size_t i = 0; i < line.size(); ++i) {
+            char ch = line[i];
+            if (fieldStart) {
+                fieldStart = false;
+                if (ch == '"') { quoted = true; continue; }
             }
-            // Claim Children
-            auto kids = GetChildren(currId);
-            for(int kidId : kids) {
-                if (!visited.count(kidId)) {
-                    visited.insert(kidId);
-                    nodeOwner[kidId] = rootId;
-                    q.push_back(kidId);
-                }
+            if (quoted) {
+                if (ch != '"') continue;
+                if (i + 1 < line.size() && line[i + 1] == '"') ++i;
+                else quoted = false;
+            } else if (ch == ',') {
+                fieldStart = true;
             }
         }
+        return quoted;
     }
 
-    bool IsConnectedToPlaced(int rootId, const std::set<int>& placed) {
-        for (const auto& p : model->people) {
-            if (nodeOwner[p.id] == rootId) {
-                if (placed.count(p.fatherId)) return true;
-                if (placed.count(p.motherId)) return true;
-                for (int sid : p.spouses) if (placed.count(sid)) return true;
-                for (int kid : GetChildren(p.id)) if (placed.count(kid)) return true;
-            }
+    // Inverse of NextField: quotes a field holding a comma, quote or line break
+    static std::string QuoteField(const std::string& field) {
+        if (field.find_first_of(",\"\r\n") == std::string::npos) return field;
+        std::string q = "\"";
+        for (char ch : field) {
+            if (ch == '"') q += '"';
+            q += ch;
         }
-        return false;
+        return q + '"';
+    }
+
+private:
+    std::vector<std::string> names;
+    std::string raw;                // Row tails back to back
+    std::vector<uint64_t> rowStart; // Offsets into raw (size = rows + 1); the text may pass 4 GiB
+    mutable std::vector<std::unique_ptr<Column>> columns; // Null until first used
+
+    static bool Holds(CmpOp op, int cmp) {
+        switch (op) {
+            case CmpOp::Lt: return cmp < 0;
+            case CmpOp::Le: return cmp <= 0;
+            case CmpOp::Gt: return cmp > 0;
+            case CmpOp::Ge: return cmp >= 0;
+            case CmpOp::Eq: return cmp == 0;
+            case CmpOp::Ne: return cmp != 0;
+            default: return false;
+        }
+    }
+
+    Column* Materialize(int c) const {
+        const size_t n = RowCount();
+        std::vector<std::string> cells(n);
+        std::string field;
+        for (size_t r = 0; r < n; ++r) {
+            size_t pos = rowStart[r], stop = rowStart[r + 1];
+            std::string tail = raw.substr(pos, stop - pos);
+            size_t at = 0;
+            for (int k = 0; k <= c && at != std::string::npos; ++k) {
+                at = NextField(tail, at, field);
+                if (k == c) cells[r] = field;
+            }
+        }
+
+        // Narrowest type every non-empty cell fits: Int, then Date, else Text
+        Column* col = new Column();
+        col->name = names[c];
+        col->valid.Resize(n, false);
+        bool allInt = true, allDate = true;
+        int64_t v;
+        for (auto& cell : cells) {
+            cell.erase(0, cell.find_first_not_of(" \t"));
+            cell.erase(cell.find_last_not_of(" \t") + 1);
+            if (cell.empty()) continue;
+            if (allInt && !ParseInt(cell, v)) allInt = false;
+            if (allDate && !ParseDate(cell, v)) allDate = false;
+        }
+        col->type = allInt ? Type::Int : allDate ? Type::Date : Type::Text;
+
+        if (col->type == Type::Text) {
+            std::map<std::string, uint32_t> seen;
+            col->codes.assign(n, 0);
+            for (size_t r = 0; r < n; ++r) {
+                if (cells[r].empty()) continue;
+                auto it = seen.find(cells[r]);
+                if (it == seen.end()) {
+                    it = seen.emplace(cells[r], (uint32_t)col->dict.size()).first;
+                    col->dict.push_back(ToWString(cells[r]));
+                }
+                col->codes[r] = it->second;
+                col->valid.Set(r);
+            }
+        } else {
+            col->values.assign(n, 0);
+            for (size_t r = 0; r < n; ++r) {
+                if (cells[r].empty()) continue;
+                if (col->type == Type::Int) ParseInt(cells[r], col->values[r]);
+                else ParseDate(cells[r], col->values[r]);
+                col->valid.Set(r);
+            }
+        }
+        return col;
+    }
+};
+
+// Immutable, structurally shared array of person records: a persistent tree of fixed
+// depth, records in 64-wide leaves under 64-wide interior nodes. An edit copies only the
+// nodes on the path to the record it touches and shares everything else with the
+// version it was derived from, whatever the size of the family.
+class PersonVersion {
+public:
+    static const size_t SHIFT = 6;
+    static const size_t CHUNK = size_t(1) << SHIFT; // Records per leaf, children per node
+    static const int LEVELS = 4;                     // Interior levels: room for 64^5 records
+
+    PersonVersion() : root(std::make_shared<Node>()) {}
+
+    // Built bottom-up, each level packed full from the left
+    static PersonVersion From(const std::vector<Person>& people) {
+        std::vector<std::shared_ptr<const Node>> level;
+        for (size_t i = 0; i < people.size(); i += CHUNK) {
+            auto leaf = std::make_shared<Node>();
+            for (size_t j = i; j < std::min(people.size(), i + CHUNK); ++j)
+                leaf->records.push_back(std::make_shared<const Person>(people[j]));
+            level.push_back(std::move(leaf));
+        }
+        for (int l = 0; l < LEVELS; ++l) {
+            std::vector<std::shared_ptr<const Node>> up;
+            for (size_t i = 0; i < level.size(); i += CHUNK) {
+                auto node = std::make_shared<Node>();
+                node->kids.assign(level.begin() + i, level.begin() + std::min(level.size(), i + CHUNK));
+                up.push_back(std::move(node));
+            }
+            level = std::move(up);
+        }
+        PersonVersion v;
+        if (!level.empty()) v.root = std::move(level[0]);
+        v.count = people.size();
+        return v;
+    }
+
+    size_t Size() const { return count; }
+    const Person& operator[](size_t i) const {
+        const Node* n = root.get();
+        for (int l = LEVELS; l > 0; --l) n = n->kids[(i >> (SHIFT * l)) & (CHUNK - 1)].get();
+        return *n->records[i & (CHUNK - 1)];
+    }
+
+    PersonVersion Set(size_t i, Person p) const {
+        PersonVersion v;
+        v.root = Put(root.get(), LEVELS, i, std::make_shared<const Person>(std::move(p)));
+        v.count = count;
+        return v;
+    }
+
+    PersonVersion Append(Person p) const {
+        PersonVersion v;
+        v.root = Put(root.get(), LEVELS, count, std::make_shared<const Person>(std::move(p)));
+        v.count = count + 1;
+        return v;
+    }
+
+    // Appends every index whose record differs between `a` and `b` (including indices
+    // only one of them has); subtrees both versions share are skipped without a look inside
+    static void Diff(const PersonVersion& a, const PersonVersion& b, std::vector<int>& out) {
+        DiffNodes(a.root.get(), b.root.get(), LEVELS, 0, out);
+    }
+
+private:
+    struct Node {
+        std::vector<std::shared_ptr<const Node>> kids;      // Interior levels
+        std::vector<std::shared_ptr<const Person>> records; // Leaves
+    };
+    std::shared_ptr<const Node> root;
+    size_t count = 0;
+
+    // Copy of `n` (null = not there yet) with record `i` set, or appended at the end
+    static std::shared_ptr<const Node> Put(const Node* n, int level, size_t i, std::shared_ptr<const Person> p) {
+        auto copy = n ? std::make_shared<Node>(*n) : std::make_shared<Node>();
+        size_t k = (i >> (SHIFT * level)) & (CHUNK - 1);
+        if (level == 0) {
+            if (k == copy->records.size()) copy->records.push_back(std::move(p));
+            else copy->records[k] = std::move(p);
+        } else {
+            auto kid = Put(k < copy->kids.size() ? copy->kids[k].get() : nullptr, level - 1, i, std::move(p));
+            if (k == copy->kids.size()) copy->kids.push_back(std::move(kid));
+            else copy->kids[k] = std::move(kid);
+        }
+        return copy;
+    }
+
+    static void DiffNodes(const Node* a, const Node* b, int level, size_t base, std::vector<int>& out) {
+        if (a == b) return;
+        if (level == 0) {
+            size_t na = a ? a->records.size() : 0, nb = b ? b->records.size() : 0;
+            for (size_t k = 0; k < std::max(na, nb); ++k) {
+                const Person* pa = (k < na) ? a->records[k].get() : nullptr;
+                const Person* pb = (k < nb) ? b->records[k].get() : nullptr;
+                if (pa != pb) out.push_back((int)(base + k));
+            }
+            return;
+        }
+        size_t na = a ? a->kids.size() : 0, nb = b ? b->kids.size() : 0;
+        for (size_t k = 0; k < std::max(na, nb); ++k)
+            DiffNodes((k < na) ? a->kids[k].get() : nullptr, (k < nb) ? b->kids[k].get() : nullptr,
+                      level - 1, base + (k << (SHIFT * level)), out);
+    }
+};
+
+// Result of moving a DataModel between two versions: the dense indices whose record was
+// rewritten, added or dropped, and the IDs whose layout that can affect (those people
+// plus their parents and spouses before and after the change)
+struct ModelDiff {
+    std::vector<int> changed;
+    std::vector<int> touchedIds;
+    std::vector<int> droppedIds; // People no longer in the model
+    std::vector<int> relinked;   // Rows whose parent and spouse links were resolved again (changed ones included)
+};
+
+// Column-oriented archive file. Each column is cut into chunks of CHUNK_ROWS rows and
+// encoded by kind: numbers as zigzag varint deltas, lists as a count per row plus item
+// deltas, text through a per-chunk dictionary when few values repeat (roles, gender) and
+// length-prefixed otherwise. The footer lists every chunk's offset, size and the min/max
+// of its numbers, so a reader seeks straight to the columns it wants (the graph without
+// the names is a fraction of the file) and skips chunks whose range misses a query.
+//   "FTCOLS01" | chunks... | footer | footer size (u32) | "FTCOLS01"
+class ColumnFile {
+public:
+    static constexpr size_t CHUNK_ROWS = 65536;
+
+    enum class Kind : uint8_t { Int, List, Text };
+
+    struct Chunk {
+        uint64_t offset = 0, bytes = 0;
+        int64_t min = INT64_MAX, max = INT64_MIN; // Numbers only; empty range if none
+    };
+    struct Column {
+        std::string name;
+        Kind kind = Kind::Int;
+        bool nullable = false;
+        std::vector<Chunk> chunks;
+    };
+
+    // Collects encoded columns in memory, then writes the file in one go
+    class Writer {
+    public:
+        explicit Writer(size_t rows) : rows(rows) {}
+
+        void SetMeta(std::string text) { meta = std::move(text); }
+
+        // `valid` (optional) marks the rows holding a value; the rest read back as null
+        void AddInts(const std::string& name, const std::vector<int64_t>& values, const RowBitmap* valid = nullptr) {
+            Column& col = Begin(name, Kind::Int, valid != nullptr);
+            for (size_t c = 0; c * CHUNK_ROWS < rows; ++c) {
+                std::string& out = NewChunk(col);
+                Chunk& ch = col.chunks.back();
+                int64_t prev = 0;
+                for (size_t r = c * CHUNK_ROWS; r < std::min(rows, (c + 1) * CHUNK_ROWS); ++r) {
+                    if (valid && !valid->Test(r)) { PutVarint(out, 0); continue; }
+                    PutVarint(out, Zig(Delta(values[r], prev)) + (valid ? 1 : 0));
+                    prev = values[r];
+                    ch.min = std::min(ch.min, prev);
+                    ch.max = std::max(ch.max, prev);
+                }
+            }
+        }
+
+        // Row r holds items[start[r] .. start[r + 1])
+        void AddLists(const std::string& name, const std::vector<uint32_t>& start, const std::vector<int64_t>& items) {
+            Column& col = Begin(name, Kind::List, false);
+            for (size_t c = 0; c * CHUNK_ROWS < rows; ++c) {
+                std::string& out = NewChunk(col);
+                Chunk& ch = col.chunks.back();
+                int64_t prev = 0;
+                for (size_t r = c * CHUNK_ROWS; r < std::min(rows, (c + 1) * CHUNK_ROWS); ++r) {
+                    PutVarint(out, start[r + 1] - start[r]);
+                    for (uint32_t k = start[r]; k < start[r + 1]; ++k) {
+                        PutVarint(out, Zig(Delta(items[k], prev)));
+                        prev = items[k];
+                        ch.min = std::min(ch.min, prev);
+                        ch.max = std::max(ch.max, prev);
+                    }
+                }
+            }
+        }
+
+        void AddText(const std::string& name, const std::vector<std::string>& values) {
+            Column& col = Begin(name, Kind::Text, false);
+            std::unordered_map<std::string, uint32_t> codes;
+            std::vector<const std::string*> dict;
+            for (size_t c = 0; c * CHUNK_ROWS < rows; ++c) {
+                std::string& out = NewChunk(col);
+                size_t begin = c * CHUNK_ROWS, end = std::min(rows, begin + CHUNK_ROWS);
+                codes.clear();
+                dict.clear();
+                for (size_t r = begin; r < end && dict.size() * 4 <= end - begin; ++r)
+                    if (codes.emplace(values[r], (uint32_t)dict.size()).second) dict.push_back(&values[r]);
+
+                bool useDict = dict.size() * 4 <= end - begin;
+                out += (char)(useDict ? 1 : 0);
+                if (useDict) {
+                    PutVarint(out, dict.size());
+                    for (const std::string* s : dict) PutString(out, *s);
+                    for (size_t r = begin; r < end; ++r) PutVarint(out, codes[values[r]]);
+                } else {
+                    for (size_t r = begin; r < end; ++r) PutString(out, values[r]);
+                }
+            }
+        }
+
+        bool Save(const std::wstring& path) const {
+            char pathMB[MAX_PATH];
+            WideCharToMultiByte(CP_ACP, 0, path.c_str(), -1, pathMB, MAX_PATH, NULL, NULL);
+            std::ofstream out(pathMB, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+
+            std::string footer;
+            PutVarint(footer, rows);
+            PutString(footer, meta);
+            PutVarint(footer, columns.size());
+            uint64_t offset = sizeof(MAGIC) - 1;
+            out.write(MAGIC, sizeof(MAGIC) - 1);
+            for (size_t i = 0; i < columns.size(); ++i) {
+                const Column& col = columns[i];
+                PutString(footer, col.name);
+                footer += (char)col.kind;
+                footer += (char)(col.nullable ? 1 : 0);
+                PutVarint(footer, col.chunks.size());
+                for (size_t c = 0; c < col.chunks.size(); ++c) {
+                    const std::string& bytes = encoded[i][c];
+                    out.write(bytes.data(), (std::streamsize)bytes.size());
+                    PutVarint(footer, offset);
+                    PutVarint(footer, bytes.size());
+                    PutVarint(footer, Zig(col.chunks[c].min));
+                    PutVarint(footer, Zig(col.chunks[c].max));
+                    offset += bytes.size();
+                }
+            }
+            uint32_t footerBytes = (uint32_t)footer.size();
+            out.write(footer.data(), (std::streamsize)footer.size());
+            out.write((const char*)&footerBytes, sizeof(footerBytes));
+            out.write(MAGIC, sizeof(MAGIC) - 1);
+            return out.good();
+        }
+
+    private:
+        size_t rows;
+        std::string meta;
+        std::vector<Column> columns;
+        std::vector<std::vector<std::string>> encoded; // Chunk bytes per column
+
+        Column& Begin(const std::string& name, Kind kind, bool nullable) {
+            columns.push_back(Column{ name, kind, nullable, {} });
+            encoded.emplace_back();
+            return columns.back();
+        }
+        std::string& NewChunk(Column& col) {
+            col.chunks.emplace_back();
+            encoded.back().emplace_back();
+            return encoded.back().back();
+        }
+    };
+
+    // Reads the footer only; columns are read on request
+    bool Open(const wchar_t* path) {
+        columns.clear();
+        bytesRead = 0;
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, path, -1, pathMB, MAX_PATH, NULL, NULL);
+        file.close();
+        file.clear();
+        file.open(pathMB, std::ios::binary);
+        if (!file.is_open()) return false;
+
+        const size_t tail = sizeof(uint32_t) + sizeof(MAGIC) - 1;
+        file.seekg(0, std::ios::end);
+        uint64_t size = (uint64_t)file.tellg();
+        if (size < sizeof(MAGIC) - 1 + tail) return false;
+        char end[tail];
+        if (!ReadAt(size - tail, end, tail) || memcmp(end + sizeof(uint32_t), MAGIC, sizeof(MAGIC) - 1) != 0) return false;
+        uint32_t footerBytes;
+        memcpy(&footerBytes, end, sizeof(footerBytes));
+        if (footerBytes > size - tail - (sizeof(MAGIC) - 1)) return false;
+        std::string footer(footerBytes, '\0');
+        if (!ReadAt(size - tail - footerBytes, &footer[0], footerBytes)) return false;
+
+        Cursor in{ footer.data(), footer.data() + footer.size() };
+        rows = (size_t)in.Varint();
+        meta = in.String();
+        size_t count = (size_t)in.Varint();
+        for (size_t i = 0; i < count && in.ok; ++i) {
+            Column col;
+            col.name = in.String();
+            col.kind = (Kind)in.Byte();
+            if (col.kind > Kind::Text) in.ok = false;
+            col.nullable = in.Byte() != 0;
+            size_t chunks = (size_t)in.Varint();
+            if (chunks != (rows + CHUNK_ROWS - 1) / CHUNK_ROWS) in.ok = false;
+            for (size_t c = 0; c < chunks && in.ok; ++c) {
+                Chunk ch;
+                ch.offset = in.Varint();
+                ch.bytes = in.Varint();
+                ch.min = Zag(in.Varint());
+                ch.max = Zag(in.Varint());
+                if (ch.offset + ch.bytes > size) in.ok = false;
+                col.chunks.push_back(ch);
+            }
+            columns.push_back(std::move(col));
+        }
+        if (!in.ok) columns.clear();
+        return in.ok;
+    }
+
+    // True if the file starts like a column file (cheap check before choosing a loader)
+    static bool Sniff(const wchar_t* path) {
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, path, -1, pathMB, MAX_PATH, NULL, NULL);
+        std::ifstream in(pathMB, std::ios::binary);
+        char head[sizeof(MAGIC) - 1];
+        return in.read(head, sizeof(head)) && memcmp(head, MAGIC, sizeof(head)) == 0;
+    }
+
+    size_t Rows() const { return rows; }
+    const std::string& Meta() const { return meta; }
+    uint64_t BytesRead() const { return bytesRead; } // Footer and chunks read since Open
+
+    const Column* Find(const std::string& name) const {
+        for (const Column& col : columns) if (col.name == name) return &col;
+        return nullptr;
+    }
+
+    // Chunks of a number column that may hold a value in [lo, hi]. With no such column
+    // every chunk is wanted.
+    std::vector<char> ChunksInRange(const std::string& name, int64_t lo, int64_t hi) const {
+        std::vector<char> want((rows + CHUNK_ROWS - 1) / CHUNK_ROWS, 1);
+        const Column* col = Find(name);
+        if (col && col->kind != Kind::Text)
+            for (size_t c = 0; c < want.size(); ++c) want[c] = col->chunks[c].max >= lo && col->chunks[c].min <= hi;
+        return want;
+    }
+
+    // The Read functions decode the chunks set in `want` (every chunk if null), in order;
+    // rows of skipped chunks are left out. False if the column is missing, of another
+    // kind, or damaged.
+    bool ReadInts(const std::string& name, std::vector<int64_t>& out, RowBitmap* valid = nullptr, const std::vector<char>* want = nullptr) {
+        out.clear();
+        const Column* col = Find(name);
+        if (!col || col->kind != Kind::Int) return false;
+        if (valid) valid->Resize(WantedRows(want), !col->nullable);
+        return ForChunks(*col, want, [&](Cursor& in, size_t count) {
+            int64_t prev = 0;
+            for (size_t r = 0; r < count && in.ok; ++r) {
+                uint64_t v = in.Varint();
+                if (col->nullable && v-- == 0) { out.push_back(0); continue; }
+                prev = Undelta(prev, Zag(v));
+                if (valid && col->nullable) valid->Set(out.size());
+                out.push_back(prev);
+            }
+        });
+    }
+
+    bool ReadLists(const std::string& name, std::vector<uint32_t>& start, std::vector<int64_t>& items, const std::vector<char>* want = nullptr) {
+        start.assign(1, 0);
+        items.clear();
+        const Column* col = Find(name);
+        if (!col || col->kind != Kind::List) return false;
+        return ForChunks(*col, want, [&](Cursor& in, size_t count) {
+            int64_t prev = 0;
+            for (size_t r = 0; r < count && in.ok; ++r) {
+                uint64_t n = in.Varint();
+                for (uint64_t k = 0; k < n && in.ok; ++k) {
+                    prev = Undelta(prev, Zag(in.Varint()));
+                    items.push_back(prev);
+                }
+                start.push_back((uint32_t)items.size());
+            }
+        });
+    }
+
+    bool ReadText(const std::string& name, std::vector<std::string>& out, const std::vector<char>* want = nullptr) {
+        out.clear();
+        const Column* col = Find(name);
+        if (!col || col->kind != Kind::Text) return false;
+        std::vector<std::string> dict;
+        return ForChunks(*col, want, [&](Cursor& in, size_t count) {
+            if (in.Byte() == 0) {
+                for (size_t r = 0; r < count && in.ok; ++r) out.push_back(in.String());
+                return;
+            }
+            dict.resize((size_t)std::min<uint64_t>(in.Varint(), count));
+            for (auto& s : dict) s = in.String();
+            for (size_t r = 0; r < count && in.ok; ++r) {
+                uint64_t code = in.Varint();
+                if (code >= dict.size()) { in.ok = false; break; }
+                out.push_back(dict[code]);
+            }
+        });
+    }
+
+private:
+    static constexpr char MAGIC[] = "FTCOLS01";
+
+    std::ifstream file;
+    size_t rows = 0;
+    std::string meta;
+    std::vector<Column> columns;
+    uint64_t bytesRead = 0;
+
+    // Bounds-checked decoding of one chunk or the footer; a damaged file clears `ok`
+    struct Cursor {
+        const char* p;
+        const char* end;
+        bool ok = true;
+
+        uint64_t Varint() {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64 && p < end; shift += 7) {
+                uint8_t b = (uint8_t)*p++;
+                v |= (uint64_t)(b & 0x7F) << shift;
+                if (b < 0x80) return v;
+            }
+            ok = false;
+            return 0;
+        }
+        uint8_t Byte() {
+            if (p < end) return (uint8_t)*p++;
+            ok = false;
+            return 0;
+        }
+        std::string String() {
+            uint64_t n = Varint();
+            if (n > (uint64_t)(end - p)) { ok = false; return std::string(); }
+            p += n;
+            return std::string(p - n, (size_t)n);
+        }
+    };
+
+    static void PutVarint(std::string& out, uint64_t v) {
+        while (v >= 0x80) { out += (char)(v | 0x80); v >>= 7; }
+        out += (char)v;
+    }
+    static void PutString(std::string& out, const std::string& s) {
+        PutVarint(out, s.size());
+        out += s;
+    }
+    static uint64_t Zig(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+    static int64_t Zag(uint64_t u) { return (int64_t)(u >> 1) ^ -(int64_t)(u & 1); }
+    static int64_t Delta(int64_t v, int64_t prev) { return (int64_t)((uint64_t)v - (uint64_t)prev); }
+    static int64_t Undelta(int64_t prev, int64_t d) { return (int64_t)((uint64_t)prev + (uint64_t)d); }
+
+    bool ReadAt(uint64_t offset, char* to, size_t bytes) {
+        file.clear();
+        file.seekg((std::streamoff)offset);
+        bytesRead += bytes;
+        return (bool)file.read(to, (std::streamsize)bytes);
+    }
+
+    size_t WantedRows(const std::vector<char>* want) const {
+        size_t n = 0;
+        for (size_t c = 0; c * CHUNK_ROWS < rows; ++c)
+            if (!want || (*want)[c]) n += std::min(CHUNK_ROWS, rows - c * CHUNK_ROWS);
+        return n;
+    }
+
+    // Reads each wanted chunk and hands it to decode(cursor, rows in the chunk)
+    template <typename Decode>
+    bool ForChunks(const Column& col, const std::vector<char>* want, Decode decode) {
+        std::string bytes;
+        for (size_t c = 0; c < col.chunks.size(); ++c) {
+            if (want && !(*want)[c]) continue;
+            bytes.resize((size_t)col.chunks[c].bytes);
+            if (!ReadAt(col.chunks[c].offset, &bytes[0], bytes.size())) return false;
+            Cursor in{ bytes.data(), bytes.data() + bytes.size() };
+            decode(in, std::min(CHUNK_ROWS, rows - c * CHUNK_ROWS));
+            if (!in.ok) return false;
+        }
+        return true;
+    }
+};
+
+// Both are odr-used (std::min binds a reference, write/memcmp take the array), which
+// needs a definition outside the class before C++17
+constexpr size_t ColumnFile::CHUNK_ROWS;
+constexpr char ColumnFile::MAGIC[];
+
+// Minimal FlatBuffers encoder for the Arrow metadata below. Like the reference builder
+// it grows the buffer at the front: children are finished before the tables pointing
+// at them, so every offset points forward. Objects are referred to by their distance
+// from the end, which stays put while the front grows. The bytes are kept reversed
+// until Finish.
+class FlatBuilder {
+public:
+    using Ref = uint32_t;
+
+    Ref String(const std::string& s) {
+        Pad(4 + s.size() + 1, 4);
+        Put<uint8_t>(0);
+        PutBytes(s.data(), s.size());
+        Put<uint32_t>((uint32_t)s.size());
+        return Size();
+    }
+
+    Ref Refs(const std::vector<Ref>& refs) {
+        Pad(4 + 4 * refs.size(), 4);
+        for (size_t i = refs.size(); i-- > 0;) Put<uint32_t>(Size() + 4 - refs[i]);
+        Put<uint32_t>((uint32_t)refs.size());
+        return Size();
+    }
+
+    // Vector of structs of `elemSize` bytes, 8-byte aligned
+    Ref Structs(const void* data, size_t count, size_t elemSize) {
+        Pad(count * elemSize, 8);
+        PutBytes(data, count * elemSize);
+        Put<uint32_t>((uint32_t)count);
+        return Size();
+    }
+
+    void StartTable() {
+        fields.clear();
+        tableStart = Size();
+    }
+    template <typename T> void Add(int slot, T value) {
+        Pad(sizeof(T), sizeof(T));
+        Put<T>(value);
+        fields.push_back({ slot, Size() });
+    }
+    void AddRef(int slot, Ref r) {
+        Pad(4, 4);
+        Put<uint32_t>(Size() + 4 - r);
+        fields.push_back({ slot, Size() });
+    }
+    Ref EndTable() {
+        int slots = 0;
+        for (const auto& f : fields) slots = std::max(slots, f.first + 1);
+        uint16_t vtableBytes = (uint16_t)(4 + 2 * slots);
+        Pad(4, 4);
+        Put<int32_t>(vtableBytes); // The vtable sits right before the table
+        Ref table = Size();
+        std::vector<uint16_t> offsets(slots, 0);
+        for (const auto& f : fields) offsets[f.first] = (uint16_t)(table - f.second);
+        for (int i = slots; i-- > 0;) Put<uint16_t>(offsets[i]);
+        Put<uint16_t>((uint16_t)(table - tableStart));
+        Put<uint16_t>(vtableBytes);
+        return table;
+    }
+
+    // The finished buffer, a multiple of 8 bytes long
+    std::string Finish(Ref root) {
+        Pad(4, 8);
+        Put<uint32_t>(Size() + 4 - root);
+        return std::string(rev.rbegin(), rev.rend());
+    }
+
+private:
+    std::string rev;
+    std::vector<std::pair<int, Ref>> fields; // Slot, distance of the open table's fields
+    Ref tableStart = 0;
+
+    Ref Size() const { return (Ref)rev.size(); }
+    void PutBytes(const void* p, size_t n) {
+        const uint8_t* b = (const uint8_t*)p;
+        for (size_t i = n; i-- > 0;) rev += (char)b[i];
+    }
+    template <typename T> void Put(T v) { PutBytes(&v, sizeof(T)); }
+    // Zeros so that an object of `bytes` put next starts on an `align` boundary
+    void Pad(size_t bytes, size_t align) { while ((rev.size() + bytes) % align) rev += '\0'; }
+};
+
+// Bounds-checked view of a FlatBuffers table; reads outside the buffer give zeros
+struct FlatTable {
+    const uint8_t* base = nullptr; // Null: the table is absent
+    size_t size = 0;
+    size_t pos = 0;
+
+    static FlatTable Root(const uint8_t* base, size_t size) {
+        FlatTable t{ base, size, 0 };
+        return t.Follow(0);
+    }
+
+    bool Present() const { return base != nullptr; }
+
+    template <typename T> T Read(size_t at) const {
+        T v{};
+        if (base && at <= size && sizeof(T) <= size - at) memcpy(&v, base + at, sizeof(T));
+        return v;
+    }
+
+    // Position of field `slot`, 0 if absent
+    size_t Field(int slot) const {
+        if (!base) return 0;
+        int64_t vtable = (int64_t)pos - Read<int32_t>(pos);
+        if (vtable < 0 || (uint64_t)vtable >= size) return 0;
+        uint16_t vtableBytes = Read<uint16_t>((size_t)vtable);
+        if ((size_t)(4 + 2 * slot) + 2 > vtableBytes) return 0;
+        uint16_t off = Read<uint16_t>((size_t)vtable + 4 + 2 * slot);
+        return off ? pos + off : 0;
+    }
+
+    template <typename T> T Scalar(int slot, T fallback) const {
+        size_t f = Field(slot);
+        return f ? Read<T>(f) : fallback;
+    }
+    FlatTable Table(int slot) const {
+        size_t f = Field(slot);
+        return f ? Follow(f) : FlatTable();
+    }
+    std::string String(int slot) const {
+        size_t f = Field(slot);
+        if (!f) return std::string();
+        size_t at = f + Read<uint32_t>(f);
+        uint32_t n = Read<uint32_t>(at);
+        if (at + 4 > size || n > size - at - 4) return std::string();
+        return std::string((const char*)base + at + 4, n);
+    }
+    // Position of the first element and count of a vector of `elemSize`-byte entries
+    bool Vector(int slot, size_t elemSize, size_t& first, size_t& count) const {
+        size_t f = Field(slot);
+        if (!f) return false;
+        size_t at = f + Read<uint32_t>(f);
+        if (at + 4 > size) return false;
+        count = Read<uint32_t>(at);
+        first = at + 4;
+        return count <= (size - first) / elemSize;
+    }
+    // The table an offset stored at `at` points to
+    FlatTable Follow(size_t at) const {
+        size_t target = at + Read<uint32_t>(at);
+        if (!base || target + 4 > size) return FlatTable();
+        return FlatTable{ base, size, target };
+    }
+};
+
+// Read-only view of a whole file; Arrow columns are used straight from the mapping
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const wchar_t* path) {
+        Close();
+        file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER bytes;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &bytes) || bytes.QuadPart == 0) { Close(); return false; }
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!data) { Close(); return false; }
+        size = (size_t)bytes.QuadPart;
+        return true;
+    }
+
+    void Close() {
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        data = nullptr;
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+        size = 0;
+    }
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Arrow IPC file format (Feather v2), the exchange format of Arrow-based analytics
+// tools. The writer emits int32 and utf8 columns in record batches of BATCH_ROWS rows,
+// uncompressed. The reader maps the file and hands out views into it, so numbers and
+// strings are read in place; it accepts integers of any width and utf8/binary columns
+// (large ones too) and skips other flat types. Compressed bodies, dictionary-encoded
+// and nested columns are rejected.
+class ArrowFile {
+public:
+    static constexpr size_t BATCH_ROWS = 1 << 20;
+
+    class Writer {
+    public:
+        explicit Writer(size_t rows) : rows(rows) {}
+
+        void SetMeta(const std::string& key, const std::string& value) { meta.emplace_back(key, value); }
+
+        // Borrowed: `values` and `valid` (rows that are not null) must outlive Save
+        void AddInt32(const std::string& name, const int32_t* values, const RowBitmap* valid = nullptr) {
+            columns.emplace_back();
+            Column& col = columns.back();
+            col.name = name;
+            col.ints = values;
+            col.valid = valid;
+        }
+        void AddInt32(const std::string& name, std::vector<int32_t> values) {
+            AddInt32(name, nullptr);
+            columns.back().ownedInts = std::move(values);
+        }
+        void AddUtf8(const std::string& name, std::vector<std::string> values) {
+            columns.emplace_back();
+            columns.back().name = name;
+            columns.back().text = std::move(values);
+            columns.back().isText = true;
+        }
+
+        bool Save(const std::wstring& path) const {
+            char pathMB[MAX_PATH];
+            WideCharToMultiByte(CP_ACP, 0, path.c_str(), -1, pathMB, MAX_PATH, NULL, NULL);
+            std::ofstream out(pathMB, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+
+            out.write("ARROW1\0\0", 8);
+            uint64_t offset = 8;
+            {
+                FlatBuilder fb;
+                FlatBuilder::Ref schema = BuildSchema(fb);
+                offset += WriteMessage(out, fb, 1, schema, 0);
+            }
+
+            struct Block { int64_t offset; int32_t metaBytes; int32_t pad; int64_t bodyBytes; };
+            std::vector<Block> blocks;
+            std::vector<int32_t> textOffsets;
+            const size_t batchRows = BATCH_ROWS; // std::min binds a reference, which would need a definition before C++17
+            for (size_t begin = 0; begin < rows; begin += batchRows) {
+                size_t count = std::min(batchRows, rows - begin);
+                struct Node { int64_t length, nulls; };
+                struct Buffer { int64_t offset, length; };
+                std::vector<Node> nodes;
+                std::vector<Buffer> buffers;
+                int64_t body = 0;
+                auto buffer = [&](int64_t bytes) {
+                    buffers.push_back({ body, bytes });
+                    body += (bytes + 7) & ~7ll;
+                };
+                for (const Column& col : columns) {
+                    int64_t nulls = 0;
+                    if (col.valid) {
+                        nulls = (int64_t)count;
+                        for (size_t w = begin / 64; w < (begin + count + 63) / 64; ++w)
+                            nulls -= __builtin_popcountll(col.valid->words[w]);
+                    }
+                    nodes.push_back({ (int64_t)count, nulls });
+                    buffer(nulls ? (int64_t)(count + 7) / 8 : 0);
+                    if (!col.isText) { buffer((int64_t)count * 4); continue; }
+                    int64_t chars = 0;
+                    for (size_t i = begin; i < begin + count; ++i) chars += col.text[i].size();
+                    buffer((int64_t)(count + 1) * 4);
+                    buffer(chars);
+                }
+
+                FlatBuilder fb;
+                FlatBuilder::Ref nodeVec = fb.Structs(nodes.data(), nodes.size(), sizeof(Node));
+                FlatBuilder::Ref bufferVec = fb.Structs(buffers.data(), buffers.size(), sizeof(Buffer));
+                fb.StartTable(); // RecordBatch
+                fb.Add<int64_t>(0, (int64_t)count);
+                fb.AddRef(1, nodeVec);
+                fb.AddRef(2, bufferVec);
+                FlatBuilder::Ref batch = fb.EndTable();
+                Block block{ (int64_t)offset, 0, 0, body };
+                uint64_t metaBytes = WriteMessage(out, fb, 3, batch, body);
+                block.metaBytes = (int32_t)metaBytes;
+                blocks.push_back(block);
+                offset += metaBytes;
+
+                // Body, in the order of `buffers`. Batches start on a 64-row boundary, so
+                // validity bitmaps and int columns go out as they lie in memory.
+                size_t b = 0;
+                for (const Column& col : columns) {
+                    size_t bytes = (size_t)buffers[b++].length;
+                    if (bytes) Write(out, col.valid->words.data() + begin / 64, bytes);
+                    if (!col.isText) {
+                        const int32_t* values = col.ints ? col.ints : col.ownedInts.data();
+                        Write(out, values + begin, (size_t)buffers[b++].length);
+                        continue;
+                    }
+                    textOffsets.assign(1, 0);
+                    for (size_t i = begin; i < begin + count; ++i)
+                        textOffsets.push_back(textOffsets.back() + (int32_t)col.text[i].size());
+                    Write(out, textOffsets.data(), (size_t)buffers[b++].length);
+                    for (size_t i = begin; i < begin + count; ++i) out.write(col.text[i].data(), (std::streamsize)col.text[i].size());
+                    Write(out, nullptr, (size_t)buffers[b++].length);
+                }
+                offset += (uint64_t)body;
+            }
+            const uint32_t endOfStream[2] = { 0xFFFFFFFFu, 0 };
+            out.write((const char*)endOfStream, sizeof(endOfStream));
+
+            FlatBuilder fb;
+            FlatBuilder::Ref schema = BuildSchema(fb);
+            FlatBuilder::Ref none = fb.Structs(nullptr, 0, sizeof(Block));
+            FlatBuilder::Ref batchVec = fb.Structs(blocks.data(), blocks.size(), sizeof(Block));
+            fb.StartTable(); // Footer
+            fb.Add<int16_t>(0, VERSION);
+            fb.AddRef(1, schema);
+            fb.AddRef(2, none);
+            fb.AddRef(3, batchVec);
+            std::string footer = fb.Finish(fb.EndTable());
+            int32_t footerBytes = (int32_t)footer.size();
+            out.write(footer.data(), (std::streamsize)footer.size());
+            out.write((const char*)&footerBytes, sizeof(footerBytes));
+            out.write("ARROW1", 6);
+            return out.good();
+        }
+
+    private:
+        struct Column {
+            std::string name;
+            bool isText = false;
+            const int32_t* ints = nullptr;
+            std::vector<int32_t> ownedInts;
+            std::vector<std::string> text;
+            const RowBitmap* valid = nullptr;
+        };
+        size_t rows;
+        std::vector<Column> columns;
+        std::vector<std::pair<std::string, std::string>> meta;
+
+        FlatBuilder::Ref BuildSchema(FlatBuilder& fb) const {
+            std::vector<FlatBuilder::Ref> fields, pairs;
+            for (const Column& col : columns) {
+                FlatBuilder::Ref name = fb.String(col.name);
+                FlatBuilder::Ref children = fb.Refs({});
+                fb.StartTable(); // Int or Utf8
+                if (!col.isText) {
+                    fb.Add<int32_t>(0, 32);
+                    fb.Add<uint8_t>(1, 1);
+                }
+                FlatBuilder::Ref type = fb.EndTable();
+                fb.StartTable(); // Field
+                fb.AddRef(0, name);
+                fb.Add<uint8_t>(1, col.valid ? 1 : 0);
+                fb.Add<uint8_t>(2, col.isText ? TYPE_UTF8 : TYPE_INT);
+                fb.AddRef(3, type);
+                fb.AddRef(5, children);
+                fields.push_back(fb.EndTable());
+            }
+            for (const auto& kv : meta) {
+                FlatBuilder::Ref key = fb.String(kv.first), value = fb.String(kv.second);
+                fb.StartTable(); // KeyValue
+                fb.AddRef(0, key);
+                fb.AddRef(1, value);
+                pairs.push_back(fb.EndTable());
+            }
+            FlatBuilder::Ref fieldVec = fb.Refs(fields), metaVec = fb.Refs(pairs);
+            fb.StartTable(); // Schema (little endian is the default)
+            fb.AddRef(1, fieldVec);
+            fb.AddRef(2, metaVec);
+            return fb.EndTable();
+        }
+
+        // Encapsulated message: continuation marker, metadata size, then the Message
+        // table wrapping `header`. Returns the bytes written.
+        static uint64_t WriteMessage(std::ofstream& out, FlatBuilder& fb, uint8_t headerType, FlatBuilder::Ref header, int64_t bodyBytes) {
+            fb.StartTable(); // Message
+            fb.Add<int16_t>(0, VERSION);
+            fb.Add<uint8_t>(1, headerType);
+            fb.AddRef(2, header);
+            fb.Add<int64_t>(3, bodyBytes);
+            std::string meta = fb.Finish(fb.EndTable());
+            const int32_t prefix[2] = { -1, (int32_t)meta.size() };
+            out.write((const char*)prefix, sizeof(prefix));
+            out.write(meta.data(), (std::streamsize)meta.size());
+            return sizeof(prefix) + meta.size();
+        }
+
+        // A body buffer of `bytes` padded to 8; null `data` if the caller already wrote it
+        static void Write(std::ofstream& out, const void* data, size_t bytes) {
+            static const char zeros[8] = {};
+            if (data) out.write((const char*)data, (std::streamsize)bytes);
+            out.write(zeros, (std::streamsize)((8 - bytes % 8) % 8));
+        }
+    };
+
+    enum class Type : uint8_t { Int, Text, Other };
+
+    struct Field {
+        std::string name;
+        Type type = Type::Other;
+        int bitWidth = 0;     // Int
+        bool isSigned = true; // Int
+        bool large = false;   // Text: 64-bit offsets
+        int buffers = 2;      // Buffers per batch (validity first)
+    };
+
+    // One column of one batch, pointing into the mapped file
+    struct View {
+        const Field* field = nullptr;
+        int64_t length = 0;
+        const uint8_t* validity = nullptr; // Null: no nulls
+        const uint8_t* values = nullptr;   // Int: the numbers, Text: the offsets
+        const char* chars = nullptr;       // Text
+        uint64_t charBytes = 0;
+
+        bool Valid(int64_t i) const { return !validity || ((validity[i >> 3] >> (i & 7)) & 1); }
+
+        int64_t Int(int64_t i) const {
+            switch (field->bitWidth) {
+            case 8:  return field->isSigned ? (int64_t)Load<int8_t>(i) : (int64_t)Load<uint8_t>(i);
+            case 16: return field->isSigned ? (int64_t)Load<int16_t>(i) : (int64_t)Load<uint16_t>(i);
+            case 32: return field->isSigned ? (int64_t)Load<int32_t>(i) : (int64_t)Load<uint32_t>(i);
+            default: return Load<int64_t>(i);
+            }
+        }
+
+        // The value as text ("" if null); numbers are formatted
+        std::string Text(int64_t i) const {
+            if (!Valid(i)) return std::string();
+            if (field->type == Type::Int) return std::to_string(Int(i));
+            uint64_t begin = field->large ? Load<uint64_t>(i) : Load<uint32_t>(i);
+            uint64_t end = field->large ? Load<uint64_t>(i + 1) : Load<uint32_t>(i + 1);
+            if (begin > end || end > charBytes) return std::string();
+            return std::string(chars + begin, (size_t)(end - begin));
+        }
+
+    private:
+        template <typename T> T Load(int64_t i) const {
+            T v;
+            memcpy(&v, values + i * (int64_t)sizeof(T), sizeof(T));
+            return v;
+        }
+    };
+
+    // True if the file starts like an Arrow file
+    static bool Sniff(const wchar_t* path) {
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, path, -1, pathMB, MAX_PATH, NULL, NULL);
+        std::ifstream in(pathMB, std::ios::binary);
+        char head[6];
+        return in.read(head, sizeof(head)) && memcmp(head, "ARROW1", 6) == 0;
+    }
+
+    // Maps the file and reads its schema and batch directory; `error` says why not
+    bool Open(const wchar_t* path, std::string& error) {
+        fields.clear();
+        batches.clear();
+        meta.clear();
+        rows = 0;
+        if (!file.Open(path)) { error = "cannot read the file"; return false; }
+        const uint8_t* d = file.Data();
+        size_t size = file.Size();
+        if (size < 8 + 10 || memcmp(d, "ARROW1", 6) != 0 || memcmp(d + size - 6, "ARROW1", 6) != 0) {
+            error = "not an Arrow IPC file";
+            return false;
+        }
+        int32_t footerBytes;
+        memcpy(&footerBytes, d + size - 10, sizeof(footerBytes));
+        if (footerBytes <= 0 || (size_t)footerBytes > size - 18) { error = "damaged footer"; return false; }
+        FlatTable footer = FlatTable::Root(d + size - 10 - footerBytes, (size_t)footerBytes);
+        if (!ReadSchema(footer.Table(1), error)) return false;
+
+        size_t first, count;
+        if (footer.Vector(2, 24, first, count) && count > 0) { error = "dictionary-encoded columns are not supported"; return false; }
+        if (!footer.Vector(3, 24, first, count)) { error = "damaged footer"; return false; }
+        for (size_t k = 0; k < count; ++k) {
+            size_t at = first + 24 * k;
+            if (!ReadBatch(footer.Read<int64_t>(at), footer.Read<int32_t>(at + 8), footer.Read<int64_t>(at + 16), error)) return false;
+        }
+        return true;
+    }
+
+    size_t Rows() const { return rows; }
+    size_t Batches() const { return batches.size(); }
+    const std::vector<Field>& Fields() const { return fields; }
+
+    int Find(const std::string& name) const {
+        for (size_t i = 0; i < fields.size(); ++i) if (fields[i].name == name) return (int)i;
+        return -1;
+    }
+
+    // Schema metadata value, "" if absent
+    std::string Meta(const std::string& key) const {
+        for (const auto& kv : meta) if (kv.first == key) return kv.second;
+        return std::string();
+    }
+
+    // Column `c` of batch `b`; false for a type the views do not cover
+    bool Get(size_t b, int c, View& v) const {
+        const Batch& batch = batches[b];
+        const Field& f = fields[c];
+        if (f.type == Type::Other) return false;
+        const Span* buf = &batch.buffers[batch.firstBuffer[c]];
+        const uint8_t* body = file.Data() + batch.body;
+        v = View();
+        v.field = &f;
+        v.length = batch.length;
+        if (batch.nulls[c] > 0) {
+            if (buf[0].length < (uint64_t)(batch.length + 7) / 8) return false;
+            v.validity = body + buf[0].offset;
+        }
+        uint64_t width = f.type == Type::Int ? (uint64_t)f.bitWidth / 8 : (f.large ? 8 : 4);
+        uint64_t entries = f.type == Type::Int ? (uint64_t)batch.length : (uint64_t)batch.length + 1;
+        if (batch.length > 0 && buf[1].length < entries * width) return false;
+        v.values = body + buf[1].offset;
+        if (f.type == Type::Text) {
+            v.chars = (const char*)body + buf[2].offset;
+            v.charBytes = buf[2].length;
+        }
+        return true;
+    }
+
+private:
+    static const int16_t VERSION = 4; // MetadataVersion V5
+    enum : uint8_t { TYPE_INT = 2, TYPE_BINARY = 4, TYPE_UTF8 = 5, TYPE_LARGE_BINARY = 19, TYPE_LARGE_UTF8 = 20 };
+
+    struct Span { uint64_t offset, length; }; // Relative to the batch body
+    struct Batch {
+        int64_t length = 0;
+        uint64_t body = 0; // File offset
+        std::vector<Span> buffers;
+        std::vector<int64_t> nulls;
+        std::vector<size_t> firstBuffer; // Per field
+    };
+
+    MappedFile file;
+    std::vector<Field> fields;
+    std::vector<Batch> batches;
+    std::vector<std::pair<std::string, std::string>> meta;
+    size_t rows = 0;
+
+    bool ReadSchema(const FlatTable& schema, std::string& error) {
+        size_t first, count;
+        if (!schema.Present() || !schema.Vector(1, 4, first, count)) { error = "damaged schema"; return false; }
+        if (schema.Scalar<int16_t>(0, 0) != 0) { error = "big-endian files are not supported"; return false; }
+        for (size_t i = 0; i < count; ++i) {
+            FlatTable ft = schema.Follow(first + 4 * i);
+            Field f;
+            f.name = ft.String(0);
+            size_t cf, cc;
+            if (ft.Table(4).Present()) { error = "dictionary-encoded column '" + f.name + "'"; return false; }
+            if (ft.Vector(5, 4, cf, cc) && cc > 0) { error = "nested column '" + f.name + "'"; return false; }
+            FlatTable type = ft.Table(3);
+            switch (ft.Scalar<uint8_t>(2, 0)) {
+            case TYPE_INT:
+                f.type = Type::Int;
+                f.bitWidth = type.Scalar<int32_t>(0, 0);
+                f.isSigned = type.Scalar<uint8_t>(1, 0) != 0;
+                if (f.bitWidth != 8 && f.bitWidth != 16 && f.bitWidth != 32 && f.bitWidth != 64) { error = "bad integer width"; return false; }
+                break;
+            case TYPE_BINARY: case TYPE_UTF8: case TYPE_LARGE_BINARY: case TYPE_LARGE_UTF8: {
+                uint8_t t = ft.Scalar<uint8_t>(2, 0);
+                f.type = Type::Text;
+                f.large = t == TYPE_LARGE_BINARY || t == TYPE_LARGE_UTF8;
+                f.buffers = 3;
+                break;
+            }
+            case 3: case 6: case 7: case 8: case 9: case 10: case 11: case 15: case 18:
+                break; // Float, Bool, Decimal, Date, Time, Timestamp, Interval, FixedSizeBinary, Duration: skipped
+            default:
+                error = "unsupported type of column '" + f.name + "'";
+                return false;
+            }
+            fields.push_back(std::move(f));
+        }
+        if (schema.Vector(2, 4, first, count)) {
+            for (size_t i = 0; i < count; ++i) {
+                FlatTable kv = schema.Follow(first + 4 * i);
+                meta.emplace_back(kv.String(0), kv.String(1));
+            }
+        }
+        return true;
+    }
+
+    bool ReadBatch(int64_t offset, int32_t metaBytes, int64_t bodyBytes, std::string& error) {
+        const uint8_t* d = file.Data();
+        uint64_t size = file.Size();
+        error = "damaged record batch";
+        if (offset < 0 || metaBytes < 8 || bodyBytes < 0 || (uint64_t)offset + (uint64_t)metaBytes > size ||
+            (uint64_t)bodyBytes > size - (uint64_t)offset - (uint64_t)metaBytes) return false;
+        int32_t word;
+        memcpy(&word, d + offset, 4);
+        size_t skip = word == -1 ? 8 : 4; // Files before format 0.15 have no continuation marker
+        FlatTable msg = FlatTable::Root(d + offset + skip, (size_t)metaBytes - skip);
+        if (msg.Scalar<uint8_t>(1, 0) != 3) return false;
+        FlatTable rb = msg.Table(2);
+        if (rb.Table(3).Present()) { error = "compressed files are not supported"; return false; }
+
+        Batch batch;
+        batch.length = rb.Scalar<int64_t>(0, 0);
+        batch.body = (uint64_t)offset + (uint64_t)metaBytes;
+        size_t nodeFirst, nodeCount, bufFirst, bufCount;
+        if (batch.length < 0 || !rb.Vector(1, 16, nodeFirst, nodeCount) || !rb.Vector(2, 16, bufFirst, bufCount) ||
+            nodeCount != fields.size()) return false;
+        size_t need = 0;
+        for (const Field& f : fields) {
+            batch.firstBuffer.push_back(need);
+            need += (size_t)f.buffers;
+        }
+        if (bufCount != need) return false;
+        for (size_t i = 0; i < nodeCount; ++i) {
+            if (rb.Read<int64_t>(nodeFirst + 16 * i) != batch.length) return false;
+            batch.nulls.push_back(rb.Read<int64_t>(nodeFirst + 16 * i + 8));
+        }
+        for (size_t i = 0; i < bufCount; ++i) {
+            Span s{ rb.Read<uint64_t>(bufFirst + 16 * i), rb.Read<uint64_t>(bufFirst + 16 * i + 8) };
+            if (s.offset > (uint64_t)bodyBytes || s.length > (uint64_t)bodyBytes - s.offset) return false;
+            batch.buffers.push_back(s);
+        }
+        rows += (size_t)batch.length;
+        batches.push_back(std::move(batch));
+        error.clear();
+        return true;
+    }
+};
+
+// The SQLite calls SqliteStore uses, resolved on first use from sqlite3.dll next to the
+// program or, in 64-bit builds, the winsqlite3.dll that ships with Windows 10 (its
+// 32-bit build uses another calling convention). With neither, SQLite files do not open
+// and everything else works as before.
+struct sqlite3;
+struct sqlite3_stmt;
+
+class SqliteApi {
+public:
+    enum { OK = 0, ROW = 100, DONE = 101, OPEN_READWRITE = 2, OPEN_CREATE = 4 };
+
+    int (*open_v2)(const char*, sqlite3**, int, const char*) = nullptr;
+    int (*close)(sqlite3*) = nullptr;
+    int (*exec)(sqlite3*, const char*, int (*)(void*, int, char**, char**), void*, char**) = nullptr;
+    int (*busy_timeout)(sqlite3*, int) = nullptr;
+    const char* (*errmsg)(sqlite3*) = nullptr;
+    int (*prepare_v2)(sqlite3*, const char*, int, sqlite3_stmt**, const char**) = nullptr;
+    int (*step)(sqlite3_stmt*) = nullptr;
+    int (*reset)(sqlite3_stmt*) = nullptr;
+    int (*finalize)(sqlite3_stmt*) = nullptr;
+    int (*bind_int64)(sqlite3_stmt*, int, long long) = nullptr;
+    int (*bind_text)(sqlite3_stmt*, int, const char*, int, void (*)(void*)) = nullptr;
+    int (*bind_null)(sqlite3_stmt*, int) = nullptr;
+    long long (*column_int64)(sqlite3_stmt*, int) = nullptr;
+    const unsigned char* (*column_text)(sqlite3_stmt*, int) = nullptr;
+    int (*column_bytes)(sqlite3_stmt*, int) = nullptr;
+
+    // Null if no SQLite library could be loaded
+    static const SqliteApi* Get() {
+        static const SqliteApi api = Load();
+        return api.close ? &api : nullptr;
+    }
+
+    // True if the file starts like a SQLite database (no library needed)
+    static bool Sniff(const wchar_t* path) {
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, path, -1, pathMB, MAX_PATH, NULL, NULL);
+        std::ifstream in(pathMB, std::ios::binary);
+        char head[16];
+        return in.read(head, sizeof(head)) && memcmp(head, "SQLite format 3", 16) == 0;
+    }
+
+private:
+    static SqliteApi Load() {
+        SqliteApi api;
+        HMODULE dll = LoadLibraryW(L"sqlite3.dll");
+#ifdef _WIN64
+        if (!dll) dll = LoadLibraryW(L"winsqlite3.dll");
+#endif
+        if (!dll) return api;
+        bool ok = Resolve(dll, api.open_v2, "sqlite3_open_v2") && Resolve(dll, api.exec, "sqlite3_exec") &&
+                  Resolve(dll, api.busy_timeout, "sqlite3_busy_timeout") && Resolve(dll, api.errmsg, "sqlite3_errmsg") &&
+                  Resolve(dll, api.prepare_v2, "sqlite3_prepare_v2") && Resolve(dll, api.step, "sqlite3_step") &&
+                  Resolve(dll, api.reset, "sqlite3_reset") && Resolve(dll, api.finalize, "sqlite3_finalize") &&
+                  Resolve(dll, api.bind_int64, "sqlite3_bind_int64") && Resolve(dll, api.bind_text, "sqlite3_bind_text") &&
+                  Resolve(dll, api.bind_null, "sqlite3_bind_null") && Resolve(dll, api.column_int64, "sqlite3_column_int64") &&
+                  Resolve(dll, api.column_text, "sqlite3_column_text") && Resolve(dll, api.column_bytes, "sqlite3_column_bytes");
+        // close last: Get() takes it as the sign that every entry resolved
+        if (!ok || !Resolve(dll, api.close, "sqlite3_close")) api.close = nullptr;
+        return api;
+    }
+
+    template <typename Fn>
+    static bool Resolve(HMODULE dll, Fn& fn, const char* name) {
+        fn = (Fn)GetProcAddress(dll, name);
+        return fn != nullptr;
+    }
+};
+
+class DataModel {
+public:
+    static constexpr const char* CORE_HEADER = "ID,Name,Role,Gender,FatherID,MotherID,SpouseID";
+
+    std::vector<Person> people;
+    std::map<int, size_t> idMap;
+    AttributeTable attrs; // Extra CSV columns, one row per entry of people
+    std::string header;   // Header line as read, kept for rewriting the file
+    std::string loadError; // Why LoadFromFile came out empty, where the reader can tell (Arrow)
+
+    // Child and spouse adjacency over dense indices, rebuilt after every load. Spouse
+    // links go both ways (a link may be listed on one side only).
+    PackedLists children;
+    PackedLists spouseLinks;
+
+    // Parts of a columnar archive LoadArchive can read; IDs are always read
+    enum ArchivePart : unsigned {
+        ArchiveGraph = 1,  // Parents and spouses
+        ArchiveNames = 2,
+        ArchiveRoles = 4,
+        ArchiveGender = 8,
+        ArchiveExtras = 16, // Columns beyond the core 7
+        ArchiveAll = 31
+    };
+
+    enum class FileFormat { Csv, Columns, Arrow, Sqlite };
+
+    // Told apart by the first bytes, whatever the file is called
+    static FileFormat FormatOf(const wchar_t* filename) {
+        if (ColumnFile::Sniff(filename)) return FileFormat::Columns;
+        if (ArrowFile::Sniff(filename)) return FileFormat::Arrow;
+        if (SqliteApi::Sniff(filename)) return FileFormat::Sqlite;
+        return FileFormat::Csv;
+    }
+
+    // Reads the CSV, or a columnar archive (ColumnFile) or Arrow file if the file is one.
+    // A SQLite database is read through a SqliteStore, which keeps its connection for
+    // incremental reloads; here it loads as empty. `cancel` is polled while CSV rows are
+    // read; a cancelled load leaves the model half built, for the caller to discard.
+    void LoadFromFile(const wchar_t* filename, const CancelToken* cancel = nullptr) {
+        loadError.clear();
+        switch (FormatOf(filename)) {
+        case FileFormat::Columns: LoadArchive(filename); return;
+        case FileFormat::Arrow: LoadArrow(filename); return;
+        case FileFormat::Sqlite: Assign(std::string(), {}, {}); return;
+        case FileFormat::Csv: break;
+        }
+        people.clear();
+        idMap.clear();
+        attrs.Clear();
+        header.clear();
+        children.Clear();
+        spouseLinks.Clear();
+
+        char fNameMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, filename, -1, fNameMB, MAX_PATH, NULL, NULL);
+
+        std::ifstream file(fNameMB);
+        if (!file.is_open()) return;
+
+        // Skip BOM if present
+        if (file.peek() == 0xEF) { file.get(); file.get(); file.get(); }
+
+        std::string line;
+        std::getline(file, line); // Header: the 7 core columns are positional, extras by name
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        SetHeader(line);
+
+        std::vector<std::string> parts(7);
+        size_t lines = 0;
+        while (AttributeTable::ReadRecord(file, line)) {
+            if (cancel && (++lines & 0xFFF) == 0 && cancel->Cancelled()) return;
+            if (line.empty()) continue;
+            if (line.back() == '\r') line.pop_back();
+
+            // Only the core columns are split here; the rest is kept raw for the attribute table
+            size_t pos = 0;
+            int got = 0;
+            while (got < 7 && pos != std::string::npos) pos = AttributeTable::NextField(line, pos, parts[got++]);
+
+            Person p;
+            if (got == 7 && ParseRecord(parts, p)) {
+                people.push_back(p);
+                attrs.AddRow(pos == std::string::npos ? std::string() : line.substr(pos));
+            }
+        }
+        FinishLoad(cancel);
+    }
+
+    // Loads only the `parts` wanted from a columnar archive, and only the people with an
+    // ID in [idLo, idHi]: other columns and ID chunks outside the range are never read.
+    // Links to people left out stay unresolved, as with Subset.
+    void LoadArchive(const wchar_t* filename, unsigned parts = ArchiveAll, int idLo = INT_MIN, int idHi = INT_MAX) {
+        people.clear();
+        idMap.clear();
+        attrs.Clear();
+        header.clear();
+        children.Clear();
+        spouseLinks.Clear();
+
+        ColumnFile file;
+        if (!file.Open(filename)) return;
+        std::vector<char> want = file.ChunksInRange("id", idLo, idHi);
+        std::vector<int64_t> ids, fathers, mothers, spouses;
+        std::vector<uint32_t> spouseStart;
+        std::vector<std::string> names, roles, genders, extras;
+        bool ok = file.ReadInts("id", ids, nullptr, &want);
+        if (parts & ArchiveGraph) {
+            ok = ok && file.ReadInts("father", fathers, nullptr, &want) && file.ReadInts("mother", mothers, nullptr, &want) &&
+                 file.ReadLists("spouses", spouseStart, spouses, &want);
+        }
+        if (parts & ArchiveNames) ok = ok && file.ReadText("name", names, &want);
+        if (parts & ArchiveRoles) ok = ok && file.ReadText("role", roles, &want);
+        if (parts & ArchiveGender) ok = ok && file.ReadText("gender", genders, &want);
+        if (parts & ArchiveExtras) ok = ok && file.ReadText("extra", extras, &want);
+        if (!ok) return;
+
+        if (parts & ArchiveExtras) SetHeader(file.Meta());
+        else header = file.Meta();
+        for (size_t r = 0; r < ids.size(); ++r) {
+            if (ids[r] < idLo || ids[r] > idHi) continue;
+            Person p;
+            p.id = (int)ids[r];
+            if (parts & ArchiveGraph) {
+                p.fatherId = (int)fathers[r];
+                p.motherId = (int)mothers[r];
+                for (uint32_t k = spouseStart[r]; k < spouseStart[r + 1]; ++k) { // ID * 2 + ex
+                    int sid = (int)(spouses[k] >> 1);
+                    p.spouses.push_back(sid);
+                    if (spouses[k] & 1) p.spouses.SetEx(sid, true);
+                }
+            }
+            if (parts & ArchiveNames) p.name = ToWString(names[r]);
+            if (parts & ArchiveRoles) p.role = ToWString(roles[r]);
+            if (parts & ArchiveGender) p.gender = ToWString(genders[r]);
+            people.push_back(std::move(p));
+            attrs.AddRow((parts & ArchiveExtras) ? extras[r] : std::string());
+        }
+        FinishLoad();
+    }
+
+    // Encodes `people` and their extra columns for a columnar archive; the caller may add
+    // columns of its own (layout coordinates) before saving
+    static ColumnFile::Writer ArchiveWriter(const std::string& header, const PersonVersion& people, const AttributeTable& attrs) {
+        size_t n = people.Size();
+        ColumnFile::Writer w(n);
+        w.SetMeta(header.empty() ? std::string(CORE_HEADER) : header);
+        std::vector<int64_t> values(n);
+        for (size_t i = 0; i < n; ++i) values[i] = people[i].id;
+        w.AddInts("id", values);
+        for (size_t i = 0; i < n; ++i) values[i] = people[i].fatherId;
+        w.AddInts("father", values);
+        for (size_t i = 0; i < n; ++i) values[i] = people[i].motherId;
+        w.AddInts("mother", values);
+
+        std::vector<uint32_t> start(1, 0);
+        std::vector<int64_t> spouses;
+        for (size_t i = 0; i < n; ++i) {
+            for (int sid : people[i].spouses) spouses.push_back((int64_t)sid * 2 + (people[i].spouses.IsEx(sid) ? 1 : 0));
+            start.push_back((uint32_t)spouses.size());
+        }
+        w.AddLists("spouses", start, spouses);
+
+        std::vector<std::string> text(n);
+        for (size_t i = 0; i < n; ++i) text[i] = ToUtf8(people[i].name);
+        w.AddText("name", text);
+        for (size_t i = 0; i < n; ++i) text[i] = ToUtf8(people[i].role);
+        w.AddText("role", text);
+        for (size_t i = 0; i < n; ++i) text[i] = ToUtf8(people[i].gender);
+        w.AddText("gender", text);
+        for (size_t i = 0; i < n; ++i) text[i] = i < attrs.RowCount() ? attrs.Tail(i) : std::string();
+        w.AddText("extra", text);
+        return w;
+    }
+
+    // Person table from an Arrow file, ours or an analytics tool's. Columns are matched by
+    // name: id (required), name, role, gender, father, mother and spouses (CSV notation),
+    // numbers of any width or as text. The layout columns (x, y, gen, root) are left out;
+    // any other column becomes an extra column.
+    void LoadArrow(const wchar_t* filename) {
+        people.clear();
+        idMap.clear();
+        attrs.Clear();
+        header.clear();
+        children.Clear();
+        spouseLinks.Clear();
+
+        ArrowFile file;
+        std::string error;
+        if (!file.Open(filename, error)) { loadError = "cannot read the Arrow file (" + error + ")"; return; }
+        static const char* const core[7] = { "id", "name", "role", "gender", "father", "mother", "spouses" };
+        int coreCol[7];
+        for (int k = 0; k < 7; ++k) coreCol[k] = file.Find(core[k]);
+        if (coreCol[0] < 0 || file.Fields()[coreCol[0]].type == ArrowFile::Type::Other) {
+            loadError = "the Arrow file has no usable 'id' column";
+            return;
+        }
+
+        const auto& fields = file.Fields();
+        std::vector<int> extraCol;
+        std::string names = CORE_HEADER;
+        for (size_t c = 0; c < fields.size(); ++c) {
+            const std::string& name = fields[c].name;
+            if (fields[c].type == ArrowFile::Type::Other || std::find(core, core + 7, name) != core + 7 ||
+                name == "x" || name == "y" || name == "gen" || name == "root") continue;
+            extraCol.push_back((int)c);
+            names += ',' + AttributeTable::QuoteField(name);
+        }
+        // Our own files carry the CSV header (its core column names included)
+        std::string saved = file.Meta("csv_header");
+        SetHeader(saved);
+        bool sameExtras = attrs.ColumnCount() == extraCol.size();
+        for (size_t e = 0; sameExtras && e < extraCol.size(); ++e)
+            sameExtras = attrs.Name((int)e) == AttributeTable::Lower(fields[extraCol[e]].name);
+        if (saved.empty() || !sameExtras) SetHeader(names);
+
+        auto number = [](const ArrowFile::View& v, int64_t r) {
+            if (!v.Valid(r)) return 0;
+            return v.field->type == ArrowFile::Type::Int ? (int)v.Int(r) : std::atoi(v.Text(r).c_str());
+        };
+        ArrowFile::View coreView[7];
+        std::vector<ArrowFile::View> extraView(extraCol.size());
+        std::vector<char> extraHave(extraCol.size());
+        for (size_t b = 0; b < file.Batches(); ++b) {
+            bool have[7];
+            for (int k = 0; k < 7; ++k) have[k] = coreCol[k] >= 0 && file.Get(b, coreCol[k], coreView[k]);
+            if (!have[0]) continue;
+            for (size_t e = 0; e < extraCol.size(); ++e) extraHave[e] = file.Get(b, extraCol[e], extraView[e]);
+
+            for (int64_t r = 0; r < coreView[0].length; ++r) {
+                if (!coreView[0].Valid(r)) continue;
+                Person p;
+                p.id = number(coreView[0], r);
+                if (have[1]) p.name = ToWString(coreView[1].Text(r));
+                if (have[2]) p.role = ToWString(coreView[2].Text(r));
+                if (have[3]) p.gender = ToWString(coreView[3].Text(r));
+                if (have[4]) p.fatherId = number(coreView[4], r);
+                if (have[5]) p.motherId = number(coreView[5], r);
+                if (have[6]) ParseSpouses(coreView[6].Text(r), p);
+
+                std::string tail; // Left empty when every cell is, like a row added in-app
+                bool anyExtra = false;
+                for (size_t e = 0; e < extraCol.size(); ++e) {
+                    std::string text = extraHave[e] ? extraView[e].Text(r) : std::string();
+                    anyExtra |= !text.empty();
+                    if (e) tail += ',';
+                    tail += AttributeTable::QuoteField(text);
+                }
+                if (!anyExtra) tail.clear();
+                people.push_back(std::move(p));
+                attrs.AddRow(tail);
+            }
+        }
+        FinishLoad();
+    }
+
+    // The person table for an Arrow file (see ArrowFile): the core columns with spouses in
+    // the CSV notation, then one text column per extra CSV column under its header name.
+    // The caller may add columns of its own (layout results) before saving.
+    static ArrowFile::Writer ArrowWriter(const std::string& header, const PersonVersion& people, const AttributeTable& attrs) {
+        size_t n = people.Size();
+        ArrowFile::Writer w(n);
+        std::string line = header.empty() ? std::string(CORE_HEADER) : header;
+        w.SetMeta("csv_header", line);
+        std::vector<int32_t> ids(n), fathers(n), mothers(n);
+        std::vector<std::string> names(n), roles(n), genders(n), spouses(n);
+        for (size_t i = 0; i < n; ++i) {
+            const Person& p = people[i];
+            ids[i] = p.id;
+            fathers[i] = p.fatherId;
+            mothers[i] = p.motherId;
+            names[i] = ToUtf8(p.name);
+            roles[i] = ToUtf8(p.role);
+            genders[i] = ToUtf8(p.gender);
+            spouses[i] = SpouseField(p);
+        }
+        w.AddInt32("id", std::move(ids));
+        w.AddUtf8("name", std::move(names));
+        w.AddUtf8("role", std::move(roles));
+        w.AddUtf8("gender", std::move(genders));
+        w.AddInt32("father", std::move(fathers));
+        w.AddInt32("mother", std::move(mothers));
+        w.AddUtf8("spouses", std::move(spouses));
+
+        std::vector<std::string> extraNames;
+        std::string field;
+        for (size_t pos = 0, c = 0; pos != std::string::npos; ++c) {
+            pos = AttributeTable::NextField(line, pos, field);
+            if (c >= 7) extraNames.push_back(field);
+        }
+        std::vector<std::vector<std::string>> extras(extraNames.size(), std::vector<std::string>(n));
+        for (size_t i = 0; i < n && i < attrs.RowCount(); ++i) {
+            std::string tail = attrs.Tail(i);
+            for (size_t pos = 0, c = 0; !tail.empty() && pos != std::string::npos && c < extras.size(); ++c)
+                pos = AttributeTable::NextField(tail, pos, extras[c][i]);
+        }
+        for (size_t c = 0; c < extras.size(); ++c) w.AddUtf8(extraNames[c], std::move(extras[c]));
+        return w;
+    }
+
+    // Applies an edit journal (see EditJournal) on top of the loaded rows. Returns the
+    // number of records read; a torn last record (no newline) is ignored. A record may
+    // span lines where a name holds a line break.
+    size_t ReplayJournal(const wchar_t* filename) {
+        char fNameMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, filename, -1, fNameMB, MAX_PATH, NULL, NULL);
+        std::ifstream file(fNameMB, std::ios::binary);
+        if (!file.is_open()) return 0;
+
+        size_t records = 0, rows = people.size();
+        std::vector<char> alive(rows, 1);
+        std::vector<std::string> parts(7);
+        std::string line, kind;
+        while (AttributeTable::ReadRecord(file, line)) {
+            if (file.eof()) break;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t pos = AttributeTable::NextField(line, 0, kind);
+            if (pos == std::string::npos) continue;
+            ++records;
+
+            if (kind == "D") {
+                auto it = idMap.find(std::atoi(line.c_str() + pos));
+                if (it == idMap.end()) continue;
+                alive[it->second] = 0;
+                idMap.erase(it);
+                continue;
+            }
+            int got = 0;
+            while (got < 7 && pos != std::string::npos) pos = AttributeTable::NextField(line, pos, parts[got++]);
+            Person p;
+            if (kind != "U" || got != 7 || !ParseRecord(parts, p)) continue;
+
+            auto it = idMap.find(p.id);
+            if (it == idMap.end()) {
+                idMap[p.id] = people.size();
+                people.push_back(p);
+                alive.push_back(1);
+            } else {
+                Person& q = people[it->second]; // Years stay with the CSV columns
+                q.name = p.name; q.role = p.role; q.gender = p.gender;
+                q.fatherId = p.fatherId; q.motherId = p.motherId;
+                q.spouses = p.spouses;
+            }
+        }
+
+        if (people.size() != rows || std::find(alive.begin(), alive.end(), 0) != alive.end()) {
+            attrs.Resize(people.size()); // People added in-app have no extra columns
+            RowBitmap keep(people.size());
+            for (size_t i = 0; i < people.size(); ++i) if (alive[i]) keep.Set(i);
+            if (keep.Count() != people.size()) {
+                attrs = attrs.Subset(keep);
+                size_t o = 0;
+                for (size_t i = 0; i < people.size(); ++i) {
+                    if (!alive[i]) continue;
+                    if (o != i) people[o] = std::move(people[i]);
+                    ++o;
+                }
+                people.resize(o);
+            }
+            idMap.clear();
+            for (size_t i = 0; i < people.size(); ++i) idMap[people[i].id] = i;
+        }
+        BuildIndices();
+        return records;
+    }
+
+    // Replaces the model with `rows`, `tails` holding each row's extra columns as CSV text
+    void Assign(const std::string& headerLine, std::vector<Person> rows, const std::vector<std::string>& tails) {
+        people = std::move(rows);
+        idMap.clear();
+        attrs.Clear();
+        SetHeader(headerLine);
+        for (size_t i = 0; i < people.size(); ++i) attrs.AddRow(i < tails.size() ? tails[i] : std::string());
+        FinishLoad();
+    }
+
+    // Drops the people in `dropIds`, then overwrites or appends `rows` (extra columns and
+    // years included); the order of the rows kept does not change
+    void ApplyRows(const std::vector<int>& dropIds, std::vector<Person> rows, const std::vector<std::string>& tails) {
+        std::vector<size_t> dead;
+        for (int id : dropIds) {
+            auto it = idMap.find(id);
+            if (it == idMap.end()) continue;
+            dead.push_back(it->second);
+            idMap.erase(it);
+        }
+        std::vector<std::pair<size_t, std::string>> changed;
+        for (size_t k = 0; k < rows.size(); ++k) {
+            auto it = idMap.find(rows[k].id);
+            size_t i = it != idMap.end() ? it->second : people.size();
+            if (i == people.size()) {
+                idMap[rows[k].id] = i;
+                people.push_back(Person());
+            }
+            people[i] = std::move(rows[k]);
+            changed.emplace_back(i, tails[k]);
+        }
+        std::sort(changed.begin(), changed.end());
+        attrs.SetRows(changed);
+        attrs.Resize(people.size());
+
+        if (!dead.empty()) {
+            RowBitmap keep(people.size(), true);
+            for (size_t i : dead) keep.Reset(i);
+            attrs = attrs.Subset(keep);
+            size_t o = 0;
+            for (size_t i = 0; i < people.size(); ++i) {
+                if (!keep.Test(i)) continue;
+                if (o != i) people[o] = std::move(people[i]);
+                ++o;
+            }
+            people.resize(o);
+            idMap.clear();
+        }
+        FinishLoad();
+    }
+
+    // The 7 core CSV columns of a person, in the form LoadFromFile reads them
+    static std::string FormatRecord(const Person& p) {
+        return std::to_string(p.id) + ',' + AttributeTable::QuoteField(ToUtf8(p.name)) + ',' +
+               AttributeTable::QuoteField(ToUtf8(p.role)) + ',' + AttributeTable::QuoteField(ToUtf8(p.gender)) + ',' +
+               std::to_string(p.fatherId) + ',' + std::to_string(p.motherId) + ',' + SpouseField(p);
+    }
+
+    // The spouse column, e.g. "2x|3" ("0" for none)
+    static std::string SpouseField(const Person& p) {
+        std::string spouses;
+        for (int sid : p.spouses) {
+            if (!spouses.empty()) spouses += '|';
+            spouses += std::to_string(sid);
+            if (p.spouses.IsEx(sid)) spouses += 'x';
+        }
+        return spouses.empty() ? std::string("0") : spouses;
+    }
+
+    // Parse Spouses (e.g., "2x|3")
+    static void ParseSpouses(const std::string& field, Person& p) {
+        std::stringstream ssSpouse(field);
+        std::string sId;
+        while(std::getline(ssSpouse, sId, '|')) {
+            bool isEx = false;
+            if (!sId.empty() && (sId.back() == 'x' || sId.back() == 'X')) {
+                isEx = true;
+                sId.pop_back();
+            }
+            try {
+                int id = std::stoi(sId);
+                if (id != 0) {
+                    p.spouses.push_back(id);
+                    if (isEx) p.spouses.SetEx(id, true);
+                }
+            } catch(...) {}
+        }
+    }
+
+    int IndexOf(int id) const {
+        auto it = idMap.find(id);
+        return (it != idMap.end()) ? (int)it->second : -1;
+    }
+
+    PackedLists::Span Children(int idx) const { return children[idx]; }
+    PackedLists::Span Spouses(int idx) const { return spouseLinks[idx]; }
+
+    // Years of the optional Birth/Death columns per person, 0 if unknown. Read through the
+    // attribute table when asked (the timeline), so loading never splits those columns.
+    std::vector<int> BirthYears() const { return ColumnYears(attrs.FindAny({"birth", "birthdate", "born"})); }
+    std::vector<int> DeathYears() const { return ColumnYears(attrs.FindAny({"death", "deathdate", "died"})); }
+
+    // One core text field of every row, lowercased and dictionary-coded like a text
+    // attribute column: what the filter compares against. Built on first use after a
+    // load or an edit, by the thread that owns the model.
+    enum class CoreText : unsigned char { Name, Role, Gender };
+    struct LoweredColumn {
+        std::vector<uint32_t> codes;    // Index into dict, per row
+        std::vector<std::wstring> dict; // Distinct lowered values in first-seen order
+    };
+    const LoweredColumn& Lowered(CoreText field) const {
+        std::shared_ptr<const LoweredColumn>& slot = lowered[(int)field];
+        if (!slot) {
+            auto col = std::make_shared<LoweredColumn>();
+            std::unordered_map<std::wstring, uint32_t> seen;
+            col->codes.resize(people.size());
+            for (size_t i = 0; i < people.size(); ++i) {
+                const Person& p = people[i];
+                auto it = seen.emplace(AttributeTable::LowerW(field == CoreText::Name ? p.name
+                                                             : field == CoreText::Role ? p.role : p.gender),
+                                       (uint32_t)col->dict.size());
+                if (it.second) col->dict.push_back(it.first->first);
+                col->codes[i] = it.first->second;
+            }
+            slot = std::move(col);
+        }
+        return *slot;
+    }
+
+    // Approximate bytes held by each part of the model (extra columns not included)
+    struct Footprint { size_t records = 0, text = 0, spouseLists = 0, adjacency = 0, idIndex = 0; };
+    Footprint MemoryFootprint() const {
+        Footprint f;
+        f.records = people.capacity() * sizeof(Person);
+        const size_t inlineChars = std::wstring().capacity();
+        auto heap = [&](const std::wstring& s) { return s.capacity() > inlineChars ? (s.capacity() + 1) * sizeof(wchar_t) : 0; };
+        for (const Person& p : people) {
+            f.text += heap(p.name) + heap(p.role) + heap(p.gender);
+            f.spouseLists += p.spouses.HeapBytes();
+        }
+        f.adjacency = children.Bytes() + spouseLinks.Bytes();
+        f.idIndex = idMap.size() * (sizeof(std::pair<const int, size_t>) + 4 * sizeof(void*)); // Tree node: 3 links + color
+        return f;
+    }
+
+    Person* Get(int id) {
+        auto it = idMap.find(id);
+        if (it != idMap.end()) return &people[it->second];
+        return nullptr;
+    }
+
+    const Person* Get(int id) const {
+        auto it = idMap.find(id);
+        return (it != idMap.end()) ? &people[it->second] : nullptr;
+    }
+
+    // Copy holding only the people set in `keep`; links to dropped people disappear
+    DataModel Subset(const RowBitmap& keep) const {
+        DataModel out;
+        out.attrs = attrs.Subset(keep);
+        for (size_t i = 0; i < people.size(); ++i) if (keep.Test(i)) out.people.push_back(people[i]);
+        for (size_t i = 0; i < out.people.size(); ++i) out.idMap[out.people[i].id] = i;
+        out.BuildIndices();
+        return out;
+    }
+
+    // Reorders people so that a family sits together in memory: each family tree depth
+    // first from its root, a person's children in one block followed by the people who
+    // married into that block. Traversals then walk mostly forward through `people`
+    // instead of hopping across the file. IDs are untouched; the dense indices change,
+    // and so does the row order the CSV is rewritten in after in-app edits.
+    void Renumber() {
+        const size_t n = people.size();
+        std::vector<int> order, stack, block;
+        order.reserve(n);
+        std::vector<char> taken(n, 0);
+        auto isRoot = [&](int i) { return people[i].fatherIdx < 0 && people[i].motherIdx < 0; };
+        auto take = [&](int i) { taken[i] = 1; order.push_back(i); block.push_back(i); };
+        auto takeMarriedIn = [&] {
+            for (size_t k = 0, end = block.size(); k < end; ++k)
+                for (int s : Spouses(block[k])) if (!taken[s] && isRoot(s)) take(s);
+        };
+
+        for (size_t r = 0; r < n; ++r) {
+            if (taken[r] || !isRoot((int)r)) continue;
+            block.clear();
+            take((int)r);
+            takeMarriedIn();
+            stack.assign(block.rbegin(), block.rend());
+            while (!stack.empty()) {
+                int u = stack.back();
+                stack.pop_back();
+                block.clear();
+                for (int c : Children(u)) if (!taken[c]) take(c);
+                if (block.empty()) continue;
+                takeMarriedIn();
+                stack.insert(stack.end(), block.rbegin(), block.rend());
+            }
+        }
+        for (size_t i = 0; i < n; ++i) if (!taken[i]) order.push_back((int)i); // Parent cycles
+
+        // Everything already resolved is carried over through the inverse permutation
+        std::vector<int> newIdx(n);
+        for (size_t i = 0; i < n; ++i) newIdx[order[i]] = (int)i;
+        std::vector<int> spouseStart(1, 0), spouseList;
+        for (size_t i = 0; i < n; ++i) {
+            for (int s : Spouses(order[i])) spouseList.push_back(newIdx[s]);
+            std::sort(spouseList.begin() + spouseStart.back(), spouseList.end());
+            spouseStart.push_back((int)spouseList.size());
+        }
+        spouseLinks.Build(spouseStart, spouseList);
+
+        std::vector<Person> moved(n);
+        for (size_t i = 0; i < n; ++i) {
+            moved[i] = std::move(people[order[i]]);
+            if (moved[i].fatherIdx >= 0) moved[i].fatherIdx = newIdx[moved[i].fatherIdx];
+            if (moved[i].motherIdx >= 0) moved[i].motherIdx = newIdx[moved[i].motherIdx];
+        }
+        people.swap(moved);
+        attrs = attrs.Permute(order);
+        for (auto& entry : idMap) entry.second = newIdx[entry.second];
+        for (auto& entry : dangling) for (int& k : entry.second) if ((size_t)k < n) k = newIdx[k];
+        for (auto& col : lowered) col.reset();
+        BuildChildren();
+    }
+
+    // Brings the model from version `from` (which it currently matches) to `to`. Only the
+    // differing records are copied, and only their entries in the ID map, the parent
+    // indices and both adjacency lists are patched, along with the people whose links
+    // they make or break (someone listing an ID that appears or disappears).
+    ModelDiff Apply(const PersonVersion& from, const PersonVersion& to) {
+        ModelDiff d;
+        PersonVersion::Diff(from, to, d.changed);
+        auto touch = [&](const Person& p) {
+            d.touchedIds.push_back(p.id);
+            if (p.fatherId != 0) d.touchedIds.push_back(p.fatherId);
+            if (p.motherId != 0) d.touchedIds.push_back(p.motherId);
+            d.touchedIds.insert(d.touchedIds.end(), p.spouses.begin(), p.spouses.end());
+        };
+        for (int i : d.changed) {
+            if ((size_t)i < from.Size()) touch(from[i]);
+            if ((size_t)i < to.Size()) touch(to[i]);
+        }
+        for (size_t i = to.Size(); i < from.Size(); ++i) d.droppedIds.push_back(from[i].id);
+
+        const size_t oldN = people.size(), newN = to.Size();
+        auto idAt = [&](const PersonVersion& v, int i) { return (size_t)i < v.Size() ? v[i].id : 0; };
+
+        // People to resolve again: the changed rows, the children and spouses of an ID
+        // that leaves, and whoever listed an ID that arrives while it was missing
+        std::vector<int> redo(d.changed);
+        for (int i : d.changed) {
+            int was = idAt(from, i), now = idAt(to, i);
+            if (was == now) continue;
+            if (was != 0) {
+                for (int k : Children(i)) redo.push_back(k);
+                for (int k : Spouses(i)) redo.push_back(k);
+            }
+            auto it = (now != 0) ? dangling.find(now) : dangling.end();
+            if (it != dangling.end()) { redo.insert(redo.end(), it->second.begin(), it->second.end()); dangling.erase(it); }
+        }
+        std::sort(redo.begin(), redo.end());
+        redo.erase(std::unique(redo.begin(), redo.end()), redo.end());
+        auto redone = [&](int k) { return std::binary_search(redo.begin(), redo.end(), k); };
+
+        // Rows of the child and spouse lists to rewrite: around each such person before...
+        std::vector<int> parentRows, spouseRows;
+        for (int i : redo) {
+            if ((size_t)i >= oldN) continue;
+            if (people[i].fatherIdx >= 0) parentRows.push_back(people[i].fatherIdx);
+            if (people[i].motherIdx >= 0) parentRows.push_back(people[i].motherIdx);
+            spouseRows.push_back(i);
+            for (int k : Spouses(i)) spouseRows.push_back(k);
+        }
+
+        for (int i : d.changed) {
+            int was = idAt(from, i);
+            if (was != 0 && was != idAt(to, i)) idMap.erase(was);
+        }
+        people.resize(newN);
+        for (int i : d.changed) {
+            if ((size_t)i >= newN) continue;
+            people[i] = to[i];
+            idMap[people[i].id] = i;
+            parentRows.push_back(i); // Its children's rows point at it by ID
+        }
+
+        // ...and after
+        for (int i : redo) {
+            if ((size_t)i >= newN) continue;
+            Person& p = people[i];
+            p.fatherIdx = Resolve(p.fatherId, i);
+            p.motherIdx = Resolve(p.motherId, i);
+            if (p.fatherIdx >= 0) parentRows.push_back(p.fatherIdx);
+            if (p.motherIdx >= 0) parentRows.push_back(p.motherIdx);
+            spouseRows.push_back(i);
+            for (int sid : p.spouses) { int k = Resolve(sid, i); if (k >= 0) spouseRows.push_back(k); }
+        }
+
+        auto patchRows = [&](std::vector<int>& rows, PackedLists& lists, auto linked) {
+            std::sort(rows.begin(), rows.end());
+            rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+            std::vector<std::pair<int, std::vector<int>>> patch;
+            for (int r : rows) {
+                if ((size_t)r >= newN) break;
+                std::vector<int> list;
+                if ((size_t)r < oldN)
+                    for (int k : lists[r]) if ((size_t)k < newN && !redone(k)) list.push_back(k);
+                linked(r, list);
+                std::sort(list.begin(), list.end());
+                list.erase(std::unique(list.begin(), list.end()), list.end());
+                patch.emplace_back(r, std::move(list));
+            }
+            lists.Patch(newN, patch);
+        };
+        patchRows(parentRows, children, [&](int r, std::vector<int>& list) {
+            for (int k : redo)
+                if ((size_t)k < newN && (people[k].fatherIdx == r || people[k].motherIdx == r)) list.push_back(k);
+        });
+        // A spouse link holds if either side lists the other, so a person left alone may
+        // keep a link the other side dropped: check both sides for every candidate
+        auto lists = [&](int a, int b) {
+            const SpouseList& s = people[a].spouses;
+            return std::find(s.begin(), s.end(), people[b].id) != s.end();
+        };
+        patchRows(spouseRows, spouseLinks, [&](int r, std::vector<int>& list) {
+            list.erase(std::remove_if(list.begin(), list.end(), [&](int k) { return !lists(r, k) && !lists(k, r); }), list.end());
+            for (int k : redo)
+                if ((size_t)k < newN && k != r && (lists(r, k) || lists(k, r))) list.push_back(k);
+        });
+
+        if (newN != oldN) attrs.Resize(newN); // People added in-app have no extra columns
+        for (auto& col : lowered) col.reset();
+        for (int i : redo) if ((size_t)i < newN) d.relinked.push_back(i);
+        return d;
+    }
+
+private:
+    mutable std::shared_ptr<const LoweredColumn> lowered[3]; // Per CoreText, null until asked for
+    std::unordered_map<int, std::vector<int>> dangling;      // Missing ID -> people listing it as a parent or spouse
+
+    // Dense index of `id`; a missing one is noted against `by` so Apply can link it up
+    // if the ID arrives later
+    int Resolve(int id, int by) {
+        int idx = IndexOf(id);
+        if (idx < 0 && id != 0) {
+            std::vector<int>& listing = dangling[id];
+            if (listing.empty() || listing.back() != by) listing.push_back(by);
+        }
+        return idx;
+    }
+
+    // Keeps the header line and names the extra columns from it (the 7 core columns are
+    // positional)
+    void SetHeader(const std::string& line) {
+        header = line;
+        std::vector<std::string> extras;
+        std::string field;
+        size_t pos = 0;
+        for (int c = 0; pos != std::string::npos; ++c) {
+            pos = AttributeTable::NextField(line, pos, field);
+            if (c >= 7) extras.push_back(AttributeTable::Lower(field));
+        }
+        attrs.SetColumns(std::move(extras));
+    }
+
+    std::vector<int> ColumnYears(int col) const {
+        std::vector<int> years(people.size(), 0);
+        if (col < 0) return years;
+        const AttributeTable::Column& c = attrs.Get(col);
+        for (size_t i = 0; i < years.size() && i < c.valid.size; ++i) years[i] = c.Year(i);
+        return years;
+    }
+
+    // Common tail of the loaders once people and attrs hold the rows (idMap may be partly
+    // filled already). Stops early, with the indices unbuilt, if `cancel` is set.
+    void FinishLoad(const CancelToken* cancel = nullptr) {
+        if (cancel && cancel->Cancelled()) return;
+        if (idMap.size() != people.size())
+            for (size_t i = 0; i < people.size(); ++i) {
+                if (cancel && (i & 0xFFF) == 0 && cancel->Cancelled()) return;
+                idMap[people[i].id] = i;
+            }
+        if (cancel && cancel->Cancelled()) return;
+        BuildIndices();
+    }
+
+    static bool ParseRecord(const std::vector<std::string>& parts, Person& p) {
+        try {
+            p.id = std::stoi(parts[0]);
+            p.name = ToWString(parts[1]);
+            p.role = ToWString(parts[2]);
+            p.gender = ToWString(parts[3]);
+            p.fatherId = std::stoi(parts[4]);
+            p.motherId = std::stoi(parts[5]);
+            ParseSpouses(parts[6], p);
+        } catch(...) { return false; }
+        return true;
+    }
+
+    // Resolve parent and spouse IDs to dense indices and pack both adjacency lists
+    void BuildIndices() {
+        size_t n = people.size();
+        for (auto& col : lowered) col.reset();
+        dangling.clear();
+        for (size_t i = 0; i < n; ++i) {
+            people[i].fatherIdx = Resolve(people[i].fatherId, (int)i);
+            people[i].motherIdx = Resolve(people[i].motherId, (int)i);
+        }
+        BuildChildren();
+
+        // Spouses: each listed link in both directions, then the doubles of links listed
+        // on both sides are dropped row by row
+        std::vector<int> listed; // Resolved people[i].spouses, all rows in order
+        for (size_t i = 0; i < n; ++i) for (int sid : people[i].spouses) listed.push_back(Resolve(sid, (int)i));
+        std::vector<int> spouseStart(n + 1, 0), spouseList;
+        for (size_t i = 0, e = 0; i < n; ++i)
+            for (size_t k = 0; k < people[i].spouses.size(); ++k, ++e)
+                if (listed[e] >= 0 && listed[e] != (int)i) { spouseStart[i + 1]++; spouseStart[listed[e] + 1]++; }
+        for (size_t i = 0; i < n; ++i) spouseStart[i + 1] += spouseStart[i];
+
+        spouseList.assign(spouseStart[n], 0);
+        std::vector<int> fill(spouseStart.begin(), spouseStart.end() - 1);
+        for (size_t i = 0, e = 0; i < n; ++i) {
+            for (size_t k = 0; k < people[i].spouses.size(); ++k, ++e) {
+                int j = listed[e];
+                if (j < 0 || j == (int)i) continue;
+                spouseList[fill[i]++] = j;
+                spouseList[fill[j]++] = (int)i;
+            }
+        }
+        int write = 0, rowBegin = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int rowEnd = spouseStart[i + 1];
+            std::sort(spouseList.begin() + rowBegin, spouseList.begin() + rowEnd);
+            spouseStart[i] = write;
+            for (int k = rowBegin; k < rowEnd; ++k)
+                if (k == rowBegin || spouseList[k] != spouseList[k - 1]) spouseList[write++] = spouseList[k];
+            rowBegin = rowEnd;
+        }
+        spouseStart[n] = write;
+        spouseList.resize(write);
+        spouseLinks.Build(spouseStart, spouseList);
+    }
+
+    // Buckets children per parent from the parent indices (counting sort)
+    void BuildChildren() {
+        size_t n = people.size();
+        std::vector<int> childStart(n + 1, 0), childList;
+        for (const auto& p : people) {
+            if (p.fatherIdx >= 0) childStart[p.fatherIdx + 1]++;
+            if (p.motherIdx >= 0 && p.motherIdx != p.fatherIdx) childStart[p.motherIdx + 1]++;
+        }
+        for (size_t i = 0; i < n; ++i) childStart[i + 1] += childStart[i];
+
+        childList.assign(childStart[n], 0);
+        std::vector<int> fill(childStart.begin(), childStart.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            const Person& p = people[i];
+            if (p.fatherIdx >= 0) childList[fill[p.fatherIdx]++] = (int)i;
+            if (p.motherIdx >= 0 && p.motherIdx != p.fatherIdx) childList[fill[p.motherIdx]++] = (int)i;
+        }
+
+        children.Build(childStart, childList);
+    }
+};
+
+// In-app edits as a chain of PersonVersions. Each edit derives a new version from the
+// current one (dropping any redo tail); undo and redo only move the cursor, and
+// DataModel::Apply copies across the records that differ. The returned ModelDiff lets
+// the layout engine relayout incrementally.
+class EditHistory {
+public:
+    // Starts over from freshly loaded data (version 0, nothing to undo)
+    void Reset(const DataModel& m) {
+        versions.assign(1, PersonVersion::From(m.people));
+        cursor = 0;
+        nextId = 1;
+        for (const auto& p : m.people) nextId = std::max(nextId, p.id + 1);
+    }
+
+    bool CanUndo() const { return cursor > 0; }
+    bool CanRedo() const { return cursor + 1 < versions.size(); }
+    const PersonVersion& Current() const { return versions[cursor]; } // Matches the model's people
+    size_t Depth() const { return cursor; } // Edits that can be undone
+
+    bool Undo(DataModel& m, ModelDiff& diff) {
+        if (!CanUndo()) return false;
+        diff = m.Apply(versions[cursor], versions[cursor - 1]);
+        --cursor;
+        return true;
+    }
+
+    bool Redo(DataModel& m, ModelDiff& diff) {
+        if (!CanRedo()) return false;
+        diff = m.Apply(versions[cursor], versions[cursor + 1]);
+        ++cursor;
+        return true;
+    }
+
+    // New child of `parentId`; `otherParentId` (0 = none) becomes the other parent.
+    // Returns the new person's ID, or 0 if a parent does not exist.
+    int AddChild(DataModel& m, int parentId, int otherParentId, const std::wstring& name, const std::wstring& gender,
+                 const std::wstring& role, ModelDiff& diff) {
+        int pi = m.IndexOf(parentId);
+        if (pi < 0 || (otherParentId != 0 && m.IndexOf(otherParentId) < 0)) return 0;
+
+        Person kid;
+        kid.id = nextId++;
+        kid.name = name;
+        kid.gender = gender;
+        kid.role = role;
+        bool viaMother = m.people[pi].IsFemale();
+        kid.fatherId = viaMother ? otherParentId : parentId;
+        kid.motherId = viaMother ? parentId : otherParentId;
+        Commit(m, Current().Append(std::move(kid)), diff);
+        return nextId - 1;
+    }
+
+    // Links `a` and `b` as spouses (on both records) or, if they already are, changes
+    // whether the marriage is marked as ended. Returns false if nothing changed.
+    bool SetSpouse(DataModel& m, int a, int b, bool ex, ModelDiff& diff) {
+        int ia = m.IndexOf(a), ib = m.IndexOf(b);
+        if (ia < 0 || ib < 0 || ia == ib) return false;
+        if (IsBelow(m, ia, ib) || IsBelow(m, ib, ia)) return false; // Would make the layout's subtrees cyclic
+
+        PersonVersion next = Current();
+        bool changed = false;
+        for (int side = 0; side < 2; ++side) {
+            int self = side ? ib : ia, other = side ? a : b;
+            Person p = next[self];
+            bool linked = std::find(p.spouses.begin(), p.spouses.end(), other) != p.spouses.end();
+            if (linked && p.spouses.IsEx(other) == ex) continue;
+            if (!linked) p.spouses.push_back(other);
+            p.spouses.SetEx(other, ex);
+            next = next.Set(self, std::move(p));
+            changed = true;
+        }
+        if (changed) Commit(m, std::move(next), diff);
+        return changed;
+    }
+
+    // Rows another program wrote (SqliteStore::Poll), overwriting the people with their
+    // IDs or appended. Applied like an edit, but the history starts over from the result:
+    // undoing an older edit would put back what the other program changed.
+    void Merge(DataModel& m, std::vector<Person> rows, const std::vector<std::string>& tails, ModelDiff& diff) {
+        PersonVersion next = Current();
+        std::vector<std::pair<size_t, std::string>> text;
+        for (size_t k = 0; k < rows.size(); ++k) {
+            int i = m.IndexOf(rows[k].id);
+            nextId = std::max(nextId, rows[k].id + 1);
+            text.emplace_back(i >= 0 ? (size_t)i : next.Size(), tails[k]);
+            next = (i >= 0) ? next.Set(i, std::move(rows[k])) : next.Append(std::move(rows[k]));
+        }
+        diff = m.Apply(Current(), next);
+        std::sort(text.begin(), text.end());
+        m.attrs.SetRows(text);
+        versions.assign(1, std::move(next));
+        cursor = 0;
+    }
+
+private:
+    std::vector<PersonVersion> versions;
+    size_t cursor = 0;
+    int nextId = 1;
+
+    // True if `to` can be reached from `from` going down through children, counting a
+    // spouse's children as one's own (how the descendants layout builds subtrees)
+    static bool IsBelow(const DataModel& m, int from, int to) {
+        std::vector<char> seen(m.people.size(), 0);
+        std::vector<int> stack = {from};
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            auto visit = [&](int parent) {
+                for (int k : m.Children(parent)) if (!seen[k]) { seen[k] = 1; stack.push_back(k); }
+            };
+            visit(i);
+            for (int sid : m.people[i].spouses) {
+                int s = m.IndexOf(sid);
+                if (s >= 0) visit(s);
+            }
+        }
+        return seen[to] != 0;
+    }
+
+    void Commit(DataModel& m, PersonVersion next, ModelDiff& diff) {
+        versions.resize(cursor + 1);
+        versions.push_back(std::move(next));
+        diff = m.Apply(versions[cursor], versions[cursor + 1]);
+        ++cursor;
+    }
+};
+
+// Append-only log of in-app edits beside the data file ("Family.csv.journal"). Every
+// edit, undo or redo appends the resulting record of each person it changed
+// ("U,<core columns>") or drops one ("D,<id>"), so an edit costs one small flushed write
+// and replaying the log on load is idempotent. Once Config::JOURNAL_COMPACT_AT records
+// have piled up the CSV is rewritten on a worker thread: the log is first sealed
+// (renamed to ".journal.1") so edits keep appending to a fresh one, the snapshot goes to
+// a temp file that is renamed over the CSV, then the sealed log is deleted. Stopping at
+// any step leaves files that load to the same model.
+class EditJournal {
+public:
+    ~EditJournal() { Wait(); }
+
+    void Open(const std::wstring& dataFile) {
+        Wait();
+        out.close();
+        csvPath = dataFile;
+        activePath = dataFile + L".journal";
+        sealedPath = activePath + L".1";
+        tempPath = dataFile + L".tmp";
+        records = 0;
+        compactAt = Config::JOURNAL_COMPACT_AT;
+    }
+
+    // Replays the sealed and the active log onto data freshly loaded from the CSV and
+    // returns the records read. Only reads the logs, so a reload worker may call it; the
+    // count is handed back through Replayed once the model is the one in use.
+    size_t Replay(DataModel& m) const {
+        return m.ReplayJournal(sealedPath.c_str()) + m.ReplayJournal(activePath.c_str());
+    }
+
+    void Replayed(size_t n) { records = n; }
+
+    // Logs the outcome of an edit, undo or redo (the model must already reflect it)
+    bool Append(const DataModel& m, const ModelDiff& diff) {
+        if (!out.is_open()) {
+            TrimTornTail(activePath);
+            out.open(Narrow(activePath), std::ios::binary | std::ios::app);
+            if (!out.is_open()) return false;
+        }
+        std::string block;
+        for (int id : diff.droppedIds) block += "D," + std::to_string(id) + "\n";
+        for (int i : diff.changed)
+            if ((size_t)i < m.people.size()) block += "U," + DataModel::FormatRecord(m.people[i]) + "\n";
+        out << block;
+        out.flush();
+        records += diff.droppedIds.size() + diff.changed.size();
+        return out.good();
+    }
+
+    bool CompactDue() const { return records >= compactAt && !Busy(); }
+    bool Busy() const { return worker.joinable(); } // A compaction has not been collected by Finish yet
+
+    // Folds the log into the CSV in the background; `people` must match `m`. `expected` is
+    // the CSV write time the app last loaded: if the file changed since, it is left alone
+    // and the sealed log is replayed by the reload that follows. Posts `msg` to `notify`
+    // when done. A columnar archive or Arrow file is rewritten in its own format (without
+    // layout columns).
+    void Compact(const DataModel& m, const PersonVersion& people, FILETIME expected, HWND notify, UINT msg) {
+        if (Busy()) return;
+        out.close();
+        if (!Seal()) {
+            compactAt = records * 2; // Log locked or unwritable: try again once it has doubled
+            return;
+        }
+        records = 0;
+        compactAt = Config::JOURNAL_COMPACT_AT;
+        replaced = false;
+        DataModel::FileFormat format = DataModel::FormatOf(csvPath.c_str());
+        worker = std::thread([this, header = m.header, people, attrs = m.attrs.Clone(), format, expected, notify, msg]() {
+            replaced = Rewrite(header, people, attrs, format, expected);
+            PostMessage(notify, msg, 0, 0);
+        });
+    }
+
+    // Collects a finished compaction. Returns true, with the CSV's new write time, if the
+    // CSV was replaced (so the reload watcher can tell the app's own write apart).
+    bool Finish(FILETIME& written) {
+        Wait();
+        written = writtenTime;
+        return replaced;
+    }
+
+    void Wait() { if (worker.joinable()) worker.join(); }
+
+private:
+    std::wstring csvPath, activePath, sealedPath, tempPath;
+    std::ofstream out;
+    size_t records = 0;     // Records in the logs not yet folded into the CSV
+    size_t compactAt = Config::JOURNAL_COMPACT_AT; // Records that trigger the next compaction
+    std::thread worker;
+    bool replaced = false;  // Worker results, read after join
+    FILETIME writtenTime = {0};
+
+    static std::string Narrow(const std::wstring& path) {
+        char mb[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, path.c_str(), -1, mb, MAX_PATH, NULL, NULL);
+        return mb;
+    }
+
+    static bool WriteTime(const std::wstring& path, FILETIME& t) {
+        WIN32_FILE_ATTRIBUTE_DATA attrib;
+        if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attrib)) return false;
+        t = attrib.ftLastWriteTime;
+        return true;
+    }
+
+    // Cuts a record left half-written by a crash, so the next append starts on its own line
+    static void TrimTornTail(const std::wstring& path) {
+        std::string text;
+        {
+            std::ifstream in(Narrow(path), std::ios::binary);
+            if (!in.is_open()) return;
+            text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        size_t whole = 0; // End of the last complete record; a name may hold a line break
+        std::istringstream records(text);
+        std::string line;
+        while (AttributeTable::ReadRecord(records, line) && !records.eof()) whole = (size_t)records.tellg();
+        if (whole == text.size()) return;
+        text.resize(whole);
+        std::ofstream out(Narrow(path), std::ios::binary | std::ios::trunc);
+        out << text;
+    }
+
+    // Moves the active log aside; a sealed log left by an interrupted compaction is
+    // extended instead, keeping the records in order
+    bool Seal() {
+        if (GetFileAttributesW(activePath.c_str()) == INVALID_FILE_ATTRIBUTES) return false;
+        if (GetFileAttributesW(sealedPath.c_str()) == INVALID_FILE_ATTRIBUTES)
+            return MoveFileExW(activePath.c_str(), sealedPath.c_str(), 0) != 0;
+        TrimTornTail(sealedPath);
+        {
+            std::ifstream in(Narrow(activePath), std::ios::binary);
+            std::ofstream sealed(Narrow(sealedPath), std::ios::binary | std::ios::app);
+            if (!in.is_open() || !sealed.is_open()) return false;
+            sealed << in.rdbuf();
+            if (!sealed.good()) return false;
+        }
+        return DeleteFileW(activePath.c_str()) != 0;
+    }
+
+    // Worker thread: snapshot -> temp file -> rename over the CSV -> drop the sealed log
+    bool Rewrite(const std::string& header, const PersonVersion& people, const AttributeTable& attrs, DataModel::FileFormat format, FILETIME expected) {
+        if (format == DataModel::FileFormat::Columns) {
+            if (!DataModel::ArchiveWriter(header, people, attrs).Save(tempPath)) { DeleteFileW(tempPath.c_str()); return false; }
+        } else if (format == DataModel::FileFormat::Arrow) {
+            if (!DataModel::ArrowWriter(header, people, attrs).Save(tempPath)) { DeleteFileW(tempPath.c_str()); return false; }
+        } else {
+            std::ofstream tmp(Narrow(tempPath), std::ios::binary | std::ios::trunc);
+            if (!tmp.is_open()) return false;
+            tmp << (header.empty() ? std::string(DataModel::CORE_HEADER) : header) << "\n";
+            for (size_t i = 0; i < people.Size(); ++i) {
+                std::string tail = attrs.Tail(i);
+                tmp << DataModel::FormatRecord(people[i]) << (tail.empty() ? "" : ",") << tail << "\n";
+            }
+            tmp.flush();
+            if (!tmp.good()) { tmp.close(); DeleteFileW(tempPath.c_str()); return false; }
+        }
+
+        FILETIME now;
+        if (!WriteTime(csvPath, now) || CompareFileTime(&now, &expected) != 0 ||
+            !MoveFileExW(tempPath.c_str(), csvPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            DeleteFileW(tempPath.c_str());
+            return false;
+        }
+        WriteTime(csvPath, writtenTime);
+        DeleteFileW(sealedPath.c_str());
+        return true;
+    }
+};
+
+// Family data kept in a SQLite database instead of a flat file, over one connection
+// held open for the program's life:
+//   people(id, name, role, gender, father, mother, spouses, extra, rev)
+//   layout(id, x, y, gen, root)      written back from a window on request
+//   meta(key, value)                 the CSV header (names of the extra columns)
+// Triggers stamp every person inserted or updated, by this program or any other, with
+// the next value of a change counter (deletions go to `deleted` with theirs). A reload
+// then reads only the rows stamped above the last value it saw, and PRAGMA data_version
+// tells without touching the tables whether another connection committed at all.
+class SqliteStore {
+public:
+    // A window's layout of one person; the bits of `has` say which values are known
+    struct LayoutRow {
+        enum : unsigned { Position = 1, Gen = 2, Root = 4 };
+        int id = 0;
+        int x = 0, y = 0, gen = 0, root = 0;
+        unsigned has = 0;
+    };
+
+    SqliteStore() {}
+    SqliteStore(const SqliteStore&) = delete;
+    SqliteStore& operator=(const SqliteStore&) = delete;
+    ~SqliteStore() { Close(); }
+
+    // Opens (or creates) the database and makes sure the tables and triggers exist
+    bool Open(const wchar_t* path) {
+        Close();
+        api = SqliteApi::Get();
+        if (!api) { error = "SQLite is not available (sqlite3.dll not found)."; return false; }
+        char pathUtf8[MAX_PATH * 3];
+        WideCharToMultiByte(CP_UTF8, 0, path, -1, pathUtf8, sizeof(pathUtf8), NULL, NULL);
+        if (api->open_v2(pathUtf8, &db, SqliteApi::OPEN_READWRITE | SqliteApi::OPEN_CREATE, nullptr) != SqliteApi::OK) {
+            Fail();
+            Close();
+            return false;
+        }
+        api->busy_timeout(db, 2000);
+        if (!Exec(SCHEMA) || !Exec(TRIGGERS)) { Close(); return false; }
+        return true;
+    }
+
+    void Close() {
+        if (db) api->close(db);
+        db = nullptr;
+        seenRev = 0;
+        dataVersion = -1;
+    }
+
+    bool IsOpen() const { return db != nullptr; }
+    const std::string& Error() const { return error; }
+
+    // Reads every person in pages of Config::SQLITE_BATCH rows (keyset paging on the ID,
+    // so no read holds the database for long). The change counter is read first: anything
+    // written meanwhile is picked up again by the next Poll.
+    bool Load(DataModel& m) {
+        dataVersion = DataVersion();
+        seenRev = Revision();
+        std::string header;
+        {
+            Statement q(*this, "SELECT value FROM meta WHERE key = 'csv_header'");
+            if (q.Step()) header = q.Text(0);
+            if (!q.ok) return false;
+        }
+        std::vector<Person> rows;
+        std::vector<std::string> tails;
+        Statement q(*this, "SELECT id, name, role, gender, father, mother, spouses, extra FROM people"
+                           " WHERE id > ?1 ORDER BY id LIMIT ?2");
+        long long after = LLONG_MIN;
+        for (size_t got = Config::SQLITE_BATCH; got == Config::SQLITE_BATCH; ) {
+            q.Reset();
+            q.Bind(1, after);
+            q.Bind(2, (long long)Config::SQLITE_BATCH);
+            for (got = 0; q.Step(); ++got) {
+                ReadPerson(q, rows, tails);
+                after = rows.back().id;
+            }
+            if (!q.ok) return false;
+        }
+        m.Assign(header, std::move(rows), tails);
+        return true;
+    }
+
+    // Reads what other connections committed since Load or the last Poll: the rows
+    // stamped above the last counter value seen (with their extra columns in `tails`), and
+    // the IDs of the people deleted since. Returns false if nothing changed (or the
+    // database could not be read).
+    bool Poll(std::vector<int>& dropped, std::vector<Person>& rows, std::vector<std::string>& tails) {
+        if (!db) return false;
+        long long version = DataVersion();
+        if (version == dataVersion) return false;
+        if (!Exec("BEGIN")) return false; // One snapshot for the counter and both queries
+        long long rev = Revision();
+        dropped.clear();
+        rows.clear();
+        tails.clear();
+        bool ok = true;
+        if (rev != seenRev) {
+            Statement d(*this, "SELECT id FROM deleted WHERE rev > ?1");
+            d.Bind(1, seenRev);
+            while (d.Step()) dropped.push_back((int)d.Int(0));
+            Statement q(*this, "SELECT id, name, role, gender, father, mother, spouses, extra FROM people WHERE rev > ?1");
+            q.Bind(1, seenRev);
+            while (q.Step()) ReadPerson(q, rows, tails);
+            ok = d.ok && q.ok;
+        }
+        Exec("COMMIT");
+        if (!ok) return false;
+        dataVersion = version;
+        if (rev == seenRev) return false; // Only the layout table or our own rows changed
+        seenRev = rev;
+        return true;
+    }
+
+    // Stores an edit already applied to `m`. The write lock is taken up front: if nobody
+    // else wrote since the last Poll, our own rows are not read back as news.
+    bool Write(const DataModel& m, const ModelDiff& diff) {
+        if (!db || !Exec("BEGIN IMMEDIATE")) return false;
+        long long before = Revision();
+        bool ok = true;
+        {
+            Statement del(*this, "DELETE FROM people WHERE id = ?1");
+            for (size_t k = 0; ok && k < diff.droppedIds.size(); ++k) {
+                del.Reset();
+                del.Bind(1, diff.droppedIds[k]);
+                ok = del.Run();
+            }
+            Statement put(*this, "INSERT OR REPLACE INTO people(id, name, role, gender, father, mother, spouses, extra)"
+                                 " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)");
+            for (size_t k = 0; ok && k < diff.changed.size(); ++k) {
+                size_t i = (size_t)diff.changed[k];
+                if (i >= m.people.size()) continue;
+                put.Reset();
+                BindPerson(put, m.people[i], i < m.attrs.RowCount() ? m.attrs.Tail(i) : std::string());
+                ok = put.Run();
+            }
+        }
+        long long after = Revision();
+        if (!Finish(ok)) return false;
+        if (before == seenRev) seenRev = after;
+        return true;
+    }
+
+    // Replaces the layout table
+    bool SaveLayout(const std::vector<LayoutRow>& rows) {
+        if (!db || !Exec("BEGIN IMMEDIATE")) return false;
+        bool ok = Exec("DELETE FROM layout");
+        {
+            Statement put(*this, "INSERT INTO layout(id, x, y, gen, root) VALUES (?1, ?2, ?3, ?4, ?5)");
+            for (size_t k = 0; ok && k < rows.size(); ++k) {
+                const LayoutRow& r = rows[k];
+                put.Reset();
+                put.Bind(1, r.id);
+                if (r.has & LayoutRow::Position) { put.Bind(2, r.x); put.Bind(3, r.y); }
+                else { put.BindNull(2); put.BindNull(3); }
+                if (r.has & LayoutRow::Gen) put.Bind(4, r.gen); else put.BindNull(4);
+                if (r.has & LayoutRow::Root) put.Bind(5, r.root); else put.BindNull(5);
+                ok = put.Run();
+            }
+        }
+        return Finish(ok);
+    }
+
+    // Replaces the people table in one transaction (a CSV moved into a new database).
+    // The triggers are set aside meanwhile: every row gets the same stamp.
+    bool Import(const std::string& header, const PersonVersion& people, const AttributeTable& attrs) {
+        if (!db || !Exec("BEGIN IMMEDIATE")) return false;
+        bool ok = Exec("DROP TRIGGER people_insert; DROP TRIGGER people_update; DROP TRIGGER people_delete;"
+                       "DELETE FROM people; DELETE FROM deleted; UPDATE revision SET value = value + 1;");
+        long long rev = Revision();
+        {
+            Statement meta(*this, "INSERT OR REPLACE INTO meta(key, value) VALUES ('csv_header', ?1)");
+            meta.Bind(1, header.empty() ? std::string(DataModel::CORE_HEADER) : header);
+            ok = ok && meta.Run();
+            Statement put(*this, "INSERT INTO people(id, name, role, gender, father, mother, spouses, extra, rev)"
+                                 " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)");
+            put.Bind(9, rev);
+            for (size_t i = 0; ok && i < people.Size(); ++i) {
+                put.Reset();
+                BindPerson(put, people[i], i < attrs.RowCount() ? attrs.Tail(i) : std::string());
+                ok = put.Run();
+            }
+        }
+        return Finish(ok && Exec(TRIGGERS));
+    }
+
+private:
+    static constexpr const char* SCHEMA =
+        "CREATE TABLE IF NOT EXISTS people(id INTEGER PRIMARY KEY, name TEXT, role TEXT, gender TEXT,"
+        " father INTEGER DEFAULT 0, mother INTEGER DEFAULT 0, spouses TEXT DEFAULT '0', extra TEXT DEFAULT '',"
+        " rev INTEGER DEFAULT 0);"
+        "CREATE INDEX IF NOT EXISTS people_rev ON people(rev);"
+        "CREATE TABLE IF NOT EXISTS deleted(id INTEGER PRIMARY KEY, rev INTEGER);"
+        "CREATE TABLE IF NOT EXISTS revision(value INTEGER NOT NULL);"
+        "INSERT INTO revision SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM revision);"
+        "CREATE TABLE IF NOT EXISTS layout(id INTEGER PRIMARY KEY, x INTEGER, y INTEGER, gen INTEGER, root INTEGER);"
+        "CREATE TABLE IF NOT EXISTS meta(key TEXT PRIMARY KEY, value TEXT);";
+
+    // Stamping `rev` is not an UPDATE OF the data columns, so it does not re-fire
+    static constexpr const char* TRIGGERS =
+        "CREATE TRIGGER IF NOT EXISTS people_insert AFTER INSERT ON people BEGIN"
+        " UPDATE revision SET value = value + 1;"
+        " UPDATE people SET rev = (SELECT value FROM revision) WHERE id = NEW.id;"
+        " DELETE FROM deleted WHERE id = NEW.id; END;"
+        "CREATE TRIGGER IF NOT EXISTS people_update AFTER UPDATE OF id, name, role, gender, father, mother, spouses, extra"
+        " ON people BEGIN"
+        " UPDATE revision SET value = value + 1;"
+        " UPDATE people SET rev = (SELECT value FROM revision) WHERE id = NEW.id;"
+        " INSERT OR REPLACE INTO deleted SELECT OLD.id, (SELECT value FROM revision) WHERE OLD.id <> NEW.id; END;"
+        "CREATE TRIGGER IF NOT EXISTS people_delete AFTER DELETE ON people BEGIN"
+        " UPDATE revision SET value = value + 1;"
+        " INSERT OR REPLACE INTO deleted VALUES (OLD.id, (SELECT value FROM revision)); END;";
+
+    const SqliteApi* api = nullptr;
+    sqlite3* db = nullptr;
+    std::string error;
+    long long seenRev = 0;      // Change counter as of the last Load, Poll or own Write
+    long long dataVersion = -1; // PRAGMA data_version at the last Load or Poll
+
+    // Prepared statement; a failed step clears `ok` and records the error
+    class Statement {
+    public:
+        bool ok = true;
+
+        Statement(SqliteStore& s, const char* sql) : store(s) {
+            if (s.api->prepare_v2(s.db, sql, -1, &stmt, nullptr) != SqliteApi::OK) { s.Fail(); ok = false; stmt = nullptr; }
+        }
+        ~Statement() { if (stmt) store.api->finalize(stmt); }
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+
+        void Reset() { if (stmt) store.api->reset(stmt); }
+        void Bind(int i, long long v) { if (stmt) store.api->bind_int64(stmt, i, v); }
+        void Bind(int i, int v) { Bind(i, (long long)v); }
+        void Bind(int i, const std::string& v) { // Copied (SQLITE_TRANSIENT)
+            if (stmt) store.api->bind_text(stmt, i, v.data(), (int)v.size(), (void (*)(void*))-1);
+        }
+        void BindNull(int i) { if (stmt) store.api->bind_null(stmt, i); }
+
+        // Next result row; false when done or failed
+        bool Step() {
+            if (!stmt || !ok) return false;
+            int rc = store.api->step(stmt);
+            if (rc == SqliteApi::ROW) return true;
+            if (rc != SqliteApi::DONE) { store.Fail(); ok = false; }
+            return false;
+        }
+
+        // A statement without result rows
+        bool Run() {
+            Step();
+            return ok;
+        }
+
+        long long Int(int c) const { return store.api->column_int64(stmt, c); }
+        std::string Text(int c) const {
+            const unsigned char* p = store.api->column_text(stmt, c);
+            return p ? std::string((const char*)p, (size_t)store.api->column_bytes(stmt, c)) : std::string();
+        }
+
+    private:
+        SqliteStore& store;
+        sqlite3_stmt* stmt = nullptr;
+    };
+
+    bool Fail() {
+        error = api->errmsg(db);
+        return false;
+    }
+
+    bool Exec(const char* sql) {
+        return api->exec(db, sql, nullptr, nullptr, nullptr) == SqliteApi::OK || Fail();
+    }
+
+    // Commits the open write transaction if `ok`, rolls it back otherwise
+    bool Finish(bool ok) {
+        if (ok && Exec("COMMIT")) return true;
+        Exec("ROLLBACK");
+        return false;
+    }
+
+    long long Revision() {
+        Statement q(*this, "SELECT value FROM revision");
+        return q.Step() ? q.Int(0) : 0;
+    }
+
+    long long DataVersion() {
+        Statement q(*this, "PRAGMA data_version");
+        return q.Step() ? q.Int(0) : 0;
+    }
+
+    // Columns: id, name, role, gender, father, mother, spouses, extra
+    static void ReadPerson(const Statement& q, std::vector<Person>& rows, std::vector<std::string>& tails) {
+        Person p;
+        p.id = (int)q.Int(0);
+        p.name = ToWString(q.Text(1));
+        p.role = ToWString(q.Text(2));
+        p.gender = ToWString(q.Text(3));
+        p.fatherId = (int)q.Int(4);
+        p.motherId = (int)q.Int(5);
+        DataModel::ParseSpouses(q.Text(6), p);
+        rows.push_back(std::move(p));
+        tails.push_back(q.Text(7));
+    }
+
+    static void BindPerson(Statement& put, const Person& p, const std::string& tail) {
+        put.Bind(1, p.id);
+        put.Bind(2, ToUtf8(p.name));
+        put.Bind(3, ToUtf8(p.role));
+        put.Bind(4, ToUtf8(p.gender));
+        put.Bind(5, p.fatherId);
+        put.Bind(6, p.motherId);
+        put.Bind(7, DataModel::SpouseField(p));
+        put.Bind(8, tail);
+    }
+};
+
+// Filter expressions over person attributes and relationships, e.g.
+//   birth < 1950 and descendant(12)      gender = female or place ~ "jak"
+//   not matriline()                      photo and (role ~ aunt or role ~ uncle)
+// Comparisons: < <= > >= = != and ~ (contains). A bare column name tests for a value,
+// `female`/`male` are shorthands, and the relation calls descendant, ancestor, branch
+// (descendants plus their spouses), matriline and patriline take a person ID or, with
+// no argument, the focus person. Compiled to postfix; every step yields a RowBitmap.
+class FilterQuery {
+public:
+    bool Empty() const { return program.empty(); }
+
+    // Compiles `text` against the model's columns. Empty text compiles to "no filter".
+    bool Compile(const std::wstring& text, const DataModel& model, std::wstring& error) {
+        program.clear();
+        src = text; pos = 0; err.clear(); m = &model;
+        Next();
+        if (tok.kind != Tok::End) {
+            ParseOr();
+            if (err.empty() && tok.kind != Tok::End) Fail(L"unexpected '" + tok.text + L"'");
+        }
+        if (!err.empty()) program.clear();
+        error = err;
+        return err.empty();
+    }
+
+    // Selection over model.people; `focusIdx` stands in for argument-less relation calls
+    RowBitmap Evaluate(const DataModel& model, int focusIdx) const {
+        const size_t n = model.people.size();
+        std::vector<RowBitmap> stack;
+        for (const Op& op : program) {
+            switch (op.kind) {
+                case Op::And: { RowBitmap b = std::move(stack.back()); stack.pop_back(); stack.back() &= b; break; }
+                case Op::Or:  { RowBitmap b = std::move(stack.back()); stack.pop_back(); stack.back() |= b; break; }
+                case Op::Not: stack.back().Flip(); break;
+                case Op::Attr: {
+                    RowBitmap b;
+                    if (op.column >= 0) model.attrs.Select(op.column, op.cmp, op.literal, b);
+                    else b = model.attrs.Get(-op.column - 1).valid;
+                    stack.push_back(std::move(b));
+                    break;
+                }
+                case Op::Core: stack.push_back(EvalCore(model, op)); break;
+                case Op::Relation: {
+                    int start = (op.personId != 0) ? model.IndexOf(op.personId) : focusIdx;
+                    stack.push_back(EvalRelation(model, op.relation, start));
+                    break;
+                }
+            }
+        }
+        if (stack.empty()) return RowBitmap(n, true);
+        return std::move(stack.back());
+    }
+
+private:
+    enum class Rel : unsigned char { Descendant, Ancestor, Branch, Matriline, Patriline };
+    enum class CoreField : unsigned char { Name, Role, Gender, Id };
+
+    struct Op {
+        enum Kind { Attr, Core, Relation, And, Or, Not } kind;
+        int column = 0;         // Attr: column, or -(column + 1) for a presence test
+        CoreField field = CoreField::Name;
+        CmpOp cmp = CmpOp::Eq;
+        std::wstring literal;
+        Rel relation = Rel::Descendant;
+        int personId = 0;       // Relation: 0 = focus person
+    };
+
+    struct Tok {
+        enum Kind { End, Word, Literal, Cmp, LParen, RParen, And, Or, Not } kind = End;
+        std::wstring text;
+        CmpOp cmp = CmpOp::Eq;
+    };
+
+    std::vector<Op> program;
+
+    // Parser state, only valid during Compile
+    std::wstring src, err;
+    size_t pos = 0;
+    Tok tok;
+    const DataModel* m = nullptr;
+
+    void Fail(const std::wstring& msg) { if (err.empty()) err = msg; tok.kind = Tok::End; }
+
+    void Next() {
+        while (pos < src.size() && iswspace(src[pos])) ++pos;
+        tok = Tok();
+        if (pos >= src.size()) return;
+        wchar_t c = src[pos];
+        auto two = [&](const wchar_t* t) { return src.compare(pos, 2, t) == 0; };
+
+        if (c == '(') { tok.kind = Tok::LParen; ++pos; }
+        else if (c == ')') { tok.kind = Tok::RParen; ++pos; }
+        else if (two(L"&&")) { tok.kind = Tok::And; pos += 2; }
+        else if (two(L"||")) { tok.kind = Tok::Or; pos += 2; }
+        else if (two(L"<=")) { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Le; pos += 2; }
+        else if (two(L">=")) { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Ge; pos += 2; }
+        else if (two(L"!=")) { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Ne; pos += 2; }
+        else if (two(L"==")) { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Eq; pos += 2; }
+        else if (c == '<') { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Lt; ++pos; }
+        else if (c == '>') { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Gt; ++pos; }
+        else if (c == '=') { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Eq; ++pos; }
+        else if (c == '~') { tok.kind = Tok::Cmp; tok.cmp = CmpOp::Contains; ++pos; }
+        else if (c == '!') { tok.kind = Tok::Not; ++pos; }
+        else if (c == '"') {
+            size_t end = src.find('"', pos + 1);
+            if (end == std::wstring::npos) { Fail(L"unterminated string"); return; }
+            tok.kind = Tok::Literal;
+            tok.text = src.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+        } else if (iswdigit(c) || (c == '-' && pos + 1 < src.size() && iswdigit(src[pos + 1]))) {
+            size_t start = pos++;
+            while (pos < src.size() && (iswdigit(src[pos]) || src[pos] == '-' || src[pos] == '/' || src[pos] == '.')) ++pos;
+            tok.kind = Tok::Literal;
+            tok.text = src.substr(start, pos - start);
+        } else if (iswalpha(c) || c == '_') {
+            size_t start = pos;
+            while (pos < src.size() && (iswalnum(src[pos]) || src[pos] == '_')) ++pos;
+            tok.text = src.substr(start, pos - start);
+            std::wstring w = AttributeTable::LowerW(tok.text);
+            tok.kind = (w == L"and") ? Tok::And : (w == L"or") ? Tok::Or : (w == L"not") ? Tok::Not : Tok::Word;
+        } else {
+            Fail(std::wstring(L"unexpected '") + c + L"'");
+        }
+    }
+
+    void Emit(Op::Kind kind) { Op op; op.kind = kind; program.push_back(op); }
+
+    void ParseOr() {
+        ParseAnd();
+        while (tok.kind == Tok::Or) { Next(); ParseAnd(); Emit(Op::Or); }
+    }
+
+    void ParseAnd() {
+        ParseNot();
+        while (tok.kind == Tok::And) { Next(); ParseNot(); Emit(Op::And); }
+    }
+
+    void ParseNot() {
+        if (tok.kind == Tok::Not) { Next(); ParseNot(); Emit(Op::Not); return; }
+        ParsePrimary();
+    }
+
+    void ParsePrimary() {
+        if (tok.kind == Tok::LParen) {
+            Next();
+            ParseOr();
+            if (tok.kind != Tok::RParen) { Fail(L"missing ')'"); return; }
+            Next();
+            return;
+        }
+        if (tok.kind != Tok::Word) { Fail(tok.kind == Tok::End ? L"unexpected end" : L"expected a field name"); return; }
+
+        std::wstring word = AttributeTable::LowerW(tok.text);
+        Next();
+
+        if (tok.kind == Tok::LParen) { ParseRelation(word); return; }
+
+        if (tok.kind != Tok::Cmp) {
+            // Bare word: gender shorthand or "column has a value"
+            Op op;
+            if (word == L"female" || word == L"male") {
+                op.kind = Op::Core; op.field = CoreField::Gender; op.literal = word;
+            } else {
+                int col = m->attrs.Find(ToUtf8(word));
+                if (col < 0) { Fail(L"unknown field '" + word + L"'"); return; }
+                op.kind = Op::Attr; op.column = -col - 1;
+            }
+            program.push_back(op);
+            return;
+        }
+
+        Op op;
+        op.cmp = tok.cmp;
+        Next();
+        if (tok.kind != Tok::Literal && tok.kind != Tok::Word) { Fail(L"expected a value after '" + word + L"'"); return; }
+        op.literal = tok.text;
+        Next();
+
+        if (word == L"name" || word == L"role" || word == L"gender" || word == L"id") {
+            op.kind = Op::Core;
+            op.field = (word == L"name") ? CoreField::Name : (word == L"role") ? CoreField::Role
+                     : (word == L"gender") ? CoreField::Gender : CoreField::Id;
+            int64_t v;
+            if (op.field == CoreField::Id && !AttributeTable::ParseInt(ToUtf8(op.literal), v)) {
+                Fail(L"id needs a number"); return;
+            }
+        } else {
+            int col = m->attrs.Find(ToUtf8(word));
+            if (col < 0) { Fail(L"unknown field '" + word + L"'"); return; }
+            if (!m->attrs.Fits(col, op.cmp, op.literal)) { Fail(L"'" + op.literal + L"' does not fit " + word); return; }
+            op.kind = Op::Attr; op.column = col;
+        }
+        program.push_back(op);
+    }
+
+    void ParseRelation(const std::wstring& name) {
+        Op op;
+        op.kind = Op::Relation;
+        if (name == L"descendant" || name == L"descendants") op.relation = Rel::Descendant;
+        else if (name == L"ancestor" || name == L"ancestors") op.relation = Rel::Ancestor;
+        else if (name == L"branch") op.relation = Rel::Branch;
+        else if (name == L"matriline") op.relation = Rel::Matriline;
+        else if (name == L"patriline") op.relation = Rel::Patriline;
+        else { Fail(L"unknown function '" + name + L"'"); return; }
+
+        Next(); // '('
+        if (tok.kind == Tok::Literal) {
+            int64_t id;
+            if (!AttributeTable::ParseInt(ToUtf8(tok.text), id)) { Fail(L"expected a person ID"); return; }
+            op.personId = (int)id;
+            Next();
+        }
+        if (tok.kind != Tok::RParen) { Fail(L"missing ')'"); return; }
+        Next();
+        program.push_back(op);
+    }
+
+    static RowBitmap EvalCore(const DataModel& model, const Op& op) {
+        RowBitmap b(model.people.size());
+        const auto& people = model.people;
+        if (op.field == CoreField::Id) {
+            int64_t v = std::stoll(ToUtf8(op.literal));
+            b.Fill([&](size_t i) {
+                int64_t id = people[i].id;
+                switch (op.cmp) {
+                    case CmpOp::Lt: return id < v;
+                    case CmpOp::Le: return id <= v;
+                    case CmpOp::Gt: return id > v;
+                    case CmpOp::Ge: return id >= v;
+                    case CmpOp::Ne: return id != v;
+                    default:        return id == v;
+                }
+            });
+            return b;
+        }
+        // Decide once per distinct lowered value, then scan the codes
+        const DataModel::LoweredColumn& col = model.Lowered(op.field == CoreField::Name ? DataModel::CoreText::Name
+                                                          : op.field == CoreField::Role ? DataModel::CoreText::Role
+                                                          : DataModel::CoreText::Gender);
+        std::wstring lit = AttributeTable::LowerW(op.literal);
+        std::vector<char> hit(col.dict.size());
+        for (size_t d = 0; d < col.dict.size(); ++d) {
+            const std::wstring& v = col.dict[d];
+            if (op.cmp == CmpOp::Contains) { hit[d] = v.find(lit) != std::wstring::npos; continue; }
+            int c = v.compare(lit);
+            switch (op.cmp) {
+                case CmpOp::Lt: hit[d] = c < 0; break;
+                case CmpOp::Le: hit[d] = c <= 0; break;
+                case CmpOp::Gt: hit[d] = c > 0; break;
+                case CmpOp::Ge: hit[d] = c >= 0; break;
+                case CmpOp::Ne: hit[d] = c != 0; break;
+                default:        hit[d] = c == 0; break;
+            }
+        }
+        const uint32_t* codes = col.codes.data();
+        b.Fill([&](size_t i) { return hit[codes[i]] != 0; });
+        return b;
+    }
+
+    // Walks the dense indices from `start`; the start person is always included
+    static RowBitmap EvalRelation(const DataModel& model, Rel rel, int start) {
+        const auto& people = model.people;
+        RowBitmap b(people.size());
+        if (start < 0) return b;
+
+        std::vector<int> stack = { start };
+        b.Set(start);
+        while (!stack.empty()) {
+            int i = stack.back(); stack.pop_back();
+            const Person& p = people[i];
+            if (rel == Rel::Ancestor) {
+                for (int par : { p.fatherIdx, p.motherIdx })
+                    if (par >= 0 && !b.Test(par)) { b.Set(par); stack.push_back(par); }
+                continue;
+            }
+            // Matriline/patriline only continue through women/men (and the start person)
+            if (rel == Rel::Matriline && i != start && !p.IsFemale()) continue;
+            if (rel == Rel::Patriline && i != start && p.IsFemale()) continue;
+            for (int k : model.Children(i))
+                if (!b.Test(k)) { b.Set(k); stack.push_back(k); }
+        }
+
+        if (rel == Rel::Branch) {
+            RowBitmap spouses = b;
+            for (size_t i = 0; i < people.size(); ++i) {
+                if (!b.Test(i)) continue;
+                for (int sid : people[i].spouses) {
+                    int j = model.IndexOf(sid);
+                    if (j >= 0) spouses.Set(j);
+                }
+            }
+            b = std::move(spouses);
+        }
+        return b;
+    }
+};
+
+// Summary analytics for an archive, written as JSON. Everything comes from the parent
+// indices and the CSR child index: one parallel pass collects the per-person counts,
+// a second walks the generations level by level, and a union-find over parent and
+// spouse links yields the connected components.
+class FamilyStats {
+public:
+    size_t people = 0;
+    std::vector<size_t> generations;  // People per generation (0 = no known parents)
+    size_t unresolved = 0;            // People on a parent cycle, so without a generation
+    std::vector<int> longestLineage;  // IDs from the oldest ancestor down
+    std::vector<size_t> fanOut;       // People by number of children
+    int maxFanOutId = 0;
+    std::vector<size_t> familySizes;  // Families (same father and mother) by number of children
+    size_t families = 0;
+    std::vector<size_t> spouseCounts; // People by number of listed spouses
+    size_t married = 0, remarried = 0, withEx = 0;
+    size_t components = 0, singletons = 0;
+    std::vector<size_t> largestComponents; // Sizes, largest first
+    DataModel::Footprint memory;
+    TaskScheduler::Counters scheduler; // Pool totals since the program started
+    double elapsedMs = 0;
+
+    static FamilyStats Compute(const DataModel& m) {
+        auto start = std::chrono::steady_clock::now();
+        FamilyStats s;
+        s.people = m.people.size();
+        s.CountPass(m);
+        s.GenerationPass(m);
+        s.ComponentPass(m);
+        s.memory = m.MemoryFootprint();
+        s.scheduler = TaskScheduler::Get().Snapshot();
+        s.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return s;
+    }
+
+    bool Write(const std::wstring& filePath) const {
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, filePath.c_str(), -1, pathMB, MAX_PATH, NULL, NULL);
+        std::ofstream out(pathMB, std::ios::binary);
+        if (!out.is_open()) return false;
+        out << ToJson();
+        return out.good();
+    }
+
+    std::string ToJson() const {
+        size_t parents = people - fanOut[0];
+        std::ostringstream o;
+        o << "{\n"
+          << "  \"people\": " << people << ",\n"
+          << "  \"elapsedMs\": " << Num(elapsedMs) << ",\n"
+          << "  \"generations\": {\"count\": " << generations.size() << ", \"unresolved\": " << unresolved
+          << ", \"histogram\": " << List(generations) << "},\n"
+          << "  \"longestLineage\": {\"length\": " << longestLineage.size() << ", \"ids\": " << List(longestLineage) << "},\n"
+          << "  \"fanOut\": {\"parents\": " << parents << ", \"max\": " << fanOut.size() - 1
+          << ", \"maxId\": " << maxFanOutId << ", \"meanPerParent\": " << Num(Ratio(ChildLinks(), parents))
+          << ", \"histogram\": " << List(fanOut) << "},\n"
+          << "  \"familySizes\": {\"families\": " << families << ", \"meanChildren\": "
+          << Num(Ratio(Weighted(familySizes), families)) << ", \"histogram\": " << List(familySizes) << "},\n"
+          << "  \"marriage\": {\"married\": " << married << ", \"remarried\": " << remarried
+          << ", \"withExSpouse\": " << withEx << ", \"remarriageRate\": " << Num(Ratio(remarried, married))
+          << ", \"exSpouseRate\": " << Num(Ratio(withEx, married)) << ", \"spousesHistogram\": " << List(spouseCounts) << "},\n"
+          << "  \"components\": {\"count\": " << components << ", \"singletons\": " << singletons
+          << ", \"largest\": " << List(largestComponents) << "},\n"
+          << "  \"memory\": {\"bytesPerPerson\": " << Num(PerPerson(memory.records + memory.text + memory.spouseLists +
+                                                                      memory.adjacency + memory.idIndex))
+          << ", \"records\": " << Num(PerPerson(memory.records)) << ", \"text\": " << Num(PerPerson(memory.text))
+          << ", \"spouseLists\": " << Num(PerPerson(memory.spouseLists)) << ", \"adjacency\": " << Num(PerPerson(memory.adjacency))
+          << ", \"idIndex\": " << Num(PerPerson(memory.idIndex)) << "},\n"
+          << "  \"scheduler\": {\"workers\": " << scheduler.workers << ", \"tasks\": " << scheduler.tasks
+          << ", \"steals\": " << scheduler.steals << ", \"idleMs\": " << Num(scheduler.idleMs) << "}\n"
+          << "}\n";
+        return o.str();
+    }
+
+private:
+    static constexpr size_t LARGEST_KEPT = 10;
+
+    template <typename T>
+    static std::string List(const std::vector<T>& v) {
+        std::string s = "[";
+        for (size_t i = 0; i < v.size(); ++i) { if (i) s += ", "; s += std::to_string(v[i]); }
+        return s + "]";
+    }
+    static std::string Num(double v) { char buf[32]; snprintf(buf, sizeof(buf), "%.4g", v); return buf; }
+    static double Ratio(size_t a, size_t b) { return b ? (double)a / b : 0.0; }
+    double PerPerson(size_t bytes) const { return Ratio(bytes, people); }
+    static size_t Weighted(const std::vector<size_t>& hist) {
+        size_t sum = 0;
+        for (size_t k = 0; k < hist.size(); ++k) sum += k * hist[k];
+        return sum;
+    }
+    size_t ChildLinks() const { return Weighted(fanOut); }
+
+    static void AddTo(std::vector<size_t>& hist, size_t k, size_t count = 1) {
+        if (hist.size() <= k) hist.resize(k + 1, 0);
+        hist[k] += count;
+    }
+    static void Merge(std::vector<size_t>& into, const std::vector<size_t>& from) {
+        for (size_t k = 0; k < from.size(); ++k) if (from[k]) AddTo(into, k, from[k]);
+    }
+
+    // Fan-out, family sizes and marriages: independent per person, so each chunk keeps
+    // its own histograms and merges them once
+    void CountPass(const DataModel& m) {
+        std::mutex mergeLock;
+        int maxFan = -1;
+        ParallelFor(m.people.size(), [&](size_t begin, size_t end) {
+            std::vector<size_t> fan, fams, sp;
+            size_t nFams = 0, nMarried = 0, nRemarried = 0, nEx = 0;
+            int bestFan = -1, bestIdx = -1;
+            std::vector<int> partners;
+            for (size_t i = begin; i < end; ++i) {
+                const Person& p = m.people[i];
+                PackedLists::Span kids = m.Children((int)i);
+                AddTo(fan, kids.size());
+                if ((int)kids.size() > bestFan) { bestFan = (int)kids.size(); bestIdx = (int)i; }
+
+                // A family is owned by its father, or by the mother when the father is unknown
+                partners.clear();
+                for (int k : kids) {
+                    const Person& c = m.people[k];
+                    if (c.fatherIdx == (int)i) partners.push_back(c.motherIdx);
+                    else if (c.fatherIdx < 0) partners.push_back(-1);
+                }
+                std::sort(partners.begin(), partners.end());
+                for (size_t a = 0, b; a < partners.size(); a = b) {
+                    for (b = a; b < partners.size() && partners[b] == partners[a]; ++b) {}
+                    AddTo(fams, b - a);
+                    ++nFams;
+                }
+
+                AddTo(sp, p.spouses.size());
+                if (!p.spouses.empty()) ++nMarried;
+                if (p.spouses.size() > 1) ++nRemarried;
+                if (p.spouses.AnyEx()) ++nEx;
+            }
+            std::lock_guard<std::mutex> lock(mergeLock);
+            Merge(fanOut, fan); Merge(familySizes, fams); Merge(spouseCounts, sp);
+            families += nFams; married += nMarried; remarried += nRemarried; withEx += nEx;
+            if (bestFan > maxFan || (bestFan == maxFan && m.people[bestIdx].id < maxFanOutId)) {
+                maxFan = bestFan;
+                maxFanOutId = m.people[bestIdx].id;
+            }
+        });
+        if (fanOut.empty()) fanOut.assign(1, 0);
+    }
+
+    // Generation = length of the longest known parent chain above a person. Kahn's
+    // algorithm over the child index: a person joins the next level once its last
+    // parent has been assigned, and large levels are split across threads.
+    void GenerationPass(const DataModel& m) {
+        size_t n = m.people.size();
+        std::vector<int> depth(n, -1);
+        std::unique_ptr<std::atomic<int>[]> pending(new std::atomic<int>[n]);
+        std::vector<int> level;
+        for (size_t i = 0; i < n; ++i) {
+            const Person& p = m.people[i];
+            int parents = (p.fatherIdx >= 0) + (p.motherIdx >= 0 && p.motherIdx != p.fatherIdx);
+            pending[i].store(parents, std::memory_order_relaxed);
+            if (parents == 0) level.push_back((int)i);
+        }
+
+        const size_t PARALLEL_LEVEL = 4096; // Smaller levels are not worth the threads
+        size_t assigned = 0;
+        for (int g = 0; !level.empty(); ++g) {
+            generations.push_back(level.size());
+            assigned += level.size();
+            std::vector<int> next;
+            std::mutex nextLock;
+            auto expand = [&](size_t begin, size_t end) {
+                std::vector<int> local;
+                for (size_t k = begin; k < end; ++k) {
+                    depth[level[k]] = g;
+                    for (int c : m.Children(level[k]))
+                        if (pending[c].fetch_sub(1, std::memory_order_relaxed) == 1) local.push_back(c);
+                }
+                std::lock_guard<std::mutex> lock(nextLock);
+                next.insert(next.end(), local.begin(), local.end());
+            };
+            if (level.size() >= PARALLEL_LEVEL) ParallelFor(level.size(), expand);
+            else expand(0, level.size());
+            level.swap(next);
+        }
+        unresolved = n - assigned;
+
+        // Deepest person (lowest index on ties), then up through a parent one level above
+        int cur = -1;
+        for (size_t i = 0; i < n; ++i)
+            if (depth[i] >= 0 && (cur < 0 || depth[i] > depth[cur])) cur = (int)i;
+        while (cur >= 0) {
+            longestLineage.push_back(m.people[cur].id);
+            const Person& p = m.people[cur];
+            int up = -1;
+            for (int par : { p.fatherIdx, p.motherIdx })
+                if (up < 0 && par >= 0 && depth[par] == depth[cur] - 1) up = par;
+            cur = up;
+        }
+        std::reverse(longestLineage.begin(), longestLineage.end());
+    }
+
+    // Weakly connected components over parent and spouse links
+    void ComponentPass(const DataModel& m) {
+        size_t n = m.people.size();
+        std::vector<int> root(n);
+        for (size_t i = 0; i < n; ++i) root[i] = (int)i;
+        auto find = [&](int x) {
+            while (root[x] != x) { root[x] = root[root[x]]; x = root[x]; } // Path halving
+            return x;
+        };
+        auto unite = [&](int a, int b) {
+            if (b < 0) return;
+            a = find(a); b = find(b);
+            if (a != b) root[std::max(a, b)] = std::min(a, b);
+        };
+        for (size_t i = 0; i < n; ++i) {
+            unite((int)i, m.people[i].fatherIdx);
+            unite((int)i, m.people[i].motherIdx);
+            for (int sp : m.Spouses((int)i)) unite((int)i, sp);
+        }
+
+        std::vector<int> size(n, 0);
+        for (size_t i = 0; i < n; ++i) ++size[find((int)i)];
+        std::vector<size_t> sizes;
+        for (size_t i = 0; i < n; ++i) {
+            if (size[i] == 0) continue;
+            ++components;
+            if (size[i] == 1) ++singletons;
+            sizes.push_back(size[i]);
+        }
+        const size_t largest = LARGEST_KEPT; // std::min binds a reference, which would need a definition before C++17
+        size_t keep = std::min(sizes.size(), largest);
+        std::partial_sort(sizes.begin(), sizes.begin() + keep, sizes.end(), std::greater<size_t>());
+        largestComponents.assign(sizes.begin(), sizes.begin() + keep);
+    }
+};
+
+// Shortest chain of parent, child and spouse links between two people: a bidirectional
+// BFS that always grows the smaller frontier by one level. Each person's visit marks for
+// both sides sit together and carry the number of the query that set them, so nothing is
+// cleared between queries and the array only grows (geometrically) with the archive: a
+// query costs what it explores rather than the size of the archive.
+class RelationFinder {
+public:
+    enum class Link : unsigned char { Start, Parent, Child, Spouse }; // Step i is this relative of step i - 1
+    struct Step { int idx; Link link; };
+
+    // Dense indices of `m`, from `from` to `to`; empty when they are not connected
+    std::vector<Step> Find(const DataModel& m, int from, int to) {
+        std::vector<Step> path;
+        size_t n = m.people.size();
+        if (from < 0 || to < 0 || (size_t)from >= n || (size_t)to >= n) return path;
+        if (from == to) return { {from, Link::Start} };
+        if (marks.size() < n) {
+            marks.reserve(std::max(n, marks.capacity() * 2));
+            marks.resize(n);
+        }
+        if (++query == 0) { // Wrapped: marks of 2^32 queries ago would look current
+            std::fill(marks.begin(), marks.end(), Mark());
+            query = 1;
+        }
+
+        int meet = Search(m, from, to);
+        if (meet >= 0) {
+            for (int v = meet; v >= 0; v = marks[v].prev[0]) path.push_back({v, Link::Start});
+            std::reverse(path.begin(), path.end());
+            for (int v = marks[meet].prev[1]; v >= 0; v = marks[v].prev[1]) path.push_back({v, Link::Start});
+            for (size_t k = 1; k < path.size(); ++k) path[k].link = LinkBetween(m, path[k - 1].idx, path[k].idx);
+        }
+        return path;
+    }
+
+    // "Ana > father Budi > wife Citra", shortened in the middle past `maxSteps`
+    static std::wstring Describe(const DataModel& m, const std::vector<Step>& path, size_t maxSteps = 8) {
+        std::wstring s;
+        for (size_t k = 0; k < path.size(); ++k) {
+            if (path.size() > maxSteps + 1 && k == maxSteps / 2) {
+                s += L" > ...";
+                k = path.size() - 1 - maxSteps / 2;
+            }
+            const Person& p = m.people[path[k].idx];
+            if (k) s += std::wstring(L" > ") + LinkName(path[k].link, p) + L" ";
+            s += p.name;
+        }
+        return s;
+    }
+
+private:
+    // Side 0 grows from `from`, side 1 from `to`
+    struct Mark {
+        uint32_t seen[2] = {0, 0}; // Query that reached the person from that side
+        int prev[2];               // Relative one step closer to that side's start, -1 at the start
+    };
+    std::vector<Mark> marks;
+    uint32_t query = 0;
+    std::vector<int> frontier[2], next;
+
+    static const wchar_t* LinkName(Link l, const Person& p) {
+        switch (l) {
+            case Link::Parent: return p.IsFemale() ? L"mother" : L"father";
+            case Link::Child:  return p.IsFemale() ? L"daughter" : L"son";
+            case Link::Spouse: return p.IsFemale() ? L"wife" : L"husband";
+            default:           return L"";
+        }
+    }
+
+    bool Seen(int s, int v) const { return marks[v].seen[s] == query; }
+
+    void Visit(int s, int v, int from) {
+        marks[v].seen[s] = query;
+        marks[v].prev[s] = from;
+    }
+
+    template <typename Fn>
+    static void ForEachRelative(const DataModel& m, int u, Fn fn) {
+        const Person& p = m.people[u];
+        if (p.fatherIdx >= 0) fn(p.fatherIdx);
+        if (p.motherIdx >= 0) fn(p.motherIdx);
+        for (int c : m.Children(u)) fn(c);
+        for (int sp : m.Spouses(u)) fn(sp);
+    }
+
+    // Person where the two searches meet, -1 if they never do. The first level that meets
+    // gives a shortest chain: every node the other side reached earlier has already been
+    // expanded, so a shorter meeting would have been found on an earlier level.
+    int Search(const DataModel& m, int from, int to) {
+        Visit(0, from, -1);
+        Visit(1, to, -1);
+        frontier[0].assign(1, from);
+        frontier[1].assign(1, to);
+        while (!frontier[0].empty() && !frontier[1].empty()) {
+            int s = (frontier[0].size() <= frontier[1].size()) ? 0 : 1;
+            next.clear();
+            int meet = -1;
+            for (int u : frontier[s]) {
+                ForEachRelative(m, u, [&](int v) {
+                    if (meet >= 0 || Seen(s, v)) return;
+                    Visit(s, v, u);
+                    if (Seen(1 - s, v)) meet = v;
+                    next.push_back(v);
+                });
+                if (meet >= 0) return meet;
+            }
+            frontier[s].swap(next);
+        }
+        return -1;
+    }
+
+    static Link LinkBetween(const DataModel& m, int a, int b) {
+        const Person& p = m.people[a];
+        if (b == p.fatherIdx || b == p.motherIdx) return Link::Parent;
+        const Person& q = m.people[b];
+        if (a == q.fatherIdx || a == q.motherIdx) return Link::Child;
+        return Link::Spouse;
+    }
+};
+
+// Reachability labels for one direction of the parent/child DAG. Every person gets a
+// post-order number in a spanning forest (one tree parent each: the last one met in
+// topological order, which keeps a lineage in one subtree rather than under a married-in
+// root), so a subtree is a range of numbers. Whoever a person reaches is then a short
+// sorted list of disjoint ranges: their own subtree, plus what the other (non-tree) edges
+// add, merged bottom-up. Queries binary-search that list, and the range lengths give an
+// exact head count: someone reached along two lines is counted once.
+//
+// Heavily intermarried data can need long lists. A person whose list would pass
+// MAX_RANGES (or the memory budget) keeps none; their queries expand through successors
+// until labeled people are met. Whoever reaches such a person keeps their own list all
+// the same, with the unlabeled people they reach first as holes beside it (up to
+// MAX_HOLES), so one overflow does not strip the labels of every ancestor: queries read
+// the ranges and walk on from the holes only. The scratch buffers make queries
+// single-threaded.
+class ReachLabels {
+public:
+    struct Range { int lo, hi; }; // Inclusive post-order numbers
+
+    static constexpr size_t MAX_RANGES = 64;        // Per person
+    static constexpr size_t MAX_HOLES = 8;          // Per person
+    static constexpr size_t BUDGET_PER_PERSON = 8;  // Ranges and holes in all, averaged over people
+
+    // succ(v, fn) calls fn(w) for each edge v -> w of the n people
+    template <typename Succ>
+    void Build(size_t n, const Succ& succ) {
+        std::vector<int> order = TopologicalOrder(n, succ);
+        NumberForest(n, order, succ);
+
+        // Until its successors are merged in, a person only reaches their own subtree.
+        // Members of a cycle (broken files) are never merged and keep just that.
+        ranges.clear();
+        rangeAt.resize(n);
+        rangeLen.assign(n, 1);
+        for (size_t v = 0; v < n; ++v) {
+            rangeAt[v] = (int)ranges.size();
+            ranges.push_back({ low[v], post[v] });
+        }
+        holes.clear();
+        holeAt.assign(n, 0);
+        holeLen.assign(n, 0);
+        const size_t budget = n * BUDGET_PER_PERSON;
+        std::vector<Range> merged;
+        std::vector<int> open; // Unlabeled people reached, directly or through labeled ones
+        for (size_t k = order.size(); k-- > 0;) {
+            int v = order[k];
+            merged.assign(1, ranges[rangeAt[v]]);
+            open.clear();
+            succ(v, [&](int w) {
+                if (rangeLen[w] == 0) {
+                    open.push_back(w);
+                    return;
+                }
+                merged.insert(merged.end(), First(w), First(w) + rangeLen[w]);
+                open.insert(open.end(), FirstHole(w), FirstHole(w) + holeLen[w]);
+            });
+            if (open.empty() && merged.size() == 1) continue;
+            Coalesce(merged);
+            std::sort(open.begin(), open.end());
+            open.erase(std::unique(open.begin(), open.end()), open.end());
+            if (merged.size() > MAX_RANGES || open.size() > MAX_HOLES ||
+                ranges.size() + merged.size() + holes.size() + open.size() > budget) {
+                rangeLen[v] = 0;
+                continue;
+            }
+            rangeAt[v] = (int)ranges.size();
+            rangeLen[v] = (int)merged.size();
+            ranges.insert(ranges.end(), merged.begin(), merged.end());
+            holeAt[v] = (int)holes.size();
+            holeLen[v] = (int)open.size();
+            holes.insert(holes.end(), open.begin(), open.end());
+        }
+        Compact();
+
+        reached.assign(n, -1);
+        for (size_t v = 0; v < n; ++v) if (Closed((int)v)) reached[v] = Total(First((int)v), rangeLen[v]);
+        seen.Resize(n, false);
+    }
+
+    // Labeled without holes: queries read the list alone
+    bool Closed(int v) const { return rangeLen[v] > 0 && holeLen[v] == 0; }
+
+    // Whether `to` can be reached from `from` (everyone reaches themselves)
+    template <typename Succ>
+    bool Reaches(int from, int to, const Succ& succ) const {
+        int p = post[to];
+        if (Closed(from)) return Contains(First(from), rangeLen[from], p);
+        return Walk(from, succ, [&](const Range* r, int len) { return Contains(r, len, p); });
+    }
+
+    // Number of people reached from v, v excluded
+    template <typename Succ>
+    int Count(int v, const Succ& succ) const {
+        if (reached[v] < 0) {
+            Expand(v, succ);
+            reached[v] = Total(scratch.data(), (int)scratch.size());
+        }
+        return reached[v] - 1;
+    }
+
+    // Whether a and b reach someone in common
+    template <typename Succ>
+    bool Overlap(int a, int b, const Succ& succ) const {
+        if (!Closed(a)) std::swap(a, b);
+        const Range* p = First(a);
+        int plen = rangeLen[a];
+        if (!Closed(a)) {
+            Expand(a, succ);
+            p = scratch.data();
+            plen = (int)scratch.size();
+        }
+        if (Closed(b)) return Intersects(p, plen, First(b), rangeLen[b]);
+        return Walk(b, succ, [&](const Range* r, int len) { return Intersects(p, plen, r, len); });
+    }
+
+    size_t RangeCount() const { return ranges.size(); }
+
+private:
+    std::vector<int> post;      // Post-order number per person
+    std::vector<int> low;       // Lowest number in each person's subtree
+    std::vector<int> rangeAt;   // Offset of each person's ranges in `ranges`
+    std::vector<int> rangeLen;  // 0 = unlabeled
+    std::vector<Range> ranges;
+    std::vector<int> holeAt, holeLen, holes; // Unlabeled people a labeled person reaches first
+    mutable std::vector<int> reached; // Sum of range lengths, the person included; -1 = not yet counted
+
+    // Query scratch for unlabeled people
+    mutable std::vector<Range> scratch;
+    mutable RowBitmap seen;
+    mutable std::vector<int> stack, touched;
+
+    const Range* First(int v) const { return ranges.data() + rangeAt[v]; }
+    const int* FirstHole(int v) const { return holes.data() + holeAt[v]; }
+
+    static int Total(const Range* r, int count) {
+        int c = 0;
+        for (int i = 0; i < count; ++i) c += r[i].hi - r[i].lo + 1;
+        return c;
+    }
+
+    static bool Contains(const Range* r, int len, int p) {
+        const Range* it = std::upper_bound(r, r + len, p, [](int x, const Range& q) { return x < q.lo; });
+        return it != r && it[-1].hi >= p;
+    }
+
+    static bool Intersects(const Range* p, int plen, const Range* q, int qlen) {
+        const Range *pe = p + plen, *qe = q + qlen;
+        while (p != pe && q != qe) {
+            if (p->hi < q->lo) ++p;
+            else if (q->hi < p->lo) ++q;
+            else return true;
+        }
+        return false;
+    }
+
+    // Sorts and joins overlapping or adjacent ranges
+    static void Coalesce(std::vector<Range>& rs) {
+        std::sort(rs.begin(), rs.end(), [](const Range& a, const Range& b) { return a.lo < b.lo; });
+        size_t out = 0;
+        for (size_t i = 1; i < rs.size(); ++i) {
+            if (rs[i].lo <= rs[out].hi + 1) rs[out].hi = std::max(rs[out].hi, rs[i].hi);
+            else rs[++out] = rs[i];
+        }
+        if (!rs.empty()) rs.resize(out + 1);
+    }
+
+    // Walks from v through the unlabeled people it reaches, handing visit(ranges, count)
+    // the list of each labeled person met (whose successors it covers, but for the holes
+    // the walk goes on from) and the single number of each unlabeled one. Stops once
+    // visit returns true.
+    template <typename Succ, typename Visit>
+    bool Walk(int v, const Succ& succ, Visit visit) const {
+        bool found = false;
+        stack.assign(1, v);
+        touched.assign(1, v);
+        seen.Set(v);
+        auto push = [&](int w) {
+            if (seen.Test(w)) return;
+            seen.Set(w);
+            touched.push_back(w);
+            stack.push_back(w);
+        };
+        while (!stack.empty() && !found) {
+            int u = stack.back();
+            stack.pop_back();
+            if (rangeLen[u] > 0) {
+                found = visit(First(u), rangeLen[u]);
+                std::for_each(FirstHole(u), FirstHole(u) + holeLen[u], push);
+                continue;
+            }
+            Range self = { post[u], post[u] };
+            found = visit(&self, 1);
+            succ(u, push);
+        }
+        for (int u : touched) seen.Reset(u);
+        return found;
+    }
+
+    // Everything v reaches when not closed, as one list in `scratch`
+    template <typename Succ>
+    void Expand(int v, const Succ& succ) const {
+        scratch.clear();
+        Walk(v, succ, [&](const Range* r, int len) { scratch.insert(scratch.end(), r, r + len); return false; });
+        Coalesce(scratch);
+    }
+
+    // Kahn's order; people on or below a cycle are left out
+    template <typename Succ>
+    static std::vector<int> TopologicalOrder(size_t n, const Succ& succ) {
+        std::vector<int> indeg(n, 0), order;
+        order.reserve(n);
+        for (size_t v = 0; v < n; ++v) succ((int)v, [&](int w) { indeg[w]++; });
+        for (size_t v = 0; v < n; ++v) if (indeg[v] == 0) order.push_back((int)v);
+        for (size_t k = 0; k < order.size(); ++k)
+            succ(order[k], [&](int w) { if (--indeg[w] == 0) order.push_back(w); });
+        return order;
+    }
+
+    // Fills `post` and `low` by an iterative DFS over the spanning forest
+    template <typename Succ>
+    void NumberForest(size_t n, const std::vector<int>& order, const Succ& succ) {
+        std::vector<int> parent(n, -1);
+        for (int v : order) succ(v, [&](int w) { parent[w] = v; });
+
+        std::vector<int> start(n + 1, 0), kids;
+        for (size_t v = 0; v < n; ++v) if (parent[v] >= 0) start[parent[v] + 1]++;
+        for (size_t v = 0; v < n; ++v) start[v + 1] += start[v];
+        kids.resize(start[n]);
+        std::vector<int> fill(start.begin(), start.end() - 1);
+        for (size_t v = 0; v < n; ++v) if (parent[v] >= 0) kids[fill[parent[v]]++] = (int)v;
+
+        post.assign(n, -1);
+        low.assign(n, 0);
+        std::vector<int> path;
+        int next = 0;
+        for (size_t root = 0; root < n; ++root) {
+            if (parent[root] >= 0) continue;
+            path.push_back((int)root);
+            fill[root] = start[root];
+            low[root] = next;
+            while (!path.empty()) {
+                int v = path.back();
+                if (fill[v] < start[v + 1]) {
+                    int c = kids[fill[v]++];
+                    fill[c] = start[c];
+                    low[c] = next;
+                    path.push_back(c);
+                } else {
+                    post[v] = next++;
+                    path.pop_back();
+                }
+            }
+        }
+    }
+
+    // Drops the superseded and unused ranges and holes, keeping each person's lists contiguous
+    void Compact() {
+        std::vector<Range> packed;
+        std::vector<int> packedHoles;
+        size_t total = 0, totalHoles = 0;
+        for (size_t v = 0; v < rangeAt.size(); ++v) {
+            if (rangeLen[v] == 0) holeLen[v] = 0;
+            total += rangeLen[v];
+            totalHoles += holeLen[v];
+        }
+        packed.reserve(total);
+        packedHoles.reserve(totalHoles);
+        for (size_t v = 0; v < rangeAt.size(); ++v) {
+            const Range* r = First((int)v);
+            rangeAt[v] = (int)packed.size();
+            packed.insert(packed.end(), r, r + rangeLen[v]);
+            const int* h = FirstHole((int)v);
+            holeAt[v] = (int)packedHoles.size();
+            packedHoles.insert(packedHoles.end(), h, h + holeLen[v]);
+        }
+        ranges.swap(packed);
+        holes.swap(packedHoles);
+    }
+};
+
+// Precomputed lineage questions over a DataModel: exact descendant and ancestor counts
+// (pedigree collapse counted once) and O(log k) "descends from" / "blood relatives"
+// tests, k being a person's range count (one to four in most families). Built in about
+// linear time, both directions at once. It keeps its own copy of the parent links, so
+// Build can run on another thread while the model changes; the answers are about the
+// rows of the model as it was when the index was made.
+class LineageIndex {
+public:
+    explicit LineageIndex(const DataModel& m) : father(m.people.size()), mother(m.people.size()) {
+        for (size_t i = 0; i < m.people.size(); ++i) {
+            const Person& p = m.people[i];
+            father[i] = p.fatherIdx;
+            mother[i] = (p.motherIdx != p.fatherIdx) ? p.motherIdx : -1;
+        }
+    }
+
+    // False once cancelled, leaving the index unusable
+    bool Build(const CancelToken* cancel = nullptr) {
+        size_t n = father.size();
+        kidStart.assign(n + 1, 0); // Children per parent (counting sort)
+        for (size_t i = 0; i < n; ++i) {
+            if (father[i] >= 0) kidStart[father[i] + 1]++;
+            if (mother[i] >= 0) kidStart[mother[i] + 1]++;
+        }
+        for (size_t i = 0; i < n; ++i) kidStart[i + 1] += kidStart[i];
+        kids.resize(kidStart[n]);
+        std::vector<int> fill(kidStart.begin(), kidStart.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            if (father[i] >= 0) kids[fill[father[i]]++] = (int)i;
+            if (mother[i] >= 0) kids[fill[mother[i]]++] = (int)i;
+        }
+        if (cancel && cancel->Cancelled()) return false;
+        ParallelFor(2, [&](size_t begin, size_t end) {
+            for (size_t dir = begin; dir < end; ++dir) {
+                if (dir == 0) down.Build(n, Down{ this });
+                else up.Build(n, Up{ this });
+            }
+        }, cancel);
+        return !(cancel && cancel->Cancelled());
+    }
+
+    int Descendants(int idx) const { return down.Count(idx, Down{ this }); }
+    int Ancestors(int idx) const { return up.Count(idx, Up{ this }); }
+
+    bool DescendsFrom(int idx, int ancestor) const {
+        if (idx == ancestor) return false;
+        if (up.Closed(idx) || !down.Closed(ancestor)) return up.Reaches(idx, ancestor, Up{ this });
+        return down.Reaches(ancestor, idx, Down{ this });
+    }
+
+    // Someone is an ancestor of both (or one descends from the other)
+    bool BloodRelated(int a, int b) const { return up.Overlap(a, b, Up{ this }); }
+
+    size_t RangeCount() const { return down.RangeCount() + up.RangeCount(); }
+
+private:
+    struct Down {
+        const LineageIndex* l;
+        template <typename Fn> void operator()(int v, Fn fn) const {
+            for (int k = l->kidStart[v]; k < l->kidStart[v + 1]; ++k) fn(l->kids[k]);
+        }
+    };
+    struct Up {
+        const LineageIndex* l;
+        template <typename Fn> void operator()(int v, Fn fn) const {
+            if (l->father[v] >= 0) fn(l->father[v]);
+            if (l->mother[v] >= 0) fn(l->mother[v]);
+        }
+    };
+
+    std::vector<int> father, mother; // Row indices, -1 = none; a mother equal to the father is dropped
+    std::vector<int> kidStart, kids;
+    ReachLabels down, up;
+};
+
+// -----------------------------------------------------------------------------
+// 4. LAYOUT ENGINE
+// -----------------------------------------------------------------------------
+enum class LayoutMode {
+    Descendants, // Classic top-down forest from generation-0 roots
+    Dag,         // Pedigree-collapse aware: every person once, proxies for extra links
+    Ancestors,   // Pedigree chart of the focus person, ancestors fanning upward
+    Hourglass,   // Ancestors above the focus person, descendants below
+    FanAncestors,   // Radial fan chart: focus in the middle, ancestors on outer rings
+    FanDescendants, // Radial fan chart: focus in the middle, descendants on outer rings
+    Timeline,       // Lifeline bars on a horizontal time axis keyed by birth year
+};
+
+// A linked stand-in box for someone whose real box lives elsewhere in the layout
+struct ProxyNode {
+    int personId;
+    int x, y;
+};
+
+// One wedge of a fan chart: ring = generations from the focus person (0 = center disc),
+// angles in degrees clockwise from 12 o'clock
+struct FanSlot {
+    int personId;
+    int ring;
+    float a0, a1;
+    bool proxy;
+};
+
+// Timeline bar: [x0, x1) spans [fromYear, toYear]; estimated when the birth year was
+// inferred from relatives instead of read from the CSV
+struct Lifeline {
+    int personId;
+    int x0, x1, y;
+    int fromYear, toYear;
+    bool estimated;
+    bool died;      // toYear is a recorded death year
+};
+
+// Connector routed by the layout itself (used by modes that do not follow the
+// "spouses side by side, children below the couple" assumption of the renderer)
+struct Connector {
+    enum Kind { Spouse, SpouseEx, Child } kind;
+    POINT from; // Spouse: edge of the first box; Child: drop point between the parents
+    POINT to;   // Spouse: edge of the second box; Child: top center of the child box
+    int fromIdx; // Dense index of the first spouse / a parent
+    int toIdx;   // Dense index of the second spouse / the child
+};
+
+class LayoutEngine {
+    const DataModel* model;
+    std::map<int, std::pair<int, int>> subtreeMetrics; // <id, {width, centerOffset}>
+    std::map<int, int> nodeOwner; // <person_id, root_id>
+    bool forestReady = false;     // gens, genSweep and nodeOwner are the last descendants pass's
+    static const int GEN_SWEEPS = 20; // Most sweeps CalculateGenerations makes
+    std::map<int, int> orderKey;  // <person_id, rank> from the crossing pass; empty = ID order
+    std::map<int, int> layoutParent; // <person_id, id of the box it was placed under>
+    std::vector<int> unmeasured;     // Children given a zero width by PlacedWidth
+    std::map<int, std::vector<int>> childOrder; // <person_id, GetChildren result>
+    std::vector<int> placeOrder;     // Placement (pre-)order of the last layout pass
+    std::vector<int> rootOrder;      // Root families in the order they were laid out
+    std::vector<std::vector<int>> dagSlotX; // DAG mode: x of each spouse slot per cluster head
+    std::vector<uint64_t> placedBits; // Bit i set once person i has a box
+
+public:
+    int totalWidth = 1000;
+    int totalHeight = 1000;
+
+    LayoutMode mode = LayoutMode::Descendants;
+    int focusId = 0; // Person the focus charts are built around (0 = default)
+    std::vector<ProxyNode> proxies;
+    std::vector<Connector> connectors;
+    std::vector<FanSlot> fan;       // Fan modes only (people stay unplaced)
+    POINT fanCenter = {0, 0};
+    int fanRings = 0;
+    std::vector<Lifeline> timeline; // Timeline mode only
+    int timelineFirstYear = 0;      // Year at the left edge of the time axis
+    int timelineLastYear = 0;
+    bool routesConnectors = false; // True when `connectors` replaces the renderer's own routing
+
+    // Per-person layout state, indexed like model->people. The model itself is never
+    // written, so several engines can lay out the same model side by side.
+    std::vector<int> boxX, boxY; // Top-left of each box; only meaningful when Placed
+    std::vector<int> gens;       // Generation (descendants / DAG modes)
+    std::vector<int> genSweep;   // Sweep of CalculateGenerations that set gens[i], 0 if it fell back
+    std::vector<int> placed;     // Indices of the placed people, ascending (after Recalculate)
+
+    bool Placed(int idx) const { return (placedBits[idx >> 6] >> (idx & 63)) & 1; }
+
+    // Ink extent of the last layout, box shadows included; totalWidth/Height add a margin
+    RECT inkBounds = {0, 0, 0, 0};
+    int legendClearY = 0; // Lowest ink in the bottom-left legend's column
+
+    // Boxes bucketed into generation rows (one per BOX_HEIGHT + V_GAP band below the
+    // topmost box): the ink extent of each row and its people as a CSR list (row r is
+    // rowMembers[rowStart[r] .. rowStart[r + 1])). Lets hit tests skip whole rows.
+    std::vector<RECT> rowBounds;
+    std::vector<int> rowStart, rowMembers;
+
+    // Crossing minimization (off by default; toggled from the UI)
+    bool minimizeCrossings = false;
+    int crossingsBefore = 0;
+    int crossingsAfter = 0;
+
+    // Polled by Recalculate between passes and root families (reloads built in the
+    // background) and handed to its ParallelFor calls; a cancelled layout is left
+    // incomplete, for the caller to discard
+    const CancelToken* cancel = nullptr;
+
+    LayoutEngine(const DataModel* m) : model(m) {}
+
+    // Points the engine at another model (e.g. a filtered subset); call Recalculate after
+    void SetModel(const DataModel* m) { model = m; }
+
+    void Recalculate() {
+        ResetState();
+        if (model->people.empty()) { FinalizeBounds(); return; }
+
+        if (mode == LayoutMode::Timeline) {
+            LayoutTimeline();
+        } else if (IsFanMode()) {
+            LayoutFan(mode == LayoutMode::FanAncestors);
+        } else if (mode == LayoutMode::Ancestors || mode == LayoutMode::Hourglass) {
+            // Focus charts only walk the focus person's lines (no generations/ownership pass)
+            LayoutFocusChart(mode == LayoutMode::Hourglass);
+        } else if (mode == LayoutMode::Dag) {
+            CalculateGenerations();
+            if (Stopped()) return;
+            LayoutDag();
+        } else {
+            CalculateGenerations();
+            if (Stopped()) return;
+            AssignOwnership();
+            if (Stopped()) return;
+            forestReady = true;
+            PlaceForest();
+            if (Stopped()) return;
+            if (minimizeCrossings) MinimizeCrossings();
+        }
+
+        FinalizeBounds();
+    }
+
+    bool Stopped() const { return cancel && cancel->Cancelled(); }
+
+    // Relayout after an edit. The descendants layout keeps the subtree widths and child
+    // orders of every box the edit cannot reach: only the touched people, anyone whose
+    // root family changed, and everyone above them (parents, spouses, the box they hung
+    // under) are measured again. Generations and root families are updated around the
+    // edit (UpdateGenerations, UpdateOwnership) when the last pass was a descendants pass
+    // of the same model. Other modes and the crossing pass lay out from scratch.
+    void Recalculate(const ModelDiff& diff) {
+        if (mode != LayoutMode::Descendants || minimizeCrossings || model->people.empty()) {
+            Recalculate();
+            return;
+        }
+        bool incremental = forestReady;
+        auto metrics = std::move(subtreeMetrics);
+        auto kids = std::move(childOrder);
+        auto oldOwner = std::move(nodeOwner);
+        auto oldParent = std::move(layoutParent);
+        auto oldGens = std::move(gens);
+        auto oldSweep = std::move(genSweep);
+        for (int id : unmeasured) metrics.erase(id); // Placeholder widths depend on the pass order
+        ResetState();
+        childOrder = std::move(kids);
+
+        std::set<int> dirty;
+        bool owned = false; // Ownership of the new version is known
+        auto spread = [&](std::vector<int> stack) {
+            while (!stack.empty()) {
+                int id = stack.back();
+                stack.pop_back();
+                if (!dirty.insert(id).second) continue;
+                metrics.erase(id);
+                childOrder.erase(id);
+                auto up = oldParent.find(id);
+                if (up != oldParent.end() && up->second != 0) stack.push_back(up->second);
+                int idx = model->IndexOf(id);
+                if (idx < 0) continue;
+                const Person* p = &model->people[idx];
+                if (p->fatherId != 0) stack.push_back(p->fatherId);
+                if (p->motherId != 0) stack.push_back(p->motherId);
+                for (int sid : p->spouses) stack.push_back(sid);
+                for (int k : model->Spouses(idx)) stack.push_back(model->people[k].id); // Listed on their side only
+                if (owned) CrossRootKids(id, stack);
+            }
+        };
+
+        // Child orders must be current before ownership is claimed through them
+        std::vector<int> seeds = diff.touchedIds;
+        for (int i : diff.relinked) seeds.push_back(model->people[i].id);
+        spread(std::move(seeds));
+        seeds.clear();
+        if (incremental) {
+            gens = std::move(oldGens);
+            genSweep = std::move(oldSweep);
+            nodeOwner = std::move(oldOwner);
+            UpdateOwnership(diff, UpdateGenerations(diff), seeds);
+        } else {
+            CalculateGenerations();
+            AssignOwnership();
+            for (const auto& o : nodeOwner) {
+                auto it = oldOwner.find(o.first);
+                if (it == oldOwner.end() || it->second != o.second) seeds.push_back(o.first);
+            }
+            for (const auto& o : oldOwner) if (!nodeOwner.count(o.first)) seeds.push_back(o.first);
+        }
+        forestReady = true;
+
+        owned = true;
+        for (int id : dirty) CrossRootKids(id, seeds);
+        spread(std::move(seeds));
+
+        subtreeMetrics = std::move(metrics);
+        PlaceForest();
+        FinalizeBounds();
+    }
+
+    static const wchar_t* ModeName(LayoutMode m) {
+        switch (m) {
+            case LayoutMode::Dag:       return L"Pedigree collapse (DAG)";
+            case LayoutMode::Ancestors: return L"Ancestors";
+            case LayoutMode::Hourglass: return L"Hourglass";
+            case LayoutMode::FanAncestors:   return L"Fan chart (ancestors)";
+            case LayoutMode::FanDescendants: return L"Fan chart (descendants)";
+            case LayoutMode::Timeline:       return L"Timeline";
+            default:                    return L"Descendants";
+        }
+    }
+
+    // Person whose box (real or proxy) contains the canvas point, 0 if none
+    int HitTest(int x, int y) const {
+        if (!fan.empty()) {
+            double dx = x - fanCenter.x, dy = y - fanCenter.y;
+            double r = std::sqrt(dx * dx + dy * dy);
+            double a = std::atan2(dx, -dy) * 180.0 / 3.14159265358979;
+            for (const auto& w : fan) {
+                if (r < RingInner(w.ring) || r >= RingOuter(w.ring)) continue;
+                if (w.ring == 0 || (a >= w.a0 && a < w.a1)) return w.personId;
+            }
+            return 0;
+        }
+        for (const auto& l : timeline)
+            if (x >= l.x0 && x < l.x1 && y >= l.y && y < l.y + Config::TL_BAR_HEIGHT) return l.personId;
+        auto inside = [&](int bx, int by) {
+            return x >= bx && x < bx + Config::BOX_WIDTH && y >= by && y < by + Config::BOX_HEIGHT;
+        };
+        if (!rowStart.empty()) {
+            for (size_t r = 0; r < rowBounds.size(); ++r) {
+                const RECT& b = rowBounds[r];
+                if (x < b.left || x >= b.right || y < b.top || y >= b.bottom) continue;
+                for (int k = rowStart[r]; k < rowStart[r + 1]; ++k) {
+                    int i = rowMembers[k];
+                    if (inside(boxX[i], boxY[i])) return model->people[i].id;
+                }
+            }
+        } else {
+            for (int i : placed)
+                if (inside(boxX[i], boxY[i])) return model->people[i].id;
+        }
+        for (const auto& px : proxies)
+            if (inside(px.x, px.y)) return px.personId;
+        return 0;
+    }
+
+    bool IsFanMode() const { return mode == LayoutMode::FanAncestors || mode == LayoutMode::FanDescendants; }
+    bool IsFocusMode() const {
+        return mode == LayoutMode::Ancestors || mode == LayoutMode::Hourglass || IsFanMode();
+    }
+
+    // Canvas x of a year on the timeline axis
+    int TimelineX(int year) const { return 50 + (year - timelineFirstYear) * Config::TL_PX_PER_YEAR; }
+
+    // Ring r spans [RingInner(r), RingOuter(r)); ring 0 is the center disc
+    static int RingInner(int r) { return (r == 0) ? 0 : Config::FAN_CENTER_R + (r - 1) * Config::FAN_RING_W; }
+    static int RingOuter(int r) { return Config::FAN_CENTER_R + r * Config::FAN_RING_W; }
+
+    static LayoutMode NextMode(LayoutMode m) {
+        switch (m) {
+            case LayoutMode::Descendants: return LayoutMode::Dag;
+            case LayoutMode::Dag:         return LayoutMode::Ancestors;
+            case LayoutMode::Ancestors:   return LayoutMode::Hourglass;
+            case LayoutMode::Hourglass:   return LayoutMode::FanAncestors;
+            case LayoutMode::FanAncestors: return LayoutMode::FanDescendants;
+            case LayoutMode::FanDescendants: return LayoutMode::Timeline;
+            default:                      return LayoutMode::Descendants;
+        }
+    }
+
+    // Focus person for the ancestor/hourglass charts: the explicit choice if it still
+    // exists, otherwise whoever is marked "Myself", otherwise the first person
+    int FocusIndex() const {
+        int idx = model->IndexOf(focusId);
+        if (idx >= 0) return idx;
+        for (size_t i = 0; i < model->people.size(); ++i)
+            if (model->people[i].role.find(L"Myself") != std::wstring::npos) return (int)i;
+        return model->people.empty() ? -1 : 0;
+    }
+
+    // ID of the root family person `id` was laid out under, 0 outside the forest modes
+    int OwnerRoot(int id) const {
+        auto it = nodeOwner.find(id);
+        return (it != nodeOwner.end()) ? it->second : 0;
+    }
+
+private:
+    void PlaceForest() {
+        int currentX = 50;
+        int currentY = 50;
+        std::set<int> placed;
+
+        // Roots in insertion order (ID order typically), or by rank once the crossing pass ran
+        std::vector<int> roots;
+        for (size_t i = 0; i < model->people.size(); ++i) {
+            const Person& p = model->people[i];
+            // Process Gen 0 Roots
+            if (gens[i] != 0) continue;
+
+            // If part of a marriage, only layout the "Canonical" root (smallest ID)
+            int minId = p.id;
+            for(int sid : p.spouses) minId = std::min(minId, sid);
+            if (p.id > minId) continue;
+
+            // Sanity: Do I own myself?
+            if (nodeOwner[p.id] != p.id) continue;
+            roots.push_back(p.id);
+        }
+        if (!orderKey.empty()) {
+            std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) { return OrderKey(a) < OrderKey(b); });
+        }
+        rootOrder = roots;
+
+        for (int rootId : roots) {
+            if (placed.count(rootId)) continue;
+            if (Stopped()) return;
+
+            // Smart Gap Logic: Reduce gap if this tree relates to the previous one
+            int gap = 0;
+            if (!placed.empty()) {
+                gap = IsConnectedToPlaced(rootId, placed) ? Config::H_GAP : Config::TREE_GAP;
+            }
+            currentX += gap;
+
+            ComputeSubtreeSize(rootId, rootId);
+            PositionSubtree(rootId, currentX, currentY, placed, rootId);
+            currentX += subtreeMetrics[rootId].first;
+        }
+    }
+
+    void ResetPositions() {
+        ClearPlacement();
+        subtreeMetrics.clear();
+        unmeasured.clear();
+        childOrder.clear();
+        layoutParent.clear();
+        placeOrder.clear();
+    }
+
+    // --- Crossing minimization -------------------------------------------------
+    // Layered barycenter heuristic. Each sweep computes, per layer, the mean x of every
+    // box's neighbours in the adjacent layer (parents on a down sweep, children on an up
+    // sweep, plus spouses placed elsewhere), sums those pulls up each placed subtree and
+    // re-ranks siblings and root families by the result. The layout is rebuilt after each
+    // sweep and the ordering with the fewest parent-child crossings is kept.
+    void MinimizeCrossings() {
+        auto start = std::chrono::steady_clock::now();
+        auto elapsedMs = [&]() {
+            return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        };
+
+        crossingsBefore = CountCrossings();
+        crossingsAfter = crossingsBefore;
+        std::map<int, int> bestKeys = orderKey;
+
+        for (int sweep = 0; sweep < Config::CROSSING_MAX_SWEEPS && crossingsAfter > 0; ++sweep) {
+            if (elapsedMs() > Config::CROSSING_BUDGET_MS || Stopped()) break;
+
+            RankByBarycenter(sweep % 2 == 0);
+            ResetPositions();
+            PlaceForest();
+
+            int c = CountCrossings();
+            if (c < crossingsAfter) {
+                crossingsAfter = c;
+                bestKeys = orderKey;
+            }
+        }
+
+        // Restore the best ordering found (the last sweep may have been worse)
+        if (bestKeys != orderKey) {
+            orderKey = bestKeys;
+            ResetPositions();
+            PlaceForest();
+        }
+
+        // Refine root family order with adjacent exchanges while budget remains
+        bool improved = !orderKey.empty();
+        while (improved && crossingsAfter > 0 && elapsedMs() <= Config::CROSSING_BUDGET_MS && !Stopped()) {
+            improved = false;
+            std::vector<int> roots = rootOrder;
+            for (size_t i = 0; i + 1 < roots.size(); ++i) {
+                if (elapsedMs() > Config::CROSSING_BUDGET_MS) break;
+                std::swap(orderKey[roots[i]], orderKey[roots[i + 1]]);
+                ResetPositions();
+                PlaceForest();
+
+                int c = CountCrossings();
+                if (c < crossingsAfter) {
+                    crossingsAfter = c;
+                    std::swap(roots[i], roots[i + 1]);
+                    improved = true;
+                } else {
+                    std::swap(orderKey[roots[i]], orderKey[roots[i + 1]]);
+                }
+            }
+            ResetPositions();
+            PlaceForest();
+        }
+    }
+
+    // Placed people grouped by row (y), top to bottom
+    std::vector<std::vector<int>> BuildLayers() {
+        std::map<int, std::vector<int>> rows;
+        ForEachPlaced([&](int i) { rows[boxY[i]].push_back(i); });
+
+        std::vector<std::vector<int>> layers;
+        for (auto& r : rows) layers.push_back(std::move(r.second));
+        return layers;
+    }
+
+    void RankByBarycenter(bool downward) {
+        auto& people = model->people;
+        auto centerX = [&](size_t i) { return (double)boxX[i] + Config::BOX_WIDTH / 2.0; };
+        auto placedIdx = [&](int id) -> int {
+            auto it = model->idMap.find(id);
+            if (it == model->idMap.end() || !Placed((int)it->second)) return -1;
+            return (int)it->second;
+        };
+
+        // 1. Local pull of every placed box, computed layer by layer in parallel
+        std::vector<std::vector<int>> layers = BuildLayers();
+        std::vector<double> pullSum(people.size(), 0.0);
+        std::vector<int> pullCount(people.size(), 0);
+
+        ParallelFor(layers.size(), [&](size_t begin, size_t end) {
+            for (size_t l = begin; l < end; ++l) {
+                for (int i : layers[l]) {
+                    const Person& p = people[i];
+                    double sum = 0; int cnt = 0;
+                    auto add = [&](int j) { if (j >= 0) { sum += centerX(j); ++cnt; } };
+
+                    if (downward) {
+                        add(placedIdx(p.fatherId));
+                        add(placedIdx(p.motherId));
+                    } else {
+                        for (int k : model->Children(i)) if (Placed(k)) add(k);
+                    }
+                    // Spouses placed in another cluster pull towards that cluster
+                    for (int sid : p.spouses) {
+                        int j = placedIdx(sid);
+                        if (j >= 0 && boxY[j] == boxY[i] &&
+                            std::abs(boxX[j] - boxX[i]) > Config::BOX_WIDTH + Config::SPOUSE_GAP) add(j);
+                    }
+                    pullSum[i] = sum; pullCount[i] = cnt;
+                }
+            }
+        }, cancel);
+
+        // 2. Accumulate pulls up the placed subtrees (reverse pre-order visits children first)
+        for (size_t r = placeOrder.size(); r-- > 0; ) {
+            int id = placeOrder[r];
+            int parentId = layoutParent[id];
+            if (parentId == 0) continue;
+            size_t i = model->idMap.at(id);
+            size_t pi = model->idMap.at(parentId);
+            pullSum[pi] += pullSum[i];
+            pullCount[pi] += pullCount[i];
+        }
+
+        // 3. Rank every placed box by its subtree barycenter (own position when unconnected)
+        std::vector<std::pair<double, int>> keyed;
+        for (const auto& layer : layers) {
+            for (int i : layer) {
+                double key = pullCount[i] ? (pullSum[i] + centerX(i)) / (pullCount[i] + 1) : centerX(i);
+                keyed.push_back({key, i});
+            }
+        }
+        std::stable_sort(keyed.begin(), keyed.end());
+
+        orderKey.clear();
+        for (size_t r = 0; r < keyed.size(); ++r) orderKey[people[keyed[r].second].id] = (int)r;
+    }
+
+    // Child connector crossings between adjacent rows. Each child has one edge, dropped from
+    // the midpoint of its placed parents (as DrawPairChildren draws it); edges are sorted by
+    // the upper x and crossings are the inversions among the lower x.
+    int CountCrossings() {
+        auto& people = model->people;
+        std::vector<std::vector<int>> layers = BuildLayers();
+
+        std::vector<long long> perLayer(layers.size(), 0);
+        ParallelFor(layers.size(), [&](size_t begin, size_t end) {
+            for (size_t l = begin; l < end; ++l) {
+                if (l == 0) continue;
+                int upperY = boxY[layers[l - 1][0]];
+
+                std::vector<std::pair<int, int>> edges; // {upper x, lower x}
+                for (int i : layers[l]) {
+                    const Person& kid = people[i];
+                    int sum = 0, cnt = 0;
+                    for (int pid : {kid.fatherId, kid.motherId}) {
+                        int pi = model->IndexOf(pid);
+                        if (pi >= 0 && Placed(pi) && boxY[pi] == upperY) { sum += boxX[pi]; ++cnt; }
+                    }
+                    if (cnt) edges.push_back({sum / cnt, boxX[i]});
+                }
+                std::sort(edges.begin(), edges.end());
+                std::vector<int> lower;
+                for (const auto& e : edges) lower.push_back(e.second);
+                perLayer[l] = CountInversions(lower);
+            }
+        }, cancel);
+
+        long long total = 0;
+        for (long long c : perLayer) total += c;
+        return (int)std::min<long long>(total, INT_MAX);
+    }
+
+    static long long CountInversions(std::vector<int>& v) {
+        if (v.size() < 2) return 0;
+        std::vector<int> tmp(v.size());
+        long long inv = 0;
+        for (size_t width = 1; width < v.size(); width *= 2) {
+            for (size_t lo = 0; lo < v.size(); lo += 2 * width) {
+                size_t mid = std::min(lo + width, v.size());
+                size_t hi = std::min(lo + 2 * width, v.size());
+                size_t a = lo, b = mid, o = lo;
+                while (a < mid && b < hi) {
+                    if (v[b] < v[a]) { inv += (long long)(mid - a); tmp[o++] = v[b++]; }
+                    else tmp[o++] = v[a++];
+                }
+                while (a < mid) tmp[o++] = v[a++];
+                while (b < hi) tmp[o++] = v[b++];
+            }
+            v.swap(tmp);
+        }
+        return inv;
+    }
+
+private:
+    void ClearPlacement() {
+        size_t n = model->people.size();
+        boxX.assign(n, 0);
+        boxY.assign(n, 0);
+        placedBits.assign((n + 63) / 64, 0);
+        placed.clear();
+    }
+
+    // Gives person idx a box; placing it again only moves the box
+    void Place(int idx, int x, int y) {
+        boxX[idx] = x;
+        boxY[idx] = y;
+        placedBits[idx >> 6] |= uint64_t(1) << (idx & 63);
+    }
+
+    // Calls fn(idx) for every placed person in index order, a word of the bitset at a time
+    template <typename Fn>
+    void ForEachPlaced(Fn fn) const {
+        for (size_t w = 0; w < placedBits.size(); ++w)
+            for (uint64_t bits = placedBits[w]; bits; bits &= bits - 1)
+                fn((int)(w * 64 + __builtin_ctzll(bits)));
+    }
+
+    // Rank from the crossing pass; people it did not rank sort first
+    int OrderKey(int id) const {
+        auto it = orderKey.find(id);
+        return (it != orderKey.end()) ? it->second : 0;
+    }
+
+    // Everything a layout pass derives, including the crossing pass's order: with
+    // minimizeCrossings off the next pass is back in ID order, and the pass itself starts
+    // its before/after count from that order
+    void ResetState() {
+        ClearPlacement();
+        orderKey.clear();
+        gens.assign(model->people.size(), -1);
+        genSweep.assign(model->people.size(), 0);
+        forestReady = false;
+        subtreeMetrics.clear();
+        unmeasured.clear();
+        childOrder.clear();
+        nodeOwner.clear();
+        layoutParent.clear();
+        placeOrder.clear();
+        proxies.clear();
+        connectors.clear();
+        routesConnectors = false;
+        fan.clear();
+        fanRings = 0;
+        timeline.clear();
+    }
+
+    // --- Focus charts (ancestors / hourglass) ------------------------------------
+    // Built from the cached parent indices and the CSR child index, so the work is
+    // proportional to the focus person's ancestors (and descendants), not the archive.
+    // A person reached twice (pedigree collapse) gets a proxy box for the repeat.
+    struct ChartNode {
+        int person;                              // Dense index
+        bool proxy;                              // Already has a box elsewhere in the chart
+        int depth;                               // Generations away from the focus person
+        int width = Config::BOX_WIDTH;           // Width of the subtree hanging off this node
+        int leaves = 1;                          // Leaf count of that subtree (fan chart spans)
+        std::vector<int> links;                  // Parent nodes (ancestors) / child nodes (descendants)
+        std::vector<std::pair<int, bool>> spouses; // Descendant clusters: {person idx, isProxy}
+        int x = 0, y = 0;
+    };
+    std::vector<ChartNode> chart;
+
+    void LayoutFocusChart(bool withDescendants) {
+        int focus = FocusIndex();
+        if (focus < 0) return;
+        routesConnectors = true;
+        chart.clear();
+
+        std::vector<char> seen(model->people.size(), 0);
+        int maxDepth = 0;
+        int anc = BuildAncestors(focus, 0, seen, maxDepth);
+        int baseY = 50 + maxDepth * Config::V_GAP;
+
+        if (!withDescendants) {
+            PlaceAncestors(anc, 50, baseY);
+        } else {
+            int desc = BuildDescendants(focus, 0, seen, true);
+            PlaceDescendants(desc, 50, baseY);
+
+            // Hang the ancestor tree over the focus box the descendant cluster produced
+            int focusX = chart[desc].x;
+            int left = focusX + Config::BOX_WIDTH / 2 - chart[anc].width / 2;
+            PlaceAncestors(anc, left, baseY);
+
+            // Shift right if the ancestors stick out past the left margin
+            int minX = INT_MAX;
+            for (const auto& c : chart) minX = std::min(minX, c.x);
+            if (minX < 50) ShiftChart(50 - minX);
+        }
+        ApplyChart();
+    }
+
+    int BuildAncestors(int idx, int depth, std::vector<char>& seen, int& maxDepth) {
+        int node = (int)chart.size();
+        chart.push_back({idx, seen[idx] != 0, depth});
+        maxDepth = std::max(maxDepth, depth);
+        if (chart[node].proxy) return node;
+        seen[idx] = 1;
+
+        const Person& p = model->people[idx];
+        int upW = 0, leaves = 0;
+        for (int par : {p.fatherIdx, p.motherIdx}) {
+            if (par < 0) continue;
+            int c = BuildAncestors(par, depth + 1, seen, maxDepth);
+            chart[node].links.push_back(c);
+            upW += chart[c].width;
+            leaves += chart[c].leaves;
+        }
+        if (leaves) chart[node].leaves = leaves;
+        if (chart[node].links.size() == 2) upW += Config::H_GAP;
+        chart[node].width = std::max(Config::BOX_WIDTH, upW);
+        return node;
+    }
+
+    // Focus box at baseY, each ancestor generation one row higher, father left of mother
+    void PlaceAncestors(int node, int left, int baseY) {
+        ChartNode& n = chart[node];
+        int center = left + n.width / 2;
+        n.x = center - Config::BOX_WIDTH / 2;
+        n.y = baseY - n.depth * Config::V_GAP;
+
+        std::vector<int> links = n.links;
+        int upW = 0;
+        for (int c : links) upW += chart[c].width;
+        if (links.size() == 2) upW += Config::H_GAP;
+
+        int x = center - upW / 2;
+        for (int c : links) {
+            PlaceAncestors(c, x, baseY);
+            x += chart[c].width + Config::H_GAP;
+        }
+
+        const ChartNode& self = chart[node];
+        int yC = self.y - Config::V_GAP + Config::BOX_HEIGHT / 2;
+        if (links.size() == 2) {
+            const ChartNode& f = chart[links[0]];
+            const ChartNode& m = chart[links[1]];
+            const Person& fp = model->people[f.person];
+            bool isEx = fp.spouses.IsEx(model->people[m.person].id);
+            connectors.push_back({isEx ? Connector::SpouseEx : Connector::Spouse,
+                                  {f.x + Config::BOX_WIDTH, yC}, {m.x, yC}, f.person, m.person});
+            connectors.push_back({Connector::Child, {(f.x + Config::BOX_WIDTH + m.x) / 2, yC},
+                                  {self.x + Config::BOX_WIDTH / 2, self.y}, f.person, self.person});
+        } else if (links.size() == 1) {
+            connectors.push_back({Connector::Child, {chart[links[0]].x + Config::BOX_WIDTH / 2, yC},
+                                  {self.x + Config::BOX_WIDTH / 2, self.y}, chart[links[0]].person, self.person});
+        }
+    }
+
+    int BuildDescendants(int idx, int depth, std::vector<char>& seen, bool isFocus) {
+        int node = (int)chart.size();
+        chart.push_back({idx, !isFocus && seen[idx] != 0, depth});
+        if (chart[node].proxy) return node;
+        seen[idx] = 1;
+
+        const Person& p = model->people[idx];
+        std::vector<std::pair<int, bool>> spouses;
+        for (int sid : p.spouses) {
+            int j = model->IndexOf(sid);
+            if (j < 0) continue;
+            spouses.push_back({j, seen[j] != 0});
+            seen[j] = 1;
+        }
+
+        int kidsW = 0, leaves = 0;
+        std::vector<int> links;
+        for (int kidId : GetChildren(p.id)) {
+            int c = BuildDescendants(model->IndexOf(kidId), depth + 1, seen, false);
+            links.push_back(c);
+            kidsW += chart[c].width;
+            leaves += chart[c].leaves;
+        }
+        if (leaves) chart[node].leaves = leaves;
+        if (!links.empty()) kidsW += (int)(links.size() - 1) * Config::H_GAP;
+
+        int s = (int)spouses.size();
+        int clusterW = Config::BOX_WIDTH * (1 + s) + Config::SPOUSE_GAP * s;
+        chart[node].spouses = std::move(spouses);
+        chart[node].links = std::move(links);
+        chart[node].width = std::max(clusterW, kidsW);
+        return node;
+    }
+
+    // [left spouses] [person] [right spouses] centered over the kids, as in PositionSubtree
+    void PlaceDescendants(int node, int left, int baseY) {
+        ChartNode& n = chart[node];
+        int y = baseY + n.depth * Config::V_GAP;
+        int center = left + n.width / 2;
+        n.y = y;
+
+        int s = (int)n.spouses.size();
+        int numLeft = s / 2;
+        int clusterW = Config::BOX_WIDTH * (1 + s) + Config::SPOUSE_GAP * s;
+        int x = center - clusterW / 2;
+
+        // Spouse boxes become their own (link-less) chart nodes so ApplyChart places them
+        std::vector<std::pair<int, int>> boxes; // {person idx, x} for child connector lookup
+        std::vector<std::pair<int, bool>> spouses = n.spouses;
+        for (int i = 0; i <= s; ++i) {
+            if (i == numLeft) { chart[node].x = x; boxes.push_back({chart[node].person, x}); }
+            else {
+                const auto& sp = spouses[i < numLeft ? i : i - 1];
+                chart.push_back({sp.first, sp.second, chart[node].depth});
+                chart.back().x = x; chart.back().y = y;
+                boxes.push_back({sp.first, x});
+            }
+            x += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+        }
+
+        int yC = y + Config::BOX_HEIGHT / 2;
+        int headX = chart[node].x;
+        for (size_t b = 0; b < boxes.size(); ++b) {
+            if (boxes[b].first == chart[node].person) continue;
+            const Person& head = model->people[chart[node].person];
+            bool isEx = head.spouses.IsEx(model->people[boxes[b].first].id);
+            int a = std::min(headX, boxes[b].second), c = std::max(headX, boxes[b].second);
+            connectors.push_back({isEx ? Connector::SpouseEx : Connector::Spouse,
+                                  {a + Config::BOX_WIDTH, yC}, {c, yC}, chart[node].person, boxes[b].first});
+        }
+
+        std::vector<int> links = chart[node].links;
+        int kidsW = 0;
+        for (int c : links) kidsW += chart[c].width;
+        if (!links.empty()) kidsW += (int)(links.size() - 1) * Config::H_GAP;
+
+        int childX = center - kidsW / 2;
+        for (int c : links) {
+            PlaceDescendants(c, childX, baseY);
+            childX += chart[c].width + Config::H_GAP;
+
+            // Drop from between the kid's parents as they appear in this cluster
+            const Person& kid = model->people[chart[c].person];
+            int px[2], found = 0;
+            for (const auto& b : boxes)
+                if ((b.first == kid.fatherIdx || b.first == kid.motherIdx) && found < 2) px[found++] = b.second;
+            if (found == 0) { px[0] = headX; found = 1; }
+            int dropX = (found == 2) ? (std::min(px[0], px[1]) + Config::BOX_WIDTH + std::max(px[0], px[1])) / 2
+                                     : px[0] + Config::BOX_WIDTH / 2;
+            connectors.push_back({Connector::Child, {dropX, yC},
+                                  {chart[c].x + Config::BOX_WIDTH / 2, chart[c].y}, chart[node].person, chart[c].person});
+        }
+    }
+
+    // Fan chart: ring per generation, every node's angular span split between its
+    // parents/children in proportion to their leaf counts
+    void LayoutFan(bool ancestors) {
+        int focus = FocusIndex();
+        if (focus < 0) return;
+        chart.clear();
+
+        std::vector<char> seen(model->people.size(), 0);
+        int maxDepth = 0;
+        int root = ancestors ? BuildAncestors(focus, 0, seen, maxDepth)
+                             : BuildDescendants(focus, 0, seen, true);
+        if (!ancestors) for (const auto& c : chart) maxDepth = std::max(maxDepth, c.depth);
+
+        fanRings = maxDepth + 1;
+        fan.reserve(chart.size());
+        PlaceFan(root, -Config::FAN_SWEEP_DEG / 2.0f, Config::FAN_SWEEP_DEG / 2.0f);
+
+        int radius = RingOuter(maxDepth);
+        fanCenter = { 50 + radius, 100 + radius };
+    }
+
+    void PlaceFan(int node, float a0, float a1) {
+        const ChartNode& n = chart[node];
+        fan.push_back({model->people[n.person].id, n.depth, a0, a1, n.proxy});
+
+        float span = a1 - a0;
+        float a = a0;
+        for (int c : n.links) {
+            float part = span * chart[c].leaves / (float)n.leaves;
+            PlaceFan(c, a, a + part);
+            a += part;
+        }
+    }
+
+    void ShiftChart(int dx) {
+        for (auto& c : chart) c.x += dx;
+        for (auto& c : connectors) { c.from.x += dx; c.to.x += dx; }
+    }
+
+    // Real nodes write the person's position, repeats become proxies. The focus person
+    // appears in both halves of an hourglass; only its first (real) node counts.
+    void ApplyChart() {
+        for (const auto& c : chart) {
+            if (c.proxy) proxies.push_back({model->people[c.person].id, c.x, c.y});
+            else if (!Placed(c.person)) Place(c.person, c.x, c.y);
+        }
+    }
+
+    // --- Timeline ------------------------------------------------------------------
+    // Lifelines sorted by birth within each branch (root family), then packed into lanes
+    // with the classic interval-partitioning greedy (min-heap of lane ends): O(n log n).
+    void LayoutTimeline() {
+        auto& people = model->people;
+        const int n = (int)people.size();
+
+        // 1. Birth years. People with only a death year start a default lifespan before it;
+        //    the rest are estimated in waves outward from everyone dated (parents first,
+        //    then spouses, then children), so each undated person is reached once however
+        //    many undated links away the nearest year is.
+        std::vector<int> birth = model->BirthYears(), death = model->DeathYears();
+        std::vector<char> estimated(n, 0);
+        std::vector<int> wave, next;
+        for (int i = 0; i < n; ++i) {
+            if (!birth[i] && death[i]) {
+                birth[i] = death[i] - Config::TL_DEFAULT_LIFESPAN;
+                estimated[i] = 1;
+            }
+            if (birth[i]) wave.push_back(i);
+        }
+        auto guessBirth = [&](int i) {
+            const Person& p = people[i];
+            int f = (p.fatherIdx >= 0) ? birth[p.fatherIdx] : 0;
+            int m = (p.motherIdx >= 0) ? birth[p.motherIdx] : 0;
+            if (f || m) return std::max(f, m) + Config::TL_GENERATION_YEARS;
+            for (int j : model->Spouses(i)) if (birth[j]) return birth[j];
+            int guess = 0;
+            for (int k : model->Children(i)) if (birth[k] && (!guess || birth[k] < guess)) guess = birth[k];
+            return guess ? guess - Config::TL_GENERATION_YEARS : 0;
+        };
+        std::vector<char> queued(n, 0);
+        std::vector<int> guesses;
+        while (!wave.empty()) {
+            next.clear();
+            auto reach = [&](int j) { if (j >= 0 && !birth[j] && !queued[j]) { queued[j] = 1; next.push_back(j); } };
+            for (int i : wave) {
+                reach(people[i].fatherIdx);
+                reach(people[i].motherIdx);
+                for (int j : model->Spouses(i)) reach(j);
+                for (int k : model->Children(i)) reach(k);
+            }
+            // Guessed from the years known before this wave, so the order within it does not matter
+            guesses.clear();
+            for (int j : next) guesses.push_back(guessBirth(j));
+            for (size_t k = 0; k < next.size(); ++k) { birth[next[k]] = guesses[k]; estimated[next[k]] = 1; }
+            wave.swap(next);
+        }
+
+        time_t t = time(NULL);
+        int thisYear = localtime(&t)->tm_year + 1900;
+        timelineFirstYear = INT_MAX;
+        timelineLastYear = INT_MIN;
+        std::vector<int> endYear(n, 0);
+        for (int i = 0; i < n; ++i) {
+            if (!birth[i]) continue;
+            int d = death[i];
+            endYear[i] = (d >= birth[i]) ? d : std::min(thisYear, birth[i] + Config::TL_DEFAULT_LIFESPAN);
+            endYear[i] = std::max(endYear[i], birth[i]);
+            timelineFirstYear = std::min(timelineFirstYear, birth[i]);
+            timelineLastYear = std::max(timelineLastYear, endYear[i]);
+        }
+        if (timelineFirstYear == INT_MAX) return; // Nobody could be dated
+        timelineFirstYear -= timelineFirstYear % 10;  // Start on a decade
+        timelineLastYear += 10 - timelineLastYear % 10;
+
+        // 2. Branch = root family, found by following the father (else mother) line up;
+        //    parentless people married into a family join their spouse's branch
+        std::vector<int> branch(n, -1);
+        std::vector<int> path;
+        for (int i = 0; i < n; ++i) {
+            int cur = i;
+            path.clear();
+            while (branch[cur] < 0) {
+                branch[cur] = -2; // Visiting (guards against cyclic data)
+                path.push_back(cur);
+                const Person& p = people[cur];
+                int up = (p.fatherIdx >= 0) ? p.fatherIdx : p.motherIdx;
+                if (up < 0) {
+                    for (int sid : p.spouses) {
+                        int j = model->IndexOf(sid);
+                        if (j >= 0 && (people[j].fatherIdx >= 0 || people[j].motherIdx >= 0)) { up = j; break; }
+                    }
+                }
+                if (up < 0 || branch[up] == -2) break;
+                cur = up;
+            }
+            int root = (branch[cur] >= 0) ? branch[cur] : cur;
+            for (int v : path) branch[v] = root;
+        }
+
+        // 3. Sort by (branch, birth); branches ordered by their earliest birth
+        std::vector<int> branchStart(n, INT_MAX);
+        for (int i = 0; i < n; ++i) if (birth[i]) branchStart[branch[i]] = std::min(branchStart[branch[i]], birth[i]);
+
+        std::vector<int> order;
+        order.reserve(n);
+        for (int i = 0; i < n; ++i) if (birth[i]) order.push_back(i);
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            int ba = branch[a], bb = branch[b];
+            if (ba != bb) return (branchStart[ba] != branchStart[bb]) ? branchStart[ba] < branchStart[bb] : ba < bb;
+            if (birth[a] != birth[b]) return birth[a] < birth[b];
+            return people[a].id < people[b].id;
+        });
+
+        // 4. Interval partitioning per branch
+        const int laneH = Config::TL_BAR_HEIGHT + Config::TL_LANE_GAP;
+        int bandTop = Config::TL_TOP;
+        timeline.reserve(order.size());
+        for (size_t s = 0; s < order.size(); ) {
+            size_t e = s;
+            while (e < order.size() && branch[order[e]] == branch[order[s]]) ++e;
+
+            // Min-heap of {x where the lane frees up, lane}
+            std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>,
+                                std::greater<std::pair<int, int>>> lanes;
+            int laneCount = 0;
+            for (size_t k = s; k < e; ++k) {
+                int i = order[k];
+                int x0 = TimelineX(birth[i]);
+                int x1 = std::max(TimelineX(endYear[i]), x0 + 4);
+                int packEnd = std::max(x1, x0 + Config::TL_MIN_BAR) + Config::H_GAP / 5;
+
+                int lane;
+                if (!lanes.empty() && lanes.top().first <= x0) { lane = lanes.top().second; lanes.pop(); }
+                else lane = laneCount++;
+                lanes.push({packEnd, lane});
+
+                timeline.push_back({people[i].id, x0, x1, bandTop + lane * laneH,
+                                    birth[i], endYear[i], estimated[i] != 0, death[i] != 0});
+            }
+            bandTop += laneCount * laneH + Config::TL_BRANCH_GAP;
+            s = e;
+        }
+    }
+
+    // --- DAG layout ------------------------------------------------------------
+    // Every person gets exactly one real box ("home"). People with parents are cluster
+    // heads placed under the best-fitting parent's cluster; people without parents sit
+    // beside a spouse. Any other spouse relation becomes a proxy box in that cluster, so
+    // shared descendants never duplicate and no connector has to leave its cluster.
+    // All passes are linear in people + relations over dense indices.
+    void LayoutDag() {
+        auto& people = model->people;
+        const int n = (int)people.size();
+        routesConnectors = true;
+
+        std::vector<char> isHead(n, 0);
+        std::vector<int> home(n, -1); // Spouse-slot people: head whose cluster holds them
+
+        // 1. Heads: everyone with a known parent, plus canonical roots of parentless couples
+        for (int i = 0; i < n; ++i)
+            if (people[i].fatherIdx >= 0 || people[i].motherIdx >= 0) isHead[i] = 1;
+
+        for (int i = 0; i < n; ++i) {
+            if (isHead[i]) continue;
+            const Person& p = people[i];
+            bool hasHeadSpouse = false;
+            int minId = p.id;
+            for (int sid : p.spouses) {
+                int j = model->IndexOf(sid);
+                if (j < 0) continue;
+                if (isHead[j] && (people[j].fatherIdx >= 0 || people[j].motherIdx >= 0)) hasHeadSpouse = true;
+                minId = std::min(minId, sid);
+            }
+            if (!hasHeadSpouse && minId == p.id) isHead[i] = 1;
+        }
+
+        // 2. Everyone else joins the first spouse that heads a cluster (or becomes a root)
+        for (int i = 0; i < n; ++i) {
+            if (isHead[i]) continue;
+            for (int sid : people[i].spouses) {
+                int j = model->IndexOf(sid);
+                if (j >= 0 && isHead[j]) { home[i] = j; break; }
+            }
+            if (home[i] < 0) isHead[i] = 1;
+        }
+        auto headOf = [&](int i) { return isHead[i] ? i : home[i]; };
+
+        // 3. Placement parent for heads; the deeper parent cluster wins, ties go to the father
+        std::vector<int> parentHead(n, -1);
+        std::vector<int> kidCount(n, 0);
+        for (int i = 0; i < n; ++i) {
+            if (!isHead[i]) continue;
+            const Person& p = people[i];
+            int hf = (p.fatherIdx >= 0) ? headOf(p.fatherIdx) : -1;
+            int hm = (p.motherIdx >= 0) ? headOf(p.motherIdx) : -1;
+            int h = (hf >= 0) ? hf : hm;
+            if (hf >= 0 && hm >= 0 && hf != hm && gens[hm] > gens[hf]) h = hm;
+            if (h == i) h = -1; // Self-parenting data error
+            parentHead[i] = h;
+            if (h >= 0) kidCount[h]++;
+        }
+
+        // Cluster children in CSR form
+        std::vector<int> kidStart(n + 1, 0);
+        for (int i = 0; i < n; ++i) kidStart[i + 1] = kidStart[i] + kidCount[i];
+        std::vector<int> kidList(kidStart[n]);
+        std::vector<int> fill(kidStart.begin(), kidStart.end() - 1);
+        for (int i = 0; i < n; ++i) if (parentHead[i] >= 0) kidList[fill[parentHead[i]]++] = i;
+
+        // Spouse slots per cluster: real for people homed here, proxy otherwise
+        std::vector<std::vector<std::pair<int, bool>>> slots(n); // {person idx, isProxy}
+        for (int h = 0; h < n; ++h) {
+            if (!isHead[h]) continue;
+            for (int sid : people[h].spouses) {
+                int j = model->IndexOf(sid);
+                if (j >= 0 && j != h) slots[h].push_back({j, home[j] != h});
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            if (isHead[i]) continue;
+            int h = home[i];
+            bool listed = false;
+            for (const auto& s : slots[h]) if (s.first == i) listed = true;
+            if (!listed) slots[h].push_back({i, false}); // One-sided spouse entry
+        }
+
+        // Order kids like GetChildren: [left spouse kids] [head kids] [right spouse kids]
+        for (int h = 0; h < n; ++h) {
+            int numLeft = (int)slots[h].size() / 2;
+            auto key = [&](int k) {
+                const Person& kid = people[k];
+                for (size_t s = 0; s < slots[h].size(); ++s) {
+                    int j = slots[h][s].first;
+                    if (kid.fatherIdx == j || kid.motherIdx == j) return ((int)s < numLeft) ? (int)s : (int)s + 1;
+                }
+                return numLeft;
+            };
+            std::sort(kidList.begin() + kidStart[h], kidList.begin() + kidStart[h + 1], [&](int a, int b) {
+                int ka = key(a), kb = key(b);
+                if (ka != kb) return ka < kb;
+                return people[a].id < people[b].id;
+            });
+        }
+
+        // 4. Pre-order over the forest (iterative; heads unreachable due to cycles become roots)
+        std::vector<int> order, treeOf(n, -1), depth(n, 0), roots;
+        order.reserve(n);
+        auto walk = [&](int root) {
+            std::vector<int> stack = {root};
+            treeOf[root] = (int)roots.size();
+            roots.push_back(root);
+            while (!stack.empty()) {
+                int h = stack.back(); stack.pop_back();
+                order.push_back(h);
+                for (int k = kidStart[h + 1]; k-- > kidStart[h]; ) {
+                    int kid = kidList[k];
+                    if (treeOf[kid] >= 0) continue;
+                    treeOf[kid] = treeOf[h];
+                    depth[kid] = depth[h] + 1;
+                    stack.push_back(kid);
+                }
+            }
+        };
+        for (int i = 0; i < n; ++i) if (isHead[i] && parentHead[i] < 0 && treeOf[i] < 0) walk(i);
+        for (int i = 0; i < n; ++i) if (isHead[i] && treeOf[i] < 0) walk(i);
+        for (int i = 0; i < n; ++i) if (!isHead[i]) treeOf[i] = treeOf[home[i]];
+
+        // 5. Subtree widths bottom-up (reverse pre-order)
+        auto clusterWidth = [&](int h) {
+            int s = (int)slots[h].size();
+            return Config::BOX_WIDTH * (1 + s) + Config::SPOUSE_GAP * s;
+        };
+        std::vector<int> width(n, 0), kidsWidth(n, 0);
+        for (size_t r = order.size(); r-- > 0; ) {
+            int h = order[r];
+            int kidsW = 0, cnt = 0;
+            for (int k = kidStart[h]; k < kidStart[h + 1]; ++k) {
+                int kid = kidList[k];
+                if (treeOf[kid] != treeOf[h] || depth[kid] != depth[h] + 1) continue;
+                kidsW += width[kid]; ++cnt;
+            }
+            if (cnt) kidsW += (cnt - 1) * Config::H_GAP;
+            kidsWidth[h] = kidsW;
+            width[h] = std::max(clusterWidth(h), kidsW);
+        }
+
+        // Trees linked to an earlier tree keep the sibling gap, unrelated ones sit flush
+        std::vector<char> linkedToEarlier(roots.size(), 0);
+        for (int i = 0; i < n; ++i) {
+            const Person& p = people[i];
+            auto link = [&](int j) {
+                if (j >= 0 && treeOf[j] != treeOf[i]) linkedToEarlier[std::max(treeOf[i], treeOf[j])] = 1;
+            };
+            link(p.fatherIdx);
+            link(p.motherIdx);
+            for (int sid : p.spouses) link(model->IndexOf(sid));
+        }
+
+        // 6. Positions, top-down in pre-order; clusters emit their own connectors
+        std::vector<int> left(n, 0);
+        dagSlotX.assign(n, {});
+        int cursor = 50;
+        for (size_t t = 0; t < roots.size(); ++t) {
+            if (t > 0) cursor += linkedToEarlier[t] ? Config::H_GAP : Config::TREE_GAP;
+            left[roots[t]] = cursor;
+            cursor += width[roots[t]];
+        }
+
+        for (int h : order) {
+            int y = 50 + depth[h] * Config::V_GAP;
+            int center = left[h] + width[h] / 2;
+            PlaceDagCluster(h, center - clusterWidth(h) / 2, y, slots[h]);
+
+            int childX = center - kidsWidth[h] / 2;
+            for (int k = kidStart[h]; k < kidStart[h + 1]; ++k) {
+                int kid = kidList[k];
+                if (treeOf[kid] != treeOf[h] || depth[kid] != depth[h] + 1) continue;
+                left[kid] = childX;
+                childX += width[kid] + Config::H_GAP;
+            }
+        }
+
+        // Child connectors, now that every box has its final position
+        for (int h : order) {
+            for (int k = kidStart[h]; k < kidStart[h + 1]; ++k) {
+                int kid = kidList[k];
+                if (depth[kid] != depth[h] + 1) continue;
+                AddDagChildConnector(h, kid, slots[h]);
+            }
+        }
+    }
+
+    // Lays out [left slots] [head] [right slots] and connects each slot to the head
+    void PlaceDagCluster(int h, int x, int y, const std::vector<std::pair<int, bool>>& slots) {
+        auto& people = model->people;
+        int numLeft = (int)slots.size() / 2;
+        std::vector<int>& slotX = dagSlotX[h];
+        slotX.assign(slots.size(), 0);
+
+        for (int s = 0; s < numLeft; ++s) { slotX[s] = x; x += Config::BOX_WIDTH + Config::SPOUSE_GAP; }
+        Place(h, x, y);
+        x += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+        for (size_t s = numLeft; s < slots.size(); ++s) { slotX[s] = x; x += Config::BOX_WIDTH + Config::SPOUSE_GAP; }
+
+        int yC = y + Config::BOX_HEIGHT / 2;
+        for (size_t s = 0; s < slots.size(); ++s) {
+            const Person& sp = people[slots[s].first];
+            if (slots[s].second) proxies.push_back({sp.id, slotX[s], y});
+            else Place(slots[s].first, slotX[s], y);
+
+            bool isEx = people[h].spouses.IsEx(sp.id) || sp.spouses.IsEx(people[h].id);
+            int a = std::min(slotX[s], boxX[h]), b = std::max(slotX[s], boxX[h]);
+            connectors.push_back({isEx ? Connector::SpouseEx : Connector::Spouse,
+                                  {a + Config::BOX_WIDTH, yC}, {b, yC}, h, slots[s].first});
+        }
+    }
+
+    // Drops a child line from between the kid's parents as they appear in cluster h
+    void AddDagChildConnector(int h, int kid, const std::vector<std::pair<int, bool>>& slots) {
+        auto& people = model->people;
+        const Person& k = people[kid];
+        int bx[2], found = 0;
+        auto slotX = [&](int idx) -> int {
+            if (idx == h) return boxX[h];
+            for (size_t s = 0; s < slots.size(); ++s) {
+                if (slots[s].first != idx) continue;
+                return dagSlotX[h][s];
+            }
+            return INT_MIN;
+        };
+        for (int par : {k.fatherIdx, k.motherIdx}) {
+            if (par < 0) continue;
+            int x = slotX(par);
+            if (x != INT_MIN) bx[found++] = x;
+        }
+        if (found == 0) { bx[0] = boxX[h]; found = 1; }
+
+        int yC = boxY[h] + Config::BOX_HEIGHT / 2;
+        int dropX = (found == 2 && bx[0] != bx[1])
+            ? (std::min(bx[0], bx[1]) + Config::BOX_WIDTH + std::max(bx[0], bx[1])) / 2
+            : bx[0] + Config::BOX_WIDTH / 2;
+        connectors.push_back({Connector::Child, {dropX, yC}, {boxX[kid] + Config::BOX_WIDTH / 2, boxY[kid]}, h, kid});
+    }
+
+    // Determine generation levels relative to roots
+    void CalculateGenerations() {
+        bool changed = true;
+        int limit = 0;
+        while(changed && limit++ < GEN_SWEEPS && !Stopped()) {
+            changed = false;
+            for(size_t i = 0; i < model->people.size(); ++i) {
+                const Person& p = model->people[i];
+                int& gen = gens[i];
+                if (gen != -1) continue;
+
+                int f = model->IndexOf(p.fatherId);
+                int m = model->IndexOf(p.motherId);
+
+                int pGen = -1;
+                if(f >= 0 && gens[f] != -1) pGen = std::max(pGen, gens[f]);
+                if(m >= 0 && gens[m] != -1) pGen = std::max(pGen, gens[m]);
+
+                if (pGen != -1) {
+                    gen = pGen + 1;
+                    changed = true;
+                } else {
+                    // Try to inherit from spouse
+                    for(int sid : p.spouses) {
+                        int sp = model->IndexOf(sid);
+                        if (sp >= 0 && gens[sp] != -1) {
+                            gen = gens[sp];
+                            changed = true;
+                            break;
+                        }
+                    }
+                    // Roots
+                    if (gen == -1 && p.fatherId == 0 && p.motherId == 0 && p.spouses.empty()) {
+                        gen = 0; changed = true;
+                    }
+                }
+                if (gen != -1) genSweep[i] = limit;
+            }
+        }
+        // Fallback
+        for(int& gen : gens) if (gen == -1) gen = 0;
+    }
+
+    // Assign every node to a 'Root Family' to prevent duplicates across trees
+    void AssignOwnership() {
+        std::set<int> visited;
+        for (size_t i = 0; i < model->people.size(); ++i) {
+            const Person& p = model->people[i];
+            if (gens[i] == 0) {
+                if (Stopped()) return;
+                // Canonical root check
+                int minId = p.id;
+                for(int sid : p.spouses) minId = std::min(minId, sid);
+                if (p.id > minId || visited.count(p.id)) continue;
+
+                StartClaiming(p.id, visited);
+            }
+        }
+    }
+
+    void StartClaiming(int rootId, std::set<int>& visited) {
+        std::vector<int> q = {rootId};
+        visited.insert(rootId);
+        nodeOwner[rootId] = rootId;
+
+        size_t head = 0;
+        while(head < q.size()) {
+            int currId = q[head++];
+            const Person* curr = model->Get(currId);
+            if (!curr) continue;
+
+            // Claim Spouses
+            for(int sid : curr->spouses) {
+                if (!visited.count(sid)) {
+                    visited.insert(sid);
+                    nodeOwner[sid] = rootId;
+                    q.push_back(sid);
+                }
+            }
+            // Claim Children
+            const auto& kids = GetChildren(currId);
+            for(int kidId : kids) {
+                if (!visited.count(kidId)) {
+                    visited.insert(kidId);
+                    nodeOwner[kidId] = rootId;
+                    q.push_back(kidId);
+                }
+            }
+        }
+    }
+
+    // Sweep and generation CalculateGenerations gives person `i`, worked out from its
+    // parents' and spouses' (sweep 0: never set, generation 0 by the fallback). A sweep
+    // visits people in index order, so `i` sees a relative set in sweep s from sweep s
+    // on if the relative comes first, from sweep s + 1 otherwise.
+    void Generation(int i, int& sweep, int& gen) const {
+        const Person& p = model->people[i];
+        auto seenFrom = [&](int d) {
+            return (d < 0 || d == i || genSweep[d] == 0) ? INT_MAX : genSweep[d] + (d < i ? 0 : 1);
+        };
+        int s = INT_MAX;
+        int f = model->IndexOf(p.fatherId), m = model->IndexOf(p.motherId);
+        s = std::min(s, std::min(seenFrom(f), seenFrom(m)));
+        for (int sid : p.spouses) s = std::min(s, seenFrom(model->IndexOf(sid)));
+        if (p.fatherId == 0 && p.motherId == 0 && p.spouses.empty()) s = 1;
+        if (s > GEN_SWEEPS) { sweep = 0; gen = 0; return; }
+
+        sweep = s;
+        int pGen = -1;
+        if (seenFrom(f) <= s) pGen = std::max(pGen, gens[f]);
+        if (seenFrom(m) <= s) pGen = std::max(pGen, gens[m]);
+        if (pGen != -1) { gen = pGen + 1; return; }
+        for (int sid : p.spouses) {
+            int sp = model->IndexOf(sid);
+            if (seenFrom(sp) <= s) { gen = gens[sp]; return; }
+        }
+        gen = 0; // Root
+    }
+
+    // CalculateGenerations' result for the edited model, from the last pass's: the
+    // relinked people are evaluated again, and the people reading a generation that
+    // changed (children, spouses) in turn. A person only depends on relatives set in an
+    // earlier step, so this settles on exactly what a full pass gives. Returns the
+    // indices whose generation or sweep changed.
+    std::vector<int> UpdateGenerations(const ModelDiff& diff) {
+        const size_t n = model->people.size();
+        gens.resize(n, 0);
+        genSweep.resize(n, 0);
+        std::vector<int> work(diff.relinked), changed;
+        std::set<int> queued(work.begin(), work.end());
+        while (!work.empty()) {
+            int i = work.back();
+            work.pop_back();
+            queued.erase(i);
+            int sweep, gen;
+            Generation(i, sweep, gen);
+            if (sweep == genSweep[i] && gen == gens[i]) continue;
+            genSweep[i] = sweep;
+            gens[i] = gen;
+            changed.push_back(i);
+            for (int k : model->Children(i)) if (queued.insert(k).second) work.push_back(k);
+            for (int k : model->Spouses(i)) if (queued.insert(k).second) work.push_back(k);
+        }
+        return changed;
+    }
+
+    // Person `i` starts a root family in AssignOwnership (unless an earlier one claims it)
+    bool IsRootFamily(int i) const {
+        const Person& p = model->people[i];
+        if (gens[i] != 0) return false;
+        for (int sid : p.spouses) if (sid < p.id) return false;
+        return true;
+    }
+
+    // AssignOwnership's result for the edited model, from the last pass's. A person
+    // belongs to the first root family (in index order) that reaches them through listed
+    // spouses and children, so only two groups can change owner: the families of the
+    // relinked people or of those whose generation changed (`regen`), and whoever those
+    // people reach now. Their owners are worked out again from the unchanged people
+    // pointing into the group. IDs appended to `moved` changed owner. IDs not in the
+    // model (a spouse listed but missing) keep what they had; nothing is placed for them.
+    void UpdateOwnership(const ModelDiff& diff, const std::vector<int>& regen, std::vector<int>& moved) {
+        std::vector<int> stack = diff.droppedIds;
+        for (int i : diff.relinked) stack.push_back(model->people[i].id);
+        for (int i : regen) stack.push_back(model->people[i].id);
+        std::set<int> families;
+        for (int id : stack) {
+            auto it = nodeOwner.find(id);
+            if (it != nodeOwner.end() && it->second != 0) families.insert(it->second);
+        }
+        for (int id : diff.droppedIds) if (nodeOwner.erase(id)) moved.push_back(id);
+
+        auto forEachReached = [&](int idx, auto visit) { // Out-edges of StartClaiming
+            const Person& p = model->people[idx];
+            for (int sid : p.spouses) { int s = model->IndexOf(sid); if (s >= 0) visit(s); }
+            for (int k : model->Children(idx)) visit(k);
+            for (int sid : p.spouses) {
+                int s = model->IndexOf(sid);
+                if (s >= 0) for (int k : model->Children(s)) visit(k);
+            }
+        };
+        auto lists = [&](int a, int b) {
+            const SpouseList& s = model->people[a].spouses;
+            return std::find(s.begin(), s.end(), model->people[b].id) != s.end();
+        };
+
+        std::set<int> group; // Dense indices
+        for (const auto& o : nodeOwner)
+            if (families.count(o.second)) { int i = model->IndexOf(o.first); if (i >= 0) group.insert(i); }
+        std::vector<int> reach;
+        for (int id : stack) { int i = model->IndexOf(id); if (i >= 0 && group.insert(i).second) reach.push_back(i); }
+        while (!reach.empty()) {
+            int i = reach.back();
+            reach.pop_back();
+            forEachReached(i, [&](int k) { if (group.insert(k).second) reach.push_back(k); });
+        }
+
+        // Best root per member: its own family if it is a root, else what reaches it
+        std::map<int, int> best; // Dense index -> dense index of the root, -1 = none
+        auto offer = [&](int i, int root) {
+            if (root < 0) return false;
+            auto it = best.find(i);
+            if (it->second >= 0 && it->second <= root) return false;
+            it->second = root;
+            return true;
+        };
+        for (int i : group) {
+            best[i] = IsRootFamily(i) ? i : -1;
+            auto from = [&](int j) { // j reaches i; an unchanged j brings its owner
+                if (j < 0 || group.count(j)) return;
+                auto o = nodeOwner.find(model->people[j].id);
+                if (o != nodeOwner.end() && o->second != 0) offer(i, model->IndexOf(o->second));
+            };
+            const Person& p = model->people[i];
+            for (int par : { p.fatherIdx, p.motherIdx }) {
+                if (par < 0) continue;
+                from(par);
+                for (int j : model->Spouses(par)) if (lists(j, par)) from(j);
+            }
+            for (int j : model->Spouses(i)) if (lists(j, i)) from(j);
+        }
+        std::vector<int> work(group.begin(), group.end());
+        while (!work.empty()) {
+            int i = work.back();
+            work.pop_back();
+            int root = best[i];
+            if (root < 0) continue;
+            forEachReached(i, [&](int k) { if (group.count(k) && offer(k, root)) work.push_back(k); });
+        }
+
+        for (const auto& b : best) {
+            int id = model->people[b.first].id;
+            int owner = (b.second >= 0) ? model->people[b.second].id : 0;
+            auto it = nodeOwner.find(id);
+            int was = (it != nodeOwner.end()) ? it->second : 0;
+            if (owner != 0) nodeOwner[id] = owner;
+            else if (it != nodeOwner.end()) nodeOwner.erase(it);
+            if (owner != was) moved.push_back(id);
+        }
+    }
+
+    bool IsConnectedToPlaced(int rootId, const std::set<int>& placed) {
+        for (const auto& p : model->people) {
+            if (nodeOwner[p.id] == rootId) {
+                if (placed.count(p.fatherId)) return true;
+                if (placed.count(p.motherId)) return true;
+                for (int sid : p.spouses) if (placed.count(sid)) return true;
+                for (int kid : GetChildren(p.id)) if (placed.count(kid)) return true;
+            }
+        }
+        return false;
     }
 
     // Returns sorted children for layout: [Left Spouse Kids] [Main Kids] [Right Spouse Kids]
-    std::vector<int> GetChildren(int pid) {
+    // (memoized until positions or the sibling order are reset)
+    const std::vector<int>& GetChildren(int pid) {
+        auto cached = childOrder.find(pid);
+        if (cached != childOrder.end()) return cached->second;
+        std::vector<int>& kids = childOrder[pid];
+
         std::set<int> kidSet;
-        Person* p = model->Get(pid);
-        if(!p) return {};
+        const Person* p = model->Get(pid);
+        if(!p) return kids;
 
         // Collect all kids involving this person
         auto addKids = [&](int parentId) {
-            for(const auto& k : model->people)
-                if(k.fatherId == parentId || k.motherId == parentId)
-                    kidSet.insert(k.id);
+            int idx = model->IndexOf(parentId);
+            if (idx < 0) return;
+            for(int k : model->Children(idx)) kidSet.insert(model->people[k].id);
         };
         addKids(pid);
         for(int sid : p->spouses) addKids(sid);
 
-        std::vector<int> kids(kidSet.begin(), kidSet.end());
+        kids.assign(kidSet.begin(), kidSet.end());
 
         // Sort for visual centering relative to parents
         int numSpouses = (int)p->spouses.size();
@@ -422,7 +6409,7 @@ private:
 
         std::sort(kids.begin(), kids.end(), [&](int a, int b) {
             auto GetKey = [&](int id) -> int {
-                Person* k = model->Get(id);
+                const Person* k = model->Get(id);
                 if(!k) return 999;
 
                 int otherId = (k->fatherId == pid) ? k->motherId : k->fatherId;
@@ -439,136 +6426,841 @@ private:
             int kA = GetKey(a);
             int kB = GetKey(b);
             if (kA != kB) return kA < kB;
+            if (!orderKey.empty()) return OrderKey(a) < OrderKey(b);
             return a < b;
         });
 
-        return kids;
+        return kids;
+    }
+
+    std::pair<int,int> ComputeSubtreeSize(int pid, int rootId) {
+        // If owned by another tree, it takes 0 space here
+        if (nodeOwner.count(pid) && nodeOwner[pid] != rootId) return {0, 0};
+        if (subtreeMetrics.count(pid)) return subtreeMetrics[pid];
+
+        const Person* p = model->Get(pid);
+        int numSpouses = (int)p->spouses.size();
+
+        // Width of Parents Cluster ( [Spouse] [Main] [Spouse] )
+        int parentsW = Config::BOX_WIDTH;
+        if (numSpouses > 0) {
+            parentsW = (Config::BOX_WIDTH * (1 + numSpouses)) + (Config::SPOUSE_GAP * numSpouses);
+        }
+
+        // Width of Children
+        const auto& kids = GetChildren(pid);
+        int kidsW = 0;
+        for(int k : kids) kidsW += ComputeSubtreeSize(k, rootId).first;
+        if(!kids.empty()) kidsW += (int)((kids.size() - 1) * Config::H_GAP);
+
+        int totalW = std::max(parentsW, kidsW);
+        subtreeMetrics[pid] = { totalW, totalW/2 };
+        return subtreeMetrics[pid];
+    }
+
+    void PositionSubtree(int pid, int x, int y, std::set<int>& placed, int rootId, int parentId = 0) {
+        if (nodeOwner.count(pid) && nodeOwner[pid] != rootId) return;
+        if (placed.count(pid)) return;
+        placed.insert(pid);
+        layoutParent[pid] = parentId;
+        placeOrder.push_back(pid);
+
+        const Person* p = model->Get(pid);
+        for(int sid : p->spouses) {
+            if (placed.insert(sid).second && model->Get(sid)) { layoutParent[sid] = pid; placeOrder.push_back(sid); }
+        }
+
+        int centerOffset = subtreeMetrics[pid].second;
+        int absoluteCenter = x + centerOffset;
+
+        // 1. Position Parents Block
+        int numSpouses = (int)p->spouses.size();
+        int parentsW = Config::BOX_WIDTH;
+        if (numSpouses > 0) parentsW = (Config::BOX_WIDTH * (1 + numSpouses)) + (Config::SPOUSE_GAP * numSpouses);
+
+        int currentX = absoluteCenter - (parentsW/2);
+
+        // A. Left Spouses
+        int numLeft = numSpouses / 2;
+        for(int i = 0; i < numLeft; ++i) {
+            int sp = model->IndexOf(p->spouses[i]);
+            if(sp >= 0) {
+                Place(sp, currentX, y);
+                currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+            }
+        }
+        // B. Main Person
+        int self = model->IndexOf(pid);
+        Place(self, currentX, y);
+        currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+
+        // C. Right Spouses
+        for(int i = numLeft; i < numSpouses; ++i) {
+            int sp = model->IndexOf(p->spouses[i]);
+            if(sp >= 0) {
+                Place(sp, currentX, y);
+                currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+            }
+        }
+
+        // 2. Position Children
+        const auto& kids = GetChildren(pid);
+        if(kids.empty()) return;
+
+        int kidsTotalW = 0;
+        for(int k : kids) kidsTotalW += PlacedWidth(k);
+        kidsTotalW += (int)(kids.size()-1) * Config::H_GAP;
+
+        int childX = absoluteCenter - (kidsTotalW/2);
+        for(int k : kids) {
+            PositionSubtree(k, childX, y + Config::V_GAP, placed, rootId, pid);
+            childX += PlacedWidth(k) + Config::H_GAP;
+        }
+    }
+
+    // A child owned by another root family picks up a zero width when `pid` is positioned
+    // first, so that family has to be measured again whenever `pid` is
+    void CrossRootKids(int pid, std::vector<int>& out) {
+        auto own = nodeOwner.find(pid);
+        for (int kid : GetChildren(pid)) {
+            auto k = nodeOwner.find(kid);
+            if (k != nodeOwner.end() && (own == nodeOwner.end() || k->second != own->second)) out.push_back(kid);
+        }
+    }
+
+    // Width of a child's subtree while positioning. A child this pass never measured (it
+    // belongs to another root family) counts as zero and keeps that width from then on.
+    int PlacedWidth(int kid) {
+        auto r = subtreeMetrics.emplace(kid, std::make_pair(0, 0));
+        if (r.second) unmeasured.push_back(kid);
+        return r.first->second.first;
+    }
+
+    // Running min/max of ink rectangles; `leftBottom` tracks the ones reaching into the
+    // legend's column
+    struct Extent {
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+        int leftBottom = INT_MIN;
+
+        bool Empty() const { return x0 > x1; }
+        void Add(int l, int t, int r, int b) {
+            x0 = std::min(x0, l); y0 = std::min(y0, t);
+            x1 = std::max(x1, r); y1 = std::max(y1, b);
+            if (l < LegendRight()) leftBottom = std::max(leftBottom, b);
+        }
+        void Add(const Extent& e) {
+            x0 = std::min(x0, e.x0); y0 = std::min(y0, e.y0);
+            x1 = std::max(x1, e.x1); y1 = std::max(y1, e.y1);
+            leftBottom = std::max(leftBottom, e.leftBottom);
+        }
+        RECT Rect() const { return Empty() ? RECT{0, 0, 0, 0} : RECT{x0, y0, x1, y1}; }
+    };
+
+    static int LegendRight() { return Config::LEGEND_INSET + Config::LEGEND_W + Config::BOX_SHADOW; }
+
+    // Extent of the placed boxes among rows [begin, end), begin a multiple of 64. Reads the
+    // SoA in row order a word of placedBits at a time: a fully placed word is a branch-free
+    // scan over fixed-width lanes the compiler can vectorize, a partly placed one visits its
+    // set bits, and the tail is masked by the bits; the lanes are folded at the end.
+    static Extent BoxExtent(const int* xs, const int* ys, const uint64_t* bits, size_t begin, size_t end) {
+        const int legendRight = LegendRight();
+        const size_t LANES = 8;
+        int lx0[LANES], ly0[LANES], lx1[LANES], ly1[LANES], lLeft[LANES];
+        for (size_t k = 0; k < LANES; ++k) {
+            lx0[k] = ly0[k] = INT_MAX;
+            lx1[k] = ly1[k] = lLeft[k] = INT_MIN;
+        }
+        // on: all ones for a placed row, zero otherwise
+        auto step = [legendRight](int x, int y, int on, int& x0, int& y0, int& x1, int& y1, int& left) {
+            int col = -(int)(x < legendRight) & on; // All ones when reaching into the legend column
+            x0 = std::min(x0, (x & on) | (INT_MAX & ~on));
+            y0 = std::min(y0, (y & on) | (INT_MAX & ~on));
+            x1 = std::max(x1, (x & on) | (INT_MIN & ~on));
+            y1 = std::max(y1, (y & on) | (INT_MIN & ~on));
+            left = std::max(left, (y & col) | (INT_MIN & ~col));
+        };
+        size_t i = begin;
+        for (; i + 64 <= end; i += 64) {
+            uint64_t word = bits[i >> 6];
+            if (word == ~uint64_t(0)) { // Fully placed: a plain scan of the SoA
+                for (size_t j = 0; j < 64; j += LANES)
+                    for (size_t k = 0; k < LANES; ++k)
+                        step(xs[i + j + k], ys[i + j + k], -1, lx0[k], ly0[k], lx1[k], ly1[k], lLeft[k]);
+                continue;
+            }
+            for (; word; word &= word - 1) { // Partly placed: visit the set bits
+                size_t j = __builtin_ctzll(word), k = j % LANES;
+                step(xs[i + j], ys[i + j], -1, lx0[k], ly0[k], lx1[k], ly1[k], lLeft[k]);
+            }
+        }
+        for (; i < end; ++i)
+            step(xs[i], ys[i], -(int)((bits[i >> 6] >> (i & 63)) & 1), lx0[0], ly0[0], lx1[0], ly1[0], lLeft[0]);
+
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN, left = INT_MIN;
+        for (size_t k = 0; k < LANES; ++k) {
+            x0 = std::min(x0, lx0[k]); y0 = std::min(y0, ly0[k]);
+            x1 = std::max(x1, lx1[k]); y1 = std::max(y1, ly1[k]);
+            left = std::max(left, lLeft[k]);
+        }
+        Extent e;
+        if (x0 > x1) return e;
+        const int sd = Config::BOX_SHADOW;
+        e.x0 = x0; e.y0 = y0;
+        e.x1 = x1 + Config::BOX_WIDTH + sd;
+        e.y1 = y1 + Config::BOX_HEIGHT + sd;
+        if (left != INT_MIN) e.leftBottom = left + Config::BOX_HEIGHT + sd;
+        return e;
+    }
+
+    // Boxes bucketed into rows by a counting sort, and each row's extent
+    void BuildRowBounds(int top) {
+        rowBounds.clear(); rowStart.clear(); rowMembers.clear();
+        const int pitch = Config::BOX_HEIGHT + Config::V_GAP;
+        auto rowOf = [&](int i) { return (boxY[i] - top) / pitch; };
+        int rows = 0;
+        for (int i : placed) rows = std::max(rows, rowOf(i) + 1);
+        if (rows == 0) return;
+
+        rowStart.assign(rows + 1, 0);
+        for (int i : placed) ++rowStart[rowOf(i) + 1];
+        for (int r = 0; r < rows; ++r) rowStart[r + 1] += rowStart[r];
+        rowMembers.resize(rowStart.back());
+        std::vector<int> fill(rowStart.begin(), rowStart.end() - 1);
+        for (int i : placed) rowMembers[fill[rowOf(i)]++] = i;
+
+        rowBounds.assign(rows, RECT{0, 0, 0, 0});
+        ParallelFor(rowBounds.size(), [&](size_t begin, size_t end) {
+            const int sd = Config::BOX_SHADOW;
+            for (size_t r = begin; r < end; ++r) {
+                Extent e;
+                for (int k = rowStart[r]; k < rowStart[r + 1]; ++k) {
+                    int i = rowMembers[k];
+                    e.Add(boxX[i], boxY[i], boxX[i] + Config::BOX_WIDTH + sd, boxY[i] + Config::BOX_HEIGHT + sd);
+                }
+                rowBounds[r] = e.Rect();
+            }
+        }, cancel);
+    }
+
+    void FinalizeBounds() {
+        placed.clear();
+        ForEachPlaced([&](int i) { placed.push_back(i); });
+
+        // Boxes: reduced in parallel blocks, each block a branch-free scan of the SoA
+        Extent ink;
+        size_t n = boxX.size();
+        size_t blocks = (n + Config::BOUNDS_BLOCK - 1) / Config::BOUNDS_BLOCK;
+        std::vector<Extent> partial(blocks);
+        auto reduce = [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b)
+                partial[b] = BoxExtent(boxX.data(), boxY.data(), placedBits.data(), b * Config::BOUNDS_BLOCK,
+                                       std::min(n, (b + 1) * Config::BOUNDS_BLOCK));
+        };
+        if (blocks > 1) ParallelFor(blocks, reduce, cancel);
+        else reduce(0, blocks);
+        for (const auto& e : partial) ink.Add(e);
+        int boxTop = ink.y0;
+
+        for (const auto& px : proxies) // Proxy boxes have no shadow
+            ink.Add(px.x, px.y, px.x + Config::BOX_WIDTH, px.y + Config::BOX_HEIGHT);
+        for (const auto& l : timeline) // Labels may run past a short bar; decade lines reach 10px below
+            ink.Add(l.x0, l.y, std::max(l.x1, l.x0 + Config::TL_MIN_BAR), l.y + Config::TL_BAR_HEIGHT + 10);
+        if (!fan.empty()) {
+            int radius = RingOuter(fanRings - 1);
+            ink.Add((int)fanCenter.x - radius, (int)fanCenter.y - radius,
+                    (int)fanCenter.x + radius, (int)fanCenter.y + radius);
+        }
+
+        inkBounds = ink.Rect();
+        legendClearY = (ink.leftBottom == INT_MIN) ? 0 : ink.leftBottom;
+        totalWidth = std::max<int>(inkBounds.right, 0) + Config::CANVAS_MARGIN;
+        totalHeight = std::max<int>(inkBounds.bottom, 70) + Config::CANVAS_MARGIN; // 70: below the title
+        BuildRowBounds(boxTop);
+    }
+
+public:
+    // Canvas height that keeps the bottom-left legend overlay clear of the drawing
+    int HeightWithLegend() const {
+        return std::max(totalHeight, legendClearY + Config::LEGEND_H + 2 * Config::LEGEND_INSET);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// 5. RENDERER
+// -----------------------------------------------------------------------------
+
+// Decoded portraits shared by the screen and the exporters. A small worker pool decodes
+// and downscales images off the UI thread (newest request first); until a thumbnail is
+// ready the backends draw a placeholder, so painting never waits on a decoder.
+class ThumbnailCache {
+public:
+    // Premultiplied BGRA, top-down
+    struct Thumb {
+        int w = 0, h = 0;
+        std::vector<uint32_t> pixels;
+        mutable HBITMAP dib = nullptr; // GDI copy, created on first draw (UI thread)
+
+        ~Thumb() { if (dib) DeleteObject(dib); }
+        size_t Bytes() const { return pixels.size() * 4 * 2; } // Pixels plus the GDI copy
+    };
+
+    ~ThumbnailCache() { Stop(); }
+
+    // `notify` receives `msg` (coalesced) whenever new thumbnails become ready
+    void Start(HWND notify, UINT msg) {
+        Gdiplus::GdiplusStartupInput input;
+        if (Gdiplus::GdiplusStartup(&gdiplusToken, &input, NULL) != Gdiplus::Ok) return;
+        notifyHwnd = notify;
+        notifyMsg = msg;
+        for (int i = 0; i < Config::THUMB_WORKERS; ++i) threads.emplace_back(&ThumbnailCache::Worker, this);
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        work.notify_all();
+        for (auto& t : threads) t.join();
+        threads.clear();
+        entries.clear();
+        lru.clear();
+        if (gdiplusToken) { Gdiplus::GdiplusShutdown(gdiplusToken); gdiplusToken = 0; }
+    }
+
+    // Ready thumbnail of `size` pixels square, or null while it is pending or if the image
+    // could not be read. A miss queues a decode. Each size is cached on its own, so a
+    // window on a high-DPI screen gets sharp photos without evicting the others.
+    std::shared_ptr<const Thumb> Get(const std::wstring& path, int size = Config::THUMB_SIZE) {
+        std::lock_guard<std::mutex> lock(mu);
+        std::wstring key = Key(path, size);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            if (!threads.empty()) Enqueue(key, path, size);
+            return nullptr;
+        }
+        Entry& e = it->second;
+        if (e.state != State::Ready) return nullptr;
+        lru.splice(lru.begin(), lru, e.lruPos);
+        return e.thumb;
+    }
+
+    // Decodes what `paths` still needs and blocks until every one is ready or failed.
+    // Pinned thumbnails are never evicted; see ThumbnailPin.
+    void Pin(const std::vector<std::wstring>& paths, int size = Config::THUMB_SIZE) {
+        std::unique_lock<std::mutex> lock(mu);
+        std::vector<std::wstring> keys;
+        for (const auto& p : paths) {
+            keys.push_back(Key(p, size));
+            if (!entries.count(keys.back())) Enqueue(keys.back(), p, size);
+            entries[keys.back()].pins++;
+        }
+        if (threads.empty()) {
+            for (const auto& k : keys) if (entries[k].state == State::Queued) Decode(lock, k);
+            queue.clear();
+        } else {
+            work.notify_all();
+        }
+        done.wait(lock, [&] {
+            for (const auto& k : keys) {
+                State st = entries[k].state;
+                if (st == State::Queued || st == State::Decoding) return false;
+            }
+            return true;
+        });
+    }
+
+    void Unpin(const std::vector<std::wstring>& paths, int size = Config::THUMB_SIZE) {
+        std::lock_guard<std::mutex> lock(mu);
+        for (const auto& p : paths) {
+            auto it = entries.find(Key(p, size));
+            if (it != entries.end() && it->second.pins > 0) it->second.pins--;
+        }
+        Evict();
+    }
+
+    // After a data reload, so paths that failed (e.g. a photo added later) get another try
+    void ForgetFailures() {
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            if (it->second.state == State::Failed && it->second.pins == 0) it = entries.erase(it);
+            else ++it;
+        }
+    }
+
+    // Called by the window when it handles the ready message
+    void OnNotified() { notifyPending = false; }
+
+    // PNG bytes of a thumbnail (for embedding in SVG); empty on failure
+    static std::string EncodePng(const Thumb& t) {
+        static const CLSID pngEncoder = { 0x557cf406, 0x1a04, 0x11d3, { 0x9a, 0x73, 0x00, 0x00, 0xf8, 0x1e, 0xf3, 0x2e } };
+        Gdiplus::Bitmap bmp(t.w, t.h, t.w * 4, PixelFormat32bppPARGB, (BYTE*)t.pixels.data());
+        IStream* stream = nullptr;
+        if (CreateStreamOnHGlobal(NULL, TRUE, &stream) != S_OK) return "";
+
+        std::string bytes;
+        STATSTG stat;
+        if (bmp.Save(stream, &pngEncoder, NULL) == Gdiplus::Ok && stream->Stat(&stat, STATFLAG_NONAME) == S_OK) {
+            HGLOBAL mem = NULL;
+            if (GetHGlobalFromStream(stream, &mem) == S_OK) {
+                const char* data = (const char*)GlobalLock(mem);
+                bytes.assign(data, (size_t)stat.cbSize.QuadPart);
+                GlobalUnlock(mem);
+            }
+        }
+        stream->Release();
+        return bytes;
+    }
+
+private:
+    enum class State { Queued, Decoding, Ready, Failed };
+    struct Entry {
+        std::wstring path;
+        int size = 0;
+        State state = State::Queued;
+        std::shared_ptr<const Thumb> thumb;
+        std::list<std::wstring>::iterator lruPos; // Valid while Ready
+        int pins = 0;
+    };
+
+    std::mutex mu;
+    std::condition_variable work, done;
+    std::unordered_map<std::wstring, Entry> entries; // By Key(path, size)
+    std::list<std::wstring> lru;    // Ready entries, most recently drawn first
+    std::deque<std::wstring> queue; // Pending decodes, newest at the back
+    std::vector<std::thread> threads;
+    size_t bytes = 0;
+    bool stopping = false;
+    ULONG_PTR gdiplusToken = 0;
+    HWND notifyHwnd = nullptr;
+    UINT notifyMsg = 0;
+    std::atomic<bool> notifyPending{false};
+
+    static std::wstring Key(const std::wstring& path, int size) { return path + L'|' + std::to_wstring(size); }
+
+    // Caller holds mu
+    void Enqueue(const std::wstring& key, const std::wstring& path, int size) {
+        Entry& e = entries[key];
+        e.path = path;
+        e.size = size;
+        e.state = State::Queued;
+        queue.push_back(key);
+        if (queue.size() > Config::THUMB_QUEUE_MAX) {
+            // Requests from boxes scrolled past long ago; they are re-queued if drawn again
+            auto it = entries.find(queue.front());
+            if (it != entries.end() && it->second.state == State::Queued && it->second.pins == 0) {
+                entries.erase(it);
+                queue.pop_front();
+            }
+        }
+        work.notify_one();
+    }
+
+    void Worker() {
+        std::unique_lock<std::mutex> lock(mu);
+        for (;;) {
+            work.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            std::wstring key = std::move(queue.back());
+            queue.pop_back();
+            auto it = entries.find(key);
+            if (it == entries.end() || it->second.state != State::Queued) continue;
+            Decode(lock, key);
+            if (notifyHwnd && !notifyPending.exchange(true)) PostMessage(notifyHwnd, notifyMsg, 0, 0);
+        }
+    }
+
+    // Decodes one queued entry with mu released during the actual work
+    void Decode(std::unique_lock<std::mutex>& lock, const std::wstring& key) {
+        Entry& queued = entries[key];
+        queued.state = State::Decoding;
+        std::wstring path = queued.path;
+        int size = queued.size;
+        lock.unlock();
+        auto thumb = std::make_shared<Thumb>();
+        bool ok = DecodeFile(path, size, *thumb);
+        lock.lock();
+
+        Entry& e = entries[key];
+        if (ok) {
+            e.state = State::Ready;
+            e.thumb = thumb;
+            lru.push_front(key);
+            e.lruPos = lru.begin();
+            bytes += thumb->Bytes();
+            Evict();
+        } else {
+            e.state = State::Failed;
+        }
+        done.notify_all();
+    }
+
+    // Drops least recently drawn, unpinned thumbnails until within budget. Caller holds mu.
+    void Evict() {
+        const size_t budget = Config::THUMB_CACHE_MB << 20;
+        auto it = lru.end();
+        while (bytes > budget && it != lru.begin()) {
+            --it;
+            auto e = entries.find(*it);
+            if (e->second.pins > 0) continue;
+            bytes -= e->second.thumb->Bytes();
+            entries.erase(e);
+            it = lru.erase(it);
+        }
+    }
+
+    // Center-crops to a square and scales to n pixels
+    static bool DecodeFile(const std::wstring& path, int n, Thumb& out) {
+        Gdiplus::Bitmap src(path.c_str());
+        if (src.GetLastStatus() != Gdiplus::Ok) return false;
+        int sw = (int)src.GetWidth(), sh = (int)src.GetHeight();
+        if (sw <= 0 || sh <= 0) return false;
+
+        int side = std::min(sw, sh);
+        Gdiplus::Bitmap dst(n, n, PixelFormat32bppPARGB);
+        {
+            Gdiplus::Graphics g(&dst);
+            g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+            g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+            g.DrawImage(&src, Gdiplus::Rect(0, 0, n, n), (sw - side) / 2, (sh - side) / 2, side, side, Gdiplus::UnitPixel);
+        }
+
+        Gdiplus::BitmapData bd;
+        Gdiplus::Rect all(0, 0, n, n);
+        if (dst.LockBits(&all, Gdiplus::ImageLockModeRead, PixelFormat32bppPARGB, &bd) != Gdiplus::Ok) return false;
+        out.w = out.h = n;
+        out.pixels.resize((size_t)n * n);
+        for (int y = 0; y < n; ++y)
+            memcpy(&out.pixels[(size_t)y * n], (const BYTE*)bd.Scan0 + (ptrdiff_t)y * bd.Stride, (size_t)n * 4);
+        dst.UnlockBits(&bd);
+        return true;
+    }
+};
+
+// Keeps the thumbnails an export needs decoded and resident for its lifetime
+class ThumbnailPin {
+    ThumbnailCache& cache;
+    std::vector<std::wstring> paths;
+    int size;
+public:
+    ThumbnailPin(ThumbnailCache& c, std::vector<std::wstring> p, int px = Config::THUMB_SIZE)
+        : cache(c), paths(std::move(p)), size(px) { cache.Pin(paths, size); }
+    ~ThumbnailPin() { cache.Unpin(paths, size); }
+};
+
+// Fonts used on the canvas; each backend maps them to a real face and size
+enum class FontRole : unsigned char { Title, Name, Role, Label };
+
+// Uniform grid over command bounds, so a region (one printed page) finds the commands
+// it touches without scanning the whole display list
+class CmdGrid {
+    RECT extent;
+    int cellW, cellH, cols, rows;
+    std::vector<int> cellStart; // Offsets into cellCmds per cell (CSR, like the child index)
+    std::vector<int> cellCmds;
+
+    void CellRange(const RECT& r, int& c0, int& r0, int& c1, int& r1) const {
+        auto clamp = [](int v, int hi) { return std::max(0, std::min(v, hi - 1)); };
+        c0 = clamp((r.left - extent.left) / cellW, cols);  c1 = clamp((r.right - extent.left) / cellW, cols);
+        r0 = clamp((r.top - extent.top) / cellH, rows);    r1 = clamp((r.bottom - extent.top) / cellH, rows);
+    }
+
+public:
+    // bounds[i] is the extent of command i; anything outside `ext` lands in the edge cells
+    CmdGrid(const std::vector<RECT>& bounds, const RECT& ext, int cw, int ch)
+        : extent(ext), cellW(std::max(1, cw)), cellH(std::max(1, ch)) {
+        cols = std::max(1, (int)((ext.right - ext.left + cellW - 1) / cellW));
+        rows = std::max(1, (int)((ext.bottom - ext.top + cellH - 1) / cellH));
+        cellStart.assign((size_t)cols * rows + 1, 0);
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<int> fill;
+            if (pass == 1) {
+                for (size_t c = 1; c < cellStart.size(); ++c) cellStart[c] += cellStart[c - 1];
+                cellCmds.resize(cellStart.back());
+                fill.assign(cellStart.begin(), cellStart.end() - 1);
+            }
+            for (size_t i = 0; i < bounds.size(); ++i) {
+                int c0, r0, c1, r1;
+                CellRange(bounds[i], c0, r0, c1, r1);
+                for (int r = r0; r <= r1; ++r)
+                    for (int c = c0; c <= c1; ++c) {
+                        size_t cell = (size_t)r * cols + c;
+                        if (pass == 0) cellStart[cell + 1]++;
+                        else cellCmds[fill[cell]++] = (int)i;
+                    }
+            }
+        }
+    }
+
+    // Commands whose cells overlap `r`, ascending (= paint order)
+    void Query(const RECT& r, std::vector<int>& out) const {
+        out.clear();
+        int c0, r0, c1, r1;
+        CellRange(r, c0, r0, c1, r1);
+        for (int row = r0; row <= r1; ++row)
+            for (int c = c0; c <= c1; ++c) {
+                size_t cell = (size_t)row * cols + c;
+                out.insert(out.end(), cellCmds.begin() + cellStart[cell], cellCmds.begin() + cellStart[cell + 1]);
+            }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+};
+
+// One retained drawing command in canvas coordinates. Every layout mode is turned into
+// the same list, which the GDI backend plays on screen and the exporters write to file.
+struct DrawCmd {
+    enum Kind : unsigned char { Rect, Polyline, Text, Wedge, Image };
+    Kind kind;
+    unsigned char penStyle;   // PS_SOLID / PS_DOT for outlines and lines
+    unsigned char penWidth;
+    FontRole font;            // Text only
+    COLORREF fill;            // Rect/Wedge fill, Text color, Image placeholder (Config::COL_NONE = none)
+    COLORREF stroke;          // Outline / line color (Config::COL_NONE = none)
+    RECT bounds;              // Rect/Text area, polyline extent, wedge outer square
+    float a0, a1;             // Wedge angles, degrees clockwise from 12 o'clock
+    int inner;                // Wedge inner radius, Image opacity (0-255)
+    int first, count;         // Polyline: slice of points; Text/Image: string index (+ DT_* format)
+};
+
+class DisplayList {
+public:
+    std::vector<DrawCmd> cmds;
+    std::vector<POINT> points;
+    std::vector<std::wstring> strings;
+    std::shared_ptr<const CmdGrid> grid; // Over cmds once the list is complete (see Index), so a paint skips the rest
+
+    void Clear() { cmds.clear(); points.clear(); strings.clear(); grid.reset(); }
+
+    // Builds `grid` over the command bounds; cells grow until there are no more of them
+    // than commands, which bounds the index on sparse canvases. Short lists are scanned.
+    void Index() {
+        grid.reset();
+        if (cmds.size() < 4096) return;
+        RECT ext = {0, 0, 0, 0};
+        for (const auto& c : cmds) {
+            ext.left = std::min(ext.left, c.bounds.left);     ext.top = std::min(ext.top, c.bounds.top);
+            ext.right = std::max(ext.right, c.bounds.right);  ext.bottom = std::max(ext.bottom, c.bounds.bottom);
+        }
+        int64_t cell = Config::PAINT_CELL;
+        while (((int64_t)ext.right - ext.left) / cell * (((int64_t)ext.bottom - ext.top) / cell) > (int64_t)cmds.size() + 1)
+            cell *= 2;
+        std::vector<RECT> bounds(cmds.size());
+        for (size_t i = 0; i < cmds.size(); ++i) bounds[i] = cmds[i].bounds;
+        grid = std::make_shared<const CmdGrid>(bounds, ext, (int)cell, (int)cell);
+    }
+
+    // Blends the colors of cmds[from..] toward the canvas, for filtered-out people
+    void Fade(size_t from) {
+        auto blend = [](COLORREF c) -> COLORREF {
+            if (c == Config::COL_NONE) return c;
+            COLORREF bg = Config::COL_BG_CANVAS;
+            return RGB((GetRValue(c) + 3 * GetRValue(bg)) / 4, (GetGValue(c) + 3 * GetGValue(bg)) / 4,
+                       (GetBValue(c) + 3 * GetBValue(bg)) / 4);
+        };
+        for (size_t i = from; i < cmds.size(); ++i) {
+            cmds[i].fill = blend(cmds[i].fill);
+            cmds[i].stroke = blend(cmds[i].stroke);
+            if (cmds[i].kind == DrawCmd::Image) cmds[i].inner = 64;
+        }
+    }
+
+    void AddRect(const RECT& rc, COLORREF fill, COLORREF stroke, int penStyle = PS_SOLID) {
+        DrawCmd c = Make(DrawCmd::Rect, rc);
+        c.fill = fill; c.stroke = stroke; c.penStyle = (unsigned char)penStyle;
+        cmds.push_back(c);
+    }
+
+    void AddPolyline(const POINT* pts, int n, COLORREF color, int width, int penStyle) {
+        RECT rc = { pts[0].x, pts[0].y, pts[0].x, pts[0].y };
+        for (int i = 1; i < n; ++i) {
+            rc.left = std::min(rc.left, pts[i].x);  rc.right = std::max(rc.right, pts[i].x);
+            rc.top = std::min(rc.top, pts[i].y);    rc.bottom = std::max(rc.bottom, pts[i].y);
+        }
+        DrawCmd c = Make(DrawCmd::Polyline, rc);
+        c.stroke = color; c.penWidth = (unsigned char)width; c.penStyle = (unsigned char)penStyle;
+        c.first = (int)points.size(); c.count = n;
+        points.insert(points.end(), pts, pts + n);
+        cmds.push_back(c);
+    }
+
+    void AddLine(int x1, int y1, int x2, int y2, COLORREF color, int width, int penStyle) {
+        POINT pts[2] = { {x1, y1}, {x2, y2} };
+        AddPolyline(pts, 2, color, width, penStyle);
+    }
+
+    void AddText(const RECT& rc, const std::wstring& text, FontRole font, COLORREF color,
+                 UINT format = DT_CENTER | DT_VCENTER | DT_SINGLELINE) {
+        DrawCmd c = Make(DrawCmd::Text, rc);
+        c.font = font; c.fill = color;
+        c.first = (int)strings.size(); c.count = (int)format;
+        strings.push_back(text);
+        cmds.push_back(c);
+    }
+
+    void AddWedge(POINT center, int inner, int outer, float a0, float a1, COLORREF fill, COLORREF stroke) {
+        RECT rc = { center.x - outer, center.y - outer, center.x + outer, center.y + outer };
+        DrawCmd c = Make(DrawCmd::Wedge, rc);
+        c.fill = fill; c.stroke = stroke; c.inner = inner; c.a0 = a0; c.a1 = a1;
+        cmds.push_back(c);
+    }
+
+    // Photo drawn from the thumbnail cache; `path` keys the cache
+    void AddImage(const RECT& rc, const std::wstring& path) {
+        DrawCmd c = Make(DrawCmd::Image, rc);
+        c.fill = Config::COL_THUMB_PLACEHOLDER; c.inner = 255;
+        c.first = (int)strings.size();
+        strings.push_back(path);
+        cmds.push_back(c);
     }
 
-    std::pair<int,int> ComputeSubtreeSize(int pid, int rootId) {
-        // If owned by another tree, it takes 0 space here
-        if (nodeOwner.count(pid) && nodeOwner[pid] != rootId) return {0, 0};
-        if (subtreeMetrics.count(pid)) return subtreeMetrics[pid];
+    // Distinct image paths, so exports can pin their thumbnails first
+    std::vector<std::wstring> ImagePaths() const {
+        std::set<std::wstring> paths;
+        for (const auto& c : cmds) if (c.kind == DrawCmd::Image) paths.insert(strings[c.first]);
+        return std::vector<std::wstring>(paths.begin(), paths.end());
+    }
 
-        Person* p = model->Get(pid);
-        int numSpouses = (int)p->spouses.size();
+    static POINT Center(const DrawCmd& c) {
+        return { (c.bounds.left + c.bounds.right) / 2, (c.bounds.top + c.bounds.bottom) / 2 };
+    }
 
-        // Width of Parents Cluster ( [Spouse] [Main] [Spouse] )
-        int parentsW = Config::BOX_WIDTH;
-        if (numSpouses > 0) {
-            parentsW = (Config::BOX_WIDTH * (1 + numSpouses)) + (Config::SPOUSE_GAP * numSpouses);
-        }
+    static POINT Polar(POINT center, double r, double deg) {
+        double a = deg * 3.14159265358979 / 180.0;
+        return { center.x + (LONG)std::lround(r * std::sin(a)), center.y - (LONG)std::lround(r * std::cos(a)) };
+    }
 
-        // Width of Children
-        auto kids = GetChildren(pid);
-        int kidsW = 0;
-        for(int k : kids) kidsW += ComputeSubtreeSize(k, rootId).first;
-        if(!kids.empty()) kidsW += (int)((kids.size() - 1) * Config::H_GAP);
+    // Outline of an annular wedge as a polygon (outer arc forward, inner arc back);
+    // the segment count follows the arc length so tiny outer-ring wedges stay cheap
+    static void WedgeOutline(const DrawCmd& c, std::vector<POINT>& out) {
+        POINT ctr = Center(c);
+        int outer = (c.bounds.right - c.bounds.left) / 2;
+        double sweep = c.a1 - c.a0;
+        int segs = std::max(2, std::min(180, (int)(outer * sweep * 3.14159265358979 / 180.0 / 6.0)));
+
+        out.clear();
+        for (int i = 0; i <= segs; ++i) out.push_back(Polar(ctr, outer, c.a0 + sweep * i / segs));
+        if (c.inner <= 0) { out.push_back(ctr); return; }
+        for (int i = segs; i >= 0; --i) out.push_back(Polar(ctr, c.inner, c.a0 + sweep * i / segs));
+    }
 
-        int totalW = std::max(parentsW, kidsW);
-        subtreeMetrics[pid] = { totalW, totalW/2 };
-        return subtreeMetrics[pid];
+private:
+    static DrawCmd Make(DrawCmd::Kind kind, const RECT& rc) {
+        DrawCmd c = {};
+        c.kind = kind; c.bounds = rc;
+        c.penStyle = PS_SOLID; c.penWidth = 1;
+        c.fill = c.stroke = Config::COL_NONE;
+        return c;
     }
+};
 
-    void PositionSubtree(int pid, int x, int y, std::set<int>& placed, int rootId) {
-        if (nodeOwner.count(pid) && nodeOwner[pid] != rootId) return;
-        if (placed.count(pid)) return;
-        placed.insert(pid);
+// Filter result as seen by the renderer: selected people draw normally, the rest are
+// faded or, with `hide`, left out together with their lines
+struct SelectionView {
+    const RowBitmap* bits = nullptr; // Dense indices of the rendered model; null = everyone
+    bool hide = false;
+    const std::vector<int>* relation = nullptr; // IDs of a relationship chain to highlight
 
-        Person* p = model->Get(pid);
-        for(int sid : p->spouses) placed.insert(sid);
+    bool Selected(int idx) const { return !bits || idx < 0 || bits->Test(idx); }
+    bool Drawn(int idx) const { return !hide || Selected(idx); }
+};
 
-        int centerOffset = subtreeMetrics[pid].second;
-        int absoluteCenter = x + centerOffset;
+// Builds the display list for the current layout
+class Renderer {
+public:
+    static void DrawTree(DisplayList& dl, const DataModel* model, const LayoutEngine& layout, int totalWidth,
+                         const SelectionView& sel = SelectionView()) {
+        DrawScene(dl, model, layout, totalWidth, sel);
+        dl.Index();
+    }
 
-        // 1. Position Parents Block
-        int numSpouses = (int)p->spouses.size();
-        int parentsW = Config::BOX_WIDTH;
-        if (numSpouses > 0) parentsW = (Config::BOX_WIDTH * (1 + numSpouses)) + (Config::SPOUSE_GAP * numSpouses);
+    static void DrawScene(DisplayList& dl, const DataModel* model, const LayoutEngine& layout, int totalWidth,
+                          const SelectionView& sel) {
+        dl.Clear();
 
-        int currentX = absoluteCenter - (parentsW/2);
+        // Draw Header
+        DrawHeader(dl, totalWidth);
 
-        // A. Left Spouses
-        int numLeft = numSpouses / 2;
-        for(int i = 0; i < numLeft; ++i) {
-            Person* sp = model->Get(p->spouses[i]);
-            if(sp) {
-                sp->x = currentX; sp->y = y;
-                currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
-            }
+        if (layout.IsFanMode()) {
+            DrawFan(dl, model, layout, sel);
+            return;
+        }
+        if (layout.mode == LayoutMode::Timeline) {
+            DrawTimeline(dl, model, layout, sel);
+            return;
         }
-        // B. Main Person
-        p->x = currentX; p->y = y;
-        currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
 
-        // C. Right Spouses
-        for(int i = numLeft; i < numSpouses; ++i) {
-            Person* sp = model->Get(p->spouses[i]);
-            if(sp) {
-                sp->x = currentX; sp->y = y;
-                currentX += Config::BOX_WIDTH + Config::SPOUSE_GAP;
+        // Draw Lines (Behind boxes)
+        if (layout.routesConnectors) {
+            DrawConnectors(dl, layout.connectors, sel);
+        } else {
+            for (int i : layout.placed) {
+                if (!sel.Drawn(i)) continue;
+                if (!model->people[i].spouses.empty()) DrawSpouseConnectors(dl, i, model, layout, sel);
+                else DrawSingleParentChildren(dl, i, model, layout, sel);
             }
         }
 
-        // 2. Position Children
-        auto kids = GetChildren(pid);
-        if(kids.empty()) return;
-
-        int kidsTotalW = 0;
-        for(int k : kids) kidsTotalW += subtreeMetrics[k].first;
-        kidsTotalW += (int)(kids.size()-1) * Config::H_GAP;
+        if (sel.relation) DrawRelationLinks(dl, model, layout, *sel.relation);
 
-        int childX = absoluteCenter - (kidsTotalW/2);
-        for(int k : kids) {
-            PositionSubtree(k, childX, y + Config::V_GAP, placed, rootId);
-            childX += subtreeMetrics[k].first + Config::H_GAP;
+        // Draw Boxes (On top)
+        int photoCol = model->attrs.FindAny({"photo", "image", "picture", "portrait"});
+        auto photoOf = [&](int idx) {
+            return (photoCol >= 0 && idx >= 0) ? model->attrs.Get(photoCol).Text(idx) : std::wstring();
+        };
+        for (int i : layout.placed) {
+            DrawSelectable(dl, sel, i, [&] {
+                DrawBox(dl, model->people[i], layout.boxX[i], layout.boxY[i], false, photoOf(i));
+            });
         }
-    }
-
-    void FinalizeBounds() {
-        int mx = 0, my = 0;
-        for(const auto& p : model->people) {
-            if(p.x > -9000) {
-                mx = std::max(mx, p.x + Config::BOX_WIDTH);
-                my = std::max(my, p.y + Config::BOX_HEIGHT);
-            }
+        for (const auto& px : layout.proxies) {
+            const Person* p = model->Get(px.personId);
+            int idx = model->IndexOf(px.personId);
+            if (p) DrawSelectable(dl, sel, idx, [&] { DrawBox(dl, *p, px.x, px.y, true, photoOf(idx)); });
         }
-        totalWidth = mx + 100;
-        totalHeight = my + 100;
+        if (sel.relation) DrawRelationFrames(dl, model, layout, *sel.relation);
     }
-};
-
-// -----------------------------------------------------------------------------
-// 5. RENDERER
-// -----------------------------------------------------------------------------
-class Renderer {
-public:
-    static void DrawTree(HDC hdc, DataModel* model, int totalWidth) {
-        // Draw Header
-        DrawHeader(hdc, totalWidth);
 
-        // Draw Lines (Behind boxes)
-        for (const auto& p : model->people) {
-            if (p.x < -9000) continue;
-            if (!p.spouses.empty()) DrawSpouseConnectors(hdc, &p, model);
-            else DrawSingleParentChildren(hdc, &p, model);
+    // Relationship chain, behind the boxes: a thick line through the centers of consecutive
+    // members (broken where a member has no box in this layout)
+    static void DrawRelationLinks(DisplayList& dl, const DataModel* model, const LayoutEngine& layout,
+                                  const std::vector<int>& ids) {
+        std::vector<POINT> pts;
+        auto flush = [&] {
+            if (pts.size() > 1) dl.AddPolyline(pts.data(), (int)pts.size(), Config::COL_RELATION, 5, PS_SOLID);
+            pts.clear();
+        };
+        for (int id : ids) {
+            int idx = model->IndexOf(id);
+            if (idx < 0 || !layout.Placed(idx)) { flush(); continue; }
+            pts.push_back({ layout.boxX[idx] + Config::BOX_WIDTH / 2, layout.boxY[idx] + Config::BOX_HEIGHT / 2 });
         }
+        flush();
+    }
 
-        // Draw Boxes (On top)
-        SetBkMode(hdc, TRANSPARENT);
-        for (const auto& p : model->people) {
-            if (p.x > -9000) DrawBox(hdc, p);
+    // ...and on top of them, a double frame round each member's box
+    static void DrawRelationFrames(DisplayList& dl, const DataModel* model, const LayoutEngine& layout,
+                                   const std::vector<int>& ids) {
+        for (int id : ids) {
+            int idx = model->IndexOf(id);
+            if (idx < 0 || !layout.Placed(idx)) continue;
+            for (int inset = 2; inset <= 3; ++inset) {
+                RECT rc = { layout.boxX[idx] - inset, layout.boxY[idx] - inset,
+                            layout.boxX[idx] + Config::BOX_WIDTH + inset, layout.boxY[idx] + Config::BOX_HEIGHT + inset };
+                dl.AddRect(rc, Config::COL_NONE, Config::COL_RELATION);
+            }
         }
     }
 
     static void DrawLegend(HDC hdc, int clientH) {
-        int x = 20;
-        int h = 135;
-        int w = 360;
-        int y = clientH - h - 20;
+        int x = Config::LEGEND_INSET;
+        int h = Config::LEGEND_H;
+        int w = Config::LEGEND_W;
+        int y = clientH - h - Config::LEGEND_INSET;
 
         // Shadow
-        RECT rcShadow = {x+4, y+4, x+w+4, y+h+4};
+        const int sd = Config::BOX_SHADOW;
+        RECT rcShadow = {x+sd, y+sd, x+w+sd, y+h+sd};
         {
             ScopedGDI<HBRUSH> sh(CreateSolidBrush(RGB(210, 210, 210)));
             FillRect(hdc, &rcShadow, sh);
@@ -622,192 +7314,1462 @@ public:
         int col2X = x + 150;
         currY = contentY; // Reset Y
 
-        auto DrawLegendLine = [&](const wchar_t* txt, COLORREF col, int style, int width) {
-            {
-                ScopedGDI<HPEN> pen(CreatePen(style, width, col));
-                AutoSelect selPen(hdc, pen);
-                MoveToEx(hdc, col2X, currY+8, NULL);
-                LineTo(hdc, col2X+25, currY+8);
+        auto DrawLegendLine = [&](const wchar_t* txt, COLORREF col, int style, int width) {
+            {
+                ScopedGDI<HPEN> pen(CreatePen(style, width, col));
+                AutoSelect selPen(hdc, pen);
+                MoveToEx(hdc, col2X, currY+8, NULL);
+                LineTo(hdc, col2X+25, currY+8);
+            }
+            TextOutW(hdc, col2X+35, currY-1, txt, lstrlenW(txt));
+            currY += 26;
+        };
+
+        DrawLegendLine(L"Spouse", Config::LINE_SPOUSE_CURR, PS_SOLID, 2);
+        DrawLegendLine(L"Ex-Spouse", Config::LINE_SPOUSE_EX, PS_DOT, 1);
+        DrawLegendLine(L"Child", Config::LINE_CHILD_NORMAL, PS_SOLID, 2);
+    }
+
+private:
+    static void DrawHeader(DisplayList& dl, int width) {
+        RECT rc = {0, 10, width, 70};
+        dl.AddText(rc, L"My Family Tree", FontRole::Title, RGB(60, 60, 60), DT_CENTER | DT_NOCLIP);
+    }
+
+    // Runs draw() for person idx unless hidden, fading what it emitted if unselected
+    template <typename Fn>
+    static void DrawSelectable(DisplayList& dl, const SelectionView& sel, int idx, Fn draw) {
+        if (!sel.Drawn(idx)) return;
+        size_t first = dl.cmds.size();
+        draw();
+        if (!sel.Selected(idx)) dl.Fade(first);
+    }
+
+    static COLORREF BoxColor(const Person& p, bool isProxy) {
+        if (isProxy) return Config::COL_BOX_PROXY;
+        if (p.role.find(L"Myself") != std::string::npos) return Config::COL_BOX_FOCUS;
+        if (p.IsFemale()) return Config::COL_BOX_FEMALE;
+        return Config::COL_BOX_DEFAULT;
+    }
+
+    // Fan chart: one wedge per slot
+    static void DrawFan(DisplayList& dl, const DataModel* model, const LayoutEngine& layout, const SelectionView& sel) {
+        for (const auto& w : layout.fan) {
+            const Person* p = model->Get(w.personId);
+            if (!p) continue;
+            DrawSelectable(dl, sel, model->IndexOf(w.personId), [&] { DrawFanSlot(dl, *p, w, layout); });
+        }
+    }
+
+    // One wedge, labelled only where the mid-arc is wide enough
+    static void DrawFanSlot(DisplayList& dl, const Person& p, const FanSlot& w, const LayoutEngine& layout) {
+        int inner = LayoutEngine::RingInner(w.ring);
+        int outer = LayoutEngine::RingOuter(w.ring);
+        bool disc = (w.ring == 0); // The focus person fills the whole center disc
+        dl.AddWedge(layout.fanCenter, inner, outer, disc ? 0.0f : w.a0, disc ? 360.0f : w.a1,
+                    BoxColor(p, w.proxy), w.proxy ? Config::COL_PROXY_BORDER : Config::COL_BOX_BORDER);
+
+        if (w.ring == 0) {
+            RECT rc = { layout.fanCenter.x - outer + 10, layout.fanCenter.y - 12,
+                        layout.fanCenter.x + outer - 10, layout.fanCenter.y + 12 };
+            dl.AddText(rc, p.name, FontRole::Name, Config::COL_TEXT_NAME);
+            return;
+        }
+
+        double rMid = (inner + outer) / 2.0;
+        double arc = rMid * (w.a1 - w.a0) * 3.14159265358979 / 180.0;
+        if (arc < Config::FAN_MIN_LABEL) return;
+
+        POINT c = DisplayList::Polar(layout.fanCenter, rMid, (w.a0 + w.a1) / 2.0);
+        int half = (int)std::min(arc, (double)Config::FAN_RING_W + 20) / 2;
+        RECT rc = { c.x - half, c.y - 9, c.x + half, c.y + 9 };
+        dl.AddText(rc, p.name, FontRole::Label, Config::COL_TEXT_NAME,
+                   DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_END_ELLIPSIS);
+    }
+
+    // Timeline: decade grid, parent-to-child ticks at the child's birth, then one bar per life
+    static void DrawTimeline(DisplayList& dl, const DataModel* model, const LayoutEngine& layout, const SelectionView& sel) {
+        if (layout.timeline.empty()) return;
+        int bottom = 0;
+        for (const auto& l : layout.timeline) bottom = std::max(bottom, l.y + Config::TL_BAR_HEIGHT);
+
+        for (int year = layout.timelineFirstYear; year <= layout.timelineLastYear; year += 10) {
+            int x = layout.TimelineX(year);
+            bool century = (year % 100 == 0);
+            dl.AddLine(x, Config::TL_TOP - 10, x, bottom + 10, century ? RGB(190, 190, 190) : RGB(225, 225, 225),
+                       1, century ? PS_SOLID : PS_DOT);
+            RECT rc = { x - 30, Config::TL_TOP - 34, x + 30, Config::TL_TOP - 14 };
+            dl.AddText(rc, std::to_wstring(year), FontRole::Label, Config::COL_TEXT_ROLE);
+        }
+
+        std::vector<int> slot(model->people.size(), -1);
+        for (size_t i = 0; i < layout.timeline.size(); ++i) {
+            int idx = model->IndexOf(layout.timeline[i].personId);
+            if (idx >= 0) slot[idx] = (int)i;
+        }
+        for (const auto& l : layout.timeline) {
+            const Person* p = model->Get(l.personId);
+            if (!sel.Drawn(model->IndexOf(l.personId))) continue;
+            for (int parentIdx : { p->fatherIdx, p->motherIdx }) {
+                if (parentIdx < 0 || slot[parentIdx] < 0 || !sel.Drawn(parentIdx)) continue;
+                const Lifeline& pl = layout.timeline[slot[parentIdx]];
+                int py = (pl.y < l.y) ? pl.y + Config::TL_BAR_HEIGHT : pl.y;
+                int cy = (pl.y < l.y) ? l.y : l.y + Config::TL_BAR_HEIGHT;
+                dl.AddLine(l.x0, py, l.x0, cy, Config::LINE_CHILD_NORMAL, 1, PS_SOLID);
+            }
+        }
+
+        for (const auto& l : layout.timeline) {
+            const Person* p = model->Get(l.personId);
+            size_t first = dl.cmds.size();
+            int idx = model->IndexOf(l.personId);
+            if (!sel.Drawn(idx)) continue;
+            RECT rc = { l.x0, l.y, l.x1, l.y + Config::TL_BAR_HEIGHT };
+            dl.AddRect(rc, BoxColor(*p, false), l.estimated ? Config::COL_PROXY_BORDER : Config::COL_BOX_BORDER,
+                       l.estimated ? PS_DOT : PS_SOLID);
+
+            // Label may run past a short bar; the packing reserves TL_MIN_BAR for it
+            std::wstring label = p->name + L"  " + (l.estimated ? L"~" : L"") + std::to_wstring(l.fromYear) + L"\u2013";
+            if (l.died) label += std::to_wstring(l.toYear);
+            RECT rcText = { l.x0 + 6, l.y, std::max(l.x1, l.x0 + Config::TL_MIN_BAR) - 4, l.y + Config::TL_BAR_HEIGHT };
+            dl.AddText(rcText, label, FontRole::Label, Config::COL_TEXT_NAME,
+                       DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_END_ELLIPSIS);
+            if (!sel.Selected(idx)) dl.Fade(first);
+        }
+    }
+
+    // Connectors pre-routed by the layout (DAG and focus modes)
+    static void DrawConnectors(DisplayList& dl, const std::vector<Connector>& connectors, const SelectionView& sel) {
+        for (const auto& c : connectors) {
+            if (!sel.Drawn(c.fromIdx) || !sel.Drawn(c.toIdx)) continue;
+            if (c.kind == Connector::Child) {
+                dl.AddLine(c.from.x, c.from.y, c.from.x, c.from.y + 30, Config::LINE_CHILD_NORMAL, 2, PS_SOLID); // Drop 30px
+                DrawOrthogonalLine(dl, c.from.x, c.from.y + 30, c.to.x, c.to.y);
+            } else {
+                bool isEx = (c.kind == Connector::SpouseEx);
+                dl.AddLine(c.from.x, c.from.y, c.to.x, c.to.y,
+                           isEx ? Config::LINE_SPOUSE_EX : Config::LINE_SPOUSE_CURR,
+                           isEx ? 1 : 2, isEx ? PS_DOT : PS_SOLID);
+            }
+        }
+    }
+
+    static void DrawSpouseConnectors(DisplayList& dl, int pi, const DataModel* m, const LayoutEngine& layout,
+                                     const SelectionView& sel) {
+        const Person* p = &m->people[pi];
+        int px = layout.boxX[pi];
+        int yC = layout.boxY[pi] + Config::BOX_HEIGHT/2;
+        int numSpouses = (int)p->spouses.size();
+
+        for(int i=0; i < numSpouses; ++i) {
+            int sid = p->spouses[i];
+            int si = m->IndexOf(sid);
+            if (si < 0 || !layout.Placed(si) || !sel.Drawn(si)) continue;
+            int sx = layout.boxX[si];
+
+            // Line Style: Ex-Spouse (Dashed) vs Current (Solid)
+            bool isEx = p->spouses.IsEx(sid);
+            COLORREF col = isEx ? Config::LINE_SPOUSE_EX : Config::LINE_SPOUSE_CURR;
+            int style = isEx ? PS_DOT : PS_SOLID;
+            int width = isEx ? 1 : 2;
+
+            // Horizontal connection
+            if (sx > px) dl.AddLine(px + Config::BOX_WIDTH, yC, sx, yC, col, width, style);
+            else dl.AddLine(px, yC, sx + Config::BOX_WIDTH, yC, col, width, style);
+
+            // Child Drop Lines
+            DrawPairChildren(dl, pi, si, m, layout, sel);
+        }
+    }
+
+    static void DrawPairChildren(DisplayList& dl, int i1, int i2, const DataModel* m, const LayoutEngine& layout,
+                                 const SelectionView& sel) {
+        const Person* p1 = &m->people[i1];
+        const Person* p2 = &m->people[i2];
+        std::vector<int> kids;
+        for(int k : m->Children(i1)) {
+            const Person& kid = m->people[k];
+            bool match = (kid.fatherId == p1->id && kid.motherId == p2->id) ||
+                         (kid.motherId == p1->id && kid.fatherId == p2->id);
+            if(match && sel.Drawn(k)) kids.push_back(k);
+        }
+
+        if(!kids.empty()) {
+            int leftX = std::min(layout.boxX[i1], layout.boxX[i2]);
+            int midX = leftX + Config::BOX_WIDTH + (Config::SPOUSE_GAP/2);
+            int yC = layout.boxY[i1] + Config::BOX_HEIGHT/2;
+
+            dl.AddLine(midX, yC, midX, yC + 30, Config::LINE_CHILD_NORMAL, 2, PS_SOLID); // Drop 30px
+
+            for(int k : kids) {
+                if(layout.Placed(k)) {
+                    DrawOrthogonalLine(dl, midX, yC + 30, layout.boxX[k] + Config::BOX_WIDTH/2, layout.boxY[k]);
+                }
+            }
+        }
+    }
+
+    static void DrawSingleParentChildren(DisplayList& dl, int pi, const DataModel* m, const LayoutEngine& layout,
+                                         const SelectionView& sel) {
+        const Person* p = &m->people[pi];
+        for(int kIdx : m->Children(pi)) {
+            const Person& k = m->people[kIdx];
+            // Check if this is the ONLY known parent (or other parent is unknown/unlisted)
+            int otherId = (k.fatherId == p->id) ? k.motherId : k.fatherId;
+
+            // If other parent is in the spouse list, it's handled by DrawPairChildren
+            bool otherInSpouses = false;
+            for(int sid : p->spouses) if(sid == otherId) otherInSpouses = true;
+
+            if(!otherInSpouses && layout.Placed(kIdx) && sel.Drawn(kIdx)) {
+                int midX = layout.boxX[pi] + Config::BOX_WIDTH/2;
+                int yC = layout.boxY[pi] + Config::BOX_HEIGHT/2;
+                // Single parents usually drop lines from bottom center, or slightly lower?
+                // Let's drop from center + 30 to match others
+                DrawOrthogonalLine(dl, midX, yC + 30, layout.boxX[kIdx] + Config::BOX_WIDTH/2, layout.boxY[kIdx]);
+            }
+        }
+    }
+
+    static void DrawOrthogonalLine(DisplayList& dl, int x1, int y1, int x2, int y2) {
+        int midY = (y1 + y2) / 2;
+        POINT pts[4] = { {x1, y1}, {x1, midY}, {x2, midY}, {x2, y2} };
+        dl.AddPolyline(pts, 4, Config::LINE_CHILD_NORMAL, 2, PS_SOLID);
+    }
+
+    // Proxy boxes stand in for a person whose real box is elsewhere: no shadow, dotted border
+    // With a photo the portrait sits on the left and the text moves right of it
+    static void DrawBox(DisplayList& dl, const Person& p, int x, int y, bool isProxy, const std::wstring& photo) {
+        RECT rc = { x, y, x + Config::BOX_WIDTH, y + Config::BOX_HEIGHT };
+
+        // 1. Shadow
+        if (!isProxy) {
+            RECT rcShadow = rc; OffsetRect(&rcShadow, Config::BOX_SHADOW, Config::BOX_SHADOW);
+            dl.AddRect(rcShadow, RGB(220, 220, 220), Config::COL_NONE);
+        }
+
+        // 2. Background + 3. Border
+        if (isProxy) dl.AddRect(rc, BoxColor(p, true), Config::COL_PROXY_BORDER, PS_DOT);
+        else dl.AddRect(rc, BoxColor(p, false), Config::COL_BOX_BORDER);
+
+        RECT rcText = rc;
+        UINT fmt = DT_CENTER | DT_VCENTER | DT_SINGLELINE;
+        if (!photo.empty()) {
+            int inset = (Config::BOX_HEIGHT - Config::THUMB_SIZE) / 2;
+            RECT rcPhoto = { x + inset, y + inset, x + inset + Config::THUMB_SIZE, y + inset + Config::THUMB_SIZE };
+            dl.AddImage(rcPhoto, photo);
+            rcText.left = rcPhoto.right + 4;
+            fmt |= DT_END_ELLIPSIS; // Less room for the name next to the photo
+        }
+
+        // 4. Text
+        // Name (Top half)
+        RECT rcName = rcText; rcName.bottom -= 20; rcName.top += 6;
+        dl.AddText(rcName, p.name, FontRole::Name, Config::COL_TEXT_NAME, fmt);
+
+        // Role (Bottom half)
+        RECT rcRole = rcText; rcRole.top += 28;
+        dl.AddText(rcRole, isProxy ? p.role + L" (see linked box)" : p.role, FontRole::Role, Config::COL_TEXT_ROLE, fmt);
+    }
+};
+
+// Plays a display list onto a GDI device context
+class GdiBackend {
+public:
+    // `view` (canvas coordinates) culls commands that cannot be visible; null draws all.
+    // Photos come from `thumbs` (placeholders while decoding or without a cache).
+    // `scale` is the device pixels per canvas unit the caller's world transform applies
+    // (DPI / 96); it only picks the photo resolution, everything else scales with the DC.
+    static void Play(HDC hdc, const DisplayList& dl, const RECT* view = nullptr, ThumbnailCache* thumbs = nullptr,
+                     double scale = 1.0) {
+        SetBkMode(hdc, TRANSPARENT);
+        std::vector<POINT> outline;
+        HDC imageDC = nullptr;
+
+        // With a view, only the commands in its grid cells (in paint order) are tested
+        std::vector<int> hits;
+        bool indexed = view && dl.grid;
+        if (indexed) dl.grid->Query(*view, hits);
+        size_t n = indexed ? hits.size() : dl.cmds.size();
+        for (size_t k = 0; k < n; ++k) {
+            const DrawCmd& c = dl.cmds[indexed ? hits[k] : k];
+            if (view && (c.bounds.right < view->left || c.bounds.left > view->right ||
+                         c.bounds.bottom < view->top || c.bounds.top > view->bottom)) continue;
+
+            switch (c.kind) {
+            case DrawCmd::Rect:
+                if (c.fill != Config::COL_NONE) {
+                    ScopedGDI<HBRUSH> br(CreateSolidBrush(c.fill));
+                    FillRect(hdc, &c.bounds, br);
+                }
+                if (c.stroke != Config::COL_NONE) {
+                    if (c.penStyle == PS_SOLID) {
+                        ScopedGDI<HBRUSH> br(CreateSolidBrush(c.stroke));
+                        FrameRect(hdc, &c.bounds, br);
+                    } else {
+                        ScopedGDI<HPEN> pen(CreatePen(c.penStyle, 1, c.stroke));
+                        AutoSelect selPen(hdc, pen);
+                        AutoSelect selBrush(hdc, GetStockObject(NULL_BRUSH));
+                        Rectangle(hdc, c.bounds.left, c.bounds.top, c.bounds.right, c.bounds.bottom);
+                    }
+                }
+                break;
+
+            case DrawCmd::Polyline: {
+                ScopedGDI<HPEN> pen(CreatePen(c.penStyle, c.penWidth, c.stroke));
+                AutoSelect sel(hdc, pen);
+                Polyline(hdc, &dl.points[c.first], c.count);
+                break;
+            }
+
+            case DrawCmd::Text: {
+                AutoSelect sel(hdc, Font(c.font));
+                SetTextColor(hdc, c.fill);
+                RECT rc = c.bounds;
+                DrawTextW(hdc, dl.strings[c.first].c_str(), -1, &rc, (UINT)c.count);
+                break;
+            }
+
+            case DrawCmd::Wedge: {
+                DisplayList::WedgeOutline(c, outline);
+                ScopedGDI<HBRUSH> br(CreateSolidBrush(c.fill));
+                ScopedGDI<HPEN> pen(c.stroke != Config::COL_NONE ? CreatePen(PS_SOLID, 1, c.stroke)
+                                                                 : (HPEN)GetStockObject(NULL_PEN));
+                AutoSelect selBrush(hdc, br);
+                AutoSelect selPen(hdc, pen);
+                Polygon(hdc, outline.data(), (int)outline.size());
+                break;
+            }
+
+            case DrawCmd::Image: {
+                std::shared_ptr<const ThumbnailCache::Thumb> thumb;
+                if (thumbs) thumb = thumbs->Get(dl.strings[c.first], ThumbPixels(c.bounds.right - c.bounds.left, scale));
+                if (!thumb) { DrawPlaceholder(hdc, c); break; }
+
+                if (!thumb->dib) thumb->dib = CreateDib(*thumb);
+                if (!imageDC) imageDC = CreateCompatibleDC(hdc);
+                AutoSelect sel(imageDC, thumb->dib);
+                BLENDFUNCTION blend = { AC_SRC_OVER, 0, (BYTE)c.inner, AC_SRC_ALPHA };
+                AlphaBlend(hdc, c.bounds.left, c.bounds.top, c.bounds.right - c.bounds.left, c.bounds.bottom - c.bounds.top,
+                           imageDC, 0, 0, thumb->w, thumb->h, blend);
+                break;
+            }
+            }
+        }
+        if (imageDC) DeleteDC(imageDC);
+    }
+
+    // Photo size to decode for a box `width` canvas units wide drawn at `scale`
+    static int ThumbPixels(int width, double scale) { return std::max(1, (int)std::lround(width * scale)); }
+
+private:
+    // Created once in canvas units; a scaling world transform renders them at the
+    // target resolution, so every DPI shares the same fonts
+    static HFONT Font(FontRole role) {
+        static ScopedGDI<HFONT> fonts[4] = {
+            CreateFont(36, 0, 0, 0, FW_SEMIBOLD, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"),
+            CreateFont(19, 0, 0, 0, FW_BOLD, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"),
+            CreateFont(15, 0, 0, 0, FW_NORMAL, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"),
+            CreateFont(13, 0, 0, 0, FW_NORMAL, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"),
+        };
+        return fonts[(int)role];
+    }
+
+    static HBITMAP CreateDib(const ThumbnailCache::Thumb& t) {
+        BITMAPINFO bi = {};
+        bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bi.bmiHeader.biWidth = t.w;
+        bi.bmiHeader.biHeight = -t.h; // Top-down
+        bi.bmiHeader.biPlanes = 1;
+        bi.bmiHeader.biBitCount = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+        void* bits = nullptr;
+        HBITMAP dib = CreateDIBSection(NULL, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
+        if (dib && bits) memcpy(bits, t.pixels.data(), t.pixels.size() * 4);
+        return dib;
+    }
+
+    // Gray square with a head-and-shoulders silhouette
+    static void DrawPlaceholder(HDC hdc, const DrawCmd& c) {
+        const RECT& rc = c.bounds;
+        ScopedGDI<HBRUSH> bg(CreateSolidBrush(c.fill));
+        FillRect(hdc, &rc, bg);
+
+        int w = rc.right - rc.left, h = rc.bottom - rc.top, cx = rc.left + w / 2;
+        COLORREF shade = (c.inner < 255) ? c.fill : Config::COL_THUMB_SILHOUETTE;
+        ScopedGDI<HBRUSH> fg(CreateSolidBrush(shade));
+        AutoSelect selBrush(hdc, fg);
+        AutoSelect selPen(hdc, GetStockObject(NULL_PEN));
+        Ellipse(hdc, cx - w / 5, rc.top + h / 6, cx + w / 5, rc.top + h / 6 + 2 * w / 5);
+        int saved = SaveDC(hdc);
+        IntersectClipRect(hdc, rc.left, rc.top, rc.right, rc.bottom);
+        Ellipse(hdc, rc.left + w / 8, rc.top + 2 * h / 3, rc.right - w / 8, rc.bottom + h / 2);
+        RestoreDC(hdc, saved);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// 6. EXPORT
+// -----------------------------------------------------------------------------
+
+// Writes a display list as an SVG document (vector output for posters and printing)
+class SvgWriter {
+public:
+    // Photos are embedded as PNG data URIs from `thumbs`; callers pin them first
+    static bool Write(const DisplayList& dl, int width, int height, const std::wstring& filePath,
+                      ThumbnailCache* thumbs = nullptr) {
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, filePath.c_str(), -1, pathMB, MAX_PATH, NULL, NULL);
+
+        std::ofstream out(pathMB, std::ios::binary);
+        if (!out.is_open()) return false;
+
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height
+            << "\" viewBox=\"0 0 " << width << " " << height << "\">\n"
+            << "<rect width=\"100%\" height=\"100%\" fill=\"" << Hex(Config::COL_BG_CANVAS) << "\"/>\n";
+
+        std::map<std::wstring, std::string> pngs; // Base64 PNG per photo path, encoded once
+
+        for (const auto& c : dl.cmds) {
+            switch (c.kind) {
+            case DrawCmd::Rect:
+                out << "<rect x=\"" << c.bounds.left << "\" y=\"" << c.bounds.top
+                    << "\" width=\"" << (c.bounds.right - c.bounds.left)
+                    << "\" height=\"" << (c.bounds.bottom - c.bounds.top) << "\""
+                    << Paint(c.fill, c.stroke, 1, c.penStyle) << "/>\n";
+                break;
+
+            case DrawCmd::Polyline:
+                out << "<polyline points=\"";
+                for (int i = 0; i < c.count; ++i) {
+                    const POINT& pt = dl.points[c.first + i];
+                    out << (i ? " " : "") << pt.x << "," << pt.y;
+                }
+                out << "\"" << Paint(Config::COL_NONE, c.stroke, c.penWidth, c.penStyle) << "/>\n";
+                break;
+
+            case DrawCmd::Text: {
+                static const int sizes[4] = {36, 19, 15, 13};
+                static const int weights[4] = {600, 700, 400, 400};
+                UINT fmt = (UINT)c.count;
+                int x = (fmt & DT_CENTER) ? (c.bounds.left + c.bounds.right) / 2 : c.bounds.left;
+                int y = (fmt & DT_VCENTER) ? (c.bounds.top + c.bounds.bottom) / 2 : c.bounds.top;
+                out << "<text x=\"" << x << "\" y=\"" << y << "\" font-family=\"Segoe UI, sans-serif\""
+                    << " font-size=\"" << sizes[(int)c.font] << "\" font-weight=\"" << weights[(int)c.font] << "\""
+                    << " fill=\"" << Hex(c.fill) << "\""
+                    << ((fmt & DT_CENTER) ? " text-anchor=\"middle\"" : "")
+                    << ((fmt & DT_VCENTER) ? " dominant-baseline=\"central\"" : " dominant-baseline=\"hanging\"")
+                    << ">" << Escape(ToUtf8(dl.strings[c.first])) << "</text>\n";
+                break;
+            }
+
+            case DrawCmd::Wedge:
+                out << "<path d=\"" << WedgePath(c) << "\"" << Paint(c.fill, c.stroke, 1, PS_SOLID) << "/>\n";
+                break;
+
+            case DrawCmd::Image: {
+                const std::wstring& path = dl.strings[c.first];
+                auto it = pngs.find(path);
+                if (it == pngs.end()) {
+                    auto thumb = thumbs ? thumbs->Get(path) : nullptr;
+                    it = pngs.emplace(path, thumb ? Base64(ThumbnailCache::EncodePng(*thumb)) : std::string()).first;
+                }
+                int w = c.bounds.right - c.bounds.left, h = c.bounds.bottom - c.bounds.top;
+                if (it->second.empty()) {
+                    out << "<rect x=\"" << c.bounds.left << "\" y=\"" << c.bounds.top << "\" width=\"" << w
+                        << "\" height=\"" << h << "\"" << Paint(c.fill, Config::COL_NONE, 1, PS_SOLID) << "/>\n";
+                } else {
+                    out << "<image x=\"" << c.bounds.left << "\" y=\"" << c.bounds.top << "\" width=\"" << w
+                        << "\" height=\"" << h << "\"";
+                    if (c.inner < 255) out << " opacity=\"" << (c.inner / 255.0) << "\"";
+                    out << " href=\"data:image/png;base64," << it->second << "\"/>\n";
+                }
+                break;
+            }
+            }
+        }
+
+        out << "</svg>\n";
+        return out.good();
+    }
+
+private:
+    static std::string Hex(COLORREF c) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "#%02x%02x%02x", GetRValue(c), GetGValue(c), GetBValue(c));
+        return buf;
+    }
+
+    static std::string Paint(COLORREF fill, COLORREF stroke, int width, int penStyle) {
+        std::string s = " fill=\"" + (fill == Config::COL_NONE ? std::string("none") : Hex(fill)) + "\"";
+        if (stroke == Config::COL_NONE) return s;
+        s += " stroke=\"" + Hex(stroke) + "\" stroke-width=\"" + std::to_string(width) + "\"";
+        if (penStyle == PS_DOT) s += " stroke-dasharray=\"2,2\"";
+        return s;
+    }
+
+    // Annular sector with true arcs (a full sweep becomes two half arcs)
+    static std::string WedgePath(const DrawCmd& c) {
+        POINT ctr = DisplayList::Center(c);
+        int outer = (c.bounds.right - c.bounds.left) / 2;
+        double sweep = c.a1 - c.a0;
+        std::ostringstream d;
+        auto pt = [&](double r, double a) { POINT p = DisplayList::Polar(ctr, r, a); d << p.x << " " << p.y; };
+
+        if (sweep >= 359.9) {
+            d << "M "; pt(outer, 0); d << " A " << outer << " " << outer << " 0 1 1 "; pt(outer, 180);
+            d << " A " << outer << " " << outer << " 0 1 1 "; pt(outer, 360); d << " Z";
+            if (c.inner > 0) {
+                d << " M "; pt(c.inner, 0); d << " A " << c.inner << " " << c.inner << " 0 1 0 "; pt(c.inner, 180);
+                d << " A " << c.inner << " " << c.inner << " 0 1 0 "; pt(c.inner, 360); d << " Z";
+            }
+            return d.str();
+        }
+
+        int large = (sweep > 180) ? 1 : 0;
+        d << "M "; pt(outer, c.a0);
+        d << " A " << outer << " " << outer << " 0 " << large << " 1 "; pt(outer, c.a1);
+        if (c.inner > 0) {
+            d << " L "; pt(c.inner, c.a1);
+            d << " A " << c.inner << " " << c.inner << " 0 " << large << " 0 "; pt(c.inner, c.a0);
+        } else {
+            d << " L " << ctr.x << " " << ctr.y;
+        }
+        d << " Z";
+        return d.str();
+    }
+
+    static std::string Escape(const std::string& s) {
+        std::string r;
+        for (char ch : s) {
+            switch (ch) {
+                case '&': r += "&amp;"; break;
+                case '<': r += "&lt;"; break;
+                case '>': r += "&gt;"; break;
+                case '"': r += "&quot;"; break;
+                default:  r += ch;
+            }
+        }
+        return r;
+    }
+};
+
+// Writes a display list as a multi-page PDF for printing wall charts. The canvas is cut
+// into page-sized tiles; each page prints its tile plus an overlap strip on every side,
+// a grid label (column letter + row number) and a marker with the neighbour's label
+// wherever a line runs off the page. Pages pull their commands from a CmdGrid and are
+// rendered in parallel batches, so the cost follows the pages, not a full-canvas bitmap.
+class PdfWriter {
+public:
+    struct Paper { const wchar_t* name; int w, h; }; // Landscape, in points
+    static const int PAPER_COUNT = 3;
+    static const Paper& PaperSize(int i) {
+        static const Paper papers[PAPER_COUNT] = { {L"A4", 842, 595}, {L"A3", 1191, 842}, {L"A1", 2384, 1684} };
+        return papers[i % PAPER_COUNT];
+    }
+
+    // Pages without any content are left out (their grid labels stay reserved). Photos come
+    // from `thumbs`; callers pin them first.
+    static bool Write(const DisplayList& dl, int width, int height, int paper, const std::wstring& filePath,
+                      ThumbnailCache* thumbs, int& pageCount) {
+        const Paper& pp = PaperSize(paper);
+        Sheet sh;
+        sh.pageW = pp.w; sh.pageH = pp.h;
+        sh.tileW = (int)((pp.w - 2 * Config::PDF_MARGIN_PT) / SCALE) - 2 * Config::PDF_OVERLAP_PX;
+        sh.tileH = (int)((pp.h - 2 * Config::PDF_MARGIN_PT) / SCALE) - 2 * Config::PDF_OVERLAP_PX;
+        sh.cols = std::max(1, (width + sh.tileW - 1) / sh.tileW);
+        sh.rows = std::max(1, (height + sh.tileH - 1) / sh.tileH);
+
+        std::vector<RECT> ink(dl.cmds.size());
+        for (size_t i = 0; i < dl.cmds.size(); ++i) ink[i] = InkBounds(dl, dl.cmds[i]);
+        CmdGrid grid(ink, RECT{0, 0, width, height}, sh.tileW, sh.tileH);
+
+        // Pages that print something, in reading order
+        std::vector<int> pages;
+        std::vector<int> hits;
+        for (int p = 0; p < sh.cols * sh.rows; ++p) {
+            RECT r = sh.Printed(p);
+            grid.Query(r, hits);
+            for (int i : hits) if (Intersects(ink[i], r)) { pages.push_back(p); break; }
+        }
+        pageCount = (int)pages.size();
+
+        // Photos become image objects shared by every page
+        std::map<std::wstring, int> imageObj; // path -> object number (0 = draw a placeholder)
+        std::vector<std::pair<std::shared_ptr<const ThumbnailCache::Thumb>, int>> images;
+        int nextObj = FIRST_IMAGE_OBJ;
+        for (const auto& path : dl.ImagePaths()) {
+            auto thumb = thumbs ? thumbs->Get(path) : nullptr;
+            if (!thumb) { imageObj[path] = 0; continue; }
+            bool alpha = std::any_of(thumb->pixels.begin(), thumb->pixels.end(), [](uint32_t px) { return (px >> 24) != 255; });
+            images.push_back({thumb, alpha ? nextObj + 1 : 0});
+            imageObj[path] = nextObj;
+            nextObj += alpha ? 2 : 1;
+        }
+        int firstPageObj = nextObj; // Page k: object firstPageObj + 2k, its content + 1
+
+        char pathMB[MAX_PATH];
+        WideCharToMultiByte(CP_ACP, 0, filePath.c_str(), -1, pathMB, MAX_PATH, NULL, NULL);
+        std::ofstream out(pathMB, std::ios::binary);
+        if (!out.is_open()) return false;
+
+        std::vector<long long> offsets(firstPageObj + 2 * pages.size(), 0);
+        auto begin = [&](int obj) { offsets[obj] = (long long)out.tellp(); out << obj << " 0 obj\n"; };
+        auto stream = [&](int obj, const std::string& dict, const std::string& data) {
+            begin(obj);
+            out << "<< " << dict << " /Length " << data.size() << " >>\nstream\n";
+            out.write(data.data(), (std::streamsize)data.size());
+            out << "\nendstream\nendobj\n";
+        };
+
+        out << "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+        begin(1); out << "<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+        begin(3); out << "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Encoding /WinAnsiEncoding >>\nendobj\n";
+        begin(4); out << "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica-Bold /Encoding /WinAnsiEncoding >>\nendobj\n";
+        begin(5); out << "<< /Type /ExtGState /ca " << FADED_ALPHA << " /CA " << FADED_ALPHA << " >>\nendobj\n";
+        begin(6);
+        out << "<< /Font << /F1 3 0 R /F2 4 0 R >> /ExtGState << /GSf 5 0 R >> /XObject <<";
+        for (const auto& im : imageObj) if (im.second) out << " /Im" << im.second << " " << im.second << " 0 R";
+        out << " >> >>\nendobj\n";
+
+        int obj = FIRST_IMAGE_OBJ;
+        for (const auto& im : images) {
+            const ThumbnailCache::Thumb& t = *im.first;
+            std::string rgb, mask;
+            rgb.reserve(t.pixels.size() * 3);
+            for (uint32_t px : t.pixels) { // Premultiplied BGRA
+                int a = px >> 24;
+                for (int shift : {16, 8, 0}) {
+                    int c = (px >> shift) & 0xFF;
+                    rgb += (char)(a ? std::min(255, c * 255 / a) : 0);
+                }
+                if (im.second) mask += (char)a;
+            }
+            std::string dict = "/Type /XObject /Subtype /Image /Width " + std::to_string(t.w) +
+                               " /Height " + std::to_string(t.h) + " /BitsPerComponent 8";
+            std::string smask = im.second ? " /SMask " + std::to_string(im.second) + " 0 R" : "";
+            stream(obj, dict + " /ColorSpace /DeviceRGB" + smask, rgb);
+            if (im.second) stream(im.second, dict + " /ColorSpace /DeviceGray", mask);
+            obj += im.second ? 2 : 1;
+        }
+
+        // Render a batch of page streams in parallel, then write them in order
+        for (size_t first = 0; first < pages.size(); first += Config::PDF_BATCH_PAGES) {
+            size_t count = std::min(Config::PDF_BATCH_PAGES, pages.size() - first);
+            std::vector<std::string> content(count);
+            ParallelFor(count, [&](size_t b, size_t e) {
+                std::vector<int> local;
+                for (size_t k = b; k < e; ++k) {
+                    size_t n = first + k;
+                    content[k] = RenderPage(dl, grid, ink, sh, pages[n], (int)n + 1, pageCount, pp.name, imageObj, local);
+                }
+            });
+            for (size_t k = 0; k < count; ++k) {
+                int pageObj = firstPageObj + 2 * (int)(first + k);
+                begin(pageObj);
+                out << "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << sh.pageW << " " << sh.pageH
+                    << "] /Resources 6 0 R /Contents " << pageObj + 1 << " 0 R >>\nendobj\n";
+                stream(pageObj + 1, "", content[k]);
             }
-            TextOutW(hdc, col2X+35, currY-1, txt, lstrlenW(txt));
-            currY += 26;
-        };
+        }
 
-        DrawLegendLine(L"Spouse", Config::LINE_SPOUSE_CURR, PS_SOLID, 2);
-        DrawLegendLine(L"Ex-Spouse", Config::LINE_SPOUSE_EX, PS_DOT, 1);
-        DrawLegendLine(L"Child", Config::LINE_CHILD_NORMAL, PS_SOLID, 2);
+        begin(2);
+        out << "<< /Type /Pages /Count " << pages.size() << " /Kids [";
+        for (size_t k = 0; k < pages.size(); ++k) out << (k % 16 ? " " : "\n") << firstPageObj + 2 * (int)k << " 0 R";
+        out << " ] >>\nendobj\n";
+
+        long long xref = (long long)out.tellp();
+        out << "xref\n0 " << offsets.size() << "\n0000000000 65535 f \n";
+        char line[32];
+        for (size_t i = 1; i < offsets.size(); ++i) {
+            snprintf(line, sizeof(line), "%010lld 00000 n \n", offsets[i]);
+            out << line;
+        }
+        out << "trailer\n<< /Size " << offsets.size() << " /Root 1 0 R >>\nstartxref\n" << xref << "\n%%EOF\n";
+        return out.good();
     }
 
 private:
-    static void DrawHeader(HDC hdc, int width) {
-        ScopedGDI<HFONT> hFont(CreateFont(36, 0, 0, 0, FW_SEMIBOLD, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"));
-        AutoSelect sel(hdc, hFont);
-        SetTextColor(hdc, RGB(60, 60, 60));
-        SetBkMode(hdc, TRANSPARENT);
+    static constexpr double SCALE = 0.75;       // Points per canvas pixel (96 dpi)
+    static constexpr double FADED_ALPHA = 0.25; // Opacity of faded photos (DisplayList::Fade)
+    static const int FIRST_IMAGE_OBJ = 7;       // 1-6: catalog, pages, fonts, fade state, resources
+
+    struct Sheet {
+        int pageW, pageH, tileW, tileH, cols, rows;
+        // Canvas area printed on page p: its tile plus the overlap strip
+        RECT Printed(int p) const {
+            int x = (p % cols) * tileW, y = (p / cols) * tileH;
+            return { x - Config::PDF_OVERLAP_PX, y - Config::PDF_OVERLAP_PX,
+                     x + tileW + Config::PDF_OVERLAP_PX, y + tileH + Config::PDF_OVERLAP_PX };
+        }
+        // "A1", "B1", ... "AA12"
+        std::string Label(int col, int row) const {
+            std::string letters;
+            for (int c = col + 1; c > 0; c = (c - 1) / 26) letters.insert(letters.begin(), (char)('A' + (c - 1) % 26));
+            return letters + std::to_string(row + 1);
+        }
+    };
 
-        RECT rc = {0, 10, width, 70};
-        DrawTextW(hdc, L"My Family Tree", -1, &rc, DT_CENTER | DT_NOCLIP);
+    static bool Intersects(const RECT& a, const RECT& b) {
+        return a.left <= b.right && a.right >= b.left && a.top <= b.bottom && a.bottom >= b.top;
     }
 
-    static void DrawSpouseConnectors(HDC hdc, const Person* p, DataModel* m) {
-        int yC = p->y + Config::BOX_HEIGHT/2;
-        int numSpouses = (int)p->spouses.size();
+    static void Put(std::string& s, const char* fmt, ...) {
+        char buf[256];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n > 0) s.append(buf, std::min(n, (int)sizeof(buf) - 1));
+    }
 
-        for(int i=0; i < numSpouses; ++i) {
-            int sid = p->spouses[i];
-            Person* sp = m->Get(sid);
-            if (!sp || sp->x < -9000) continue;
+    static void Color(std::string& s, COLORREF c, bool stroke) {
+        Put(s, "%.3f %.3f %.3f %s\n", GetRValue(c) / 255.0, GetGValue(c) / 255.0, GetBValue(c) / 255.0, stroke ? "RG" : "rg");
+    }
 
-            // Line Style: Ex-Spouse (Dashed) vs Current (Solid)
-            bool isEx = p->exSpouses.count(sid);
-            COLORREF col = isEx ? Config::LINE_SPOUSE_EX : Config::LINE_SPOUSE_CURR;
-            int style = isEx ? PS_DOT : PS_SOLID;
-            int width = isEx ? 1 : 2;
+    // Base-14 Helvetica has no embedded font, so text is limited to the WinAnsi range
+    static std::string WinAnsi(const std::wstring& s) {
+        std::string r;
+        for (wchar_t ch : s) {
+            if ((ch >= 32 && ch < 127) || (ch >= 0xA0 && ch <= 0xFF)) r += (char)ch;
+            else if (ch == 0x2013) r += '\x96';
+            else if (ch == 0x2014) r += '\x97';
+            else if (ch == 0x2026) r += '\x85';
+            else r += '?';
+        }
+        return r;
+    }
 
-            {
-                ScopedGDI<HPEN> sPen(CreatePen(style, width, col));
-                AutoSelect sel(hdc, sPen);
+    // Advance widths (1/1000 em) of Helvetica / Helvetica-Bold for ASCII 32-126
+    static double TextWidth(const std::string& s, bool bold, double em) {
+        static const short regular[95] = {
+            278,278,355,556,556,889,667,191,333,333,389,584,278,333,278,278,556,556,556,556,556,556,556,556,
+            556,556,278,278,584,584,584,556,1015,667,667,722,722,667,611,778,722,278,500,667,556,833,722,778,
+            667,778,722,667,611,722,667,944,667,667,611,278,278,278,469,556,333,556,556,500,556,556,278,556,
+            556,222,222,500,222,833,556,556,556,556,333,500,278,556,500,722,500,500,500,334,260,334,584 };
+        static const short heavy[95] = {
+            278,333,474,556,556,889,722,238,333,333,389,584,278,333,278,278,556,556,556,556,556,556,556,556,
+            556,556,333,333,584,584,584,611,975,722,722,722,722,667,611,778,722,278,556,722,611,833,722,778,
+            667,778,722,667,611,722,667,944,667,667,611,333,278,333,584,556,333,556,611,556,611,556,333,611,
+            611,278,278,556,278,889,611,611,611,611,389,556,333,611,556,778,556,556,500,389,280,389,584 };
+        const short* w = bold ? heavy : regular;
+        double total = 0;
+        for (unsigned char ch : s) total += (ch >= 32 && ch < 127) ? w[ch - 32] : 556;
+        return total * em / 1000.0;
+    }
 
-                // Horizontal connection
-                if (sp->x > p->x) {
-                    MoveToEx(hdc, p->x + Config::BOX_WIDTH, yC, NULL);
-                    LineTo(hdc, sp->x, yC);
-                } else {
-                    MoveToEx(hdc, p->x, yC, NULL);
-                    LineTo(hdc, sp->x + Config::BOX_WIDTH, yC);
+    // Font cell heights as GDI creates them (GdiBackend), Segoe UI's em is about 3/4 of that
+    static int FontHeight(FontRole f) { static const int h[4] = {36, 19, 15, 13}; return h[(int)f]; }
+    static bool FontBold(FontRole f) { return f == FontRole::Title || f == FontRole::Name; }
+
+    // Bounds of what a command actually draws (centered text is narrower than its box)
+    static RECT InkBounds(const DisplayList& dl, const DrawCmd& c) {
+        RECT r = c.bounds;
+        if (c.kind != DrawCmd::Text) return r;
+        UINT fmt = (UINT)c.count;
+        int w = (int)TextWidth(WinAnsi(dl.strings[c.first]), FontBold(c.font), FontHeight(c.font) * 0.75);
+        if (!(fmt & DT_NOCLIP)) w = std::min(w, (int)(r.right - r.left));
+        if (fmt & DT_CENTER) { int mid = (r.left + r.right) / 2; r.left = mid - w / 2; r.right = mid + w / 2 + 1; }
+        else r.right = r.left + w;
+        return r;
+    }
+
+    static void Text(std::string& s, const DisplayList& dl, const DrawCmd& c) {
+        UINT fmt = (UINT)c.count;
+        bool bold = FontBold(c.font);
+        int h = FontHeight(c.font);
+        double em = h * 0.75;
+        std::string text = WinAnsi(dl.strings[c.first]);
+        int boxW = c.bounds.right - c.bounds.left;
+        double w = TextWidth(text, bold, em);
+        if ((fmt & DT_END_ELLIPSIS) && w > boxW) {
+            while (!text.empty() && TextWidth(text + "...", bold, em) > boxW) text.pop_back();
+            text += "...";
+            w = TextWidth(text, bold, em);
+        }
+
+        double x = (fmt & DT_CENTER) ? (c.bounds.left + c.bounds.right - w) / 2.0 : c.bounds.left;
+        double y = (fmt & DT_VCENTER) ? (c.bounds.top + c.bounds.bottom) / 2.0 + 0.255 * h : c.bounds.top + 0.755 * h;
+        std::string esc;
+        for (char ch : text) {
+            if (ch == '(' || ch == ')' || ch == '\\') esc += '\\';
+            esc += ch;
+        }
+        Color(s, c.fill, false);
+        Put(s, "BT /F%d %.2f Tf 1 0 0 -1 %.2f %.2f Tm (", bold ? 2 : 1, em, x, y);
+        s += esc;
+        s += ") Tj ET\n";
+    }
+
+    static void Stroke(std::string& s, COLORREF c, int width, int penStyle) {
+        Color(s, c, true);
+        Put(s, "%d w %s\n", width, penStyle == PS_DOT ? "[2 2] 0 d" : "[] 0 d");
+    }
+
+    // Canvas -> page: scale, flip y and move the printed area inside the margins
+    static std::string RenderPage(const DisplayList& dl, const CmdGrid& grid, const std::vector<RECT>& ink,
+                                  const Sheet& sh, int p, int number, int total, const wchar_t* paperName,
+                                  const std::map<std::wstring, int>& imageObj, std::vector<int>& hits) {
+        RECT area = sh.Printed(p);
+        double m = Config::PDF_MARGIN_PT;
+        double areaW = (area.right - area.left) * SCALE, areaH = (area.bottom - area.top) * SCALE;
+        std::string s;
+        Put(s, "q\n%.2f %.2f %.2f %.2f re W n\n", m, sh.pageH - m - areaH, areaW, areaH);
+        Put(s, "%.4f 0 0 %.4f %.4f %.4f cm\n", SCALE, -SCALE, m - area.left * SCALE, sh.pageH - m + area.top * SCALE);
+
+        grid.Query(area, hits);
+        std::vector<POINT> outline;
+        for (int i : hits) {
+            if (!Intersects(ink[i], area)) continue;
+            const DrawCmd& c = dl.cmds[i];
+            const RECT& b = c.bounds;
+            switch (c.kind) {
+            case DrawCmd::Rect:
+                if (c.fill != Config::COL_NONE) {
+                    Color(s, c.fill, false);
+                    Put(s, "%ld %ld %ld %ld re f\n", b.left, b.top, b.right - b.left, b.bottom - b.top);
+                }
+                if (c.stroke != Config::COL_NONE) {
+                    Stroke(s, c.stroke, 1, c.penStyle);
+                    Put(s, "%.1f %.1f %ld %ld re S\n", b.left + 0.5, b.top + 0.5, b.right - b.left - 1, b.bottom - b.top - 1);
+                }
+                break;
+
+            case DrawCmd::Polyline:
+                Stroke(s, c.stroke, c.penWidth, c.penStyle);
+                for (int k = 0; k < c.count; ++k) {
+                    const POINT& pt = dl.points[c.first + k];
+                    Put(s, "%ld %ld %s\n", pt.x, pt.y, k ? "l" : "m");
+                }
+                s += "S\n";
+                break;
+
+            case DrawCmd::Text:
+                Text(s, dl, c);
+                break;
+
+            case DrawCmd::Wedge:
+                DisplayList::WedgeOutline(c, outline);
+                Color(s, c.fill, false);
+                for (size_t k = 0; k < outline.size(); ++k) Put(s, "%ld %ld %s\n", outline[k].x, outline[k].y, k ? "l" : "m");
+                if (c.stroke != Config::COL_NONE) { Stroke(s, c.stroke, 1, PS_SOLID); s += "b\n"; }
+                else s += "f\n";
+                break;
+
+            case DrawCmd::Image: {
+                auto it = imageObj.find(dl.strings[c.first]);
+                if (it == imageObj.end() || it->second == 0) {
+                    Color(s, c.fill, false);
+                    Put(s, "%ld %ld %ld %ld re f\n", b.left, b.top, b.right - b.left, b.bottom - b.top);
+                    break;
                 }
+                Put(s, "q %s%ld 0 0 %ld %ld %ld cm /Im%d Do Q\n", c.inner < 255 ? "/GSf gs " : "",
+                    b.right - b.left, -(b.bottom - b.top), b.left, b.bottom, it->second);
+                break;
             }
+            }
+        }
+        ContinuationMarkers(s, dl, sh, area, hits);
+        s += "Q\n";
+
+        std::string label = "My Family Tree - page " + sh.Label(p % sh.cols, p / sh.cols) + " (" +
+                            std::to_string(number) + " of " + std::to_string(total) + "), grid A1-" +
+                            sh.Label(sh.cols - 1, sh.rows - 1) + ", " + WinAnsi(paperName);
+        Color(s, Config::COL_TEXT_ROLE, false);
+        Put(s, "BT /F1 8 Tf %.2f %.2f Td (", m, m / 2 - 3);
+        s += label;
+        s += ") Tj ET\n";
+        return s;
+    }
 
-            // Child Drop Lines
-            DrawPairChildren(hdc, p, sp, m);
+    // A triangle and the neighbouring page's label wherever a line leaves the printed area
+    static void ContinuationMarkers(std::string& s, const DisplayList& dl, const Sheet& sh, const RECT& area,
+                                    const std::vector<int>& hits) {
+        const int size = 8;
+        for (int i : hits) {
+            const DrawCmd& c = dl.cmds[i];
+            if (c.kind != DrawCmd::Polyline) continue;
+            for (int k = 1; k < c.count; ++k) {
+                POINT a = dl.points[c.first + k - 1], b = dl.points[c.first + k];
+                // Edges as {fixed coordinate, is vertical edge, outward direction}
+                const struct { long at; bool vertical; int dir; } edges[4] = {
+                    {area.left, true, -1}, {area.right, true, 1}, {area.top, false, -1}, {area.bottom, false, 1} };
+                for (const auto& e : edges) {
+                    double pa = e.vertical ? a.x : a.y, pb = e.vertical ? b.x : b.y;
+                    if ((pa - e.at) * (pb - e.at) >= 0) continue; // Does not cross this edge
+                    double t = (e.at - pa) / (pb - pa);
+                    double along = e.vertical ? a.y + t * (b.y - a.y) : a.x + t * (b.x - a.x);
+                    double lo = e.vertical ? area.top : area.left, hi = e.vertical ? area.bottom : area.right;
+                    if (along < lo || along > hi) continue;
+
+                    double ox = e.vertical ? e.at + e.dir : along, oy = e.vertical ? along : e.at + e.dir;
+                    int col = (int)std::floor(ox / sh.tileW), row = (int)std::floor(oy / sh.tileH);
+                    if (col < 0 || row < 0 || col >= sh.cols || row >= sh.rows) continue;
+
+                    double x = e.vertical ? e.at : along, y = e.vertical ? along : e.at;
+                    double in = -e.dir * 1.5 * size; // Triangle base sits inside the page
+                    Color(s, c.stroke, false);
+                    if (e.vertical) Put(s, "%.1f %.1f m %.1f %.1f l %.1f %.1f l f\n", x, y, x + in, y - size, x + in, y + size);
+                    else Put(s, "%.1f %.1f m %.1f %.1f l %.1f %.1f l f\n", x, y, x - size, y + in, x + size, y + in);
+
+                    std::string label = sh.Label(col, row);
+                    double w = TextWidth(label, false, 10);
+                    double tx = e.vertical ? (e.dir < 0 ? x + 1.5 * size + 3 : x - 1.5 * size - 3 - w) : x + size + 3;
+                    double ty = e.vertical ? y - size - 2 : (e.dir < 0 ? y + 1.5 * size + 10 : y - 1.5 * size - 3);
+                    Color(s, Config::COL_TEXT_ROLE, false);
+                    Put(s, "BT /F1 10 Tf 1 0 0 -1 %.1f %.1f Tm (%s) Tj ET\n", tx, ty, label.c_str());
+                }
+            }
         }
     }
+};
 
-    static void DrawPairChildren(HDC hdc, const Person* p1, const Person* p2, DataModel* m) {
-        std::vector<int> kids;
-        for(const auto& k : m->people) {
-            bool match = (k.fatherId == p1->id && k.motherId == p2->id) ||
-                         (k.motherId == p1->id && k.fatherId == p2->id);
-            if(match) kids.push_back(k.id);
+// -----------------------------------------------------------------------------
+// 7. APPLICATION WINDOW
+// -----------------------------------------------------------------------------
+// How people outside the filter selection are shown
+enum class FilterDisplay { Dim, Hide, Collapse };
+
+// A window's view of one version of the data: its filter compiled against it, the
+// selection, the subset laid out in Collapse display, the relationship chain, the layout
+// and its display list. The settings are copied from the window on the UI thread; a
+// background reload builds the rest against the model it loaded, so the window only has
+// to swap it in.
+struct ViewBuild {
+    LayoutMode mode = LayoutMode::Descendants;
+    int focusId = 0;
+    bool minimizeCrossings = false;
+    std::wstring filterText;
+    FilterDisplay filterDisplay = FilterDisplay::Dim;
+    int relationFrom = 0, relationTo = 0; // IDs of the relationship query, 0 = none
+
+    FilterQuery filter;
+    std::wstring filterError;
+    RowBitmap selection;     // Over the laid-out model, valid while the filter is not empty
+    DataModel collapsed;
+    bool isCollapsed = false; // Laid out over `collapsed` rather than the whole model
+    bool relationGone = false; // One of the two people is no longer in the data
+    std::vector<int> relationIds;
+    std::wstring relationText;
+    LayoutEngine layout{nullptr};
+    DisplayList scene;       // With the relationship chain highlighted
+
+    // The relationship query `fromId` -> `toId` over `data`: the chain by ID (empty if
+    // unrelated) and its description. False if either person is gone.
+    static bool Relate(RelationFinder& finder, const DataModel& data, int fromId, int toId,
+                       std::vector<int>& ids, std::wstring& text) {
+        ids.clear();
+        text.clear();
+        int from = data.IndexOf(fromId), to = data.IndexOf(toId);
+        if (from < 0 || to < 0) return false;
+        auto path = finder.Find(data, from, to);
+        for (const auto& step : path) ids.push_back(data.people[step.idx].id);
+        if (path.empty()) text = data.people[from].name + L" and " + data.people[to].name + L" are not related";
+        else text = RelationFinder::Describe(data, path);
+        return true;
+    }
+
+    // Filter -> relationship chain -> generations -> ownership -> layout -> display list.
+    // False once cancelled.
+    bool Build(const DataModel& data, const CancelToken* cancel) {
+        layout.SetModel(&data);
+        layout.mode = mode;
+        layout.focusId = focusId;
+        layout.minimizeCrossings = minimizeCrossings;
+        filter.Compile(filterText, data, filterError);
+        isCollapsed = !filter.Empty() && Select(filter, filterDisplay, data, layout.FocusIndex(), selection, collapsed);
+        if (cancel && cancel->Cancelled()) return false;
+        if (relationFrom != 0) {
+            RelationFinder finder;
+            relationGone = !Relate(finder, data, relationFrom, relationTo, relationIds, relationText);
+            if (cancel && cancel->Cancelled()) return false;
         }
 
-        if(!kids.empty()) {
-            ScopedGDI<HPEN> kPen(CreatePen(PS_SOLID, 2, Config::LINE_CHILD_NORMAL));
-            AutoSelect sel(hdc, kPen);
+        const DataModel* shown = isCollapsed ? &collapsed : &data;
+        layout.SetModel(shown);
+        layout.cancel = cancel;
+        layout.Recalculate();
+        layout.cancel = nullptr;
+        if (cancel && cancel->Cancelled()) return false;
+
+        SelectionView sel;
+        if (!filter.Empty()) { sel.bits = &selection; sel.hide = (filterDisplay == FilterDisplay::Hide); }
+        if (!relationIds.empty()) sel.relation = &relationIds;
+        Renderer::DrawTree(scene, shown, layout, layout.totalWidth, sel);
+        return true;
+    }
 
-            int leftX = std::min(p1->x, p2->x);
-            int midX = leftX + Config::BOX_WIDTH + (Config::SPOUSE_GAP/2);
-            int yC = p1->y + Config::BOX_HEIGHT/2;
+    // Evaluates a compiled, non-empty filter over `data`. In Collapse display it also
+    // picks the subset to lay out, the selection plus the ancestors that connect it, and
+    // returns true with `selection` over the subset's rows.
+    static bool Select(const FilterQuery& filter, FilterDisplay display, const DataModel& data, int focusIdx,
+                       RowBitmap& selection, DataModel& collapsed) {
+        RowBitmap sel = filter.Evaluate(data, focusIdx);
+        if (display != FilterDisplay::Collapse) {
+            selection = std::move(sel);
+            return false;
+        }
+        RowBitmap keep = sel;
+        std::vector<int> stack;
+        for (size_t i = 0; i < data.people.size(); ++i) if (sel.Test(i)) stack.push_back((int)i);
+        while (!stack.empty()) {
+            const Person& p = data.people[stack.back()];
+            stack.pop_back();
+            for (int par : { p.fatherIdx, p.motherIdx })
+                if (par >= 0 && !keep.Test(par)) { keep.Set(par); stack.push_back(par); }
+        }
+        collapsed = data.Subset(keep);
+        selection.Resize(collapsed.people.size(), false);
+        for (size_t i = 0; i < collapsed.people.size(); ++i)
+            if (sel.Test(data.IndexOf(collapsed.people[i].id))) selection.Set(i);
+        return true;
+    }
+};
 
-            MoveToEx(hdc, midX, yC, NULL);
-            LineTo(hdc, midX, yC + 30); // Drop 30px
+// Implemented by every window showing the document
+class DocumentView {
+public:
+    virtual ~DocumentView() = default;
+    virtual ViewBuild PrepareReload() const = 0;           // Settings for a reload built in the background
+    virtual void OnDataReloaded(ViewBuild* built) = 0;     // `data` was loaded again; `built` is null if not prepared
+    virtual void OnModelEdited(const ModelDiff& diff) = 0; // `data` changed through an edit, undo or redo
+    virtual void OnThumbsReady() = 0;                      // Decoded photos arrived
+    virtual void OnLineageReady() = 0;                     // FamilyDocument::Lineage() has labels for `data` again
+};
 
-            for(int kidId : kids) {
-                Person* k = m->Get(kidId);
-                if(k && k->x > -9000) {
-                    DrawOrthogonalLine(hdc, midX, yC + 30, k->x + Config::BOX_WIDTH/2, k->y);
-                }
-            }
+// Reloads of a changed data file, run as a pipeline in one task on the TaskScheduler
+// (its parallel stages fork from there): parse -> journal replay -> renumbering -> for
+// each window filter, generations, ownership, layout and display list (ViewBuild) ->
+// lineage labels, with a cancellation check between the stages and inside the long ones.
+// Starting a reload cancels the one in flight: its stale work stops at the next check and
+// the task moves straight on to the newest request, so under rapid successive saves the
+// wait for the latest version stays about one reload long. The finished job is collected
+// on the UI thread once `msg` arrives. With no pool workers the job runs inside Start.
+class ReloadPipeline {
+public:
+    struct Job {
+        std::wstring path;
+        const EditJournal* journal = nullptr; // Its logs are replayed on top of the file
+        std::vector<DocumentView*> views;     // Windows prepared for, parallel to `builds`
+        std::vector<ViewBuild> builds;
+        DataModel model;
+        size_t replayed = 0;                  // Journal records in `model`
+        std::shared_ptr<LineageIndex> lineage; // Of `model`, for the window titles
+
+        bool Run(const CancelToken* cancel) {
+            auto stopped = [cancel] { return cancel && cancel->Cancelled(); };
+            model.LoadFromFile(path.c_str(), cancel);
+            if (stopped()) return false;
+            if (journal) replayed = journal->Replay(model);
+            if (stopped()) return false;
+            if (model.people.size() >= Config::RENUMBER_AT) model.Renumber();
+            for (ViewBuild& b : builds)
+                if (stopped() || !b.Build(model, cancel)) return false;
+            lineage = std::make_shared<LineageIndex>(model);
+            return lineage->Build(cancel);
         }
+    };
+
+    ~ReloadPipeline() { Stop(); }
+
+    // Queues `job`, dropping a queued or finished but uncollected one and cancelling the
+    // one running. Posts `msg` to `notify` when a job finishes without being cancelled.
+    void Start(std::unique_ptr<Job> job, HWND notify, UINT msg) {
+        std::unique_lock<std::mutex> lock(mu);
+        Drop();
+        next = std::move(job);
+        if (running) running->Cancel();
+        this->notify = notify;
+        this->msg = msg;
+        Schedule(lock);
     }
 
-    static void DrawSingleParentChildren(HDC hdc, const Person* p, DataModel* m) {
-        ScopedGDI<HPEN> kPen(CreatePen(PS_SOLID, 2, Config::LINE_CHILD_NORMAL));
-        AutoSelect sel(hdc, kPen);
+    // The finished job, or null if a newer one was started since its message was posted
+    std::unique_ptr<Job> Collect() {
+        std::lock_guard<std::mutex> lock(mu);
+        return std::move(done);
+    }
 
-        for(const auto& k : m->people) {
-            // Check if this is the ONLY known parent (or other parent is unknown/unlisted)
-            bool isP = (k.fatherId == p->id || k.motherId == p->id);
-            if(!isP) continue;
+    bool Busy() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return next || running || done;
+    }
 
-            int otherId = (k.fatherId == p->id) ? k.motherId : k.fatherId;
+    // Drops every job not collected yet (the file was loaded some other way)
+    void Cancel() {
+        std::unique_lock<std::mutex> lock(mu);
+        Drop();
+        if (running) running->Cancel();
+        if (!dropped.empty()) Schedule(lock);
+    }
 
-            // If other parent is in the spouse list, it's handled by DrawPairChildren
-            bool otherInSpouses = false;
-            for(int sid : p->spouses) if(sid == otherId) otherInSpouses = true;
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+            Drop();
+            if (running) running->Cancel();
+        }
+        if (tasks) tasks->Wait();
+    }
 
-            if(!otherInSpouses && k.x > -9000) {
-                int midX = p->x + Config::BOX_WIDTH/2;
-                int yC = p->y + Config::BOX_HEIGHT/2;
-                // Single parents usually drop lines from bottom center, or slightly lower?
-                // Let's drop from center + 30 to match others
-                DrawOrthogonalLine(hdc, midX, yC + 30, k.x + Config::BOX_WIDTH/2, k.y);
+private:
+    mutable std::mutex mu;
+    std::unique_ptr<TaskScheduler::Group> tasks; // Made on first use, like the pool
+    std::unique_ptr<Job> next, done;
+    std::vector<std::unique_ptr<Job>> dropped; // Replaced, cancelled or never collected: freed by Drain
+    CancelToken* running = nullptr; // Token of the job being run
+    bool draining = false;          // A Drain task is queued or running
+    bool stopping = false;
+    HWND notify = nullptr;
+    UINT msg = 0;
+
+    // Moves the queued and the uncollected job to `dropped`; called with `mu` held
+    void Drop() {
+        if (next) dropped.push_back(std::move(next));
+        if (done) dropped.push_back(std::move(done));
+    }
+
+    // Makes sure a Drain task is queued or running; called with `lock` held. With no pool
+    // workers it drains right here.
+    void Schedule(std::unique_lock<std::mutex>& lock) {
+        if (draining || stopping) return;
+        draining = true;
+        if (TaskScheduler::Get().Threads() <= 1) {
+            lock.unlock();
+            Drain();
+            return;
+        }
+        if (!tasks) tasks = std::make_unique<TaskScheduler::Group>();
+        tasks->Run([this] { Drain(); });
+    }
+
+    // Runs jobs until none is waiting. Dropped jobs are freed here, once no newer job is
+    // waiting, so their models and layouts are not released on the UI thread.
+    void Drain() {
+        std::unique_lock<std::mutex> lock(mu);
+        for (;;) {
+            if (!dropped.empty() && !next) {
+                std::vector<std::unique_ptr<Job>> stale = std::move(dropped);
+                dropped.clear();
+                lock.unlock();
+                stale.clear();
+                lock.lock();
+                continue;
+            }
+            if (stopping || !next) break;
+            std::unique_ptr<Job> job = std::move(next);
+            CancelToken token;
+            running = &token;
+            lock.unlock();
+            bool finished = job->Run(&token);
+            lock.lock();
+            running = nullptr;
+            if (finished && !token.Cancelled()) {
+                done = std::move(job);
+                PostMessage(notify, msg, 0, 0);
+            } else {
+                dropped.push_back(std::move(job));
             }
         }
+        draining = false;
     }
+};
 
-    static void DrawOrthogonalLine(HDC hdc, int x1, int y1, int x2, int y2) {
-        int midY = (y1 + y2) / 2;
-        POINT pts[4] = { {x1, y1}, {x1, midY}, {x2, midY}, {x2, y2} };
-        Polyline(hdc, pts, 4);
+// The family shared by every open window: one model with its indices (id map, child
+// index, attribute columns), the edit history and journal, and the photo cache. A window
+// adds only its own layout, filter and display list, so a second view of the same data
+// costs one layout. The reload timer, photo, journal and reload notifications arrive on
+// a message-only window that does not depend on any view staying open.
+class FamilyDocument {
+    HWND hwnd = nullptr;
+    std::vector<DocumentView*> views;
+    FILETIME lastModTime = {0};
+    ReloadPipeline reloads;    // Changes to the file after the first load
+    uint64_t version = 0;      // Bumped by every load and edit of `data`
+    std::shared_ptr<const LineageIndex> lineage; // Labels of `data` as of version `lineageOf`
+    std::shared_ptr<LineageIndex> building;      // On the task pool, for version `buildingOf`
+    uint64_t lineageOf = 0, buildingOf = 0;
+    std::unique_ptr<TaskScheduler::Group> lineageTasks; // Made on first use: the pool starts with it
+
+public:
+    DataModel data;
+    EditHistory history;       // In-app edits of `data` since the last load
+    EditJournal journal;       // The same edits on disk, until folded into the CSV
+    SqliteStore store;         // Open instead of the journal when DATA_FILE is a SQLite database
+    ThumbnailCache thumbs;
+    RelationFinder relations;  // Search buffers reused by every window's relationship queries
+    bool journalFailed = false;
+
+    // Lineage labels of `data`, or null while the ones for its latest load or edit are
+    // still being built (views hear OnLineageReady once they are in)
+    const LineageIndex* Lineage() const { return (lineage && lineageOf == version) ? lineage.get() : nullptr; }
+
+    void Open(HWND h) {
+        hwnd = h;
+        thumbs.Start(hwnd, Config::WM_THUMBS_READY);
+        journal.Open(Config::DATA_FILE);
+        Reload(true);
+        SetTimer(hwnd, 1, 1000, NULL); // Auto-reload timer
     }
 
-    static void DrawBox(HDC hdc, const Person& p) {
-        RECT rc = { p.x, p.y, p.x + Config::BOX_WIDTH, p.y + Config::BOX_HEIGHT };
+    void Close() {
+        KillTimer(hwnd, 1);
+        reloads.Stop();
+        if (lineageTasks) lineageTasks->Wait();
+        thumbs.Stop();
+        journal.Wait();
+    }
 
-        // 1. Shadow
-        RECT rcShadow = rc; OffsetRect(&rcShadow, 4, 4);
-        {
-            ScopedGDI<HBRUSH> hShad(CreateSolidBrush(RGB(220, 220, 220)));
-            FillRect(hdc, &rcShadow, hShad);
+    void Attach(DocumentView* v) { views.push_back(v); }
+
+    // Returns how many views are left
+    size_t Detach(DocumentView* v) {
+        views.erase(std::remove(views.begin(), views.end(), v), views.end());
+        return views.size();
+    }
+
+    void OnTimer() { Reload(false); }
+
+    void OnThumbsReady() {
+        thumbs.OnNotified();
+        for (DocumentView* v : views) v->OnThumbsReady();
+    }
+
+    // The background rewrite of the CSV finished; its new write time is ours, not an edit
+    void OnJournalCompacted() {
+        FILETIME written;
+        if (journal.Finish(written)) lastModTime = written;
+    }
+
+    // A background lineage build finished. Edits made meanwhile start another; a reload
+    // may have brought newer labels already.
+    void OnLineageReady() {
+        if (lineageTasks) lineageTasks->Wait();
+        if (!building) return;
+        if (!lineage || buildingOf > lineageOf) {
+            lineage = std::move(building);
+            lineageOf = buildingOf;
+        }
+        building.reset();
+        if (!Lineage()) {
+            BuildLineage();
+            return;
         }
+        for (DocumentView* v : views) v->OnLineageReady();
+    }
+
+    // A background reload finished; a newer one started since leaves nothing to collect
+    void OnReloadReady() {
+        std::unique_ptr<ReloadPipeline::Job> job = reloads.Collect();
+        if (!job) return;
+        data = std::move(job->model);
+        journal.Replayed(job->replayed);
+        Reloaded(job.get());
+    }
 
-        // 2. Background
-        COLORREF bg = Config::COL_BOX_DEFAULT;
-        if (p.role.find(L"Myself") != std::string::npos) bg = Config::COL_BOX_FOCUS;
-        else if (p.IsFemale()) bg = Config::COL_BOX_FEMALE;
+    // Logs an edit already applied to `data` through `history` (or writes it to the
+    // database) and updates every view
+    void Commit(const ModelDiff& diff) {
+        if (store.IsOpen()) journalFailed = !store.Write(data, diff);
+        else journalFailed = !journal.Append(data, diff);
+        if (reloads.Busy())
+            StartReload(); // The reload in flight read the journal before this edit
+        else if (journal.CompactDue())
+            journal.Compact(data, history.Current(), lastModTime, hwnd, Config::WM_JOURNAL_COMPACTED);
+        Edited(diff);
+    }
 
-        {
-            ScopedGDI<HBRUSH> hBg(CreateSolidBrush(bg));
-            FillRect(hdc, &rc, hBg);
+private:
+    void Reload(bool force) {
+        if (journal.Busy()) return; // The CSV is being rewritten from our own edits
+        if (store.IsOpen() && !force) {
+            // Only the rows other programs changed; the file time says little here (WAL)
+            std::vector<int> dropped;
+            std::vector<Person> rows;
+            std::vector<std::string> tails;
+            if (!store.Poll(dropped, rows, tails)) return;
+            if (!dropped.empty()) {
+                // The rows after a deleted person move up: rebuilt in full
+                data.ApplyRows(dropped, std::move(rows), tails);
+                Reloaded();
+                return;
+            }
+            ModelDiff diff;
+            history.Merge(data, std::move(rows), tails, diff);
+            thumbs.ForgetFailures();
+            Edited(diff);
+            return;
         }
+        WIN32_FILE_ATTRIBUTE_DATA attrib;
+        if (GetFileAttributesExW(Config::DATA_FILE, GetFileExInfoStandard, &attrib)) {
+            if (force || CompareFileTime(&lastModTime, &attrib.ftLastWriteTime) != 0) {
+                lastModTime = attrib.ftLastWriteTime;
+                if (!force && DataModel::FormatOf(Config::DATA_FILE) != DataModel::FileFormat::Sqlite) {
+                    StartReload(); // Preempts a reload of an older version still in flight
+                    return;
+                }
+                reloads.Cancel();
+                std::string failure = "Error: family.csv not found or empty.";
+                if (DataModel::FormatOf(Config::DATA_FILE) == DataModel::FileFormat::Sqlite) {
+                    if (store.Open(Config::DATA_FILE) && store.Load(data)) {
+                        failure.clear(); // An empty database is not an error
+                    } else {
+                        failure = "Error: " + store.Error();
+                        store.Close();
+                        data.LoadFromFile(Config::DATA_FILE);
+                    }
+                } else {
+                    store.Close();
+                    data.LoadFromFile(Config::DATA_FILE);
+                    if (!data.loadError.empty()) failure = "Error: " + data.loadError + ".";
+                    journal.Replayed(journal.Replay(data));
+                }
+                Reloaded();
 
-        // 3. Border
-        {
-            ScopedGDI<HBRUSH> hBr(CreateSolidBrush(Config::COL_BOX_BORDER));
-            FrameRect(hdc, &rc, hBr);
+                if (force && data.people.empty() && !failure.empty()) {
+                    MessageBoxA(NULL, failure.c_str(), "Family Tree", MB_ICONWARNING);
+                }
+            }
         }
+    }
 
-        // 4. Text
-        ScopedGDI<HFONT> fName(CreateFont(19, 0, 0, 0, FW_BOLD, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"));
-        ScopedGDI<HFONT> fRole(CreateFont(15, 0, 0, 0, FW_NORMAL, 0, 0, 0, DEFAULT_CHARSET, 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI"));
+    // Hands the current version of the file to the pipeline, with every window's settings
+    void StartReload() {
+        auto job = std::make_unique<ReloadPipeline::Job>();
+        job->path = Config::DATA_FILE;
+        job->journal = &journal;
+        for (DocumentView* v : views) {
+            job->views.push_back(v);
+            job->builds.push_back(v->PrepareReload());
+        }
+        reloads.Start(std::move(job), hwnd, Config::WM_RELOAD_READY);
+    }
 
-        SetBkMode(hdc, TRANSPARENT);
+    // Common tail of edits and polled rows, once `data` reflects them: the views relayout
+    // incrementally from `diff`
+    void Edited(const ModelDiff& diff) {
+        ++version;
+        for (DocumentView* v : views) v->OnModelEdited(diff);
+        BuildLineage();
+    }
 
-        // Name (Top half)
-        RECT rcName = rc; rcName.bottom -= 20; rcName.top += 6;
-        {
-            AutoSelect sel(hdc, fName);
-            SetTextColor(hdc, Config::COL_TEXT_NAME);
-            DrawTextW(hdc, p.name.c_str(), -1, &rcName, DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    // Common tail of every kind of reload, once `data` holds the new rows. A pipeline
+    // `job` has renumbered them already and built the views it was started for.
+    void Reloaded(ReloadPipeline::Job* job = nullptr) {
+        if (!job && data.people.size() >= Config::RENUMBER_AT) data.Renumber();
+        history.Reset(data);
+        ++version;
+        if (job && job->lineage) {
+            lineage = std::move(job->lineage);
+            lineageOf = version;
         }
+        thumbs.ForgetFailures();
+        for (DocumentView* v : views) {
+            ViewBuild* built = nullptr;
+            if (job) {
+                auto it = std::find(job->views.begin(), job->views.end(), v);
+                if (it != job->views.end()) built = &job->builds[it - job->views.begin()];
+            }
+            v->OnDataReloaded(built);
+        }
+        BuildLineage();
+    }
 
-        // Role (Bottom half)
-        RECT rcRole = rc; rcRole.top += 28;
-        {
-            AutoSelect sel(hdc, fRole);
-            SetTextColor(hdc, Config::COL_TEXT_ROLE);
-            DrawTextW(hdc, p.role.c_str(), -1, &rcRole, DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    // Starts building the lineage labels of `data` on the task pool unless they are in
+    // or a build is running (which starts the next one when it is done). Copying the
+    // parent links is all it costs here; with no pool workers it builds in place.
+    void BuildLineage() {
+        if (Lineage() || building) return;
+        building = std::make_shared<LineageIndex>(data);
+        buildingOf = version;
+        if (TaskScheduler::Get().Threads() <= 1) {
+            building->Build();
+            OnLineageReady();
+            return;
         }
+        if (!lineageTasks) lineageTasks = std::make_unique<TaskScheduler::Group>();
+        lineageTasks->Run([index = building.get(), notify = hwnd] {
+            index->Build();
+            PostMessage(notify, Config::WM_LINEAGE_READY, 0, 0);
+        });
     }
 };
 
-// -----------------------------------------------------------------------------
-// 6. APPLICATION WINDOW
-// -----------------------------------------------------------------------------
-class FamilyTreeApp {
+// One top-level window: its own layout mode, focus, filter, display list and scroll
+// position over the shared document
+class TreeWindow : public DocumentView {
+    FamilyDocument& doc;
     HWND hwnd = nullptr;
     HWND hBtnScreenshot = nullptr;
-    DataModel data;
+    HWND hBtnSvg = nullptr;
+    HWND hBtnPdf = nullptr;
+    HWND hLblFilter = nullptr;
+    HWND hEditFilter = nullptr;
+    DataModel collapsed;       // Filtered subset laid out in Collapse display
+    const DataModel* shown;    // Model the layout and renderer currently use
+    FilterQuery filter;
+    std::wstring filterText, filterError;
+    FilterDisplay filterDisplay = FilterDisplay::Dim;
+    RowBitmap selection;       // Over shown->people, valid while the filter is not empty
+    enum class PendingLink { None, Spouse, Ex, Relation } pendingLink = PendingLink::None; // Waiting for a click
+    int relationFrom = 0, relationTo = 0; // IDs of the relationship query, 0 = none
+    std::vector<int> relationIds;         // Its chain (IDs), empty if unrelated
+    std::wstring relationText;
     LayoutEngine layout;
-    FILETIME lastModTime = {0};
-    int scrollX = 0, scrollY = 0;
+    DisplayList scene; // Display list of the current layout, rebuilt on relayout
+    int scrollX = 0, scrollY = 0; // Device pixels
+    int paper = 0;     // PdfWriter::PaperSize index for the PDF export
+    UINT dpi = 96;     // Of the monitor the window is on; the layout is in 96-dpi canvas units
+    HFONT hUiFont = nullptr;
 
 public:
-    FamilyTreeApp() : layout(&data) {}
+    // A window opened from another one starts with the same mode and focus
+    TreeWindow(FamilyDocument& d, const TreeWindow* from) : doc(d), shown(&d.data), layout(&d.data) {
+        if (from) {
+            layout.mode = from->layout.mode;
+            layout.focusId = from->layout.focusId;
+        }
+    }
+
+    static HWND Open(HINSTANCE hInst, int nCmdShow, const TreeWindow* from) {
+        HWND h = CreateWindow(_T("FamilyTreeApp"), _T("Family Tree Viewer"), WS_OVERLAPPEDWINDOW | WS_VSCROLL | WS_HSCROLL,
+                              CW_USEDEFAULT, CW_USEDEFAULT, 1200, 800, NULL, NULL, hInst, (LPVOID)from);
+        if (h) ShowWindow(h, nCmdShow);
+        return h;
+    }
+
+    ~TreeWindow() { if (hUiFont) DeleteObject(hUiFont); }
+
+    double Scale() const { return dpi / 96.0; }
+    int Px(int dip) const { return MulDiv(dip, dpi, 96); }
+
+    // Control font for the current DPI (replaced when the window changes monitor)
+    void ApplyUiFont() {
+        HFONT old = hUiFont;
+        hUiFont = CreateFont(Px(16), 0, 0, 0, FW_NORMAL, 0, 0, 0, DEFAULT_CHARSET,
+                             0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI");
+        for (HWND c : { hBtnScreenshot, hBtnSvg, hBtnPdf, hLblFilter, hEditFilter })
+            SendMessage(c, WM_SETFONT, (WPARAM)hUiFont, TRUE);
+        if (old) DeleteObject(old);
+    }
+
+    // Moved to a monitor with another scale: the layout is kept, only the view is rescaled
+    void OnDpiChanged(UINT newDpi, const RECT* suggested) {
+        scrollX = MulDiv(scrollX, newDpi, dpi);
+        scrollY = MulDiv(scrollY, newDpi, dpi);
+        dpi = newDpi;
+        ApplyUiFont();
+        SetWindowPos(hwnd, NULL, suggested->left, suggested->top, suggested->right - suggested->left,
+                     suggested->bottom - suggested->top, SWP_NOZORDER | SWP_NOACTIVATE);
+        OnSize();
+        InvalidateRect(hwnd, NULL, TRUE);
+    }
 
     void Init(HWND h) {
         hwnd = h;
+        dpi = WindowDpi(hwnd);
 
         // Create Screenshot Button
         hBtnScreenshot = CreateWindowW(
@@ -818,16 +8780,196 @@ public:
             (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), NULL
         );
 
-        // Set a modern font for the button
-        HFONT hFont = CreateFont(16, 0, 0, 0, FW_NORMAL, 0, 0, 0, DEFAULT_CHARSET,
-                                 0, 0, ANTIALIASED_QUALITY, 0, L"Segoe UI");
-        SendMessage(hBtnScreenshot, WM_SETFONT, (WPARAM)hFont, TRUE);
+        // Create SVG Export Button (below the screenshot button)
+        hBtnSvg = CreateWindowW(
+            L"BUTTON", L"Export SVG",
+            WS_TABSTOP | WS_VISIBLE | WS_CHILD | BS_PUSHBUTTON,
+            0, 0, 100, 30,
+            hwnd, (HMENU)Config::ID_BTN_SVG,
+            (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), NULL
+        );
 
-        ReloadData(true);
-        SetTimer(hwnd, 1, 1000, NULL); // Auto-reload timer
+        // Paged PDF export (below the SVG button); its label shows the paper size
+        hBtnPdf = CreateWindowW(
+            L"BUTTON", L"",
+            WS_TABSTOP | WS_VISIBLE | WS_CHILD | BS_PUSHBUTTON,
+            0, 0, 100, 30,
+            hwnd, (HMENU)Config::ID_BTN_PDF,
+            (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), NULL
+        );
+        UpdatePdfButton();
+
+        // Filter expression box (top-left), applied as the user types
+        hLblFilter = CreateWindowW(
+            L"STATIC", L"Filter:",
+            WS_VISIBLE | WS_CHILD,
+            Px(20), Px(25), Px(45), Px(20),
+            hwnd, NULL,
+            (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), NULL
+        );
+        hEditFilter = CreateWindowW(
+            L"EDIT", L"",
+            WS_TABSTOP | WS_VISIBLE | WS_CHILD | WS_BORDER | ES_AUTOHSCROLL,
+            Px(70), Px(20), Px(360), Px(26),
+            hwnd, (HMENU)Config::ID_EDIT_FILTER,
+            (HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), NULL
+        );
+
+        ApplyUiFont();
+
+        doc.Attach(this);
+        ApplyFilter();
+    }
+
+    // The last window to close ends the program
+    void OnDestroy() {
+        if (doc.Detach(this) == 0) PostQuitMessage(0);
+    }
+
+    ViewBuild PrepareReload() const override {
+        ViewBuild b;
+        b.mode = layout.mode;
+        b.focusId = layout.focusId;
+        b.minimizeCrossings = layout.minimizeCrossings;
+        b.filterText = filterText;
+        b.filterDisplay = filterDisplay;
+        b.relationFrom = relationFrom;
+        b.relationTo = relationTo;
+        return b;
     }
 
-    void OnTimer() { ReloadData(false); }
+    void OnDataReloaded(ViewBuild* built) override {
+        pendingLink = PendingLink::None;
+        if (!built || built->mode != layout.mode || built->focusId != layout.focusId ||
+            built->minimizeCrossings != layout.minimizeCrossings || built->filterText != filterText ||
+            built->filterDisplay != filterDisplay || built->relationFrom != relationFrom ||
+            built->relationTo != relationTo) {
+            FindRelation();
+            ApplyFilter(); // Column indices and the selection depend on the new data
+            return;
+        }
+        // Laid out by the reload worker with the settings the window still has
+        filter = std::move(built->filter);
+        filterError = std::move(built->filterError);
+        selection = std::move(built->selection);
+        collapsed = std::move(built->collapsed);
+        shown = built->isCollapsed ? &collapsed : &doc.data;
+        layout = std::move(built->layout);
+        layout.SetModel(shown);
+        scene = std::move(built->scene);
+        relationIds = std::move(built->relationIds);
+        relationText = std::move(built->relationText);
+        if (built->relationGone) relationFrom = relationTo = 0;
+        UpdateTitle();
+        UpdateScrollBars();
+        InvalidateRect(hwnd, NULL, TRUE);
+    }
+
+    void OnModelEdited(const ModelDiff& diff) override {
+        FindRelation();
+        if (filter.Empty()) Relayout(&diff);
+        else ApplyFilter(); // The selection (and a collapsed subset) refer to the old rows
+    }
+
+    // Repaint only: the display list already references the photos
+    void OnThumbsReady() override { InvalidateRect(hwnd, NULL, FALSE); }
+
+    void OnLineageReady() override { UpdateTitle(); }
+
+    void OnKey(WPARAM key) {
+        if (key == Config::KEY_TOGGLE_CROSSING) {
+            layout.minimizeCrossings = !layout.minimizeCrossings;
+            Relayout();
+        } else if (key == Config::KEY_CYCLE_MODE) {
+            layout.mode = LayoutEngine::NextMode(layout.mode);
+            Relayout();
+        } else if (key == Config::KEY_FILTER_DISPLAY) {
+            filterDisplay = (filterDisplay == FilterDisplay::Dim) ? FilterDisplay::Hide
+                          : (filterDisplay == FilterDisplay::Hide) ? FilterDisplay::Collapse : FilterDisplay::Dim;
+            Refilter();
+        } else if (GetKeyState(VK_CONTROL) < 0 && (key == Config::KEY_UNDO || key == Config::KEY_REDO)) {
+            ModelDiff diff;
+            bool done = (key == Config::KEY_UNDO) ? doc.history.Undo(doc.data, diff) : doc.history.Redo(doc.data, diff);
+            if (done) doc.Commit(diff);
+        } else if (key == Config::KEY_ADD_CHILD) {
+            int focus = layout.FocusIndex();
+            if (focus < 0) return;
+            const Person* parent = doc.data.Get(shown->people[focus].id);
+            int parentId = parent->id, otherId = 0;
+            for (int sid : parent->spouses) {
+                if (!parent->spouses.IsEx(sid) && doc.data.Get(sid)) { otherId = sid; break; }
+            }
+            ModelDiff diff;
+            int kidId = doc.history.AddChild(doc.data, parentId, otherId, L"New child", L"Male", L"Child", diff);
+            if (kidId == 0) return;
+            layout.focusId = kidId;
+            doc.Commit(diff);
+        } else if (key == Config::KEY_LINK_SPOUSE || key == Config::KEY_TOGGLE_EX || key == Config::KEY_RELATION) {
+            if (layout.FocusIndex() < 0) return;
+            pendingLink = (key == Config::KEY_LINK_SPOUSE) ? PendingLink::Spouse
+                        : (key == Config::KEY_TOGGLE_EX) ? PendingLink::Ex : PendingLink::Relation;
+            UpdateTitle();
+        } else if (key == VK_ESCAPE && pendingLink != PendingLink::None) {
+            pendingLink = PendingLink::None;
+            UpdateTitle();
+        } else if (key == VK_ESCAPE && relationFrom != 0) {
+            relationFrom = relationTo = 0;
+            FindRelation();
+            Redraw();
+        } else if (key == Config::KEY_PAPER) {
+            paper = (paper + 1) % PdfWriter::PAPER_COUNT;
+            UpdatePdfButton();
+        } else if (key == Config::KEY_NEW_VIEW) {
+            Open((HINSTANCE)GetWindowLongPtr(hwnd, GWLP_HINSTANCE), SW_SHOW, this);
+        } else if (key == Config::KEY_STATS) {
+            ExportStats();
+        } else if (key == Config::KEY_ARCHIVE) {
+            ExportArchive();
+        } else if (key == Config::KEY_ARROW) {
+            ExportArrow();
+        } else if (key == Config::KEY_SQLITE) {
+            ExportSqlite();
+        }
+    }
+
+    // Clicking a box (real or proxy) makes that person the focus of the ancestor charts,
+    // or completes a pending spouse link from the focus person
+    void OnClick(int clientX, int clientY) {
+        SetFocus(hwnd); // Take keyboard shortcuts back from the filter box
+        int id = layout.HitTest((int)((clientX + scrollX) / Scale()), (int)((clientY + scrollY) / Scale()));
+        if (id == 0) return;
+        if (pendingLink == PendingLink::Relation) {
+            pendingLink = PendingLink::None;
+            relationFrom = shown->people[layout.FocusIndex()].id;
+            relationTo = id;
+            FindRelation();
+            Redraw();
+            return;
+        }
+        if (pendingLink != PendingLink::None) {
+            int from = shown->people[layout.FocusIndex()].id;
+            const Person* a = doc.data.Get(from);
+            bool ex = (pendingLink == PendingLink::Ex) && !(a && a->spouses.IsEx(id)); // X toggles
+            pendingLink = PendingLink::None;
+            ModelDiff diff;
+            if (doc.history.SetSpouse(doc.data, from, id, ex, diff)) doc.Commit(diff);
+            else UpdateTitle();
+            return;
+        }
+        layout.focusId = id;
+        if (layout.IsFocusMode()) ApplyFilter();
+        else if (!filter.Empty()) Refilter(); // Relations may be relative to the focus
+        else UpdateTitle();
+    }
+
+    void OnFilterChanged() {
+        int len = GetWindowTextLengthW(hEditFilter);
+        std::wstring text(len + 1, L'\0');
+        GetWindowTextW(hEditFilter, &text[0], len + 1);
+        text.resize(len);
+        filterText = text;
+        Refilter();
+    }
 
     void OnPaint() {
         PAINTSTRUCT ps;
@@ -843,17 +8985,21 @@ public:
         ScopedGDI<HBRUSH> hBg(CreateSolidBrush(Config::COL_BG_CANVAS));
         FillRect(hdcMem, &rc, hBg);
 
-        // Draw Content
+        // Draw Content (canvas units scaled to the monitor's DPI, then scrolled)
+        double s = Scale();
         SetGraphicsMode(hdcMem, GM_ADVANCED);
-        XFORM xform = { 1.0f, 0, 0, 1.0f, (float)-scrollX, (float)-scrollY };
+        XFORM xform = { (float)s, 0, 0, (float)s, (float)-scrollX, (float)-scrollY };
         SetWorldTransform(hdcMem, &xform);
 
-        Renderer::DrawTree(hdcMem, &data, layout.totalWidth);
+        RECT view = { (LONG)(scrollX / s), (LONG)(scrollY / s),
+                      (LONG)((scrollX + rc.right) / s) + 1, (LONG)((scrollY + rc.bottom) / s) + 1 };
+        GdiBackend::Play(hdcMem, scene, &view, &doc.thumbs, s);
 
-        // Reset for Overlay (Title, etc)
-        ModifyWorldTransform(hdcMem, &xform, MWT_IDENTITY);
+        // Overlay (legend) is scaled but does not scroll
+        XFORM overlay = { (float)s, 0, 0, (float)s, 0, 0 };
+        SetWorldTransform(hdcMem, &overlay);
 
-        Renderer::DrawLegend(hdcMem, rc.bottom);
+        Renderer::DrawLegend(hdcMem, (int)(rc.bottom / s));
 
         BitBlt(hdc, 0, 0, rc.right, rc.bottom, hdcMem, 0, 0, SRCCOPY);
 
@@ -868,9 +9014,12 @@ public:
         GetClientRect(hwnd, &rc);
 
         // Position button in top-right corner
-        int btnW = 100;
-        int btnH = 30;
-        SetWindowPos(hBtnScreenshot, NULL, rc.right - btnW - 20, 20, btnW, btnH, SWP_NOZORDER);
+        int btnW = Px(100);
+        int btnH = Px(30);
+        int right = rc.right - btnW - Px(20);
+        SetWindowPos(hBtnScreenshot, NULL, right, Px(20), btnW, btnH, SWP_NOZORDER);
+        SetWindowPos(hBtnSvg, NULL, right, Px(20) + btnH + Px(10), btnW, btnH, SWP_NOZORDER);
+        SetWindowPos(hBtnPdf, NULL, right, Px(20) + 2 * (btnH + Px(10)), btnW, btnH, SWP_NOZORDER);
 
         UpdateScrollBars();
     }
@@ -881,8 +9030,8 @@ public:
         GetScrollInfo(hwnd, bar, &si);
 
         switch(LOWORD(wParam)) {
-            case SB_LINELEFT:   pos -= 10; break;
-            case SB_LINERIGHT:  pos += 10; break;
+            case SB_LINELEFT:   pos -= Px(10); break;
+            case SB_LINERIGHT:  pos += Px(10); break;
             case SB_PAGELEFT:   pos -= si.nPage; break;
             case SB_PAGERIGHT:  pos += si.nPage; break;
             case SB_THUMBTRACK: pos = si.nTrackPos; break;
@@ -897,11 +9046,17 @@ public:
         void CaptureScreenshot() {
             // Use total layout dimensions to capture everything
             int w = layout.totalWidth;
-            int h = layout.totalHeight;
+            int h = layout.HeightWithLegend();
     
             // Minimum safety size
             if (w < 800) w = 800;
             if (h < 600) h = 600;
+
+            // Same layout, rendered at the export resolution
+            double s = Config::EXPORT_DPI > 0 ? Config::EXPORT_DPI / 96.0 : Scale();
+            int canvasW = w, canvasH = h;
+            w = (int)std::lround(w * s);
+            h = (int)std::lround(h * s);
     
             HDC hdcScreen = GetDC(NULL);
             HDC hdcMem = CreateCompatibleDC(hdcScreen);
@@ -914,25 +9069,23 @@ public:
             FillRect(hdcMem, &rc, hBg);
             
             // 2. Draw Content
-            // We use identity transform because we want to draw from (0,0) of the canvas
+            // Scale-only transform: draw from (0,0) of the canvas
             SetGraphicsMode(hdcMem, GM_ADVANCED);
-            XFORM xform = { 1.0f, 0, 0, 1.0f, 0.0f, 0.0f };
+            XFORM xform = { (float)s, 0, 0, (float)s, 0.0f, 0.0f };
             SetWorldTransform(hdcMem, &xform);
     
             // Draw the tree
-            Renderer::DrawTree(hdcMem, &data, w);
+            DisplayList full;
+            Renderer::DrawTree(full, shown, layout, canvasW, CurrentSelection());
+            // Wait for every photo in the export, decoded at the export's pixel size
+            ThumbnailPin pin(doc.thumbs, full.ImagePaths(), GdiBackend::ThumbPixels(Config::THUMB_SIZE, s));
+            GdiBackend::Play(hdcMem, full, nullptr, &doc.thumbs, s);
     
             // Draw Legend (at the bottom of the full canvas)
-            ModifyWorldTransform(hdcMem, &xform, MWT_IDENTITY);
-            Renderer::DrawLegend(hdcMem, h);
+            Renderer::DrawLegend(hdcMem, canvasH);
             
             // 3. Generate filename
-            time_t t = time(NULL);
-            struct tm* now = localtime(&t);
-            wchar_t filename[MAX_PATH];
-            swprintf(filename, MAX_PATH, L"family_tree_%04d-%02d-%02d_%02d-%02d-%02d.bmp", 
-                     now->tm_year + 1900, now->tm_mon + 1, now->tm_mday,
-                     now->tm_hour, now->tm_min, now->tm_sec);
+            std::wstring filename = ExportFileName(L"bmp");
                      
             bool success = SaveBitmapToFile(hbm, filename);
             
@@ -950,29 +9103,282 @@ public:
                 MessageBoxW(hwnd, L"Failed to save screenshot.", L"Error", MB_OK | MB_ICONERROR);
             }
         }
+
+    // Vector export of the whole canvas (same display list as the screen)
+    void ExportSvg() {
+        int w = std::max(layout.totalWidth, 800);
+        int h = std::max(layout.totalHeight, 600);
+
+        DisplayList full;
+        Renderer::DrawTree(full, shown, layout, w, CurrentSelection());
+        std::wstring filename = ExportFileName(L"svg");
+
+        ThumbnailPin pin(doc.thumbs, full.ImagePaths());
+        if (SvgWriter::Write(full, w, h, filename, &doc.thumbs)) {
+            std::wstring msg = L"Family tree exported to:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"SVG Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            MessageBoxW(hwnd, L"Failed to export SVG.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // Wall-chart print: the same display list tiled over pages of the chosen paper size
+    void ExportPdf() {
+        int w = std::max(layout.totalWidth, 800);
+        int h = std::max(layout.totalHeight, 600);
+
+        DisplayList full;
+        Renderer::DrawTree(full, shown, layout, w, CurrentSelection());
+        std::wstring filename = ExportFileName(L"pdf");
+
+        ThumbnailPin pin(doc.thumbs, full.ImagePaths());
+        int pages = 0;
+        if (PdfWriter::Write(full, w, h, paper, filename, &doc.thumbs, pages)) {
+            std::wstring msg = L"Family tree printed to " + std::to_wstring(pages) + L" " +
+                               PdfWriter::PaperSize(paper).name + L" pages:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"PDF Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            MessageBoxW(hwnd, L"Failed to export PDF.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // Analytics of the whole archive (not just the filtered view) as JSON
+    void ExportStats() {
+        FamilyStats stats = FamilyStats::Compute(doc.data);
+        std::wstring filename = ExportFileName(L"json");
+        if (stats.Write(filename)) {
+            std::wstring msg = L"Statistics of " + std::to_wstring(stats.people) + L" people (" +
+                               std::to_wstring((int)stats.elapsedMs) + L" ms) exported to:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"Statistics Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            MessageBoxW(hwnd, L"Failed to export statistics.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // The whole archive in the columnar format (see ColumnFile), plus the top-left of
+    // every box this window has placed as the x and y columns (null for the others)
+    void ExportArchive() {
+        const DataModel& data = doc.data;
+        size_t n = data.people.size();
+        ColumnFile::Writer w = DataModel::ArchiveWriter(data.header, doc.history.Current(), data.attrs);
+        std::vector<int64_t> x(n), y(n);
+        RowBitmap placed(n);
+        for (size_t i = 0; i < n; ++i) {
+            int idx = shown->IndexOf(data.people[i].id);
+            if (idx < 0 || !layout.Placed(idx)) continue;
+            placed.Set(i);
+            x[i] = layout.boxX[idx];
+            y[i] = layout.boxY[idx];
+        }
+        w.AddInts("x", x, &placed);
+        w.AddInts("y", y, &placed);
+
+        std::wstring filename = ExportFileName(L"ftc");
+        if (w.Save(filename)) {
+            std::wstring msg = L"Archive of " + std::to_wstring(n) + L" people exported to:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"Archive Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            MessageBoxW(hwnd, L"Failed to export archive.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // The person table as an Arrow file for analytics tools, with this window's layout:
+    // box position (x, y), generation and root family (null where the mode has none).
+    // Unless a Collapse filter gave the layout its own model, its vectors line up with
+    // the data and are written as they are.
+    void ExportArrow() {
+        const DataModel& data = doc.data;
+        size_t n = data.people.size();
+        bool aligned = shown == &data;
+        ArrowFile::Writer w = DataModel::ArrowWriter(data.header, doc.history.Current(), data.attrs);
+        std::vector<int32_t> x, y, gen, root(n);
+        if (!aligned) { x.assign(n, 0); y.assign(n, 0); gen.assign(n, 0); }
+        RowBitmap placed(n), hasGen(n), hasRoot(n);
+        for (size_t i = 0; i < n; ++i) {
+            int idx = aligned ? (int)i : shown->IndexOf(data.people[i].id);
+            if (idx < 0) continue;
+            if (layout.Placed(idx)) placed.Set(i);
+            if (layout.gens[idx] >= 0) hasGen.Set(i);
+            if (!aligned) { x[i] = layout.boxX[idx]; y[i] = layout.boxY[idx]; gen[i] = layout.gens[idx]; }
+            root[i] = layout.OwnerRoot(data.people[i].id);
+            if (root[i] != 0) hasRoot.Set(i);
+        }
+        w.AddInt32("x", aligned ? layout.boxX.data() : x.data(), &placed);
+        w.AddInt32("y", aligned ? layout.boxY.data() : y.data(), &placed);
+        w.AddInt32("gen", aligned ? layout.gens.data() : gen.data(), &hasGen);
+        w.AddInt32("root", root.data(), &hasRoot);
+
+        std::wstring filename = ExportFileName(L"arrow");
+        if (w.Save(filename)) {
+            std::wstring msg = L"Person table of " + std::to_wstring(n) + L" people exported to:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"Arrow Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            MessageBoxW(hwnd, L"Failed to export Arrow file.", L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
+
+    // This window's layout into the layout table of the SQLite source, or, for any other
+    // source, a new database with the people and the layout
+    void ExportSqlite() {
+        const DataModel& data = doc.data;
+        std::vector<SqliteStore::LayoutRow> rows(data.people.size());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            SqliteStore::LayoutRow& r = rows[i];
+            r.id = data.people[i].id;
+            int idx = shown->IndexOf(r.id);
+            if (idx < 0) continue;
+            if (layout.Placed(idx)) { r.x = layout.boxX[idx]; r.y = layout.boxY[idx]; r.has |= r.Position; }
+            if (layout.gens[idx] >= 0) { r.gen = layout.gens[idx]; r.has |= r.Gen; }
+            r.root = layout.OwnerRoot(r.id);
+            if (r.root != 0) r.has |= r.Root;
+        }
+
+        if (doc.store.IsOpen()) {
+            if (doc.store.SaveLayout(rows)) {
+                MessageBoxW(hwnd, L"Layout saved to the database's layout table.", L"SQLite", MB_OK | MB_ICONINFORMATION);
+            } else {
+                std::wstring msg = L"Failed to save the layout:\n" + ToWString(doc.store.Error());
+                MessageBoxW(hwnd, msg.c_str(), L"Error", MB_OK | MB_ICONERROR);
+            }
+            return;
+        }
+        std::wstring filename = ExportFileName(L"db");
+        SqliteStore out;
+        if (out.Open(filename.c_str()) && out.Import(data.header, doc.history.Current(), data.attrs) && out.SaveLayout(rows)) {
+            std::wstring msg = std::to_wstring(rows.size()) + L" people and their layout exported to:\n" + filename;
+            MessageBoxW(hwnd, msg.c_str(), L"SQLite Exported", MB_OK | MB_ICONINFORMATION);
+        } else {
+            std::wstring msg = L"Failed to export SQLite database:\n" + ToWString(out.Error());
+            MessageBoxW(hwnd, msg.c_str(), L"Error", MB_OK | MB_ICONERROR);
+        }
+    }
 private:
-    void ReloadData(bool force) {
-        WIN32_FILE_ATTRIBUTE_DATA attrib;
-        if (GetFileAttributesExW(Config::DATA_FILE, GetFileExInfoStandard, &attrib)) {
-            if (force || CompareFileTime(&lastModTime, &attrib.ftLastWriteTime) != 0) {
-                lastModTime = attrib.ftLastWriteTime;
-                data.LoadFromFile(Config::DATA_FILE);
-                layout.Recalculate();
-                UpdateScrollBars();
-                InvalidateRect(hwnd, NULL, TRUE);
+    // family_tree_YYYY-MM-DD_HH-MM-SS.<ext>
+    static std::wstring ExportFileName(const wchar_t* ext) {
+        time_t t = time(NULL);
+        struct tm* now = localtime(&t);
+        wchar_t filename[MAX_PATH];
+        swprintf(filename, MAX_PATH, L"family_tree_%04d-%02d-%02d_%02d-%02d-%02d.%ls",
+                 now->tm_year + 1900, now->tm_mon + 1, now->tm_mday,
+                 now->tm_hour, now->tm_min, now->tm_sec, ext);
+        return filename;
+    }
 
-                if (force && data.people.empty()) {
-                    MessageBoxA(hwnd, "Error: family.csv not found or empty.", "Family Tree", MB_ICONWARNING);
-                }
+    // Recompiles the filter against the current data, evaluates it and picks the model to
+    // lay out: everything, or in Collapse display the selection plus the ancestors that
+    // connect it
+    void ApplyFilter() {
+        const DataModel& data = doc.data;
+        shown = &data;
+        layout.SetModel(&data);
+        filter.Compile(filterText, data, filterError);
+
+        if (!filter.Empty() &&
+            ViewBuild::Select(filter, filterDisplay, data, layout.FocusIndex(), selection, collapsed)) {
+            shown = &collapsed;
+            layout.SetModel(&collapsed);
+        }
+        Relayout();
+    }
+
+    // The filter text, its display or the focus changed but not the data. While the whole
+    // model stays laid out (Dim and Hide) no box moves, so only the selection and the
+    // display list are rebuilt; entering or leaving Collapse goes through ApplyFilter.
+    void Refilter() {
+        filter.Compile(filterText, doc.data, filterError);
+        bool collapse = (filterDisplay == FilterDisplay::Collapse) && !filter.Empty();
+        if (collapse || shown != &doc.data) { ApplyFilter(); return; }
+        if (!filter.Empty()) selection = filter.Evaluate(doc.data, layout.FocusIndex());
+        Redraw();
+    }
+
+    SelectionView CurrentSelection() const {
+        SelectionView v;
+        if (!relationIds.empty()) v.relation = &relationIds;
+        if (filter.Empty()) return v;
+        v.bits = &selection;
+        v.hide = (filterDisplay == FilterDisplay::Hide);
+        return v;
+    }
+
+    void Relayout(const ModelDiff* diff = nullptr) {
+        if (diff) layout.Recalculate(*diff);
+        else layout.Recalculate();
+        Renderer::DrawTree(scene, shown, layout, layout.totalWidth, CurrentSelection());
+        UpdateTitle();
+        UpdateScrollBars();
+        InvalidateRect(hwnd, NULL, TRUE);
+    }
+
+    // New display list for the same layout (highlight changed)
+    void Redraw() {
+        Renderer::DrawTree(scene, shown, layout, layout.totalWidth, CurrentSelection());
+        UpdateTitle();
+        InvalidateRect(hwnd, NULL, TRUE);
+    }
+
+    // Runs the relationship query again on the current data; the chain is kept by ID so
+    // it survives filtering, and an edit may have shortened or broken it
+    void FindRelation() {
+        relationIds.clear();
+        relationText.clear();
+        if (relationFrom != 0 && !ViewBuild::Relate(doc.relations, doc.data, relationFrom, relationTo, relationIds, relationText))
+            relationFrom = relationTo = 0; // Deleted
+    }
+
+    void UpdateTitle() {
+        std::wstring title = L"Family Tree Viewer - ";
+        title += LayoutEngine::ModeName(layout.mode);
+        int focus = layout.FocusIndex();
+        if (focus >= 0) {
+            title += L" - Focus: " + shown->people[focus].name;
+            int idx = doc.data.IndexOf(shown->people[focus].id);
+            const LineageIndex* lineage = doc.Lineage(); // Counts follow once built
+            if (idx >= 0 && lineage) {
+                title += L" (" + std::to_wstring(lineage->Descendants(idx)) + L" descendants, " +
+                         std::to_wstring(lineage->Ancestors(idx)) + L" ancestors)";
             }
         }
+        if (!filterError.empty()) {
+            title += L" - Filter error: " + filterError;
+        } else if (!filter.Empty()) {
+            static const wchar_t* displayNames[] = { L"dim", L"hide", L"collapse" };
+            title += L" - Filter: " + std::to_wstring(selection.Count()) + L" of " +
+                     std::to_wstring(doc.data.people.size()) + L" (" + displayNames[(int)filterDisplay] + L")";
+        }
+        if (doc.history.CanUndo()) title += L" - Edits: " + std::to_wstring(doc.history.Depth());
+        if (doc.journalFailed) title += L" (not saved)";
+        if (pendingLink == PendingLink::Spouse) title += L" - Click the spouse to link (Esc cancels)";
+        else if (pendingLink == PendingLink::Ex) title += L" - Click the spouse to mark/unmark as ex (Esc cancels)";
+        else if (pendingLink == PendingLink::Relation) title += L" - Click a person to see how they are related (Esc cancels)";
+        else if (relationFrom != 0) {
+            title += L" - Relation: " + relationText;
+            if (!relationIds.empty()) {
+                title += L" (" + std::to_wstring(relationIds.size() - 1) + L" steps";
+                const LineageIndex* lineage = doc.Lineage();
+                int from = doc.data.IndexOf(relationFrom), to = doc.data.IndexOf(relationTo);
+                if (lineage && from >= 0 && to >= 0)
+                    title += lineage->BloodRelated(from, to) ? L", by blood" : L", by marriage";
+                title += L")";
+            }
+        }
+        if (layout.minimizeCrossings && layout.mode == LayoutMode::Descendants) {
+            title += L" - Crossings: " + std::to_wstring(layout.crossingsBefore) +
+                     L" -> " + std::to_wstring(layout.crossingsAfter);
+        }
+        SetWindowTextW(hwnd, title.c_str());
+    }
+
+    void UpdatePdfButton() {
+        std::wstring label = std::wstring(L"PDF (") + PdfWriter::PaperSize(paper).name + L")";
+        SetWindowTextW(hBtnPdf, label.c_str());
     }
 
     void UpdateScrollBars() {
         RECT rc;
         GetClientRect(hwnd, &rc);
-        SetScrollInfoHelper(SB_HORZ, scrollX, layout.totalWidth, rc.right);
-        SetScrollInfoHelper(SB_VERT, scrollY, layout.totalHeight, rc.bottom);
+        SetScrollInfoHelper(SB_HORZ, scrollX, (int)(layout.totalWidth * Scale()), rc.right);
+        SetScrollInfoHelper(SB_VERT, scrollY, (int)(layout.HeightWithLegend() * Scale()), rc.bottom);
     }
 
     void SetScrollInfoHelper(int bar, int pos, int maxVal, int page) {
@@ -982,41 +9388,79 @@ private:
     }
 };
 
-static FamilyTreeApp g_App;
+static FamilyDocument g_Doc;
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    TreeWindow* app = (TreeWindow*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    if (msg == WM_NCCREATE) {
+        // Each window gets its own view of the shared document
+        const TreeWindow* from = (const TreeWindow*)((CREATESTRUCT*)lp)->lpCreateParams;
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)new TreeWindow(g_Doc, from));
+        return DefWindowProc(hwnd, msg, wp, lp);
+    }
+    if (!app) return DefWindowProc(hwnd, msg, wp, lp);
+
     switch(msg) {
-        case WM_CREATE: g_App.Init(hwnd); break;
+        case WM_CREATE: app->Init(hwnd); break;
         case WM_COMMAND:
             if (LOWORD(wp) == Config::ID_BTN_SCREENSHOT) {
-                g_App.CaptureScreenshot();
+                app->CaptureScreenshot();
+            } else if (LOWORD(wp) == Config::ID_BTN_SVG) {
+                app->ExportSvg();
+            } else if (LOWORD(wp) == Config::ID_BTN_PDF) {
+                app->ExportPdf();
+            } else if (LOWORD(wp) == Config::ID_EDIT_FILTER && HIWORD(wp) == EN_CHANGE) {
+                app->OnFilterChanged();
             }
             break;
-        case WM_TIMER:  g_App.OnTimer(); break;
-        case WM_PAINT:  g_App.OnPaint(); break;
-        case WM_SIZE:   g_App.OnSize(); break;
-        case WM_HSCROLL: g_App.OnScroll(SB_HORZ, wp); break;
-        case WM_VSCROLL: g_App.OnScroll(SB_VERT, wp); break;
+        case WM_KEYDOWN: app->OnKey(wp); break;
+        case WM_LBUTTONDOWN: app->OnClick(GET_X_LPARAM(lp), GET_Y_LPARAM(lp)); break;
+        case WM_PAINT:  app->OnPaint(); break;
+        case WM_SIZE:   app->OnSize(); break;
+        case WM_DPICHANGED: app->OnDpiChanged(HIWORD(wp), (const RECT*)lp); break;
+        case WM_HSCROLL: app->OnScroll(SB_HORZ, wp); break;
+        case WM_VSCROLL: app->OnScroll(SB_VERT, wp); break;
         case WM_MOUSEWHEEL: {
             int delta = GET_WHEEL_DELTA_WPARAM(wp);
-            g_App.OnScroll(SB_VERT, (delta > 0) ? SB_LINEUP : SB_LINEDOWN);
-            g_App.OnScroll(SB_VERT, (delta > 0) ? SB_LINEUP : SB_LINEDOWN);
+            app->OnScroll(SB_VERT, (delta > 0) ? SB_LINEUP : SB_LINEDOWN);
+            app->OnScroll(SB_VERT, (delta > 0) ? SB_LINEUP : SB_LINEDOWN);
             return 0;
         }
-        case WM_DESTROY: PostQuitMessage(0); break;
+        case WM_DESTROY: app->OnDestroy(); break;
+        case WM_NCDESTROY:
+            SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+            delete app;
+            break;
+        default: return DefWindowProc(hwnd, msg, wp, lp);
+    }
+    return 0;
+}
+
+// Message-only window of the shared document
+LRESULT CALLBACK DocProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    switch(msg) {
+        case WM_TIMER:  g_Doc.OnTimer(); break;
+        case Config::WM_THUMBS_READY: g_Doc.OnThumbsReady(); break;
+        case Config::WM_JOURNAL_COMPACTED: g_Doc.OnJournalCompacted(); break;
+        case Config::WM_RELOAD_READY: g_Doc.OnReloadReady(); break;
+        case Config::WM_LINEAGE_READY: g_Doc.OnLineageReady(); break;
         default: return DefWindowProc(hwnd, msg, wp, lp);
     }
     return 0;
 }
 
 int WINAPI WinMain(HINSTANCE hInst, HINSTANCE, LPSTR, int nCmdShow) {
+    EnableDpiAwareness();
     WNDCLASSEX wc = { sizeof(WNDCLASSEX), CS_HREDRAW | CS_VREDRAW, WndProc, 0, 0, hInst, LoadIcon(NULL, IDI_APPLICATION),
                       LoadCursor(NULL, IDC_ARROW), (HBRUSH)GetStockObject(WHITE_BRUSH), NULL, _T("FamilyTreeApp"), NULL };
     RegisterClassEx(&wc);
-    HWND hwnd = CreateWindow(_T("FamilyTreeApp"), _T("Family Tree Viewer"), WS_OVERLAPPEDWINDOW | WS_VSCROLL | WS_HSCROLL,
-                             CW_USEDEFAULT, CW_USEDEFAULT, 1200, 800, NULL, NULL, hInst, NULL);
-    ShowWindow(hwnd, nCmdShow);
+    WNDCLASSEX dc = { sizeof(WNDCLASSEX), 0, DocProc, 0, 0, hInst, NULL, NULL, NULL, NULL, _T("FamilyTreeDoc"), NULL };
+    RegisterClassEx(&dc);
+
+    g_Doc.Open(CreateWindow(_T("FamilyTreeDoc"), NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInst, NULL));
+    TreeWindow::Open(hInst, nCmdShow, nullptr);
     MSG msg;
     while(GetMessage(&msg, NULL, 0, 0)) { TranslateMessage(&msg); DispatchMessage(&msg); }
+    g_Doc.Close();
     return (int)msg.wParam;
 }